@@ -1,4 +1,5 @@
 HEADERS += base/Timer.hpp \
+    base/Arena.hpp \
     base/String.hpp \
     base/Defs.hpp \
     base/Random.hpp \
@@ -12,8 +13,14 @@ HEADERS += base/Timer.hpp \
     base/Main.hpp \
     base/Math.hpp \
     base/MulticoreLauncher.hpp \
-    base/Array.hpp
+    base/Pipeline.hpp \
+    base/Topology.hpp \
+    base/Trace.hpp \
+    base/PerfCounters.hpp \
+    base/Array.hpp \
+    base/InlineArray.hpp
 SOURCES += base/Math.cpp \
+    base/Arena.cpp \
     base/Array.cpp \
     base/UnionFind.cpp \
     base/Main.cpp \
@@ -22,6 +29,10 @@ SOURCES += base/Math.cpp \
     base/Defs.cpp \
     base/String.cpp \
     base/MulticoreLauncher.cpp \
+    base/Pipeline.cpp \
+    base/Topology.cpp \
+    base/Trace.cpp \
+    base/PerfCounters.cpp \
     base/DLLImports.cpp \
     base/Random.cpp \
     base/Hash.cpp \
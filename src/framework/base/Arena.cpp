@@ -0,0 +1,119 @@
+/*
+ *  Copyright (c) 2009-2011, NVIDIA Corporation
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *      * Redistributions of source code must retain the above copyright
+ *        notice, this list of conditions and the following disclaimer.
+ *      * Redistributions in binary form must reproduce the above copyright
+ *        notice, this list of conditions and the following disclaimer in the
+ *        documentation and/or other materials provided with the distribution.
+ *      * Neither the name of NVIDIA Corporation nor the
+ *        names of its contributors may be used to endorse or promote products
+ *        derived from this software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ *  ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ *  WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ *  DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+ *  DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ *  (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ *  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ *  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ *  (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ *  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "base/Arena.hpp"
+#include "base/Thread.hpp"
+
+using namespace FW;
+
+//------------------------------------------------------------------------
+
+static void deinitArena(void* arena)
+{
+    delete (Arena*)arena;
+}
+
+//------------------------------------------------------------------------
+
+Arena::Arena(size_t chunkBytes)
+:   m_chunkBytes        (chunkBytes),
+    m_chunk             (0),
+    m_offset            (0),
+    m_bytesReserved     (0),
+    m_numChunkAllocs    (0)
+{
+}
+
+//------------------------------------------------------------------------
+
+void* Arena::alloc(size_t bytes, size_t align)
+{
+    FW_ASSERT(align && (align & (align - 1)) == 0);
+
+    // Bump within the current chunk, or move on to the next one that fits.
+
+    for (;;)
+    {
+        if (m_chunk < m_chunks.getSize())
+        {
+            const Chunk& chunk = m_chunks[m_chunk];
+            size_t start = ((size_t)chunk.ptr + m_offset + align - 1) & ~(align - 1);
+            size_t offset = start - (size_t)chunk.ptr;
+            if (offset + bytes <= chunk.size)
+            {
+                m_offset = offset + bytes;
+                return (void*)start;
+            }
+        }
+
+        if (m_chunk >= m_chunks.getSize() - 1)
+            break;
+        m_chunk++;
+        m_offset = 0;
+    }
+
+    // Out of chunks => allocate a new one.
+
+    Chunk& chunk = m_chunks.add();
+    chunk.size = max(m_chunkBytes, bytes + align);
+    chunk.ptr = (U8*)FW::malloc(chunk.size);
+    m_bytesReserved += chunk.size;
+    m_numChunkAllocs++;
+
+    m_chunk = m_chunks.getSize() - 1;
+    size_t start = ((size_t)chunk.ptr + align - 1) & ~(align - 1);
+    m_offset = start - (size_t)chunk.ptr + bytes;
+    return (void*)start;
+}
+
+//------------------------------------------------------------------------
+
+void Arena::release(void)
+{
+    for (int i = 0; i < m_chunks.getSize(); i++)
+        FW::free(m_chunks[i].ptr);
+    m_chunks.reset();
+    m_chunk = 0;
+    m_offset = 0;
+    m_bytesReserved = 0;
+}
+
+//------------------------------------------------------------------------
+
+Arena& Arena::getThreadArena(void)
+{
+    Thread* thread = Thread::getCurrent();
+    Arena* arena = (Arena*)thread->getUserData("arena");
+    if (!arena)
+    {
+        arena = new Arena;
+        thread->setUserData("arena", arena, deinitArena);
+    }
+    return *arena;
+}
+
+//------------------------------------------------------------------------
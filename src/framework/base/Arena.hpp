@@ -0,0 +1,96 @@
+/*
+ *  Copyright (c) 2009-2011, NVIDIA Corporation
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *      * Redistributions of source code must retain the above copyright
+ *        notice, this list of conditions and the following disclaimer.
+ *      * Redistributions in binary form must reproduce the above copyright
+ *        notice, this list of conditions and the following disclaimer in the
+ *        documentation and/or other materials provided with the distribution.
+ *      * Neither the name of NVIDIA Corporation nor the
+ *        names of its contributors may be used to endorse or promote products
+ *        derived from this software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ *  ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ *  WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ *  DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+ *  DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ *  (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ *  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ *  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ *  (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ *  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#pragma once
+#include "base/Array.hpp"
+
+namespace FW
+{
+//------------------------------------------------------------------------
+// Monotonic scratch allocator.
+//
+// Memory is bumped from a list of chunks that are kept for reuse, so
+// after the first few tasks neither alloc() nor reset() touches the heap.
+// Objects are not constructed or destructed; use for POD temporaries.
+//
+// Scoped use inside a task:
+//
+// Arena::Mark mark = arena.getMark();
+// int* tmp = arena.alloc<int>(n);
+// ...
+// arena.rewind(mark);
+//
+// Every thread has its own instance in getThreadArena().
+//------------------------------------------------------------------------
+
+class Arena
+{
+public:
+    struct Mark
+    {
+        S32                 chunk;
+        size_t              offset;
+    };
+
+public:
+    explicit            Arena           (size_t chunkBytes = 64 << 10);
+                        ~Arena          (void)                  { release(); }
+
+    void*               alloc           (size_t bytes, size_t align = 16);
+    template <class T> T* alloc         (int num)               { return (T*)alloc(num * sizeof(T)); }
+
+    Mark                getMark         (void) const            { Mark m; m.chunk = m_chunk; m.offset = m_offset; return m; }
+    void                rewind          (const Mark& mark)      { m_chunk = mark.chunk; m_offset = mark.offset; }
+    void                reset           (void)                  { m_chunk = 0; m_offset = 0; }    // O(1), keeps the chunks.
+    void                release         (void);                                                   // Frees the chunks.
+
+    size_t              getBytesReserved(void) const            { return m_bytesReserved; }
+    S32                 getNumChunkAllocs(void) const           { return m_numChunkAllocs; }    // Heap allocations made so far.
+
+    static Arena&       getThreadArena  (void);
+
+private:
+                        Arena           (const Arena&); // forbidden
+    Arena&              operator=       (const Arena&); // forbidden
+
+    struct Chunk
+    {
+        U8*                 ptr;
+        size_t              size;
+    };
+
+private:
+    size_t              m_chunkBytes;
+    Array<Chunk>        m_chunks;
+    S32                 m_chunk;            // Current chunk; == m_chunks.getSize() if none.
+    size_t              m_offset;           // Within the current chunk.
+    size_t              m_bytesReserved;
+    S32                 m_numChunkAllocs;
+};
+
+//------------------------------------------------------------------------
+}
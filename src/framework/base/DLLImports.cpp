@@ -219,6 +219,26 @@ void FW::deinitDLLImports(void) {}
 #undef FW_DLL_IMPORT_CUDA
 #undef FW_DLL_IMPORT_CUV2
 
+//------------------------------------------------------------------------
+// Without FW_USE_CUDA there is no libcuda to link against, so the CUDA
+// entry points fail at run time like the unresolved imports on Windows.
+
+#if (!FW_USE_CUDA)
+#   define FW_DLL_IMPORT_RETV(RET, CALL, NAME, PARAMS, PASS)
+#   define FW_DLL_IMPORT_VOID(RET, CALL, NAME, PARAMS, PASS)
+#   define FW_DLL_DECLARE_RETV(RET, CALL, NAME, PARAMS, PASS)
+#   define FW_DLL_DECLARE_VOID(RET, CALL, NAME, PARAMS, PASS)
+#   define FW_DLL_IMPORT_CUDA(RET, CALL, NAME, PARAMS, PASS)    RET CALL NAME PARAMS { fail(#NAME "(): Built without FW_USE_CUDA!"); return (RET)0; }
+#   define FW_DLL_IMPORT_CUV2(RET, CALL, NAME, PARAMS, PASS)    RET CALL NAME PARAMS { fail(#NAME "(): Built without FW_USE_CUDA!"); return (RET)0; }
+#   include "base/DLLImports.inl"
+#   undef FW_DLL_IMPORT_RETV
+#   undef FW_DLL_IMPORT_VOID
+#   undef FW_DLL_DECLARE_RETV
+#   undef FW_DLL_DECLARE_VOID
+#   undef FW_DLL_IMPORT_CUDA
+#   undef FW_DLL_IMPORT_CUV2
+#endif
+
 #endif
 
 //------------------------------------------------------------------------
@@ -38,6 +38,10 @@
 #define FW_USE_GLEW 0
 #endif
 
+#if !defined FW_USE_GL
+#define FW_USE_GL 1			// 0 builds the CPU-only core without any GL calls, for tools that never open a window
+#endif
+
 //------------------------------------------------------------------------
 
 #if (FW_USE_CUDA)
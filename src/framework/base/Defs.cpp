@@ -29,7 +29,10 @@
 #include "base/String.hpp"
 #include "base/Thread.hpp"
 #include "base/Timer.hpp"
+#include "base/Trace.hpp"
+#ifndef FW_HEADLESS
 #include "gui/Window.hpp"
+#endif
 #include "io/File.hpp"
 
 #include <stdlib.h>
@@ -37,7 +40,7 @@
 #include <stdarg.h>
 #include <malloc.h>
 
-#ifdef FW_QT
+#if defined(FW_QT) && !defined(FW_HEADLESS)
 #include <QMessageBox>
 #endif
 
@@ -45,7 +48,32 @@ using namespace FW;
 
 //------------------------------------------------------------------------
 
-#define FW_MEM_DEBUG    0
+#ifndef FW_MEM_DEBUG
+#   define FW_MEM_DEBUG 0
+#endif
+
+// Per-thread caches of small blocks (see FW::malloc()). Replaced by the
+// global alloc list when FW_MEM_DEBUG is enabled.
+
+#if !FW_MEM_DEBUG && defined(__GNUC__) && !defined(_WIN32)
+#   define FW_MEM_THREAD_CACHE  1
+#   include <pthread.h>
+#else
+#   define FW_MEM_THREAD_CACHE  0
+#endif
+
+#ifdef _MSC_VER
+#   define FW_THREAD_LOCAL      __declspec(thread)
+#else
+#   define FW_THREAD_LOCAL      __thread
+#endif
+
+#define FW_MEM_NUM_CLASSES      16
+#define FW_MEM_LARGE_CLASS      FW_MEM_NUM_CLASSES
+#define FW_MEM_CACHE_BYTES      (32 << 10)      // Max bytes kept per size class and thread.
+#define FW_MEM_USAGE_SLACK      (64 << 10)      // Max unpublished change in getMemoryUsed() per thread.
+#define FW_MEM_MAX_OWNERS       32              // Distinct pushMemOwner() ids; later ones count as the first.
+#define FW_MEM_MAX_OWNER_DEPTH  16              // Nesting of pushMemOwner() per thread.
 
 //------------------------------------------------------------------------
 
@@ -59,6 +87,28 @@ struct AllocHeader
 
 //------------------------------------------------------------------------
 
+struct BlockHeader
+{
+    size_t          size;       // Usable bytes following the header.
+    U32             sizeClass;  // FW_MEM_LARGE_CLASS if the block is not cached.
+    U32             owner;      // Index in s_memOwnerIDs, charged until freed.
+};
+
+//------------------------------------------------------------------------
+
+struct ThreadMemCache
+{
+    void*           freeList    [FW_MEM_NUM_CLASSES];   // Linked through the first word of each block.
+    S32             numFree     [FW_MEM_NUM_CLASSES];
+    S64             usageDelta;                         // Not yet added to s_memoryUsed.
+    S64             ownerDelta  [FW_MEM_MAX_OWNERS];    // Not yet added to s_memOwnerUsed.
+    S32             ownerStack  [FW_MEM_MAX_OWNER_DEPTH];
+    S32             ownerDepth;                         // May exceed FW_MEM_MAX_OWNER_DEPTH; the excess is not recorded.
+    bool            registered;                         // Released by releaseMemCache() on thread exit.
+};
+
+//------------------------------------------------------------------------
+
 struct ProfileTimer
 {
     String          id;
@@ -91,6 +141,8 @@ bool SafeSpinlock::s_inited = false;
 
 static SafeSpinlock                     s_lock;
 static size_t                           s_memoryUsed        = 0;
+static size_t                           s_memoryPeak        = 0;        // Max of s_memoryUsed since resetMemoryPeak().
+static FW_THREAD_LOCAL S64              s_numAllocs         = 0;        // FW::malloc() calls by this thread, in every build.
 static bool                             s_hasFailed         = false;
 static int                              s_nestingLevel      = 0;
 static bool                             s_discardEvents     = false;
@@ -105,6 +157,20 @@ static AllocHeader                      s_memAllocs         = { &s_memAllocs, &s
 static Hash<U32, Array<const char*> >   s_memOwnerStacks;
 #endif
 
+#if FW_MEM_THREAD_CACHE
+static const size_t                     c_memClassSizes[FW_MEM_NUM_CLASSES] =
+{
+    16, 32, 48, 64, 96, 128, 192, 256, 384, 512, 768, 1024, 1536, 2048, 3072, 4096
+};
+
+static __thread ThreadMemCache          s_memCache;
+static pthread_key_t                    s_memCacheKey;
+static pthread_once_t                   s_memCacheKeyOnce   = PTHREAD_ONCE_INIT;
+static const char*                      s_memOwnerIDs[FW_MEM_MAX_OWNERS] = { "Uncategorized" };
+static volatile S32                     s_numMemOwners      = 1;
+static size_t                           s_memOwnerUsed[FW_MEM_MAX_OWNERS];
+#endif
+
 static bool                             s_profileStarted    = false;
 static Hash<const char*, S32>           s_profilePointerToToken;
 static Hash<String, S32>                s_profileStringToToken;
@@ -121,6 +187,89 @@ static void deinitString(void* str)
 
 //------------------------------------------------------------------------
 
+#if FW_MEM_THREAD_CACHE
+
+static inline int getMemClass(size_t size)
+{
+    for (int i = 0; i < FW_MEM_NUM_CLASSES; i++)
+        if (size <= c_memClassSizes[i])
+            return i;
+    return FW_MEM_LARGE_CLASS;
+}
+
+//------------------------------------------------------------------------
+
+static void flushMemUsage(ThreadMemCache& cache)
+{
+    size_t used = __sync_add_and_fetch(&s_memoryUsed, (size_t)cache.usageDelta);
+    cache.usageDelta = 0;
+
+    for (int i = 0; i < s_numMemOwners; i++)
+    {
+        if (cache.ownerDelta[i])
+            __sync_add_and_fetch(&s_memOwnerUsed[i], (size_t)cache.ownerDelta[i]);
+        cache.ownerDelta[i] = 0;
+    }
+
+    size_t peak;
+    while ((peak = s_memoryPeak) < used && !__sync_bool_compare_and_swap(&s_memoryPeak, peak, used))
+        ;
+}
+
+//------------------------------------------------------------------------
+
+static inline void addMemUsage(ThreadMemCache& cache, U32 owner, S64 delta)
+{
+    cache.ownerDelta[owner] += delta;
+    cache.usageDelta += delta;
+    if (cache.usageDelta > FW_MEM_USAGE_SLACK || cache.usageDelta < -FW_MEM_USAGE_SLACK)
+        flushMemUsage(cache);
+}
+
+//------------------------------------------------------------------------
+
+static void releaseMemCache(void* ptr)
+{
+    ThreadMemCache& cache = *(ThreadMemCache*)ptr;
+    for (int i = 0; i < FW_MEM_NUM_CLASSES; i++)
+    {
+        while (cache.freeList[i])
+        {
+            void* next = *(void**)cache.freeList[i];
+            ::free((BlockHeader*)cache.freeList[i] - 1);
+            cache.freeList[i] = next;
+        }
+        cache.numFree[i] = 0;
+    }
+    flushMemUsage(cache);
+    cache.registered = false;
+}
+
+//------------------------------------------------------------------------
+
+static void createMemCacheKey(void)
+{
+    pthread_key_create(&s_memCacheKey, releaseMemCache);
+}
+
+//------------------------------------------------------------------------
+
+static void registerMemCache(ThreadMemCache& cache)
+{
+    pthread_once(&s_memCacheKeyOnce, createMemCacheKey);
+    pthread_setspecific(s_memCacheKey, &cache);
+    cache.registered = true;
+}
+
+#endif
+
+//------------------------------------------------------------------------
+// Without FW_MEM_DEBUG, allocations up to 4 KB are rounded up to one of
+// FW_MEM_NUM_CLASSES size classes, and freed blocks are kept in a cache
+// of the freeing thread for reuse by its next allocations of the same
+// class. The block header records the size, so neither path takes a
+// lock, and getMemoryUsed() is updated from per-thread deltas.
+
 void* FW::malloc(size_t size)
 {
 #if FW_MEM_DEBUG
@@ -138,6 +287,7 @@ void* FW::malloc(size_t size)
     alloc->size         = size;
     alloc->ownerID      = "Uncategorized";
     s_memoryUsed        += size;
+    s_memoryPeak        = max(s_memoryPeak, s_memoryUsed);
 
     if (!s_memPushingOwner)
     {
@@ -148,6 +298,34 @@ void* FW::malloc(size_t size)
 
     s_lock.leave();
 
+#elif FW_MEM_THREAD_CACHE
+    ThreadMemCache& cache = s_memCache;
+    if (!cache.registered)
+        registerMemCache(cache);
+
+    int sizeClass = getMemClass(size);
+    BlockHeader* block;
+    if (sizeClass != FW_MEM_LARGE_CLASS && cache.freeList[sizeClass])
+    {
+        void* cached = cache.freeList[sizeClass];
+        cache.freeList[sizeClass] = *(void**)cached;
+        cache.numFree[sizeClass]--;
+        block = (BlockHeader*)cached - 1;
+    }
+    else
+    {
+        size_t blockSize = (sizeClass != FW_MEM_LARGE_CLASS) ? c_memClassSizes[sizeClass] : size;
+        block = (BlockHeader*)::malloc(sizeof(BlockHeader) + blockSize);
+        if (!block)
+            fail("Out of memory!");
+        block->size = blockSize;
+        block->sizeClass = sizeClass;
+    }
+
+    block->owner = (cache.ownerDepth) ? cache.ownerStack[min(cache.ownerDepth, FW_MEM_MAX_OWNER_DEPTH) - 1] : 0;
+    addMemUsage(cache, block->owner, (S64)block->size);
+    void* ptr = block + 1;
+
 #else
     void* ptr = ::malloc(size);
     if (!ptr)
@@ -159,9 +337,11 @@ void* FW::malloc(size_t size)
 #else
     s_memoryUsed += malloc_usable_size(ptr);
 #endif
+    s_memoryPeak = max(s_memoryPeak, s_memoryUsed);
     s_lock.leave();
 #endif
 
+    s_numAllocs++;
     return ptr;
 }
 
@@ -183,6 +363,24 @@ void FW::free(void* ptr)
 
     s_lock.leave();
 
+#elif FW_MEM_THREAD_CACHE
+    ThreadMemCache& cache = s_memCache;
+    if (!cache.registered)
+        registerMemCache(cache);
+
+    BlockHeader* block = (BlockHeader*)ptr - 1;
+    U32 sizeClass = block->sizeClass;
+    addMemUsage(cache, block->owner, -(S64)block->size);
+
+    if (sizeClass != FW_MEM_LARGE_CLASS && cache.numFree[sizeClass] * c_memClassSizes[sizeClass] < FW_MEM_CACHE_BYTES)
+    {
+        *(void**)ptr = cache.freeList[sizeClass];
+        cache.freeList[sizeClass] = ptr;
+        cache.numFree[sizeClass]++;
+    }
+    else
+        ::free(block);
+
 #else
     s_lock.enter();
 #ifdef _MSC_VER
@@ -214,6 +412,31 @@ void* FW::realloc(void* ptr, size_t size)
     memcpy(newPtr, ptr, min(size, ((AllocHeader*)ptr - 1)->size));
     FW::free(ptr);
 
+#elif FW_MEM_THREAD_CACHE
+    // Small blocks are never shrunk in place; large ones use ::realloc().
+
+    BlockHeader* block = (BlockHeader*)ptr - 1;
+    if (block->sizeClass != FW_MEM_LARGE_CLASS && size <= block->size)
+        return ptr;
+
+    void* newPtr;
+    if (block->sizeClass == FW_MEM_LARGE_CLASS && getMemClass(size) == FW_MEM_LARGE_CLASS)
+    {
+        size_t oldSize = block->size;
+        block = (BlockHeader*)::realloc(block, sizeof(BlockHeader) + size);
+        if (!block)
+            fail("Out of memory!");
+        block->size = size;
+        addMemUsage(s_memCache, block->owner, (S64)size - (S64)oldSize);
+        newPtr = block + 1;
+    }
+    else
+    {
+        newPtr = FW::malloc(size);
+        memcpy(newPtr, ptr, min(size, block->size));
+        FW::free(ptr);
+    }
+
 #else
 #ifdef _MSC_VER
     size_t oldSize = _msize(ptr);
@@ -231,6 +454,7 @@ void* FW::realloc(void* ptr, size_t size)
 #else
     s_memoryUsed += malloc_usable_size(newPtr) - oldSize;
 #endif
+    s_memoryPeak = max(s_memoryPeak, s_memoryUsed);
     s_lock.leave();
 #endif
 
@@ -367,7 +591,7 @@ void FW::fail(const char* fmt, ...)
     // Kill the app.
 
     FatalExit(1);
-#elif defined(FW_QT)
+#elif defined(FW_QT) && !defined(FW_HEADLESS)
     QMessageBox::critical(0, "Fatal error", tmp.getPtr());
     abort();
 #else
@@ -468,14 +692,70 @@ bool FW::hasLogFile(void)
 
 size_t FW::getMemoryUsed(void)
 {
+    // Other threads may still hold up to FW_MEM_USAGE_SLACK each.
+
+#if FW_MEM_THREAD_CACHE
+    flushMemUsage(s_memCache);
+#endif
     return s_memoryUsed;
 }
 
 //------------------------------------------------------------------------
 
+size_t FW::getMemoryPeak(void)
+{
+    getMemoryUsed();
+    return s_memoryPeak;
+}
+
+//------------------------------------------------------------------------
+
+void FW::resetMemoryPeak(void)
+{
+    s_memoryPeak = getMemoryUsed();
+}
+
+//------------------------------------------------------------------------
+
+S64 FW::getNumAllocs(void)
+{
+    return s_numAllocs;
+}
+
+//------------------------------------------------------------------------
+
 void FW::pushMemOwner(const char* id)
 {
-#if !FW_MEM_DEBUG
+#if FW_MEM_THREAD_CACHE
+    // Ids are registered once; the stack itself is per thread.
+
+    S32 owner = -1;
+    for (int i = 0; i < s_numMemOwners && owner == -1; i++)
+        if (s_memOwnerIDs[i] == id || strcmp(s_memOwnerIDs[i], id) == 0)
+            owner = i;
+
+    if (owner == -1)
+    {
+        s_lock.enter();
+        for (int i = 0; i < s_numMemOwners && owner == -1; i++)
+            if (strcmp(s_memOwnerIDs[i], id) == 0)
+                owner = i;
+        if (owner == -1 && s_numMemOwners < FW_MEM_MAX_OWNERS)
+        {
+            owner = s_numMemOwners;
+            s_memOwnerIDs[owner] = id;
+            __sync_synchronize();
+            s_numMemOwners = owner + 1;
+        }
+        s_lock.leave();
+    }
+
+    ThreadMemCache& cache = s_memCache;
+    if (cache.ownerDepth < FW_MEM_MAX_OWNER_DEPTH)
+        cache.ownerStack[cache.ownerDepth] = max(owner, 0);
+    cache.ownerDepth++;
+
+#elif !FW_MEM_DEBUG
     FW_UNREF(id);
 #else
     s_lock.enter();
@@ -499,7 +779,13 @@ void FW::pushMemOwner(const char* id)
 
 void FW::popMemOwner(void)
 {
-#if FW_MEM_DEBUG
+#if FW_MEM_THREAD_CACHE
+    ThreadMemCache& cache = s_memCache;
+    if (cache.ownerDepth)
+        cache.ownerDepth--;
+
+#elif FW_MEM_DEBUG
+    s_lock.enter();
     U32 threadID = Thread::getID();
     Array<const char*>* stack = s_memOwnerStacks.search(threadID);
     if (stack)
@@ -512,6 +798,7 @@ void FW::popMemOwner(void)
                 s_memOwnerStacks.reset();
         }
     }
+    s_lock.leave();
 #endif
 }
 
@@ -519,7 +806,21 @@ void FW::popMemOwner(void)
 
 void FW::printMemStats(void)
 {
-#if FW_MEM_DEBUG
+#if FW_MEM_THREAD_CACHE
+    // Live bytes per owner, within the per-thread slack like getMemoryUsed().
+
+    size_t used = getMemoryUsed();
+    printf("\n");
+    printf("%-32s%.2f\n", "Memory usage / megs", (F32)used * exp2(-20));
+    for (int i = 0; i < s_numMemOwners; i++)
+    {
+        S64 owned = (S64)s_memOwnerUsed[i];
+        if (owned > 0)
+            printf("  %-30s%-12.2f%.0f%%\n", s_memOwnerIDs[i], (F32)owned * exp2(-20), (F32)owned / (F32)max(used, (size_t)1) * 100.0f);
+    }
+    printf("\n");
+
+#elif FW_MEM_DEBUG
     // Create snapshot of the alloc list.
 
     s_lock.enter();
@@ -580,10 +881,11 @@ void FW::profileStart(void)
 
 void FW::profilePush(const char* id)
 {
-    if (!s_profileStarted)
+    // Other threads only show up in the trace.
+
+    Trace::begin(id);
+    if (!s_profileStarted || !Thread::isMain())
         return;
-    if (!Thread::isMain())
-        fail("profilePush() can only be used in the main thread!");
 
     // Find or create token.
 
@@ -638,10 +940,9 @@ void FW::profilePush(const char* id)
 
 void FW::profilePop(void)
 {
-    if (!s_profileStarted || s_profileStack.getSize() == 0)
+    Trace::end();
+    if (!s_profileStarted || s_profileStack.getSize() == 0 || !Thread::isMain())
         return;
-    if (!Thread::isMain())
-        fail("profilePop() can only be used in the main thread!");
 
     if (s_profileStack.getSize() > 1)
         s_profileTimers[s_profileStack.getLast()].timer.end();
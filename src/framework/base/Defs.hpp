@@ -170,11 +170,15 @@ bool            hasLogFile      (void);
 // Memory profiling.
 
 size_t          getMemoryUsed   (void);
-void            pushMemOwner    (const char* id);
+size_t          getMemoryPeak   (void);     // Highest getMemoryUsed() since resetMemoryPeak(), within the per-thread slack.
+void            resetMemoryPeak (void);
+S64             getNumAllocs    (void);     // FW::malloc() calls by the calling thread.
+void            pushMemOwner    (const char* id);   // Charges the calling thread's allocations to id until popMemOwner().
 void            popMemOwner     (void);
-void            printMemStats   (void);
+void            printMemStats   (void);             // Live bytes per owner. Not available with neither FW_MEM_DEBUG nor the per-thread caches.
 
-// Performance profiling.
+// Performance profiling. Push/pop can be called from any thread, but only
+// the main thread's timers are printed; see Trace for the others.
 
 void            profileStart    (void);
 void            profilePush     (const char* id);
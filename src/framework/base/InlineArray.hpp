@@ -0,0 +1,246 @@
+/*
+ *  Copyright (c) 2009-2011, NVIDIA Corporation
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *      * Redistributions of source code must retain the above copyright
+ *        notice, this list of conditions and the following disclaimer.
+ *      * Redistributions in binary form must reproduce the above copyright
+ *        notice, this list of conditions and the following disclaimer in the
+ *        documentation and/or other materials provided with the distribution.
+ *      * Neither the name of NVIDIA Corporation nor the
+ *        names of its contributors may be used to endorse or promote products
+ *        derived from this software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ *  ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ *  WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ *  DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+ *  DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ *  (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ *  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ *  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ *  (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ *  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#pragma once
+#include "base/Array.hpp"
+
+namespace FW
+{
+//------------------------------------------------------------------------
+// Array with storage for N elements inside the object, so that small
+// containers live on the stack (or inside their owner) and touch the heap
+// only when they outgrow N. Once on the heap, the allocation grows like
+// Array's; reset() and compact() return to the inline storage when the
+// contents fit.
+//
+// The interface is the subset of Array's used by per-query containers.
+
+template <class T, int N> class InlineArray
+{
+public:
+
+    // Constructors.
+
+    inline              InlineArray (void);                             // Create an empty array using the inline storage.
+    inline              InlineArray (const InlineArray<T, N>& other);   // Copy constructor.
+    inline              ~InlineArray(void);
+
+    // Array-wide getters.
+
+    inline int          getSize     (void) const                        { return m_size; }
+    inline int          getCapacity (void) const                        { return m_alloc; }     // Never less than N.
+    inline bool         isInline    (void) const                        { return (m_ptr == m_inline); }
+    inline const T*     getPtr      (int idx = 0) const                 { FW_ASSERT(idx >= 0 && idx <= m_size); return m_ptr + idx; }
+    inline T*           getPtr      (int idx = 0)                       { FW_ASSERT(idx >= 0 && idx <= m_size); return m_ptr + idx; }
+    inline int          getStride   (void) const                        { return sizeof(T); }
+    inline int          getNumBytes (void) const                        { return getSize() * getStride(); }
+
+    // Element access.
+
+    inline const T&     get         (int idx) const                     { FW_ASSERT(idx >= 0 && idx < m_size); return m_ptr[idx]; }
+    inline T&           get         (int idx)                           { FW_ASSERT(idx >= 0 && idx < m_size); return m_ptr[idx]; }
+    inline T            set         (int idx, const T& item)            { T& slot = get(idx); T old = slot; slot = item; return old; }
+    inline const T&     getFirst    (void) const                        { return get(0); }
+    inline T&           getFirst    (void)                              { return get(0); }
+    inline const T&     getLast     (void) const                        { return get(getSize() - 1); }
+    inline T&           getLast     (void)                              { return get(getSize() - 1); }
+
+    // Array-wide operations that may shrink the allocation.
+
+    inline void         reset       (int size = 0);                     // Discards old contents, and resets size to the given value and capacity to max(size, N).
+    inline void         setCapacity (int numElements);                  // Resizes the allocation for max(numElements, size, N) elements. Does not modify contents.
+    inline void         compact     (void)                              { setCapacity(0); }
+    inline void         set         (const T* ptr, int size);           // Discards old contents, and re-initializes the array from the given memory location.
+    inline void         set         (const InlineArray<T, N>& other)    { if (&other != this) set(other.getPtr(), other.getSize()); }
+
+    // Array-wide operations that can only grow the allocation.
+
+    inline void         clear       (void)                              { m_size = 0; }
+    inline void         resize      (int size);                         // Sets the size to the given value. Allocates more space if necessary.
+    inline void         reserve     (int numElements)                   { if (numElements > m_alloc) realloc(numElements); }
+
+    // Element addition. Allocates more space if necessary.
+
+    inline T&           add         (void)                              { return *add(NULL, 1); }
+    inline T&           add         (const T& item)                     { T* slot = add(NULL, 1); *slot = item; return *slot; }
+    inline T*           add         (const T* ptr, int size);           // Appends a number of elements from the given memory location. If NULL, the elements are left uninitialized.
+    inline T*           add         (const InlineArray<T, N>& other)    { FW_ASSERT(&other != this); return add(other.getPtr(), other.getSize()); }
+
+    // Element removal. Does not shrink the allocation.
+
+    inline T            remove      (int idx);                          // Removes the given element and returns its value. Shifts the following elements down.
+    inline T&           removeLast  (void)                              { FW_ASSERT(m_size > 0); m_size--; return m_ptr[m_size]; }
+    inline T            removeSwap  (int idx);                          // Removes the given element and returns its value. Swaps in the last element to fill the vacant slot.
+
+    // Operators.
+
+    inline const T&     operator[]  (int idx) const                     { return get(idx); }
+    inline T&           operator[]  (int idx)                           { return get(idx); }
+    inline InlineArray<T, N>& operator= (const InlineArray<T, N>& other) { set(other); return *this; }
+
+    // Internals.
+
+private:
+    void                realloc     (int size);
+    void                reallocRound(int size);
+
+private:
+    T*                  m_ptr;
+    S32                 m_size;
+    S32                 m_alloc;
+    T                   m_inline[N];
+};
+
+//------------------------------------------------------------------------
+
+template <class T, int N> InlineArray<T, N>::InlineArray(void)
+:   m_ptr   (m_inline),
+    m_size  (0),
+    m_alloc (N)
+{
+}
+
+//------------------------------------------------------------------------
+
+template <class T, int N> InlineArray<T, N>::InlineArray(const InlineArray<T, N>& other)
+:   m_ptr   (m_inline),
+    m_size  (0),
+    m_alloc (N)
+{
+    set(other);
+}
+
+//------------------------------------------------------------------------
+
+template <class T, int N> InlineArray<T, N>::~InlineArray(void)
+{
+    if (!isInline())
+        delete[] m_ptr;
+}
+
+//------------------------------------------------------------------------
+
+template <class T, int N> void InlineArray<T, N>::reset(int size)
+{
+    clear();
+    setCapacity(size);
+    m_size = size;
+}
+
+//------------------------------------------------------------------------
+
+template <class T, int N> void InlineArray<T, N>::setCapacity(int numElements)
+{
+    int c = max(numElements, m_size, N);
+    if (m_alloc != c)
+        realloc(c);
+}
+
+//------------------------------------------------------------------------
+
+template <class T, int N> void InlineArray<T, N>::set(const T* ptr, int size)
+{
+    reset(size);
+    if (ptr)
+        Array<T>::copy(m_ptr, ptr, size);
+}
+
+//------------------------------------------------------------------------
+
+template <class T, int N> void InlineArray<T, N>::resize(int size)
+{
+    FW_ASSERT(size >= 0);
+    if (size > m_alloc)
+        reallocRound(size);
+    m_size = size;
+}
+
+//------------------------------------------------------------------------
+
+template <class T, int N> T* InlineArray<T, N>::add(const T* ptr, int size)
+{
+    int oldSize = getSize();
+    resize(oldSize + size);
+    T* slot = m_ptr + oldSize;
+    if (ptr)
+        Array<T>::copy(slot, ptr, size);
+    return slot;
+}
+
+//------------------------------------------------------------------------
+
+template <class T, int N> T InlineArray<T, N>::remove(int idx)
+{
+    T old = get(idx);
+    Array<T>::copyOverlap(m_ptr + idx, m_ptr + idx + 1, m_size - idx - 1);
+    m_size--;
+    return old;
+}
+
+//------------------------------------------------------------------------
+
+template <class T, int N> T InlineArray<T, N>::removeSwap(int idx)
+{
+    FW_ASSERT(idx >= 0 && idx < m_size);
+
+    T old = get(idx);
+    m_size--;
+    if (idx < m_size)
+        m_ptr[idx] = m_ptr[m_size];
+    return old;
+}
+
+//------------------------------------------------------------------------
+
+template <class T, int N> void InlineArray<T, N>::realloc(int size)
+{
+    FW_ASSERT(size >= N);
+
+    T* newPtr = (size > N) ? new T[size] : m_inline;
+    if (newPtr != m_ptr)
+    {
+        Array<T>::copy(newPtr, m_ptr, min(size, m_size));
+        if (!isInline())
+            delete[] m_ptr;
+    }
+    m_ptr = newPtr;
+    m_alloc = size;
+}
+
+//------------------------------------------------------------------------
+
+template <class T, int N> void InlineArray<T, N>::reallocRound(int size)
+{
+    FW_ASSERT(size >= 0);
+    int rounded = N;
+    while (size > rounded)
+        rounded <<= 1;
+    realloc(rounded);
+}
+
+//------------------------------------------------------------------------
+}
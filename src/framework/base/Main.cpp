@@ -28,10 +28,12 @@
 #include "base/Main.hpp"
 #include "base/DLLImports.hpp"
 #include "base/Thread.hpp"
+#include "gpu/CudaModule.hpp"
+#ifndef FW_HEADLESS
 #include "gui/Window.hpp"
 #include "gpu/GLContext.hpp"
-#include "gpu/CudaModule.hpp"
 #include "gpu/CudaCompiler.hpp"
+#endif
 
 #ifdef _MSC_VER
 #include <crtdbg.h>
@@ -42,7 +44,9 @@
 #include <pthread.h>
 #endif
 
-#ifdef FW_QT
+#if defined(FW_QT) && defined(FW_HEADLESS)
+#include <QCoreApplication>
+#elif defined(FW_QT)
 #include <QApplication>
 #endif
 
@@ -60,7 +64,10 @@ static bool s_enableLeakCheck   = true;
 
 int main(int argc, char* argv[])
 {
-#ifdef FW_QT
+#if defined(FW_QT) && defined(FW_HEADLESS)
+    // Opted in by the .pro files of the command-line tools: no Qt GUI, no windows.
+    QCoreApplication app(argc, argv);
+#elif defined(FW_QT)
     QApplication app(argc, argv);
 #endif
 
@@ -102,6 +109,7 @@ int main(int argc, char* argv[])
 
     // Message loop.
 
+#ifndef FW_HEADLESS
     while (Window::getNumOpen())
     {
         // Wait for a message.
@@ -135,14 +143,19 @@ int main(int argc, char* argv[])
         }
 #endif
     }
+#endif
 
     // Clean up.
 
     failIfError();
+#ifndef FW_HEADLESS
     CudaCompiler::staticDeinit();
+#endif
     CudaModule::staticDeinit();
+#ifndef FW_HEADLESS
     GLContext::staticDeinit();
     Window::staticDeinit();
+#endif
     deinitDLLImports();
     profileEnd(false);
     failIfError();
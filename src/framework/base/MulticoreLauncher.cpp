@@ -27,30 +27,225 @@
 
 #include "base/MulticoreLauncher.hpp"
 #include "base/Timer.hpp"
+#include "base/Topology.hpp"
+#include "base/Trace.hpp"
 
 using namespace FW;
 
 //------------------------------------------------------------------------
 
+#ifdef _MSC_VER
+#   define FW_THREAD_LOCAL          __declspec(thread)
+#   define FW_ATOMIC_ADD(PTR, V)    InterlockedExchangeAdd((volatile LONG*)(PTR), (V))
+#   define FW_ATOMIC_CAS(PTR, A, B) (InterlockedCompareExchangePointer((PVOID volatile*)(PTR), (PVOID)(B), (PVOID)(A)) == (PVOID)(A))
+#   define FW_MEMORY_FENCE()        MemoryBarrier()
+#else
+#   define FW_THREAD_LOCAL          __thread
+#   define FW_ATOMIC_ADD(PTR, V)    __sync_fetch_and_add((PTR), (V))
+#   define FW_ATOMIC_CAS(PTR, A, B) __sync_bool_compare_and_swap((PTR), (A), (B))
+#   define FW_MEMORY_FENCE()        __sync_synchronize()
+#endif
+
+//------------------------------------------------------------------------
+// A range of task indices. Split in halves until at most grain indices
+// remain, which then form one task.
+
+struct MulticoreLauncher::Job
+{
+    MulticoreLauncher*  launcher;
+    TaskFunc            func;       // Called for each index, or
+    RangeFunc           rangeFunc;  // called once for the whole chunk.
+    void*               data;
+    S32                 start;
+    S32                 end;
+    S32                 grain;
+};
+
+//------------------------------------------------------------------------
+// Chase-Lev work-stealing deque. The owning worker pushes and pops at the
+// bottom; other threads steal from the top. The ring only grows, and old
+// rings are kept until the deque dies since thieves may still read them.
+
+class MulticoreLauncher::WorkDeque
+{
+public:
+                        WorkDeque       (void);
+                        ~WorkDeque      (void);
+
+    void                push            (Job* job);     // Owner only.
+    Job*                pop             (void);         // Owner only.
+    Job*                steal           (bool& lost);   // Any thread. Sets lost if another thread took the job.
+
+private:
+    struct Ring
+    {
+        SPTR            mask;
+        Job*            jobs[1];
+    };
+
+    static Ring*        newRing         (SPTR size);
+    Ring*               grow            (Ring* ring, SPTR top, SPTR bottom);
+
+private:
+                        WorkDeque       (const WorkDeque&); // forbidden
+    WorkDeque&          operator=       (const WorkDeque&); // forbidden
+
+private:
+    volatile SPTR       m_top;
+    volatile SPTR       m_bottom;
+    Ring* volatile      m_ring;
+    Array<Ring*>        m_retired;
+};
+
+//------------------------------------------------------------------------
+
+struct MulticoreLauncher::StatsSlot
+{
+    SchedulerStats      stats;
+    U8                  pad[64];                        // Keep the slots of different workers off each other's cache lines.
+};
+
+//------------------------------------------------------------------------
+
 Spinlock                        MulticoreLauncher::s_lock;
 S32                             MulticoreLauncher::s_numInstances   = 0;
 S32                             MulticoreLauncher::s_desiredThreads = -1;
 
 Monitor*                        MulticoreLauncher::s_monitor        = NULL;
-Deque<MulticoreLauncher::Task>  MulticoreLauncher::s_pending;
 S32                             MulticoreLauncher::s_numThreads     = 0;
+volatile S32                    MulticoreLauncher::s_numSleeping    = 0;
+volatile S32                    MulticoreLauncher::s_numQueued      = 0;
+
+MulticoreLauncher::WorkDeque*   MulticoreLauncher::s_deques[MaxWorkers];
+S32                             MulticoreLauncher::s_workerNodes[MaxWorkers];
+bool                            MulticoreLauncher::s_pinThreads     = true;
+Spinlock                        MulticoreLauncher::s_injectedLock;
+Deque<MulticoreLauncher::Job*>  MulticoreLauncher::s_injected;
+volatile S32                    MulticoreLauncher::s_numInjected    = 0;
+MulticoreLauncher::StatsSlot    MulticoreLauncher::s_stats[MaxWorkers + 1];
+
+static volatile S32             s_numDeques     = 0;    // Slots of s_deques that have been created.
+static FW_THREAD_LOCAL S32      s_workerIdx     = -1;   // Index of the current worker thread, -1 if not a worker.
+
+//------------------------------------------------------------------------
+
+MulticoreLauncher::WorkDeque::WorkDeque(void)
+:   m_top       (0),
+    m_bottom    (0),
+    m_ring      (newRing(64))
+{
+}
+
+//------------------------------------------------------------------------
+
+MulticoreLauncher::WorkDeque::~WorkDeque(void)
+{
+    FW::free(m_ring);
+    for (int i = 0; i < m_retired.getSize(); i++)
+        FW::free(m_retired[i]);
+}
+
+//------------------------------------------------------------------------
+
+void MulticoreLauncher::WorkDeque::push(Job* job)
+{
+    SPTR b = m_bottom;
+    SPTR t = m_top;
+    Ring* r = m_ring;
+    if (b - t > r->mask)
+        r = grow(r, t, b);
+
+    r->jobs[b & r->mask] = job;
+    FW_MEMORY_FENCE();
+    m_bottom = b + 1;
+}
+
+//------------------------------------------------------------------------
+
+MulticoreLauncher::Job* MulticoreLauncher::WorkDeque::pop(void)
+{
+    SPTR b = m_bottom - 1;
+    Ring* r = m_ring;
+    m_bottom = b;
+    FW_MEMORY_FENCE();
+    SPTR t = m_top;
+
+    if (t > b)
+    {
+        m_bottom = b + 1;
+        return NULL;
+    }
+
+    // Last job => race against the thieves.
+
+    Job* job = r->jobs[b & r->mask];
+    if (t == b)
+    {
+        if (!FW_ATOMIC_CAS(&m_top, t, t + 1))
+            job = NULL;
+        m_bottom = b + 1;
+    }
+    return job;
+}
+
+//------------------------------------------------------------------------
+
+MulticoreLauncher::Job* MulticoreLauncher::WorkDeque::steal(bool& lost)
+{
+    SPTR t = m_top;
+    FW_MEMORY_FENCE();
+    SPTR b = m_bottom;
+    if (t >= b)
+        return NULL;
+
+    Ring* r = m_ring;
+    Job* job = r->jobs[t & r->mask];
+    if (!FW_ATOMIC_CAS(&m_top, t, t + 1))
+    {
+        lost = true;
+        return NULL;
+    }
+    return job;
+}
+
+//------------------------------------------------------------------------
+
+MulticoreLauncher::WorkDeque::Ring* MulticoreLauncher::WorkDeque::newRing(SPTR size)
+{
+    Ring* ring = (Ring*)FW::malloc(sizeof(Ring) + (size_t)(size - 1) * sizeof(Job*));
+    ring->mask = size - 1;
+    return ring;
+}
+
+//------------------------------------------------------------------------
+
+MulticoreLauncher::WorkDeque::Ring* MulticoreLauncher::WorkDeque::grow(Ring* ring, SPTR top, SPTR bottom)
+{
+    Ring* newRing = WorkDeque::newRing((ring->mask + 1) * 2);
+    for (SPTR i = top; i < bottom; i++)
+        newRing->jobs[i & newRing->mask] = ring->jobs[i & ring->mask];
+
+    m_retired.add(ring);
+    FW_MEMORY_FENCE();
+    m_ring = newRing;
+    return newRing;
+}
 
 //------------------------------------------------------------------------
 
 MulticoreLauncher::MulticoreLauncher(void)
-:   m_numTasks  (0)
+:   m_numTasks      (0),
+    m_finishedLock  (0),
+    m_numFinished   (0),
+    m_waiting       (0),
+    m_wakeup        (0, 1)
 {
     s_lock.enter();
 
     // First time => query the number of cores.
 
     if (s_desiredThreads == -1)
-        s_desiredThreads = getNumCores();
+        s_desiredThreads = min(getNumCores(), (int)MaxWorkers);
 
     // First instance => static init.
 
@@ -84,7 +279,13 @@ MulticoreLauncher::~MulticoreLauncher(void)
 
         delete s_monitor;
         s_monitor = NULL;
-        s_pending.reset();
+        for (int i = 0; i < s_numDeques; i++)
+        {
+            delete s_deques[i];
+            s_deques[i] = NULL;
+        }
+        s_numDeques = 0;
+        s_injected.reset();
     }
 
     s_lock.leave();
@@ -97,25 +298,20 @@ MulticoreLauncher& MulticoreLauncher::push(TaskFunc func, void* data, int firstI
     FW_ASSERT(func != NULL);
     FW_ASSERT(numTasks >= 0);
 
-    if (numTasks <= 0)
-        return *this;
+    if (numTasks > 0)
+        pushJob(func, NULL, data, firstIdx, firstIdx + numTasks, 1);
+    return *this;
+}
 
-    s_monitor->enter();
+//------------------------------------------------------------------------
 
-    for (int i = 0; i < numTasks; i++)
-    {
-        Task& task = s_pending.addLast();
-        task.launcher = this;
-        task.func     = func;
-        task.data     = data;
-        task.idx      = firstIdx + i;
-        task.result   = NULL;
-    }
-    m_numTasks += numTasks;
+MulticoreLauncher& MulticoreLauncher::pushRange(RangeFunc func, void* data, int start, int end, int grain)
+{
+    FW_ASSERT(func != NULL);
+    FW_ASSERT(grain > 0);
 
-    applyNumThreads();
-    s_monitor->notifyAll();
-    s_monitor->leave();
+    if (end > start)
+        pushJob(NULL, func, data, start, end, grain);
     return *this;
 }
 
@@ -124,18 +320,30 @@ MulticoreLauncher& MulticoreLauncher::push(TaskFunc func, void* data, int firstI
 MulticoreLauncher::Task MulticoreLauncher::pop(void)
 {
     FW_ASSERT(getNumTasks());
-    s_monitor->enter();
 
-    // Wait for a task to finish.
+    // Wait for a task to finish, helping with pending ones.
 
     while (!getNumFinished())
-        s_monitor->wait();
+    {
+        Job* job = dequeue();
+        if (job)
+            runJob(job);
+        else
+            sleepUntilWork(this);
+    }
 
     // Pop from the queue.
 
-    m_numTasks--;
+    while (FW_ATOMIC_CAS(&m_finishedLock, 0, 1) == false)
+    {
+        getLocalStats().numFinishedSpins++;
+        Thread::yield();
+    }
     Task task = m_finished.removeFirst();
-    s_monitor->leave();
+    m_numFinished--;
+    m_finishedLock = 0;
+
+    FW_ATOMIC_ADD(&m_numTasks, -1);
     return task;
 }
 
@@ -150,7 +358,7 @@ int MulticoreLauncher::getNumTasks(void) const
 
 int MulticoreLauncher::getNumFinished(void) const
 {
-    return m_finished.getSize();
+    return m_numFinished;
 }
 
 //------------------------------------------------------------------------
@@ -174,6 +382,15 @@ void MulticoreLauncher::popAll(const String& progressMessage)
 
 //------------------------------------------------------------------------
 
+void MulticoreLauncher::parallelFor(RangeFunc func, void* data, int start, int end, int grain)
+{
+    MulticoreLauncher launcher;
+    launcher.pushRange(func, data, start, end, grain);
+    launcher.popAll();
+}
+
+//------------------------------------------------------------------------
+
 int MulticoreLauncher::getNumCores(void)
 {
 #ifdef _MSC_VER
@@ -192,7 +409,7 @@ void MulticoreLauncher::setNumThreads(int numThreads)
     FW_ASSERT(numThreads > 0);
     s_lock.enter();
 
-    s_desiredThreads = numThreads;
+    s_desiredThreads = min(numThreads, (int)MaxWorkers);
     if (s_numThreads != 0)
     {
         s_monitor->enter();
@@ -205,17 +422,81 @@ void MulticoreLauncher::setNumThreads(int numThreads)
 
 //------------------------------------------------------------------------
 
+MulticoreLauncher::SchedulerStats MulticoreLauncher::getSchedulerStats(void)
+{
+    SchedulerStats total;
+    memset(&total, 0, sizeof(total));
+    for (int i = 0; i <= MaxWorkers; i++)
+    {
+        const S64* src = (const S64*)&s_stats[i].stats;
+        S64* dst = (S64*)&total;
+        for (int j = 0; j < (int)(sizeof(SchedulerStats) / sizeof(S64)); j++)
+            dst[j] += src[j];
+    }
+    return total;
+}
+
+//------------------------------------------------------------------------
+
+void MulticoreLauncher::resetSchedulerStats(void)
+{
+    for (int i = 0; i <= MaxWorkers; i++)
+        memset(&s_stats[i].stats, 0, sizeof(SchedulerStats));
+    FW_MEMORY_FENCE();
+}
+
+//------------------------------------------------------------------------
+
+void MulticoreLauncher::setThreadPinning(bool enable)
+{
+    s_lock.enter();
+
+    // Running workers keep the setting they started with, so restart them.
+
+    if (s_pinThreads != enable && s_numThreads != 0)
+    {
+        int numThreads = s_desiredThreads;
+        s_monitor->enter();
+        s_desiredThreads = 0;
+        applyNumThreads();
+        s_pinThreads = enable;
+        s_desiredThreads = numThreads;
+        applyNumThreads();
+        s_monitor->leave();
+    }
+    s_pinThreads = enable;
+
+    s_lock.leave();
+}
+
+//------------------------------------------------------------------------
+
+int MulticoreLauncher::getCurrentNode(void)
+{
+    int idx = s_workerIdx;
+    return (idx != -1) ? s_workerNodes[idx] : Topology::getCurrentNode();
+}
+
+//------------------------------------------------------------------------
+
 void MulticoreLauncher::applyNumThreads(void) // Must have the monitor.
 {
-    // Start new threads.
+    // Start new threads. Worker i always owns s_deques[i].
 
     while (s_numThreads < s_desiredThreads)
     {
-        (new Thread)->start(threadFunc, NULL);
+        int idx = s_numThreads;
+        if (!s_deques[idx])
+            s_deques[idx] = new WorkDeque;
+        Topology::getSlotCpu(idx, s_workerNodes[idx]);
+        FW_MEMORY_FENCE();
+        s_numDeques = max((int)s_numDeques, idx + 1);
+
+        (new Thread)->start(threadFunc, (void*)(SPTR)idx);
         s_numThreads++;
     }
 
-    // Kill excess threads.
+    // Kill excess threads. Jobs left in their deques get stolen.
 
     if (s_numThreads > s_desiredThreads)
     {
@@ -229,41 +510,238 @@ void MulticoreLauncher::applyNumThreads(void) // Must have the monitor.
 
 void MulticoreLauncher::threadFunc(void* param)
 {
-    FW_UNREF(param);
-    Thread::getCurrent()->setPriority(Thread::Priority_Min);
+    s_workerIdx = (S32)(SPTR)param;
+    Trace::setThreadName(sprintf("Worker %d", s_workerIdx));
+
+    int node;
+    int cpu = Topology::getSlotCpu(s_workerIdx, node);
+    if (!s_pinThreads || !Topology::pinCurrentThread(cpu))
+        Thread::getCurrent()->setPriority(Thread::Priority_Min);
+
+    while (s_workerIdx < *(volatile S32*)&s_desiredThreads)
+    {
+        Job* job = dequeue();
+        if (job)
+            runJob(job);
+        else
+            sleepUntilWork(NULL);
+    }
+
     s_monitor->enter();
+    s_numThreads--;
+    delete Thread::getCurrent();
+    s_monitor->notifyAll();
+    s_monitor->leave();
+}
+
+//------------------------------------------------------------------------
+
+void MulticoreLauncher::pushJob(TaskFunc func, RangeFunc rangeFunc, void* data, int start, int end, int grain)
+{
+    // Start the threads lazily.
+
+    if (s_numThreads != s_desiredThreads)
+    {
+        s_monitor->enter();
+        applyNumThreads();
+        s_monitor->leave();
+    }
+
+    FW_ATOMIC_ADD(&m_numTasks, (end - start + grain - 1) / grain);
+
+    Job* job        = new Job;
+    job->launcher   = this;
+    job->func       = func;
+    job->rangeFunc  = rangeFunc;
+    job->data       = data;
+    job->start      = start;
+    job->end        = end;
+    job->grain      = grain;
+    enqueue(job);
+}
+
+//------------------------------------------------------------------------
+
+void MulticoreLauncher::postFinished(const Task& task)
+{
+    while (FW_ATOMIC_CAS(&m_finishedLock, 0, 1) == false)
+    {
+        getLocalStats().numFinishedSpins++;
+        Thread::yield();
+    }
+    m_finished.addLast(task);
+    m_numFinished++;
+    FW_MEMORY_FENCE();
+
+    // Wake the popping thread if it sleeps, and nobody else. Still under the lock,
+    // since pop() may destroy the launcher as soon as it is released.
+
+    if (FW_ATOMIC_CAS(&m_waiting, 1, 0))
+        m_wakeup.release();
+    m_finishedLock = 0; // Last access to the launcher.
+}
+
+//------------------------------------------------------------------------
+
+void MulticoreLauncher::enqueue(Job* job)
+{
+    FW_ATOMIC_ADD(&s_numQueued, 1);
+
+    if (s_workerIdx != -1)
+        s_deques[s_workerIdx]->push(job);
+    else
+    {
+        s_injectedLock.enter();
+        s_injected.addLast(job);
+        s_numInjected++;
+        s_stats[MaxWorkers].stats.numInjected++;
+        s_injectedLock.leave();
+    }
+
+    wakeSleeper();
+}
 
-    while (s_numThreads <= s_desiredThreads)
+//------------------------------------------------------------------------
+
+MulticoreLauncher::Job* MulticoreLauncher::dequeue(void)
+{
+    // Own deque first, then jobs from non-worker threads.
+
+    int idx = s_workerIdx;
+    Job* job = (idx != -1) ? s_deques[idx]->pop() : NULL;
+
+    if (!job && s_numInjected)
     {
-        // No pending tasks => wait.
+        s_injectedLock.enter();
+        if (s_injected.getSize())
+        {
+            job = s_injected.removeFirst();
+            s_numInjected--;
+        }
+        s_injectedLock.leave();
+    }
+
+    // Steal from the other workers, starting from the next one. Workers
+    // on the same node first, since their jobs touch nearby memory.
 
-        if (!s_pending.getSize())
+    int numDeques = s_numDeques;
+    int node = (job) ? 0 : getCurrentNode();
+    for (int pass = 0; pass < 2 && !job; pass++)
+    for (int i = 1; i <= numDeques && !job; i++)
+    {
+        int victim = (idx + i) % numDeques;
+        if (victim != idx && victim >= 0 && (s_workerNodes[victim] == node) == (pass == 0))
         {
-            s_monitor->wait();
-            continue;
+            bool lost = false;
+            job = s_deques[victim]->steal(lost);
+            SchedulerStats& stats = getLocalStats();
+            stats.numFailedSteals += (lost) ? 1 : 0;
+            stats.numSteals += (job) ? 1 : 0;
+            stats.numRemoteSteals += (job && pass == 1) ? 1 : 0;
         }
+    }
+
+    if (job)
+        FW_ATOMIC_ADD(&s_numQueued, -1);
+    return job;
+}
 
-        // Pick a task.
+//------------------------------------------------------------------------
 
-        Task task = s_pending.removeFirst();
-        MulticoreLauncher* launcher = task.launcher;
+void MulticoreLauncher::runJob(Job* job)
+{
+    // Split off the second half for others to steal until one task remains.
 
-        // Execute.
+    while (job->end - job->start > job->grain)
+    {
+        int numChunks = (job->end - job->start + job->grain - 1) / job->grain;
+        int mid = job->start + (numChunks / 2) * job->grain;
 
-        s_monitor->leave();
-        task.func(task);
-        failIfError();
-        s_monitor->enter();
+        Job* other = new Job(*job);
+        other->start = mid;
+        job->end = mid;
+        enqueue(other);
+    }
 
-        // Mark as finished.
+    // Execute.
 
-        launcher->m_finished.addLast(task);
-        s_monitor->notifyAll();
+    getLocalStats().numJobs++;
+    Task task;
+    task.launcher   = job->launcher;
+    task.func       = job->func;
+    task.data       = job->data;
+    task.idx        = job->start;
+    task.result     = NULL;
+
+    if (job->func)
+        job->func(task);
+    else
+        job->rangeFunc(job->data, job->start, job->end);
+    failIfError();
+
+    delete job;
+    task.launcher->postFinished(task);
+}
+
+//------------------------------------------------------------------------
+
+void MulticoreLauncher::sleepUntilWork(MulticoreLauncher* waiter)
+{
+    // The thread in pop() sleeps on its launcher's semaphore, which only postFinished()
+    // releases. Jobs queued meanwhile are left to the workers; whoever queues a job
+    // dequeues again before it sleeps, so none are stranded.
+
+    if (waiter)
+    {
+        waiter->m_waiting = 1;
+        FW_MEMORY_FENCE();
+        bool idle = (s_numQueued <= 0 && !waiter->getNumFinished());
+        if (!idle && !FW_ATOMIC_CAS(&waiter->m_waiting, 1, 0))
+            idle = true;    // postFinished() cleared the flag first, and releases the semaphore.
+        if (idle)
+        {
+            getLocalStats().numSleeps++;
+            waiter->m_wakeup.acquire();
+        }
+        return;
     }
 
-    s_numThreads--;
-    delete Thread::getCurrent();
-    s_monitor->notifyAll();
+    // Wakers check s_numSleeping after publishing, so re-check under the monitor.
+
+    s_monitor->enter();
+    FW_ATOMIC_ADD(&s_numSleeping, 1);
+    FW_MEMORY_FENCE();
+
+    bool idle = (s_numQueued <= 0 && s_workerIdx < *(volatile S32*)&s_desiredThreads);
+
+    if (idle)
+    {
+        getLocalStats().numSleeps++;
+        s_monitor->wait();
+    }
+
+    FW_ATOMIC_ADD(&s_numSleeping, -1);
+    s_monitor->leave();
+}
+
+//------------------------------------------------------------------------
+
+MulticoreLauncher::SchedulerStats& MulticoreLauncher::getLocalStats(void)
+{
+    int idx = s_workerIdx;
+    return s_stats[(idx != -1) ? idx : MaxWorkers].stats;
+}
+
+//------------------------------------------------------------------------
+
+void MulticoreLauncher::wakeSleeper(void)
+{
+    FW_MEMORY_FENCE();
+    if (s_numSleeping <= 0)
+        return;
+
+    s_monitor->enter();
+    s_monitor->notify();
     s_monitor->leave();
 }
 
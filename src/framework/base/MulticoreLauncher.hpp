@@ -84,6 +84,26 @@ namespace FW
 //     }
 //     ...
 // }
+//
+// Parallel loop over [0, n[ in chunks of 64 indices:
+//
+// void myRangeFunc(void* data, int start, int end)
+// {
+//     for (int i = start; i < end; i++)
+//         ...
+// }
+//
+// MulticoreLauncher::parallelFor(myRangeFunc, &myData, 0, n, 64);
+//
+// Every worker thread has its own deque of jobs. A batch is pushed as a
+// single job, and whoever runs it splits it in halves, leaving the other
+// half for idle workers to steal. Threads waiting in pop() run jobs, too.
+// getSchedulerStats() counts the steals, lost races and sleeps (see
+// reconstruction_bench scaling).
+//
+// Workers are pinned to CPUs spread evenly across the NUMA nodes (see
+// Topology), and steal from their own node first. Data that a task
+// reads a lot can be placed with getCurrentNode().
 //------------------------------------------------------------------------
 
 class MulticoreLauncher
@@ -91,6 +111,7 @@ class MulticoreLauncher
 public:
     struct Task;
     typedef void (*TaskFunc)(Task& task);
+    typedef void (*RangeFunc)(void* data, int start, int end); // [start, end[
 
     struct Task
     {
@@ -101,12 +122,24 @@ public:
         void*               result; // Potentially written by TaskFunc.
     };
 
+    struct SchedulerStats           // Counted per thread without atomics; threads outside the pool share one slot and may lose counts.
+    {
+        S64                 numJobs;            // Jobs run, including the halves split off for stealing.
+        S64                 numSteals;          // Jobs taken from another worker's deque...
+        S64                 numRemoteSteals;    // ... of which from a worker on another NUMA node.
+        S64                 numFailedSteals;    // Steals that lost the race for the last job to the owner or another thief.
+        S64                 numInjected;        // Jobs pushed by threads outside the pool (through s_injectedLock).
+        S64                 numSleeps;          // Waits with nothing to run, on the monitor or a launcher's wakeup.
+        S64                 numFinishedSpins;   // Yields waiting for the finished list of a launcher.
+    };
+
 public:
                             MulticoreLauncher   (void);
                             ~MulticoreLauncher  (void);
 
     MulticoreLauncher&      push                (TaskFunc func, void* data, int firstIdx = 0, int numTasks = 1);
-    Task                    pop                 (void);         // Blocks until at least one task has finished.
+    MulticoreLauncher&      pushRange           (RangeFunc func, void* data, int start, int end, int grain); // One task per grain-sized chunk, Task::idx = start of chunk.
+    Task                    pop                 (void);         // Blocks until at least one task has finished. Runs pending tasks while waiting.
 
     int                     getNumTasks         (void) const;   // Tasks that have been pushed but not popped.
     int                     getNumFinished      (void) const;   // Tasks that can be popped without blocking.
@@ -114,13 +147,39 @@ public:
     void                    popAll              (void)          { while (getNumTasks()) pop(); }
     void                    popAll              (const String& progressMessage);
 
+    static void             parallelFor         (RangeFunc func, void* data, int start, int end, int grain = 1);
+
     static int              getNumCores         (void);
     static void             setNumThreads       (int numThreads);
+    static void             setThreadPinning    (bool enable);  // Restarts the running workers if changed; call with no tasks in flight. Unpinned threads run at Priority_Min.
+    static int              getCurrentNode      (void);         // NUMA node of the calling thread.
+
+    static SchedulerStats   getSchedulerStats   (void);         // Totals since resetSchedulerStats(). Call with no tasks in flight.
+    static void             resetSchedulerStats (void);
 
 private:
+    struct Job;
+    class WorkDeque;
+    struct StatsSlot;
+
+    enum
+    {
+        MaxWorkers = 256,
+    };
+
     static void             applyNumThreads     (void);
     static void             threadFunc          (void* param);
 
+    void                    pushJob             (TaskFunc func, RangeFunc rangeFunc, void* data, int start, int end, int grain);
+    void                    postFinished        (const Task& task);
+
+    static void             enqueue             (Job* job);
+    static Job*             dequeue             (void);
+    static void             runJob              (Job* job);
+    static void             sleepUntilWork      (MulticoreLauncher* waiter);
+    static SchedulerStats&  getLocalStats       (void);
+    static void             wakeSleeper         (void);         // One worker sleeping on the monitor, for a queued job.
+
 private:
                             MulticoreLauncher   (const MulticoreLauncher&); // forbidden
     MulticoreLauncher&      operator=           (const MulticoreLauncher&); // forbidden
@@ -130,12 +189,25 @@ private:
     static S32              s_numInstances;
     static S32              s_desiredThreads;
 
-    static Monitor*         s_monitor;
-    static Deque<Task>      s_pending;
+    static Monitor*         s_monitor;          // Sleeping and changing the number of threads.
     static S32              s_numThreads;
+    static volatile S32     s_numSleeping;
+    static volatile S32     s_numQueued;        // Jobs in all deques + s_injected.
+
+    static WorkDeque*       s_deques[MaxWorkers];
+    static S32              s_workerNodes[MaxWorkers];
+    static bool             s_pinThreads;
+    static Spinlock         s_injectedLock;
+    static Deque<Job*>      s_injected;         // Pushed by non-worker threads.
+    static volatile S32     s_numInjected;
+    static StatsSlot        s_stats[MaxWorkers + 1];    // Per worker, then all other threads.
 
-    S32                     m_numTasks;
+    volatile S32            m_numTasks;
+    volatile S32            m_finishedLock;
+    volatile S32            m_numFinished;
     Deque<Task>             m_finished;
+    volatile S32            m_waiting;          // The thread in pop() sleeps on m_wakeup; cleared by whoever wakes it.
+    Semaphore               m_wakeup;
 };
 
 //------------------------------------------------------------------------
@@ -0,0 +1,389 @@
+/*
+ *  Copyright (c) 2009-2011, NVIDIA Corporation
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *      * Redistributions of source code must retain the above copyright
+ *        notice, this list of conditions and the following disclaimer.
+ *      * Redistributions in binary form must reproduce the above copyright
+ *        notice, this list of conditions and the following disclaimer in the
+ *        documentation and/or other materials provided with the distribution.
+ *      * Neither the name of NVIDIA Corporation nor the
+ *        names of its contributors may be used to endorse or promote products
+ *        derived from this software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ *  ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ *  WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ *  DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+ *  DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ *  (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ *  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ *  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ *  (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ *  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "base/PerfCounters.hpp"
+#include "base/Thread.hpp"
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+
+#if defined(__linux__)
+#   include <unistd.h>
+#   include <sys/ioctl.h>
+#   include <sys/syscall.h>
+#   include <linux/perf_event.h>
+#endif
+
+using namespace FW;
+
+//------------------------------------------------------------------------
+
+namespace
+{
+
+struct ThreadCounters
+{
+    S32                 leader;                 // Group fd, -1 if nothing could be opened.
+    S32                 fds[PerfCounters::Event_Max];
+    S32                 slots[PerfCounters::Event_Max]; // Position in the group read, -1 if not counted.
+    S32                 numOpen;
+};
+
+struct PhaseTotals
+{
+    const char*         name;
+    U64                 values[PerfCounters::Event_Max];
+    U32                 eventMask;              // Events counted by at least one scope.
+    S64                 numScopes;
+};
+
+}
+
+//------------------------------------------------------------------------
+
+static Spinlock             s_lock;
+static volatile bool        s_active    = false;
+static String               s_reason;           // Why the first failed thread could not count.
+static Array<PhaseTotals>   s_phases;           // In order of first appearance.
+
+static const char* const    c_eventNames[PerfCounters::Event_Max] =
+{
+    "cycles",
+    "instructions",
+    "LLC misses",
+    "branch misses",
+};
+
+//------------------------------------------------------------------------
+
+static void deinitThreadCounters(void* data)
+{
+    ThreadCounters* tc = (ThreadCounters*)data;
+#if defined(__linux__)
+    for (int i = 0; i < PerfCounters::Event_Max; i++)
+        if (tc->fds[i] != -1)
+            close(tc->fds[i]);
+#endif
+    delete tc;
+}
+
+//------------------------------------------------------------------------
+
+#if defined(__linux__)
+
+static void setReason(const String& reason)
+{
+    s_lock.enter();
+    if (!s_reason.getLength())
+        s_reason = reason;
+    s_lock.leave();
+}
+
+//------------------------------------------------------------------------
+
+static String describeOpenError(int err)
+{
+    String reason = FW::sprintf("perf_event_open() failed: %s", strerror(err));
+    if (err == EACCES || err == EPERM)
+    {
+        int paranoid = 0;
+        FILE* f = fopen("/proc/sys/kernel/perf_event_paranoid", "rt");
+        if (f && fscanf(f, "%d", &paranoid) == 1)
+            reason += FW::sprintf(" (kernel.perf_event_paranoid = %d, user-mode counting needs <= 2)", paranoid);
+        if (f)
+            fclose(f);
+    }
+    else if (err == ENOENT || err == EOPNOTSUPP)
+        reason += " (no hardware PMU, e.g. a virtual machine)";
+    else if (err == ENOSYS)
+        reason += " (not supported by the kernel or blocked by seccomp)";
+    return reason;
+}
+
+//------------------------------------------------------------------------
+
+static void openThreadCounters(ThreadCounters& tc)
+{
+    // LLC misses use the generic cache-miss event, which the kernel maps
+    // to last-level misses on x86.
+
+    static const U64 configs[PerfCounters::Event_Max] =
+    {
+        PERF_COUNT_HW_CPU_CYCLES,
+        PERF_COUNT_HW_INSTRUCTIONS,
+        PERF_COUNT_HW_CACHE_MISSES,
+        PERF_COUNT_HW_BRANCH_MISSES,
+    };
+
+    int firstError = 0;
+    for (int i = 0; i < PerfCounters::Event_Max; i++)
+    {
+        perf_event_attr attr;
+        memset(&attr, 0, sizeof(attr));
+        attr.size           = sizeof(attr);
+        attr.type           = PERF_TYPE_HARDWARE;
+        attr.config         = configs[i];
+        attr.read_format    = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv     = 1;
+
+        int fd = (int)syscall(__NR_perf_event_open, &attr, 0, -1, tc.leader, 0);   // This thread, any CPU.
+        if (fd == -1)
+        {
+            if (!firstError)
+                firstError = errno;
+            continue;
+        }
+
+        if (tc.leader == -1)
+            tc.leader = fd;
+        tc.fds[i] = fd;
+        tc.slots[i] = tc.numOpen++;
+    }
+
+    if (tc.leader == -1)
+        setReason(describeOpenError(firstError));
+}
+
+#endif
+
+//------------------------------------------------------------------------
+
+static ThreadCounters* getThreadCounters(void)
+{
+    Thread* thread = Thread::getCurrent();
+    ThreadCounters* tc = (ThreadCounters*)thread->getUserData("perfcounters");
+    if (tc)
+        return tc;
+
+    tc = new ThreadCounters;
+    tc->leader = -1;
+    tc->numOpen = 0;
+    for (int i = 0; i < PerfCounters::Event_Max; i++)
+    {
+        tc->fds[i] = -1;
+        tc->slots[i] = -1;
+    }
+
+#if defined(__linux__)
+    openThreadCounters(*tc);
+#else
+    setReason("hardware counters are only supported on Linux");
+#endif
+
+    thread->setUserData("perfcounters", tc, deinitThreadCounters);
+    return tc;
+}
+
+//------------------------------------------------------------------------
+
+static bool readThreadCounters(const ThreadCounters& tc, U64* values)
+{
+#if defined(__linux__)
+    U64 buf[3 + PerfCounters::Event_Max];   // nr, time enabled, time running, values in group order.
+    ssize_t size = (ssize_t)((3 + tc.numOpen) * sizeof(U64));
+    if (tc.leader == -1 || read(tc.leader, buf, size) != size)
+        return false;
+
+    for (int i = 0; i < PerfCounters::Event_Max; i++)
+        values[i] = (tc.slots[i] != -1) ? buf[3 + tc.slots[i]] : 0;
+    values[PerfCounters::Event_Max + 0] = buf[1];
+    values[PerfCounters::Event_Max + 1] = buf[2];
+    return true;
+#else
+    FW_UNREF(tc);
+    FW_UNREF(values);
+    return false;
+#endif
+}
+
+//------------------------------------------------------------------------
+
+void PerfCounters::start(void)
+{
+    s_lock.enter();
+    s_phases.reset();
+    s_active = true;
+    s_lock.leave();
+}
+
+//------------------------------------------------------------------------
+
+void PerfCounters::stop(void)
+{
+    s_active = false;
+}
+
+//------------------------------------------------------------------------
+
+bool PerfCounters::isActive(void)
+{
+    return s_active;
+}
+
+//------------------------------------------------------------------------
+
+bool PerfCounters::isAvailable(void)
+{
+    return (getThreadCounters()->leader != -1);
+}
+
+//------------------------------------------------------------------------
+
+String PerfCounters::getUnavailableReason(void)
+{
+    s_lock.enter();
+    String reason = s_reason;
+    s_lock.leave();
+    return reason;
+}
+
+//------------------------------------------------------------------------
+
+bool PerfCounters::begin(U64* values)
+{
+    if (!s_active)
+        return false;
+    return readThreadCounters(*getThreadCounters(), values);
+}
+
+//------------------------------------------------------------------------
+
+void PerfCounters::end(const char* name, const U64* values)
+{
+    const ThreadCounters& tc = *getThreadCounters();
+    U64 now[NumValues];
+    if (!s_active || !readThreadCounters(tc, now))
+        return;
+
+    // The group was not on the PMU at all => nothing to add. Partially
+    // scheduled (multiplexed with other users) => extrapolate.
+
+    U64 enabled = now[Event_Max + 0] - values[Event_Max + 0];
+    U64 running = now[Event_Max + 1] - values[Event_Max + 1];
+    if (!running)
+        return;
+    F64 scale = (running < enabled) ? (F64)enabled / (F64)running : 1.0;
+
+    s_lock.enter();
+
+    PhaseTotals* phase = NULL;
+    for (int i = 0; i < s_phases.getSize() && !phase; i++)
+        if (s_phases[i].name == name || strcmp(s_phases[i].name, name) == 0)
+            phase = &s_phases[i];
+
+    if (!phase)
+    {
+        phase = &s_phases.add();
+        memset(phase, 0, sizeof(PhaseTotals));
+        phase->name = name;
+    }
+
+    for (int i = 0; i < Event_Max; i++)
+    {
+        if (tc.slots[i] == -1)
+            continue;
+        phase->values[i] += (U64)((F64)(now[i] - values[i]) * scale + 0.5);
+        phase->eventMask |= 1u << i;
+    }
+    phase->numScopes++;
+
+    s_lock.leave();
+}
+
+//------------------------------------------------------------------------
+
+bool PerfCounters::getTotal(const char* name, Event event, U64& value)
+{
+    FW_ASSERT(event >= 0 && event < Event_Max);
+    bool found = false;
+    s_lock.enter();
+    for (int i = 0; i < s_phases.getSize() && !found; i++)
+    {
+        const PhaseTotals& phase = s_phases[i];
+        if (strcmp(phase.name, name) == 0 && (phase.eventMask & (1u << event)) != 0)
+        {
+            value = phase.values[event];
+            found = true;
+        }
+    }
+    s_lock.leave();
+    return found;
+}
+
+//------------------------------------------------------------------------
+
+void PerfCounters::printSummary(void)
+{
+    s_lock.enter();
+    Array<PhaseTotals> phases = s_phases;
+    String reason = s_reason;
+    s_lock.leave();
+
+    if (!phases.getSize())
+    {
+        if (reason.getLength())
+            printf("Hardware counters unavailable: %s\n", reason.getPtr());
+        return;
+    }
+
+    printf("Hardware counters (user mode, summed over threads):\n");
+    printf("  %-24s %10s %10s %6s %9s %9s\n", "", "Mcycles", "Minstr", "IPC", "LLC MPKI", "br MPKI");
+    for (int i = 0; i < phases.getSize(); i++)
+    {
+        const PhaseTotals& p = phases[i];
+        String line = FW::sprintf("  %-24s", p.name);
+        bool haveInstr = ((p.eventMask & (1u << Event_Instructions)) != 0 && p.values[Event_Instructions] != 0);
+        F64 kinstr = (F64)p.values[Event_Instructions] * 1.0e-3;
+
+        for (int j = 0; j < Event_Max; j++)
+        {
+            bool have = ((p.eventMask & (1u << j)) != 0);
+            if (j == Event_Cycles || j == Event_Instructions)
+                line += (have) ? FW::sprintf(" %10.1f", (F64)p.values[j] * 1.0e-6) : FW::sprintf(" %10s", "n/a");
+            if (j == Event_Instructions)
+            {
+                bool haveIPC = (haveInstr && (p.eventMask & (1u << Event_Cycles)) != 0 && p.values[Event_Cycles] != 0);
+                line += (haveIPC) ? FW::sprintf(" %6.2f", (F64)p.values[Event_Instructions] / (F64)p.values[Event_Cycles]) : FW::sprintf(" %6s", "n/a");
+            }
+            if (j == Event_LLCMisses || j == Event_BranchMisses)
+                line += (have && haveInstr) ? FW::sprintf(" %9.2f", (F64)p.values[j] / kinstr) : FW::sprintf(" %9s", "n/a");
+        }
+        printf("%s\n", line.getPtr());
+    }
+
+    U32 missing = 0;
+    for (int i = 0; i < phases.getSize(); i++)
+        missing |= phases[i].eventMask;
+    missing = ~missing & ((1u << Event_Max) - 1);
+    for (int i = 0; i < Event_Max; i++)
+        if (missing & (1u << i))
+            printf("  (%s not supported by this CPU)\n", c_eventNames[i]);
+}
+
+//------------------------------------------------------------------------
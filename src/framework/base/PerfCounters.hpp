@@ -0,0 +1,109 @@
+/*
+ *  Copyright (c) 2009-2011, NVIDIA Corporation
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *      * Redistributions of source code must retain the above copyright
+ *        notice, this list of conditions and the following disclaimer.
+ *      * Redistributions in binary form must reproduce the above copyright
+ *        notice, this list of conditions and the following disclaimer in the
+ *        documentation and/or other materials provided with the distribution.
+ *      * Neither the name of NVIDIA Corporation nor the
+ *        names of its contributors may be used to endorse or promote products
+ *        derived from this software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ *  ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ *  WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ *  DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+ *  DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ *  (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ *  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ *  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ *  (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ *  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#pragma once
+#include "base/String.hpp"
+
+#define FW_PERF_CONCAT2(A, B)   A##B
+#define FW_PERF_CONCAT(A, B)    FW_PERF_CONCAT2(A, B)
+#define FW_PERF_SCOPE(NAME)     FW::PerfScope FW_PERF_CONCAT(perfScope, __LINE__)(NAME)
+
+namespace FW
+{
+//------------------------------------------------------------------------
+// Hardware event counts per named phase, summed over all threads.
+//
+// PerfCounters::start();
+// ...
+// {
+//     FW_PERF_SCOPE("Filtering");     // in any thread
+//     ...
+// }
+// ...
+// PerfCounters::printSummary();
+// PerfCounters::stop();
+//
+// Each thread opens its own group of counters with perf_event_open()
+// the first time it enters a scope, counting user-mode events of that
+// thread only. Scopes read the group on entry and exit and add the
+// difference to the phase; nested scopes are counted in both. When the
+// counters cannot be opened (non-Linux, perf_event_paranoid, seccomp in
+// containers, virtual machines without a PMU), the scopes do nothing and
+// printSummary() says why. Events the CPU lacks are left out and shown
+// as n/a. Names must be string literals.
+//------------------------------------------------------------------------
+
+class PerfCounters
+{
+public:
+    enum Event
+    {
+        Event_Cycles = 0,
+        Event_Instructions,
+        Event_LLCMisses,
+        Event_BranchMisses,
+
+        Event_Max,
+        NumValues = Event_Max + 2   // Events, time enabled, time running.
+    };
+
+public:
+    static void         start               (void);             // Clears the totals.
+    static void         stop                (void);
+    static bool         isActive            (void);
+    static bool         isAvailable         (void);             // Opens the counters of the calling thread.
+    static String       getUnavailableReason(void);
+
+    static bool         begin               (U64* values);      // values[NumValues], false if not counting.
+    static void         end                 (const char* name, const U64* values);
+
+    static bool         getTotal            (const char* name, Event event, U64& value);
+    static void         printSummary        (void);
+
+private:
+                        PerfCounters        (void); // forbidden
+};
+
+//------------------------------------------------------------------------
+
+class PerfScope
+{
+public:
+    explicit            PerfScope           (const char* name)  : m_name(name) { m_active = (PerfCounters::isActive() && PerfCounters::begin(m_values)); }
+                        ~PerfScope          (void)              { if (m_active) PerfCounters::end(m_name, m_values); }
+
+private:
+                        PerfScope           (const PerfScope&); // forbidden
+    PerfScope&          operator=           (const PerfScope&); // forbidden
+
+    const char*         m_name;
+    bool                m_active;
+    U64                 m_values[PerfCounters::NumValues];
+};
+
+//------------------------------------------------------------------------
+}
@@ -0,0 +1,216 @@
+/*
+ *  Copyright (c) 2009-2011, NVIDIA Corporation
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *      * Redistributions of source code must retain the above copyright
+ *        notice, this list of conditions and the following disclaimer.
+ *      * Redistributions in binary form must reproduce the above copyright
+ *        notice, this list of conditions and the following disclaimer in the
+ *        documentation and/or other materials provided with the distribution.
+ *      * Neither the name of NVIDIA Corporation nor the
+ *        names of its contributors may be used to endorse or promote products
+ *        derived from this software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ *  ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ *  WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ *  DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+ *  DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ *  (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ *  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ *  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ *  (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ *  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "base/Pipeline.hpp"
+#include "base/Timer.hpp"
+
+using namespace FW;
+
+//------------------------------------------------------------------------
+
+Pipeline::Pipeline(void)
+:   m_numItems  (0),
+    m_numDone   (0),
+    m_totalTime (0.0f)
+{
+}
+
+//------------------------------------------------------------------------
+
+Pipeline::~Pipeline(void)
+{
+}
+
+//------------------------------------------------------------------------
+
+int Pipeline::addStage(const String& name, StageFunc func, void* data, U32 flags)
+{
+    FW_ASSERT(func);
+    if (flags & Stage_MainThread)
+        flags |= Stage_Serial;
+    FW_ASSERT((flags & (Stage_Serial | Stage_Parallel)) != (Stage_Serial | Stage_Parallel));
+
+    Stage& s    = m_stages.add();
+    s.name      = name;
+    s.func      = func;
+    s.data      = data;
+    s.flags     = flags;
+    s.numStarted = 0;
+    s.numRunning = 0;
+    s.busyTime  = 0.0f;
+    return m_stages.getSize() - 1;
+}
+
+//------------------------------------------------------------------------
+
+void Pipeline::addEdge(int producer, int consumer, int queueSize)
+{
+    FW_ASSERT(producer >= 0 && producer < consumer && consumer < m_stages.getSize());
+    FW_ASSERT(queueSize >= 1);
+
+    Edge& e     = m_edges.add();
+    e.producer  = producer;
+    e.consumer  = consumer;
+    e.queueSize = queueSize;
+    m_stages[producer].outputs.add(m_edges.getSize() - 1);
+    m_stages[consumer].inputs.add(m_edges.getSize() - 1);
+}
+
+//------------------------------------------------------------------------
+
+void Pipeline::run(int numItems)
+{
+    FW_ASSERT(numItems >= 0);
+    Timer timer(true);
+
+    int numStages = m_stages.getSize();
+    m_numItems = numItems;
+    m_done.reset(numStages * numItems);
+    m_itemTime.reset(numStages * numItems);
+    memset(m_done.getPtr(), 0, m_done.getNumBytes());
+    m_numDone = 0;
+    for (int i = 0; i < numStages; i++)
+    {
+        m_stages[i].numStarted = 0;
+        m_stages[i].numRunning = 0;
+        m_stages[i].busyTime = 0.0f;
+    }
+
+    MulticoreLauncher launcher;
+    while (m_numDone < numStages * numItems)
+    {
+        // Start everything that the queues permit. Main-thread stages are
+        // run one item at a time, so that their consumers can start in
+        // between.
+
+        bool ranLocal = false;
+        for (int i = 0; i < numStages; i++)
+        {
+            while (canStart(i))
+            {
+                Stage& s = m_stages[i];
+                int item = s.numStarted++;
+
+                if (s.flags & Stage_MainThread)
+                {
+                    Timer itemTimer(true);
+                    s.func(s.data, item);
+                    m_itemTime[i * numItems + item] = itemTimer.getElapsed();
+                    finish(i, item);
+                    ranLocal = true;
+                    break;
+                }
+
+                s.numRunning++;
+                launcher.push(taskFunc, this, i * numItems + item);
+            }
+        }
+
+        // Nothing to do here => wait for a worker, helping it meanwhile.
+
+        if (!ranLocal && !launcher.getNumFinished())
+        {
+            FW_ASSERT(launcher.getNumTasks()); // Otherwise the graph is stuck.
+            MulticoreLauncher::Task task = launcher.pop();
+            finish(task.idx / numItems, task.idx % numItems);
+        }
+
+        while (launcher.getNumFinished())
+        {
+            MulticoreLauncher::Task task = launcher.pop();
+            finish(task.idx / numItems, task.idx % numItems);
+        }
+    }
+
+    m_totalTime = timer.getElapsed();
+}
+
+//------------------------------------------------------------------------
+
+void Pipeline::printStats(void) const
+{
+    printf("Pipeline: %d items in %.2f s\n", m_numItems, m_totalTime);
+    for (int i = 0; i < m_stages.getSize(); i++)
+    {
+        const Stage& s = m_stages[i];
+        printf("  %-16s %-8.2f s busy, %-8.1f ms/item\n", s.name.getPtr(), s.busyTime, s.busyTime * 1000.0f / (F32)max(m_numItems, 1));
+    }
+}
+
+//------------------------------------------------------------------------
+
+bool Pipeline::canStart(int stage) const
+{
+    const Stage& s = m_stages[stage];
+    int item = s.numStarted;
+    if (item >= m_numItems)
+        return false;
+    if ((s.flags & Stage_Serial) && s.numRunning)
+        return false;
+
+    // Producers must have finished the item.
+
+    for (int i = 0; i < s.inputs.getSize(); i++)
+        if (!m_done[m_edges[s.inputs[i]].producer * m_numItems + item])
+            return false;
+
+    // Back-pressure: every output queue must have room.
+
+    for (int i = 0; i < s.outputs.getSize(); i++)
+    {
+        const Edge& e = m_edges[s.outputs[i]];
+        if (item >= m_stages[e.consumer].numStarted + e.queueSize)
+            return false;
+    }
+    return true;
+}
+
+//------------------------------------------------------------------------
+
+void Pipeline::finish(int stage, int item)
+{
+    Stage& s = m_stages[stage];
+    m_done[stage * m_numItems + item] = 1;
+    s.busyTime += m_itemTime[stage * m_numItems + item];
+    if (!(s.flags & Stage_MainThread))
+        s.numRunning--;
+    m_numDone++;
+}
+
+//------------------------------------------------------------------------
+
+void Pipeline::taskFunc(MulticoreLauncher::Task& task)
+{
+    Pipeline* pipe = (Pipeline*)task.data;
+    const Stage& s = pipe->m_stages[task.idx / pipe->m_numItems];
+
+    Timer timer(true);
+    s.func(s.data, task.idx % pipe->m_numItems);
+    pipe->m_itemTime[task.idx] = timer.getElapsed();
+}
+
+//------------------------------------------------------------------------
@@ -0,0 +1,126 @@
+/*
+ *  Copyright (c) 2009-2011, NVIDIA Corporation
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *      * Redistributions of source code must retain the above copyright
+ *        notice, this list of conditions and the following disclaimer.
+ *      * Redistributions in binary form must reproduce the above copyright
+ *        notice, this list of conditions and the following disclaimer in the
+ *        documentation and/or other materials provided with the distribution.
+ *      * Neither the name of NVIDIA Corporation nor the
+ *        names of its contributors may be used to endorse or promote products
+ *        derived from this software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ *  ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ *  WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ *  DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+ *  DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ *  (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ *  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ *  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ *  (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ *  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#pragma once
+#include "base/MulticoreLauncher.hpp"
+
+namespace FW
+{
+//------------------------------------------------------------------------
+// Stream a sequence of items through a graph of stages on the thread pool.
+//
+// Every item visits every stage, in increasing item order per stage. An
+// edge between two stages means that the consumer can only process item
+// i after the producer has finished it, and that at most queueSize items
+// can be started by the producer but not yet taken by the consumer. A
+// full queue stalls the producer, which bounds the number of items in
+// flight and thereby their memory.
+//
+// Overlap loading, filtering and exporting of frames:
+//
+// Pipeline pipe;
+// int build  = pipe.addStage("Build",  buildFunc,  &frames);
+// int filter = pipe.addStage("Filter", filterFunc, &frames);
+// int save   = pipe.addStage("Export", exportFunc, &frames, Pipeline::Stage_MainThread);
+// pipe.addEdge(build, filter);
+// pipe.addEdge(filter, save);
+// pipe.run(numFrames);
+//
+// Stages run on worker threads unless Stage_MainThread is given, in which
+// case they run in the thread calling run(); use that for anything that
+// touches GL or the profiler. Serial stages process one item at a time.
+//------------------------------------------------------------------------
+
+class Pipeline
+{
+public:
+    typedef void (*StageFunc)(void* data, int item);
+
+    enum StageFlags
+    {
+        Stage_Serial        = 1 << 0,   // One item at a time.
+        Stage_Parallel      = 1 << 1,   // Items overlap, as far as the queues permit.
+        Stage_MainThread    = 1 << 2,   // Runs in the thread calling run(). Implies serial.
+    };
+
+public:
+                        Pipeline        (void);
+                        ~Pipeline       (void);
+
+    int                 addStage        (const String& name, StageFunc func, void* data, U32 flags = Stage_Serial);
+    void                addEdge         (int producer, int consumer, int queueSize = 1); // Stages must be connected in the order they were added.
+
+    void                run             (int numItems);
+
+    int                 getNumStages    (void) const    { return m_stages.getSize(); }
+    F32                 getStageTime    (int stage) const { return m_stages[stage].busyTime; } // Summed over items in the last run().
+    F32                 getTotalTime    (void) const    { return m_totalTime; }
+    void                printStats      (void) const;
+
+private:
+    struct Stage
+    {
+        String          name;
+        StageFunc       func;
+        void*           data;
+        U32             flags;
+        Array<S32>      inputs;         // Edge indices.
+        Array<S32>      outputs;
+
+        S32             numStarted;
+        S32             numRunning;
+        F32             busyTime;
+    };
+
+    struct Edge
+    {
+        S32             producer;
+        S32             consumer;
+        S32             queueSize;
+    };
+
+    bool                canStart        (int stage) const;
+    void                finish          (int stage, int item);
+    static void         taskFunc        (MulticoreLauncher::Task& task);
+
+private:
+                        Pipeline        (const Pipeline&); // forbidden
+    Pipeline&           operator=       (const Pipeline&); // forbidden
+
+private:
+    Array<Stage>        m_stages;
+    Array<Edge>         m_edges;
+
+    S32                 m_numItems;
+    Array<U8>           m_done;         // [stage * m_numItems + item]
+    Array<F32>          m_itemTime;     // Written by the task, read after pop().
+    S32                 m_numDone;
+    F32                 m_totalTime;
+};
+
+//------------------------------------------------------------------------
+}
@@ -90,8 +90,11 @@ Thread*             Thread::s_mainThread    = NULL;
 #ifdef FW_QT
 
 //------------------------------------------------------------------------
+// Recursive, like a critical section. FW::malloc() takes s_lock again
+// when FW_MEM_DEBUG is enabled and the caller already holds it.
 
 Spinlock::Spinlock(void)
+:   m_mutex(QMutex::Recursive)
 {
 }
 
@@ -0,0 +1,308 @@
+/*
+ *  Copyright (c) 2009-2011, NVIDIA Corporation
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *      * Redistributions of source code must retain the above copyright
+ *        notice, this list of conditions and the following disclaimer.
+ *      * Redistributions in binary form must reproduce the above copyright
+ *        notice, this list of conditions and the following disclaimer in the
+ *        documentation and/or other materials provided with the distribution.
+ *      * Neither the name of NVIDIA Corporation nor the
+ *        names of its contributors may be used to endorse or promote products
+ *        derived from this software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ *  ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ *  WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ *  DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+ *  DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ *  (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ *  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ *  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ *  (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ *  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "base/Topology.hpp"
+#include "base/Thread.hpp"
+#include "base/String.hpp"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#if defined(__linux__)
+#   include <sched.h>
+#   include <unistd.h>
+#   include <sys/syscall.h>
+#elif !defined(_MSC_VER)
+#   include <unistd.h>
+#endif
+
+using namespace FW;
+
+//------------------------------------------------------------------------
+
+#ifdef _MSC_VER
+#   define FW_MEMORY_FENCE()    MemoryBarrier()
+#else
+#   define FW_MEMORY_FENCE()    __sync_synchronize()
+#endif
+
+//------------------------------------------------------------------------
+
+static Spinlock             s_lock;
+static volatile bool        s_detected      = false;
+static S32                  s_fakeNodes     = -1;   // -1 = from the environment.
+static volatile bool        s_interleave    = true; // setInterleave()
+static Array<S32>           s_cpus;                 // Usable OS CPU indices.
+static Array<Array<S32> >   s_nodeCpus;             // Per node.
+static Array<S32>           s_cpuNodes;             // OS CPU index => node, -1 if not usable.
+static Array<S32>           s_osNodes;              // Node => OS node index, empty if fake.
+
+//------------------------------------------------------------------------
+
+#if defined(__linux__)
+static void readCpuList(const String& path, Array<S32>& list) // "0-3,8,10-11"
+{
+    list.clear();
+    FILE* f = fopen(path.getPtr(), "rt");
+    if (!f)
+        return;
+
+    char buf[4096];
+    if (fgets(buf, sizeof(buf), f))
+    {
+        const char* p = buf;
+        while (*p >= '0' && *p <= '9')
+        {
+            char* end;
+            int lo = (int)strtol(p, &end, 10);
+            int hi = lo;
+            if (*end == '-')
+                hi = (int)strtol(end + 1, &end, 10);
+            for (int i = lo; i <= hi; i++)
+                list.add(i);
+            p = (*end == ',') ? end + 1 : end;
+        }
+    }
+    fclose(f);
+}
+#endif
+
+//------------------------------------------------------------------------
+
+int Topology::getNumNodes(void)
+{
+    detect();
+    return s_nodeCpus.getSize();
+}
+
+//------------------------------------------------------------------------
+
+int Topology::getNumCpus(void)
+{
+    detect();
+    return s_cpus.getSize();
+}
+
+//------------------------------------------------------------------------
+
+bool Topology::isFake(void)
+{
+    detect();
+    return (s_fakeNodes > 0);
+}
+
+//------------------------------------------------------------------------
+
+int Topology::getSlotCpu(int slot, int& node)
+{
+    FW_ASSERT(slot >= 0);
+    detect();
+
+    // Fake nodes may have no CPUs of their own on small machines.
+
+    node = slot % s_nodeCpus.getSize();
+    const Array<S32>& cpus = s_nodeCpus[node];
+    if (cpus.getSize())
+        return cpus[(slot / s_nodeCpus.getSize()) % cpus.getSize()];
+    return s_cpus[slot % s_cpus.getSize()];
+}
+
+//------------------------------------------------------------------------
+
+int Topology::getCurrentNode(void)
+{
+    detect();
+#if defined(__linux__)
+    int cpu = sched_getcpu();
+    if (cpu >= 0 && cpu < s_cpuNodes.getSize() && s_cpuNodes[cpu] != -1)
+        return s_cpuNodes[cpu];
+#endif
+    return 0;
+}
+
+//------------------------------------------------------------------------
+
+bool Topology::pinCurrentThread(int cpu)
+{
+    FW_ASSERT(cpu >= 0);
+#if defined(__linux__)
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    return (sched_setaffinity(0, sizeof(set), &set) == 0);
+#elif defined(_MSC_VER)
+    if (cpu >= (int)sizeof(DWORD_PTR) * 8)
+        return false;
+    return (SetThreadAffinityMask(GetCurrentThread(), (DWORD_PTR)1 << cpu) != 0);
+#else
+    return false;
+#endif
+}
+
+//------------------------------------------------------------------------
+
+bool Topology::interleave(void* ptr, size_t bytes)
+{
+    detect();
+#if defined(__linux__)
+    if (s_osNodes.getSize() < 2 || !s_interleave)
+        return false;
+
+    // Whole pages only; the partial ones at the ends stay where they are.
+
+    UPTR pageSize = (UPTR)sysconf(_SC_PAGESIZE);
+    UPTR start = ((UPTR)ptr + pageSize - 1) & ~(pageSize - 1);
+    UPTR end = ((UPTR)ptr + bytes) & ~(pageSize - 1);
+    if (end <= start)
+        return false;
+
+    const int maskBits = 1024;
+    unsigned long mask[maskBits / (8 * sizeof(unsigned long))] = { 0 };
+    for (int i = 0; i < s_osNodes.getSize(); i++)
+        if (s_osNodes[i] < maskBits)
+            mask[s_osNodes[i] / (8 * sizeof(unsigned long))] |= 1ul << (s_osNodes[i] % (8 * sizeof(unsigned long)));
+
+    const int mpolInterleave = 3;   // MPOL_INTERLEAVE
+    const int mpolMoveOwned = 1 << 1; // MPOL_MF_MOVE
+    return (syscall(SYS_mbind, (void*)start, (unsigned long)(end - start), mpolInterleave, mask, (unsigned long)maskBits + 1, mpolMoveOwned) == 0);
+#else
+    FW_UNREF(ptr);
+    FW_UNREF(bytes);
+    return false;
+#endif
+}
+
+//------------------------------------------------------------------------
+
+void Topology::setInterleave(bool enable)
+{
+    s_interleave = enable;
+}
+
+//------------------------------------------------------------------------
+
+void Topology::setFakeNumNodes(int numNodes)
+{
+    FW_ASSERT(numNodes >= 0);
+    s_lock.enter();
+    s_fakeNodes = numNodes;
+    s_detected = false;
+    s_lock.leave();
+}
+
+//------------------------------------------------------------------------
+
+void Topology::detect(void)
+{
+    if (s_detected)
+        return;
+
+    s_lock.enter();
+    if (s_detected)
+    {
+        s_lock.leave();
+        return;
+    }
+
+    if (s_fakeNodes == -1)
+    {
+        const char* env = getenv("FW_NUMA_NODES");
+        s_fakeNodes = (env) ? max(atoi(env), 0) : 0;
+    }
+
+    // Usable CPUs and their OS nodes.
+
+    s_cpus.clear();
+    Array<S32> cpuOsNodes;
+#if defined(__linux__)
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    if (sched_getaffinity(0, sizeof(set), &set) == 0)
+        for (int i = 0; i < CPU_SETSIZE; i++)
+            if (CPU_ISSET(i, &set))
+                s_cpus.add(i);
+
+    Array<S32> osNodes, cpus;
+    readCpuList("/sys/devices/system/node/online", osNodes);
+    for (int i = 0; i < osNodes.getSize(); i++)
+    {
+        readCpuList(sprintf("/sys/devices/system/node/node%d/cpulist", osNodes[i]), cpus);
+        for (int j = 0; j < cpus.getSize(); j++)
+        {
+            while (cpuOsNodes.getSize() <= cpus[j])
+                cpuOsNodes.add(-1);
+            cpuOsNodes[cpus[j]] = osNodes[i];
+        }
+    }
+#elif defined(_MSC_VER)
+    SYSTEM_INFO si;
+    GetSystemInfo(&si);
+    for (int i = 0; i < (int)si.dwNumberOfProcessors && i < (int)sizeof(DWORD_PTR) * 8; i++)
+        s_cpus.add(i);
+#else
+    for (int i = 0; i < (int)sysconf(_SC_NPROCESSORS_ONLN); i++)
+        s_cpus.add(i);
+#endif
+    if (!s_cpus.getSize())
+        s_cpus.add(0);
+
+    // Assign nodes. Fake ones get contiguous blocks of CPUs.
+
+    s_nodeCpus.reset(max(s_fakeNodes, 1));
+    for (int i = 0; i < s_nodeCpus.getSize(); i++)
+        s_nodeCpus[i].clear();
+    s_osNodes.clear();
+    s_cpuNodes.reset(s_cpus.getLast() + 1);
+    for (int i = 0; i < s_cpuNodes.getSize(); i++)
+        s_cpuNodes[i] = -1;
+
+    for (int i = 0; i < s_cpus.getSize(); i++)
+    {
+        int cpu = s_cpus[i];
+        int node = 0;
+        if (s_fakeNodes > 0)
+            node = (int)((S64)i * s_fakeNodes / s_cpus.getSize());
+        else if (cpu < cpuOsNodes.getSize() && cpuOsNodes[cpu] != -1)
+        {
+            node = s_osNodes.indexOf(cpuOsNodes[cpu]);
+            if (node == -1)
+            {
+                node = s_osNodes.getSize();
+                s_osNodes.add(cpuOsNodes[cpu]);
+                s_nodeCpus.resize(max(s_nodeCpus.getSize(), node + 1));
+            }
+        }
+        s_nodeCpus[node].add(cpu);
+        s_cpuNodes[cpu] = node;
+    }
+
+    FW_MEMORY_FENCE();
+    s_detected = true;
+    s_lock.leave();
+}
+
+//------------------------------------------------------------------------
@@ -0,0 +1,72 @@
+/*
+ *  Copyright (c) 2009-2011, NVIDIA Corporation
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *      * Redistributions of source code must retain the above copyright
+ *        notice, this list of conditions and the following disclaimer.
+ *      * Redistributions in binary form must reproduce the above copyright
+ *        notice, this list of conditions and the following disclaimer in the
+ *        documentation and/or other materials provided with the distribution.
+ *      * Neither the name of NVIDIA Corporation nor the
+ *        names of its contributors may be used to endorse or promote products
+ *        derived from this software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ *  ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ *  WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ *  DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+ *  DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ *  (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ *  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ *  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ *  (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ *  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#pragma once
+#include "base/Array.hpp"
+
+namespace FW
+{
+//------------------------------------------------------------------------
+// NUMA topology of the CPUs this process may run on.
+//
+// Worker slots are spread round-robin across the nodes, so that any
+// number of threads loads the sockets evenly:
+//
+// int node;
+// int cpu = Topology::getSlotCpu(slot, node);
+// Topology::pinCurrentThread(cpu);
+//
+// Setting FW_NUMA_NODES=n in the environment, or calling setFakeNumNodes(n)
+// before the first query, splits the CPUs into n fake nodes. Everything
+// but the memory policy then behaves as on an n-socket machine.
+//------------------------------------------------------------------------
+
+class Topology
+{
+public:
+    static int          getNumNodes         (void);
+    static int          getNumCpus          (void);
+    static bool         isFake              (void);
+
+    static int          getSlotCpu          (int slot, int& node);  // OS CPU index for the slot'th worker thread.
+    static int          getCurrentNode      (void);                 // Node of the CPU the caller runs on, 0 if unknown.
+    static bool         pinCurrentThread    (int cpu);
+
+    static bool         interleave          (void* ptr, size_t bytes); // Spread untouched pages across the nodes. No-op on one node.
+    static void         setInterleave       (bool enable);          // false = interleave() does nothing and pages stay where first touched.
+
+    static void         setFakeNumNodes     (int numNodes);         // 0 = real topology. Call before the threads start.
+
+private:
+    static void         detect              (void);
+
+private:
+                        Topology            (void); // forbidden
+};
+
+//------------------------------------------------------------------------
+}
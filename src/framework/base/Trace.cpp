@@ -0,0 +1,362 @@
+/*
+ *  Copyright (c) 2009-2011, NVIDIA Corporation
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *      * Redistributions of source code must retain the above copyright
+ *        notice, this list of conditions and the following disclaimer.
+ *      * Redistributions in binary form must reproduce the above copyright
+ *        notice, this list of conditions and the following disclaimer in the
+ *        documentation and/or other materials provided with the distribution.
+ *      * Neither the name of NVIDIA Corporation nor the
+ *        names of its contributors may be used to endorse or promote products
+ *        derived from this software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ *  ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ *  WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ *  DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+ *  DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ *  (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ *  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ *  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ *  (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ *  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "base/Trace.hpp"
+#include "base/Thread.hpp"
+#include "base/Timer.hpp"
+#include "io/File.hpp"
+
+#include <string.h>
+
+#if defined(_MSC_VER)
+#   include <intrin.h>
+#elif defined(__i386__) || defined(__x86_64__)
+#   include <x86intrin.h>
+#else
+#   include <time.h>
+#endif
+
+using namespace FW;
+
+//------------------------------------------------------------------------
+
+#ifdef _MSC_VER
+#   define FW_THREAD_LOCAL      __declspec(thread)
+#   define FW_MEMORY_FENCE()    MemoryBarrier()
+#else
+#   define FW_THREAD_LOCAL      __thread
+#   define FW_MEMORY_FENCE()    __sync_synchronize()
+#endif
+
+//------------------------------------------------------------------------
+
+namespace
+{
+
+enum
+{
+    MaxDepth = 64,  // Deeper scopes are counted but not recorded.
+};
+
+struct TraceEvent
+{
+    const char*         name;
+    U64                 begin;
+    U64                 end;
+    S32                 depth;
+};
+
+struct TraceBuffer
+{
+    String              name;
+    S32                 tid;
+    S32                 generation;     // Events are from this start().
+
+    Array<TraceEvent>   events;         // Ring.
+    S64                 numWritten;
+
+    S32                 depth;
+    const char*         stackName[MaxDepth];
+    U64                 stackBegin[MaxDepth];
+};
+
+struct NameTotal
+{
+    const char*         name;
+    F64                 seconds;
+    S64                 count;
+};
+
+}
+
+//------------------------------------------------------------------------
+
+static Spinlock                     s_lock;
+static Array<TraceBuffer*>          s_buffers;      // Live as long as the process; threads may still hold them.
+static volatile S32                 s_generation    = 0;
+static volatile bool                s_active        = false;
+static S32                          s_capacity      = 0;
+static U64                          s_tscStart      = 0;
+static U64                          s_tscStop       = 0;
+static Timer                        s_timer;
+static F64                          s_seconds       = 0.0;  // start()..stop(), for calibrating the TSC.
+
+static FW_THREAD_LOCAL TraceBuffer* s_buffer        = NULL;
+
+//------------------------------------------------------------------------
+
+static TraceBuffer* getBuffer(void)
+{
+    TraceBuffer* buf = s_buffer;
+    if (!buf)
+    {
+        buf = new TraceBuffer;
+        buf->generation = -1;
+        buf->numWritten = 0;
+        buf->depth = 0;
+
+        s_lock.enter();
+        buf->tid = s_buffers.getSize();
+        s_buffers.add(buf);
+        s_lock.leave();
+
+        buf->name = (Thread::isMain()) ? String("Main thread") : sprintf("Thread %d", buf->tid);
+        s_buffer = buf;
+    }
+
+    // First event since start() => reset. Only the owner writes its buffer.
+
+    if (buf->generation != s_generation)
+    {
+        buf->events.reset(s_capacity);
+        buf->numWritten = 0;
+        buf->depth = 0;
+        buf->generation = s_generation;
+    }
+    return buf;
+}
+
+//------------------------------------------------------------------------
+
+static F64 getTicksPerSecond(void)
+{
+    return (s_seconds > 0.0 && s_tscStop > s_tscStart) ? (F64)(s_tscStop - s_tscStart) / s_seconds : 1.0e9;
+}
+
+//------------------------------------------------------------------------
+
+static void writeJSONString(BufferedOutputStream& out, const char* str)
+{
+    out.write("\"", 1);
+    for (const char* p = str; *p; p++)
+    {
+        if (*p == '"' || *p == '\\')
+            out.write("\\", 1);
+        if ((U8)*p >= 0x20)
+            out.write(p, 1);
+    }
+    out.write("\"", 1);
+}
+
+//------------------------------------------------------------------------
+
+void Trace::start(int eventsPerThread)
+{
+    FW_ASSERT(eventsPerThread > 0);
+    s_lock.enter();
+    s_active = false;
+    s_capacity = eventsPerThread;
+    s_generation++;
+    s_timer.start();
+    s_tscStart = readTSC();
+    FW_MEMORY_FENCE();
+    s_active = true;
+    s_lock.leave();
+}
+
+//------------------------------------------------------------------------
+
+void Trace::stop(void)
+{
+    s_lock.enter();
+    if (s_active)
+    {
+        s_active = false;
+        s_tscStop = readTSC();
+        s_seconds = s_timer.getElapsed();
+    }
+    s_lock.leave();
+}
+
+//------------------------------------------------------------------------
+
+bool Trace::isActive(void)
+{
+    return s_active;
+}
+
+//------------------------------------------------------------------------
+
+void Trace::begin(const char* name)
+{
+    if (!s_active)
+        return;
+
+    TraceBuffer* buf = getBuffer();
+    if (buf->depth < MaxDepth)
+    {
+        buf->stackName[buf->depth] = name;
+        buf->stackBegin[buf->depth] = readTSC();
+    }
+    buf->depth++;
+}
+
+//------------------------------------------------------------------------
+
+void Trace::end(void)
+{
+    // Ignore scopes that began before start().
+
+    TraceBuffer* buf = s_buffer;
+    if (!s_active || !buf || buf->generation != s_generation || !buf->depth)
+        return;
+
+    buf->depth--;
+    if (buf->depth < MaxDepth)
+    {
+        TraceEvent& ev = buf->events[(int)(buf->numWritten % buf->events.getSize())];
+        ev.name     = buf->stackName[buf->depth];
+        ev.begin    = buf->stackBegin[buf->depth];
+        ev.end      = readTSC();
+        ev.depth    = buf->depth;
+        buf->numWritten++;
+    }
+}
+
+//------------------------------------------------------------------------
+
+void Trace::setThreadName(const String& name)
+{
+    getBuffer()->name = name;
+}
+
+//------------------------------------------------------------------------
+
+void Trace::printSummary(void)
+{
+    F64 tps = getTicksPerSecond();
+    printf("Trace: %.3f s\n", (F64)(s_tscStop - s_tscStart) / tps);
+
+    // Per thread: time in outermost scopes.
+
+    Array<NameTotal> names;
+    F64 maxBusy = 0.0;
+    F64 sumBusy = 0.0;
+    int numBusy = 0;
+
+    for (int i = 0; i < s_buffers.getSize(); i++)
+    {
+        const TraceBuffer& buf = *s_buffers[i];
+        if (buf.generation != s_generation || !buf.numWritten)
+            continue;
+
+        int num = (int)min(buf.numWritten, (S64)buf.events.getSize());
+        F64 busy = 0.0;
+        for (int j = 0; j < num; j++)
+        {
+            const TraceEvent& ev = buf.events[j];
+            F64 secs = (F64)(ev.end - ev.begin) / tps;
+            if (ev.depth == 0)
+                busy += secs;
+
+            int k = 0;
+            while (k < names.getSize() && names[k].name != ev.name && strcmp(names[k].name, ev.name) != 0)
+                k++;
+            if (k == names.getSize())
+            {
+                NameTotal& t = names.add();
+                t.name = ev.name;
+                t.seconds = 0.0;
+                t.count = 0;
+            }
+            names[k].seconds += secs;
+            names[k].count++;
+        }
+
+        printf("  %-20s %8.3f s busy, %d events", buf.name.getPtr(), busy, num);
+        if (buf.numWritten > num)
+            printf(" (%d oldest dropped)", (int)(buf.numWritten - num));
+        printf("\n");
+
+        maxBusy = max(maxBusy, busy);
+        sumBusy += busy;
+        numBusy++;
+    }
+
+    if (numBusy)
+        printf("  load imbalance %.2f (max/mean busy)\n", (sumBusy > 0.0) ? maxBusy * numBusy / sumBusy : 1.0);
+
+    for (int i = 0; i < names.getSize(); i++)
+        printf("  %-32s %8.3f s, %lld calls\n", names[i].name, names[i].seconds, (long long)names[i].count);
+}
+
+//------------------------------------------------------------------------
+
+bool Trace::exportChromeJSON(const String& fileName)
+{
+    FW_ASSERT(!s_active);
+    F64 usPerTick = 1.0e6 / getTicksPerSecond();
+
+    File file(fileName, File::Create);
+    BufferedOutputStream out(file);
+    out.writef("{\"traceEvents\":[\n");
+
+    bool first = true;
+    for (int i = 0; i < s_buffers.getSize(); i++)
+    {
+        const TraceBuffer& buf = *s_buffers[i];
+        if (buf.generation != s_generation || !buf.numWritten)
+            continue;
+
+        out.writef("%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":0,\"tid\":%d,\"args\":{\"name\":", (first) ? "" : ",\n", buf.tid);
+        writeJSONString(out, buf.name.getPtr());
+        out.writef("}}");
+        first = false;
+
+        // Oldest first.
+
+        int num = (int)min(buf.numWritten, (S64)buf.events.getSize());
+        int oldest = (buf.numWritten > num) ? (int)(buf.numWritten % num) : 0;
+        for (int j = 0; j < num; j++)
+        {
+            const TraceEvent& ev = buf.events[(oldest + j) % num];
+            out.writef(",\n{\"name\":");
+            writeJSONString(out, ev.name);
+            out.writef(",\"ph\":\"X\",\"pid\":0,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f}",
+                buf.tid, (F64)(S64)(ev.begin - s_tscStart) * usPerTick, (F64)(ev.end - ev.begin) * usPerTick);
+        }
+    }
+
+    out.writef("\n],\"displayTimeUnit\":\"ms\"}\n");
+    out.flush();
+    return !hasError();
+}
+
+//------------------------------------------------------------------------
+
+U64 Trace::readTSC(void)
+{
+#if defined(_MSC_VER) || defined(__i386__) || defined(__x86_64__)
+    return __rdtsc();
+#else
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (U64)ts.tv_sec * 1000000000u + (U64)ts.tv_nsec;
+#endif
+}
+
+//------------------------------------------------------------------------
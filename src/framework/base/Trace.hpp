@@ -0,0 +1,119 @@
+/*
+ *  Copyright (c) 2009-2011, NVIDIA Corporation
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *      * Redistributions of source code must retain the above copyright
+ *        notice, this list of conditions and the following disclaimer.
+ *      * Redistributions in binary form must reproduce the above copyright
+ *        notice, this list of conditions and the following disclaimer in the
+ *        documentation and/or other materials provided with the distribution.
+ *      * Neither the name of NVIDIA Corporation nor the
+ *        names of its contributors may be used to endorse or promote products
+ *        derived from this software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ *  ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ *  WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ *  DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+ *  DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ *  (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ *  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ *  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ *  (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ *  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#pragma once
+#include "base/String.hpp"
+
+//------------------------------------------------------------------------
+// FW_TRACE selects which trace scopes are compiled in:
+//   0 = none,
+//   1 = phases and tasks (default),
+//   2 = also the fine-grained ones inside per-sample loops.
+
+#ifndef FW_TRACE
+#   define FW_TRACE 1
+#endif
+
+#define FW_TRACE_CONCAT2(A, B)  A##B
+#define FW_TRACE_CONCAT(A, B)   FW_TRACE_CONCAT2(A, B)
+
+#if (FW_TRACE >= 1)
+#   define FW_TRACE_SCOPE(NAME)     FW::TraceScope FW_TRACE_CONCAT(traceScope, __LINE__)(NAME)
+#   define FW_TRACE_BEGIN(NAME)     FW::Trace::begin(NAME)
+#   define FW_TRACE_END()           FW::Trace::end()
+#else
+#   define FW_TRACE_SCOPE(NAME)     ((void)0)
+#   define FW_TRACE_BEGIN(NAME)     ((void)0)
+#   define FW_TRACE_END()           ((void)0)
+#endif
+
+#if (FW_TRACE >= 2)
+#   define FW_TRACE_FINE_BEGIN(NAME) FW::Trace::begin(NAME)
+#   define FW_TRACE_FINE_END()      FW::Trace::end()
+#else
+#   define FW_TRACE_FINE_BEGIN(NAME) ((void)0)
+#   define FW_TRACE_FINE_END()      ((void)0)
+#endif
+
+namespace FW
+{
+//------------------------------------------------------------------------
+// Timeline of named scopes on every thread.
+//
+// Trace::start();
+// ...
+// {
+//     FW_TRACE_SCOPE("Filter scanline");  // in any thread
+//     ...
+// }
+// ...
+// Trace::stop();
+// Trace::printSummary();
+// Trace::exportChromeJSON("trace.json");  // chrome://tracing or ui.perfetto.dev
+//
+// Each thread appends to its own ring buffer, so recording takes no
+// locks; when a buffer is full, the oldest events are overwritten.
+// Timestamps come from the TSC and are calibrated against Timer over
+// the start()..stop() interval. Names must be string literals or live
+// until the export. profilePush()/profilePop() are recorded as well.
+//------------------------------------------------------------------------
+
+class Trace
+{
+public:
+    static void         start               (int eventsPerThread = 1 << 16);
+    static void         stop                (void);
+    static bool         isActive            (void);
+
+    static void         begin               (const char* name);  // No-op unless active.
+    static void         end                 (void);
+    static void         setThreadName       (const String& name); // Shown in the export, default "Main thread"/"Thread N".
+
+    static void         printSummary        (void);              // Busy time per thread and per name, load imbalance.
+    static bool         exportChromeJSON    (const String& fileName);
+
+    static U64          readTSC             (void);
+
+private:
+                        Trace               (void); // forbidden
+};
+
+//------------------------------------------------------------------------
+
+class TraceScope
+{
+public:
+    explicit            TraceScope          (const char* name)  { Trace::begin(name); }
+                        ~TraceScope         (void)              { Trace::end(); }
+
+private:
+                        TraceScope          (const TraceScope&); // forbidden
+    TraceScope&         operator=           (const TraceScope&); // forbidden
+};
+
+//------------------------------------------------------------------------
+}
@@ -50,6 +50,12 @@ void Buffer::wrapGL(GLuint glBuffer)
 {
     FW_ASSERT(glBuffer != 0);
 
+#if (!FW_USE_GL)
+
+    fail("Buffer::wrapGL(): Built without FW_USE_GL!");
+
+#else
+
     GLint size;
     {
         GLint oldBuffer;
@@ -62,6 +68,8 @@ void Buffer::wrapGL(GLuint glBuffer)
 
     m_glBuffer = glBuffer;
     wrap(GL, size);
+
+#endif
 }
 
 //------------------------------------------------------------------------
@@ -123,14 +131,7 @@ void Buffer::setRange(S64 dstOfs, const void* src, S64 size, bool async, CUstrea
     switch (m_owner)
     {
     case GL:
-        {
-            GLint oldBuffer;
-            glGetIntegerv(GL_ARRAY_BUFFER_BINDING, &oldBuffer);
-            glBindBuffer(GL_ARRAY_BUFFER, getMutableGLBuffer());
-            glBufferSubData(GL_ARRAY_BUFFER, (GLintptr)dstOfs, (GLsizeiptr)size, src);
-            glBindBuffer(GL_ARRAY_BUFFER, oldBuffer);
-            GLContext::checkErrors();
-        }
+        glSetRange(getMutableGLBuffer(), dstOfs, src, size);
         break;
 
     case Cuda:
@@ -194,14 +195,7 @@ void Buffer::getRange(void* dst, S64 srcOfs, S64 size, bool async, CUstream cuda
     switch (m_owner)
     {
     case GL:
-        {
-            GLint oldBuffer;
-            glGetIntegerv(GL_ARRAY_BUFFER_BINDING, &oldBuffer);
-            glBindBuffer(GL_ARRAY_BUFFER, m_glBuffer);
-            glGetBufferSubData(GL_ARRAY_BUFFER, (GLintptr)srcOfs, (GLsizeiptr)size, dst);
-            glBindBuffer(GL_ARRAY_BUFFER, oldBuffer);
-            GLContext::checkErrors();
-        }
+        glGetRange(dst, m_glBuffer, srcOfs, size);
         break;
 
     case Cuda:
@@ -286,12 +280,7 @@ void Buffer::setOwner(Module module, bool modify, bool async, CUstream cudaStrea
         if (validSize)
         {
             profilePush("glBufferSubData");
-            GLint oldBuffer;
-            glGetIntegerv(GL_ARRAY_BUFFER_BINDING, &oldBuffer);
-            glBindBuffer(GL_ARRAY_BUFFER, m_glBuffer);
-            glBufferSubData(GL_ARRAY_BUFFER, 0, (GLsizeiptr)validSize, m_cpuPtr);
-            glBindBuffer(GL_ARRAY_BUFFER, oldBuffer);
-            GLContext::checkErrors();
+            glSetRange(m_glBuffer, 0, m_cpuPtr, validSize);
             profilePop();
         }
         m_dirty &= ~GL;
@@ -546,12 +535,7 @@ void Buffer::validateCPU(bool async, CUstream cudaStream, S64 validSize)
     if (source == GL)
     {
         profilePush("glGetBufferSubData");
-        GLint oldBuffer;
-        glGetIntegerv(GL_ARRAY_BUFFER_BINDING, &oldBuffer);
-        glBindBuffer(GL_ARRAY_BUFFER, m_glBuffer);
-        glGetBufferSubData(GL_ARRAY_BUFFER, 0, (GLsizeiptr)validSize, m_cpuPtr);
-        glBindBuffer(GL_ARRAY_BUFFER, oldBuffer);
-        GLContext::checkErrors();
+        glGetRange(m_cpuPtr, m_glBuffer, 0, validSize);
         profilePop();
     }
     else
@@ -603,6 +587,15 @@ void Buffer::cpuFree(U8*& cpuPtr, U8*& cpuBase, U32 hints)
 void Buffer::glAlloc(GLuint& glBuffer, S64 size, const void* data)
 {
     FW_ASSERT(size >= 0);
+
+#if (!FW_USE_GL)
+
+    FW_UNREF(glBuffer);
+    FW_UNREF(data);
+    fail("Buffer::glAlloc(): Built without FW_USE_GL!");
+
+#else
+
     GLContext::staticInit();
 
     GLint oldBuffer;
@@ -613,6 +606,8 @@ void Buffer::glAlloc(GLuint& glBuffer, S64 size, const void* data)
     glBufferData(GL_ARRAY_BUFFER, (GLsizeiptr)size, data, GL_STATIC_DRAW);
     glBindBuffer(GL_ARRAY_BUFFER, oldBuffer);
     GLContext::checkErrors();
+
+#endif
 }
 
 //------------------------------------------------------------------------
@@ -626,14 +621,64 @@ void Buffer::glFree(GLuint& glBuffer, bool& cudaGLReg)
             CudaModule::checkError("cuGLUnregisterBufferObject", cuGLUnregisterBufferObject(glBuffer));
             cudaGLReg = false;
         }
+#if (FW_USE_GL)
         glDeleteBuffers(1, &glBuffer);
         GLContext::checkErrors();
+#endif
         glBuffer = 0;
     }
 }
 
 //------------------------------------------------------------------------
 
+void Buffer::glSetRange(GLuint glBuffer, S64 dstOfs, const void* src, S64 size)
+{
+#if (!FW_USE_GL)
+
+    FW_UNREF(glBuffer);
+    FW_UNREF(dstOfs);
+    FW_UNREF(src);
+    FW_UNREF(size);
+    fail("Buffer::glSetRange(): Built without FW_USE_GL!");
+
+#else
+
+    GLint oldBuffer;
+    glGetIntegerv(GL_ARRAY_BUFFER_BINDING, &oldBuffer);
+    glBindBuffer(GL_ARRAY_BUFFER, glBuffer);
+    glBufferSubData(GL_ARRAY_BUFFER, (GLintptr)dstOfs, (GLsizeiptr)size, src);
+    glBindBuffer(GL_ARRAY_BUFFER, oldBuffer);
+    GLContext::checkErrors();
+
+#endif
+}
+
+//------------------------------------------------------------------------
+
+void Buffer::glGetRange(void* dst, GLuint glBuffer, S64 srcOfs, S64 size)
+{
+#if (!FW_USE_GL)
+
+    FW_UNREF(dst);
+    FW_UNREF(glBuffer);
+    FW_UNREF(srcOfs);
+    FW_UNREF(size);
+    fail("Buffer::glGetRange(): Built without FW_USE_GL!");
+
+#else
+
+    GLint oldBuffer;
+    glGetIntegerv(GL_ARRAY_BUFFER_BINDING, &oldBuffer);
+    glBindBuffer(GL_ARRAY_BUFFER, glBuffer);
+    glGetBufferSubData(GL_ARRAY_BUFFER, (GLintptr)srcOfs, (GLsizeiptr)size, dst);
+    glBindBuffer(GL_ARRAY_BUFFER, oldBuffer);
+    GLContext::checkErrors();
+
+#endif
+}
+
+//------------------------------------------------------------------------
+
 void Buffer::cudaAlloc(CUdeviceptr& cudaPtr, CUdeviceptr& cudaBase, bool& cudaGLReg, S64 size, GLuint glBuffer, U32 hints, int align)
 {
     CudaModule::staticInit();
@@ -130,6 +130,8 @@ private:
     static void     cpuFree             (U8*& cpuPtr, U8*& cpuBase, U32 hints);
     static void     glAlloc             (GLuint& glBuffer, S64 size, const void* data);
     static void     glFree              (GLuint& glBuffer, bool& cudaGLReg);
+    static void     glSetRange          (GLuint glBuffer, S64 dstOfs, const void* src, S64 size);
+    static void     glGetRange          (void* dst, GLuint glBuffer, S64 srcOfs, S64 size);
     static void     cudaAlloc           (CUdeviceptr& cudaPtr, CUdeviceptr& cudaBase, bool& cudaGLReg, S64 size, GLuint glBuffer, U32 hints, int align);
     static void     cudaFree            (CUdeviceptr& cudaPtr, CUdeviceptr& cudaBase, GLuint glBuffer, U32 hints);
 
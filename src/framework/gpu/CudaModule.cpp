@@ -393,13 +393,15 @@ void CudaModule::staticInit(void)
         flags |= CU_CTX_LMEM_RESIZE_TO_MAX; // reduce launch overhead with large localmem
 #endif
 
-    if (!isAvailable_cuGLCtxCreate())
-        checkError("cuCtxCreate", cuCtxCreate(&s_context, flags, s_device));
-    else
+#if (FW_USE_GL)
+    if (isAvailable_cuGLCtxCreate())
     {
         GLContext::staticInit();
         checkError("cuGLCtxCreate", cuGLCtxCreate(&s_context, flags, s_device));
     }
+    else
+#endif
+        checkError("cuCtxCreate", cuCtxCreate(&s_context, flags, s_device));
 
     if (isAvailable_cuEventCreate())
     {
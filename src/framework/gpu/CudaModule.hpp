@@ -26,13 +26,20 @@
  */
 
 #pragma once
+#include "base/Math.hpp"
+#include "base/String.hpp"
+#include "base/DLLImports.hpp"
+#include "base/Hash.hpp"
+#if (FW_USE_GL)
 #include "gpu/GLContext.hpp"
+#endif
 
 namespace FW
 {
 //------------------------------------------------------------------------
 
 class Buffer;
+class Image;
 
 //------------------------------------------------------------------------
 
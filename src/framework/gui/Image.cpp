@@ -474,6 +474,15 @@ void Image::flipY(void)
 
 GLuint Image::createGLTexture(ImageFormat::ID desiredFormat, bool generateMipmaps) const
 {
+#if (!FW_USE_GL)
+
+    FW_UNREF(desiredFormat);
+    FW_UNREF(generateMipmaps);
+    fail("Image::createGLTexture(): Built without FW_USE_GL!");
+    return 0;
+
+#else
+
     // Select format.
 
     ImageFormat::ID formatID;
@@ -524,6 +533,8 @@ GLuint Image::createGLTexture(ImageFormat::ID desiredFormat, bool generateMipmap
 
     delete converted;
     return tex;
+
+#endif
 }
 
 //------------------------------------------------------------------------
@@ -256,7 +256,7 @@ void BufferedOutputStream::writefv(const char* fmt, va_list args)
     va_copy(tmp, args);
     int size = vsnprintf((char*)m_buffer.getPtr(m_numValid), space, fmt, tmp);
 #endif
-    if (size >= 0)
+    if (size >= 0 && size < space) // C99 vsnprintf() returns the full length when truncating.
     {
         addValid(size);
         return;
@@ -0,0 +1,30 @@
+# The GUI-free part of the framework for the command-line tools: no windows, GL or CUDA.
+include(../src_core.pri)
+DEFINES += FW_HEADLESS
+VPATH += ../framework
+include(../framework/base.pri)
+
+HEADERS += io/File.hpp \
+    io/Stream.hpp \
+    io/ImageBinaryIO.hpp \
+    io/ImageBmpIO.hpp \
+    io/ImageLodePngIO.hpp \
+    io/ImageRawPngIO.hpp \
+    io/ImageTargaIO.hpp \
+    io/ImageTiffIO.hpp \
+    3rdparty/lodepng/lodepng.h \
+    gpu/Buffer.hpp \
+    gpu/CudaModule.hpp \
+    gui/Image.hpp
+SOURCES += io/Stream.cpp \
+    io/FileQt.cpp \
+    io/ImageBinaryIO.cpp \
+    io/ImageBmpIO.cpp \
+    io/ImageLodePngIO.cpp \
+    io/ImageRawPngIO.cpp \
+    io/ImageTargaIO.cpp \
+    io/ImageTiffIO.cpp \
+    3rdparty/lodepng/lodepng.cpp \
+    gpu/Buffer.cpp \
+    gpu/CudaModule.cpp \
+    gui/Image.cpp
@@ -37,6 +37,9 @@
 #include "io/Stream.hpp"
 #include "io/StateDump.hpp"
 #include "io/AviExporter.hpp"
+#include "base/Pipeline.hpp"
+#include "base/Trace.hpp"
+#include "base/PerfCounters.hpp"
 
 #include <stdio.h>
 #ifdef _MSC_VER
@@ -86,7 +89,7 @@ inline float smoothStepEase(float t, float ease)
 
 App::App(void)
 :   m_commonCtrl    					(CommonControls::Feature_Default & ~CommonControls::Feature_RepaintOnF5),
-	m_cameraParams  					(&m_commonCtrl, 0),
+	m_camera        					(&m_commonCtrl, 0),
     m_action        					(Action_None),
 	m_samples							(NULL),
 	m_inputImage						(NULL),
@@ -97,6 +100,7 @@ App::App(void)
 	m_reconstructionPinholeImage		(NULL),
 	m_reconstructionPinholeImageCuda	(NULL),
 	m_debugImage						(NULL),
+	m_costImage							(NULL),
 	m_imageC							(NULL),
 	m_pinholeImageT						(NULL),
 	m_pinholeImageC						(NULL),
@@ -107,12 +111,17 @@ App::App(void)
 	m_flipY								(true),
 	m_gamma								(1.6f),
 	m_focalDistance						(1.f),
+	m_memoryBudgetMB					(0.f),
 	m_showImage							(0),
-	m_displayNoCuda						(false)
+	m_costChannel						(COST_TICKS),
+	m_displayNoCuda						(false),
+	m_recordTrace						(false),
+	m_countEvents						(false),
+	m_writeTelemetry					(false)
 {
     m_commonCtrl.showFPS(false);
     m_commonCtrl.addStateObject(this);
-	m_cameraParams.camera.setKeepAligned(true);
+	m_camera.setKeepAligned(true);
 
 	m_commonCtrl.setStateFilePrefix( "state_reconstruction_app_" );
 
@@ -124,13 +133,19 @@ App::App(void)
 #else
 	m_commonCtrl.addToggle(&m_displayNoCuda,							FW_KEY_SPACE,	"Enable CUDA [SPACE]");
 #endif
+	m_commonCtrl.addToggle(&m_cameraParams.lazyGather,					FW_KEY_G,		"Lazy front-to-back gather [G]");
+	m_commonCtrl.addToggle(&m_cameraParams.numaReplicas,				FW_KEY_N,		"Replicate hierarchy per NUMA node [N]");
+	m_commonCtrl.addToggle(&m_recordTrace,								FW_KEY_T,		"Record trace of all threads to trace.json [T]");
+	m_commonCtrl.addToggle(&m_countEvents,								FW_KEY_H,		"Count hardware events per phase [H]");
+	m_commonCtrl.addToggle(&m_writeTelemetry,							FW_KEY_J,		"Write reconstruction telemetry to telemetry.json [J]");
 	m_commonCtrl.addButton((S32*)&m_action, Action_ClearImages,			FW_KEY_DELETE,	"Invalidate all images [DELETE]");
-	m_window.addListener(&m_cameraParams.camera);
+	m_window.addListener(&m_camera);
 
     m_commonCtrl.addSeparator();
 
     m_commonCtrl.addButton((S32*)&m_action, Action_ExportUVSweep,       FW_KEY_U,       "Export uv sweep avi... [U]");
 	m_commonCtrl.addButton((S32*)&m_action, Action_RunSweep,			FW_KEY_R,		"Run refocus sweep [R]");
+	m_commonCtrl.addButton((S32*)&m_action, Action_ExportCostMap,		FW_KEY_C,		"Export cost map as float image... [C]");
 
     m_commonCtrl.addSeparator();
 
@@ -140,6 +155,14 @@ App::App(void)
 	m_commonCtrl.addToggle(&m_showImage, VIZ_GROUNDTRUTH_PINHOLE		, FW_KEY_F4, 	"Show ground truth (pinhole) [F4]");
 	m_commonCtrl.addToggle(&m_showImage, VIZ_RECONSTRUCTION_PINHOLE		, FW_KEY_F5, 	"Show pinhole reconstruction [F5]");
 	m_commonCtrl.addToggle(&m_showImage, VIZ_NUM_SURFACES				, FW_KEY_F6, 	"Show #surfaces [F6]");
+	m_commonCtrl.addToggle(&m_showImage, VIZ_COST						, FW_KEY_F7, 	"Show reconstruction cost per pixel [F7]");
+
+    m_commonCtrl.addSeparator();
+
+	m_commonCtrl.addToggle(&m_costChannel, COST_TICKS					, FW_KEY_NONE, 	"Cost: time (TSC ticks)");
+	m_commonCtrl.addToggle(&m_costChannel, COST_NODES_VISITED			, FW_KEY_NONE, 	"Cost: hierarchy nodes visited");
+	m_commonCtrl.addToggle(&m_costChannel, COST_SAMPLES_TESTED			, FW_KEY_NONE, 	"Cost: samples tested");
+	m_commonCtrl.addToggle(&m_costChannel, COST_TRIANGLE_CANDIDATES		, FW_KEY_NONE, 	"Cost: triangle candidates");
 
     m_window.setTitle("Temporal lightfield reconstruction");
 	m_window.setSize(Vec2i(640,480));
@@ -150,6 +173,7 @@ App::App(void)
 	m_commonCtrl.beginSliderStack();
 	m_commonCtrl.addSlider(&m_focalDistance, 0.01f, 100.0f, true, FW_KEY_NONE,FW_KEY_NONE, "Focal distance *= %.2f", 0.1f);
 	m_commonCtrl.addSlider(&m_gamma, 1.f,2.5f,false, FW_KEY_NONE,FW_KEY_NONE, "Gamma %.2f", 0.1f);
+	m_commonCtrl.addSlider(&m_memoryBudgetMB, 0.f,16384.f,false, FW_KEY_NONE,FW_KEY_NONE, "Memory budget %.0f MB (0 = unlimited)", 0.1f);
 	m_commonCtrl.endSliderStack();
 
 	// load state
@@ -171,6 +195,7 @@ App::~App(void)
 	delete m_reconstructionPinholeImage;
 	delete m_reconstructionPinholeImageCuda;
 	delete m_debugImage;
+	delete m_costImage;
 	delete m_imageC;
 	delete m_pinholeImageT;
 	delete m_pinholeImageC;
@@ -193,6 +218,10 @@ bool App::handleEvent(const Window::Event& ev)
     String name;
     Mat4f mat;
 
+	m_cameraParams.memoryBudget = (size_t)m_memoryBudgetMB << 20;
+	m_cameraParams.cameraToWorld = m_camera.getCameraToWorld();
+	m_cameraParams.cameraFar = m_camera.getFar();
+
     switch (action)
     {
     case Action_None:
@@ -228,6 +257,20 @@ bool App::handleEvent(const Window::Event& ev)
 		m_vizDoneCuda = 0;
 		break;
 
+	case Action_ExportCostMap:
+		if(!m_haveSampleBuffer)
+		{
+	        m_commonCtrl.message("Sample buffer not imported!");
+		}
+		else
+		{
+			reconstruct(VIZ_RECONSTRUCTION);
+			name = m_window.showFileSaveDialog("Export cost map (.bin keeps the float values)");
+			if (name.getLength())
+				exportImage(name, m_costImage);
+		}
+		break;
+
 	case Action_RunSweep:
 		{
 			float aper0  = 1.f;
@@ -241,7 +284,6 @@ bool App::handleEvent(const Window::Event& ev)
 			float btime1 = 0.20f;
 
 			m_gamma = 1.6f;
-			Image* image = new Image(m_window.getSize(), ImageFormat::RGBA_Vec4f);
 
 			String sweepName = "sweep_";
 #ifdef FW_QT
@@ -258,32 +300,35 @@ bool App::handleEvent(const Window::Event& ev)
 				sweepName += (char)('a' + ((stamp >> i) & 15));
 #endif
 			AviExporter avi(sweepName + ".avi", m_window.getSize(), fps);
+
+			m_cameraParams.reconstruction = RECONSTRUCTION_TRIANGLE2;
+			Movie movie;
+			initMovie(movie, frames, m_window.getSize(), false);
+			movie.avi  = &avi;
+			movie.name = sweepName;
 			for (int i=0; i < frames; i++)
 			{
-				FW::printf("\n** FRAME %d / %d **\n\n", i, frames);
-
 				float t = smoothStepEase((float)i / (frames-1), ease);
-				float f = 1.f/(1.f/focus0 + t*(1.f/focus1 - 1.f/focus0));
-				float a = aper0 + t*(aper1-aper0);
-
-				m_cameraParams.reconstruction = RECONSTRUCTION_TRIANGLE2;
-				TreeGather filter(*m_samples, m_cameraParams, a, f);
-				filter.reconstructDofMotion(*image);
-				adjustGamma(*image);
-				exportImage(sweepName + sprintf("_frame%03d.png", i), image);
-				avi.getFrame() = *image;
-				int n = 1;
-				if (i==0) n = (int)(btime0*fps+.5f);
-				if (i==frames-1) n = (int)(btime1*fps+.5f);
-				while (n--)
-					avi.exportFrame();
-				blitToWindow(m_window.getGL(), *image);
-			    m_window.getGL()->swapBuffers();
-			}			
+				MovieFrame& frame = movie.frames[i];
+				frame.focalDistance = 1.f/(1.f/focus0 + t*(1.f/focus1 - 1.f/focus0));
+				frame.aperture = aper0 + t*(aper1-aper0);
+				if (i==0) frame.numRepeats = (int)(btime0*fps+.5f);
+				if (i==frames-1) frame.numRepeats = (int)(btime1*fps+.5f);
+			}
+
+			Pipeline pipe;
+			int build  = pipe.addStage("Build",  movieBuildStage,  &movie);
+			int filter = pipe.addStage("Filter", movieFilterStage, &movie);
+			int gamma  = pipe.addStage("Gamma",  sweepGammaStage,  &movie, Pipeline::Stage_Parallel);
+			int output = pipe.addStage("Export", sweepExportStage, &movie, Pipeline::Stage_MainThread);
+			pipe.addEdge(build, filter);	// at most two hierarchies alive
+			pipe.addEdge(filter, gamma, 2);
+			pipe.addEdge(gamma, output, 2);
+			pipe.run(frames);
+
 			avi.flush();
 			FW::printf("Sweep done\n");
-
-			delete image;
+			pipe.printStats();
 		}
 		// sweep parameters
 		break;
@@ -371,7 +416,18 @@ void App::importSampleBuffer (const String& fileName)
 	// Import sample buffer.
 
 	delete m_samples;
+	pushMemOwner("Load");
 	m_samples = new UVTSampleBuffer(fileName.getPtr());
+	popMemOwner();
+	printf("Memory in use after load: %.1fMB\n", getMemoryUsed()/1024.f/1024.f);
+
+	// Build/gather constants stored by "reconstruction_bench tune" for this machine and scene class, if any.
+
+	const String machine = ReconstructionTuning::getMachineName();
+	const String sceneClass = ReconstructionTuning::getSceneClass(*m_samples);
+	m_cameraParams.tuning = ReconstructionTuning();
+	if(m_cameraParams.tuning.load("tuning.txt", machine, sceneClass))
+		printf("Tuning for %s/%s: %s\n", machine.getPtr(), sceneClass.getPtr(), m_cameraParams.tuning.toString().getPtr());
 
 	// Resize window and image.
 
@@ -386,6 +442,7 @@ void App::importSampleBuffer (const String& fileName)
 	delete m_reconstructionPinholeImage;
 	delete m_reconstructionPinholeImageCuda;
 	delete m_debugImage;
+	delete m_costImage;
 	delete m_imageC;
 	delete m_pinholeImageT;
 	delete m_pinholeImageC;
@@ -397,6 +454,7 @@ void App::importSampleBuffer (const String& fileName)
 	m_reconstructionPinholeImage  		= new Image(windowSize, ImageFormat::RGBA_Vec4f);
 	m_reconstructionPinholeImageCuda 	= new Image(windowSize, ImageFormat::RGBA_Vec4f);
 	m_debugImage						= new Image(windowSize, ImageFormat::RGBA_Vec4f);
+	m_costImage							= new Image(windowSize, ImageFormat::RGBA_Vec4f);
 	m_imageC		 					= new Image(windowSize, ImageFormat::RGBA_Vec4f);
 	m_pinholeImageT  					= new Image(windowSize, ImageFormat::RGBA_Vec4f);
 	m_pinholeImageC  					= new Image(windowSize, ImageFormat::RGBA_Vec4f);
@@ -408,6 +466,7 @@ void App::importSampleBuffer (const String& fileName)
     m_reconstructionPinholeImage->clear();
     m_reconstructionPinholeImageCuda->clear();
     m_debugImage->clear();
+	m_costImage->clear();
 	m_imageC->clear();
 	m_pinholeImageT->clear();
     m_pinholeImageC->clear();
@@ -485,6 +544,10 @@ void App::reconstructPinhole(Visualization viz)
 	printf("Reconstructing pinhole image\n");
 
 	profileStart();
+	if(m_recordTrace)
+		Trace::start();
+	if(m_countEvents)
+		PerfCounters::start();
 	profilePush("Tree gathering (pinhole)");
 
 	vizDone |= (1<<viz);
@@ -498,6 +561,8 @@ void App::reconstructPinhole(Visualization viz)
 			Image* img = (m_cameraParams.enableCuda) ? m_reconstructionPinholeImageCuda : m_reconstructionPinholeImage;
 			TreeGather filter(*m_samples, m_cameraParams, 1.f, m_focalDistance);
 			filter.reconstructDofMotion(*img, m_debugImage);
+			if(m_writeTelemetry && !filter.exportTelemetry("telemetry.json"))
+				printf("Telemetry export failed: %s\n", clearError().getPtr());
 
 			// scale debug data to [0,1]
 			Vec4f mxVal(0);
@@ -524,6 +589,8 @@ void App::reconstructPinhole(Visualization viz)
 
 	profilePop();
 	profileEnd();
+	PerfCounters::stop();
+	endTrace();
 }
 
 //------------------------------------------------------------------------
@@ -539,6 +606,10 @@ void App::reconstruct(Visualization viz)
 
 	vizDone |= (1<<viz);
 	profileStart();
+	if(m_recordTrace)
+		Trace::start();
+	if(m_countEvents)
+		PerfCounters::start();
 	profilePush("Tree gathering");
 
 	switch(viz)
@@ -548,7 +619,9 @@ void App::reconstruct(Visualization viz)
 			m_cameraParams.reconstruction = RECONSTRUCTION_TRIANGLE2;
 			TreeGather filter(*m_samples, m_cameraParams, 1.f, m_focalDistance);
 			Image* img = (m_cameraParams.enableCuda) ? m_reconstructionImageCuda : m_reconstructionImage;
-			filter.reconstructDofMotion(*img);
+			filter.reconstructDofMotion(*img, NULL, m_costImage);
+			if(m_writeTelemetry && !filter.exportTelemetry("telemetry.json"))
+				printf("Telemetry export failed: %s\n", clearError().getPtr());
 			break;
 		}
 	default:
@@ -558,6 +631,23 @@ void App::reconstruct(Visualization viz)
 
 	profilePop();
 	profileEnd();
+	PerfCounters::stop();
+	endTrace();
+}
+
+//------------------------------------------------------------------------
+
+void App::endTrace(void)
+{
+	if(!m_recordTrace)
+		return;
+
+	Trace::stop();
+	Trace::printSummary();
+	if(Trace::exportChromeJSON("trace.json"))
+		printf("Trace written to trace.json\n");
+	else
+		printf("Trace export failed: %s\n", clearError().getPtr());
 }
 
 //------------------------------------------------------------------------
@@ -613,11 +703,17 @@ void App::render (GLContext* gl)
 		}
 		break;
 
+	case VIZ_COST:
+		if ( !m_displayNoCuda )
+			reconstruct(VIZ_RECONSTRUCTION);
+		showCost(img);
+		break;
+
 	default:
 		break;
 	}	
 
-	if ( m_showImage != VIZ_GROUNDTRUTH && m_showImage != VIZ_GROUNDTRUTH_PINHOLE )
+	if ( m_showImage != VIZ_GROUNDTRUTH && m_showImage != VIZ_GROUNDTRUTH_PINHOLE && m_showImage != VIZ_COST )
 		adjustGamma(img);
 
 	blitToWindow(gl, img);
@@ -657,82 +753,207 @@ void App::adjustGamma(Image& img) const
 
 //------------------------------------------------------------------------
 
+void App::showCost(Image& img) const
+{
+	// Heatmap of the selected channel, black-red-yellow-white up to the maximum.
+
+	float mx = 0.f;
+	for(int y=0;y<img.getSize().y;y++)
+	for(int x=0;x<img.getSize().x;x++)
+		mx = max(mx, m_costImage->getVec4f(Vec2i(x,y))[m_costChannel]);
+
+	for(int y=0;y<img.getSize().y;y++)
+	for(int x=0;x<img.getSize().x;x++)
+	{
+		float c = (mx > 0.f) ? 3.f * m_costImage->getVec4f(Vec2i(x,y))[m_costChannel] / mx : 0.f;
+		img.setVec4f(Vec2i(x,y), Vec4f(clamp(c,0.f,1.f), clamp(c-1.f,0.f,1.f), clamp(c-2.f,0.f,1.f), 1.f));
+	}
+}
+
+//------------------------------------------------------------------------
+
 void App::exportAVI(const String& filename)
 {
 	// uv-movie
-	Image image(m_reconstructionImage->getSize(), ImageFormat::RGBA_Vec4f);
-    Image debug(m_reconstructionImage->getSize(), ImageFormat::RGBA_Vec4f);
-
-	Vec2i videoSize = image.getSize()*Vec2i(2,1);
+	const Vec2i size = m_reconstructionImage->getSize();
+	Vec2i videoSize = size*Vec2i(2,1);
 	videoSize.x = (videoSize.x+15) & -16;
 	videoSize.y = (videoSize.y+15) & -16;
-	Image frame(videoSize, ImageFormat::ABGR_8888);
 	AviExporter avi(filename, videoSize, 5);
 
-	frame.clear(0);
-
 	const int numFrames = 4;		// per dimension
+	Movie movie;
+	initMovie(movie, numFrames*numFrames, size, true);
+	movie.avi  = &avi;
+	movie.frameSize = videoSize;
+	movie.name = filename.getDirName();
+
 	for(int v=0;v<numFrames;v++)
 	for(int u=0;u<numFrames;u++)
 	{
-		const int frameNum = (v*numFrames+u+1);
-		printf("processing frame %d/%d\n", frameNum,numFrames*numFrames);
+		MovieFrame& frame = movie.frames[v*numFrames+u];
+		frame.focalDistance = m_focalDistance;
+		if(v%2==0)	frame.overrideUVT = Vec3f(float(u+0.5f)/numFrames,float(v+0.5f)/numFrames,0.5f);				// left to right
+		else		frame.overrideUVT = Vec3f(float(numFrames-1-u+0.5f)/numFrames,float(v+0.5f)/numFrames,0.5f);	// right to left
+	}
 
-		// reconstruct
+	Pipeline pipe;
+	int build   = pipe.addStage("Build",   movieBuildStage,  &movie);
+	int filter  = pipe.addStage("Filter",  movieFilterStage, &movie);
+	int compose = pipe.addStage("Compose", uvComposeStage,   &movie, Pipeline::Stage_Parallel);
+	int output  = pipe.addStage("Export",  uvExportStage,    &movie, Pipeline::Stage_MainThread);
+	pipe.addEdge(build, filter);
+	pipe.addEdge(filter, compose, 2);
+	pipe.addEdge(compose, output, 2);
+	pipe.run(movie.frames.getSize());
+	pipe.printStats();
 
-		if(v%2==0)	m_cameraParams.overrideUVT = Vec3f(float(u+0.5f)/numFrames,float(v+0.5f)/numFrames,0.5f);				// left to right
-		else		m_cameraParams.overrideUVT = Vec3f(float(numFrames-1-u+0.5f)/numFrames,float(v+0.5f)/numFrames,0.5f);	// right to left
-		TreeGather filter(*m_samples, m_cameraParams, 1.f, m_focalDistance);
-		filter.reconstructDofMotion(image, &debug);
+	m_cameraParams.overrideUVT = Vec3f(FW_F32_MAX,FW_F32_MAX,FW_F32_MAX);
+}
 
-		if(!m_flipY)	// ehhh...
-		{
-			image.flipY();
-			debug.flipY();
-		}
+//------------------------------------------------------------------------
 
-		// scale debug data to [0,1]
+void App::initMovie(Movie& movie, int numFrames, const Vec2i& size, bool withDebug)
+{
+	movie.app		= this;
+	movie.size		= size;
+	movie.frameSize	= size;
+	movie.withDebug	= withDebug;
+	movie.avi		= NULL;
+	movie.frames.reset(numFrames);
+	for(int i=0;i<numFrames;i++)
+	{
+		MovieFrame& frame	= movie.frames[i];
+		frame.overrideUVT	= m_cameraParams.overrideUVT;
+		frame.aperture		= 1.f;
+		frame.focalDistance	= 1.f;
+		frame.numRepeats	= 1;
+		frame.filter		= NULL;
+		frame.image			= NULL;
+		frame.debug			= NULL;
+		frame.frame			= NULL;
+	}
+}
 
-		Vec4f mxVal(0);
-		for(int y=0;y<debug.getSize().y;y++)
-		for(int x=0;x<debug.getSize().x;x++)
-		{
-			mxVal = max(mxVal, debug.getVec4f(Vec2i(x,y)));
-		}
-		for(int y=0;y<debug.getSize().y;y++)
-		for(int x=0;x<debug.getSize().x;x++)
-		{
-			Vec4f c = debug.getVec4f(Vec2i(x,y)) / mxVal;
-			debug.setVec4f(Vec2i(x,y), c);
-		}
+//------------------------------------------------------------------------
+// Pipeline stages. Everything but the export stages runs in worker
+// threads, so they must not touch GL or the profiler.
 
-		// left: reconstructed image
+void App::movieBuildStage(void* data, int item)
+{
+	Movie& movie = *(Movie*)data;
+	MovieFrame& frame = movie.frames[item];
+	FW::printf("\n** FRAME %d / %d **\n\n", item, movie.frames.getSize());
+	frame.filter = new TreeGather(*movie.app->m_samples, movie.app->m_cameraParams, frame.aperture, frame.focalDistance);
+}
 
-		for(int y=0;y<image.getSize().y;y++)
-		for(int x=0;x<image.getSize().x;x++)
-			frame.setABGR(Vec2i(x,y), image.getABGR(Vec2i(x,y)));
+void App::movieFilterStage(void* data, int item)
+{
+	Movie& movie = *(Movie*)data;
+	MovieFrame& frame = movie.frames[item];
+
+	// The hierarchy does not depend on (u,v,t), only the output samples
+	// generated here do. This stage is serial, so nobody else reads it.
+
+	movie.app->m_cameraParams.overrideUVT = frame.overrideUVT;
+	frame.image = new Image(movie.size, ImageFormat::RGBA_Vec4f);
+	if(movie.withDebug)
+		frame.debug = new Image(movie.size, ImageFormat::RGBA_Vec4f);
+	frame.filter->reconstructDofMotion(*frame.image, frame.debug);
+	delete frame.filter;
+	frame.filter = NULL;
+}
 
-		// right: #surfaces
-		for(int y=0;y<image.getSize().y;y++)
-		for(int x=0;x<image.getSize().x;x++)
-			frame.setVec4f(Vec2i(image.getSize().x+x,y), Vec4f(debug.getVec4f(Vec2i(x,y))[0]));
+void App::sweepGammaStage(void* data, int item)
+{
+	Movie& movie = *(Movie*)data;
+	movie.app->adjustGamma(*movie.frames[item].image);
+}
 
-		// output to avi
-		adjustGamma(frame);
-		avi.getFrame() = frame;
-		avi.exportFrame();
+void App::sweepExportStage(void* data, int item)
+{
+	Movie& movie = *(Movie*)data;
+	MovieFrame& frame = movie.frames[item];
+	App& app = *movie.app;
+
+	exportImage(movie.name + sprintf("_frame%03d.png", item), frame.image);
+	movie.avi->getFrame() = *frame.image;
+	for(int i=0;i<frame.numRepeats;i++)
+		movie.avi->exportFrame();
+	app.blitToWindow(app.m_window.getGL(), *frame.image);
+	app.m_window.getGL()->swapBuffers();
+
+	delete frame.image;
+	frame.image = NULL;
+}
+
+void App::uvComposeStage(void* data, int item)
+{
+	Movie& movie = *(Movie*)data;
+	MovieFrame& mf = movie.frames[item];
+	Image& image = *mf.image;
+	Image& debug = *mf.debug;
 
-		// export to pngs as well
+	if(!movie.app->m_flipY)	// ehhh...
+	{
+		image.flipY();
+		debug.flipY();
+	}
 
-		String framename;
-		framename = filename.getDirName() + "/Frame" + String(frameNum) + ".png";
-		exportImage(framename.getPtr(), &frame);
+	// scale debug data to [0,1]
 
-		// show most recent frame in window (a bit awkward here).
-//		adjustGamma(image);
-//		blitToWindow(m_window.getGL(), image);
-//	    m_window.repaint();
+	Vec4f mxVal(0);
+	for(int y=0;y<debug.getSize().y;y++)
+	for(int x=0;x<debug.getSize().x;x++)
+	{
+		mxVal = max(mxVal, debug.getVec4f(Vec2i(x,y)));
+	}
+	for(int y=0;y<debug.getSize().y;y++)
+	for(int x=0;x<debug.getSize().x;x++)
+	{
+		Vec4f c = debug.getVec4f(Vec2i(x,y)) / mxVal;
+		debug.setVec4f(Vec2i(x,y), c);
 	}
 
-	m_cameraParams.overrideUVT = Vec3f(FW_F32_MAX,FW_F32_MAX,FW_F32_MAX);
+	mf.frame = new Image(movie.frameSize, ImageFormat::ABGR_8888);
+	Image& frame = *mf.frame;
+	frame.clear(0);
+
+	// left: reconstructed image
+
+	for(int y=0;y<image.getSize().y;y++)
+	for(int x=0;x<image.getSize().x;x++)
+		frame.setABGR(Vec2i(x,y), image.getABGR(Vec2i(x,y)));
+
+	// right: #surfaces
+	for(int y=0;y<image.getSize().y;y++)
+	for(int x=0;x<image.getSize().x;x++)
+		frame.setVec4f(Vec2i(image.getSize().x+x,y), Vec4f(debug.getVec4f(Vec2i(x,y))[0]));
+
+	movie.app->adjustGamma(frame);
+
+	delete mf.image;
+	delete mf.debug;
+	mf.image = NULL;
+	mf.debug = NULL;
+}
+
+void App::uvExportStage(void* data, int item)
+{
+	Movie& movie = *(Movie*)data;
+	MovieFrame& frame = movie.frames[item];
+
+	// output to avi
+
+	movie.avi->getFrame() = *frame.frame;
+	movie.avi->exportFrame();
+
+	// export to pngs as well
+
+	String framename;
+	framename = movie.name + "/Frame" + String(item+1) + ".png";
+	exportImage(framename.getPtr(), frame.frame);
+
+	delete frame.frame;
+	frame.frame = NULL;
 }
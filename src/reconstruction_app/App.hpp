@@ -28,10 +28,13 @@
 #pragma once
 #include "gui/Window.hpp"
 #include "gui/CommonControls.hpp"
+#include "3d/CameraControls.hpp"
 #include "reconstruction/Reconstruction.hpp"
 
 namespace FW
 {
+class AviExporter;
+
 //------------------------------------------------------------------------
 
 class App : public Window::Listener, public CommonControls::StateObject
@@ -45,6 +48,7 @@ private:
 		Action_ExportUVSweep,
 		Action_ClearImages,
 		Action_RunSweep,
+		Action_ExportCostMap,
     };
 
 	enum Visualization
@@ -55,6 +59,41 @@ private:
 		VIZ_GROUNDTRUTH_PINHOLE,
 		VIZ_RECONSTRUCTION_PINHOLE,
 		VIZ_NUM_SURFACES,
+		VIZ_COST,
+	};
+
+	enum CostChannel					// of m_costImage
+	{
+		COST_TICKS,
+		COST_NODES_VISITED,
+		COST_SAMPLES_TESTED,
+		COST_TRIANGLE_CANDIDATES,
+	};
+
+	// Frames of a sweep or an AVI, streamed through a Pipeline so that
+	// frame N+1 is built while frame N is filtered and N-1 is exported.
+
+	struct MovieFrame
+	{
+		Vec3f			overrideUVT;
+		float			aperture;
+		float			focalDistance;
+		int				numRepeats;		// AVI frames
+		TreeGather*		filter;
+		Image*			image;
+		Image*			debug;
+		Image*			frame;			// composed output
+	};
+
+	struct Movie
+	{
+		App*				app;
+		Array<MovieFrame>	frames;
+		Vec2i				size;
+		Vec2i				frameSize;		// composed output
+		bool				withDebug;
+		AviExporter*		avi;
+		String				name;
 	};
 
 public:
@@ -75,7 +114,18 @@ private:
 
 	void			blitToWindow		(GLContext* gl, Image& img);
 	void			adjustGamma			(Image& image) const;
+	void			showCost			(Image& image) const;
+
+	void			initMovie			(Movie& movie, int numFrames, const Vec2i& size, bool withDebug);
+	static void		movieBuildStage		(void* data, int item);
+	static void		movieFilterStage	(void* data, int item);
+	static void		sweepGammaStage		(void* data, int item);
+	static void		sweepExportStage	(void* data, int item);
+	static void		uvComposeStage		(void* data, int item);
+	static void		uvExportStage		(void* data, int item);
+
     void            firstTimeInit   	(void);
+	void			endTrace			(void);
 
 private:
                     App             	(const App&); // forbidden
@@ -84,6 +134,7 @@ private:
 private:
     Window          	m_window;
     CommonControls  	m_commonCtrl;
+	CameraControls		m_camera;
 	CameraParams		m_cameraParams;
 
     Action          	m_action;
@@ -97,6 +148,7 @@ private:
 	Image*				m_reconstructionPinholeImage;
 	Image*				m_reconstructionPinholeImageCuda;
 	Image*				m_debugImage;
+	Image*				m_costImage;		// per pixel of the 128spp reconstruction, see CostChannel
 
 	Image*				m_imageC;
 	Image*				m_pinholeImageT;
@@ -111,9 +163,14 @@ private:
 	bool				m_flipY;
 	float				m_gamma;
 	float				m_focalDistance;
+	float				m_memoryBudgetMB;	// CameraParams::memoryBudget
 	S32					m_showImage;
+	S32					m_costChannel;
 
 	bool				m_displayNoCuda;	// show a prompt if exe not built with CUDA and trying to enable it
+	bool				m_recordTrace;		// timeline of all threads to trace.json
+	bool				m_countEvents;		// hardware counters per phase, printed with the stats
+	bool				m_writeTelemetry;	// JSON report of every reconstruction to telemetry.json
 };
 
 //------------------------------------------------------------------------
@@ -0,0 +1,875 @@
+/*
+ *  Copyright (c) 2010-2011, NVIDIA Corporation
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *      * Redistributions of source code must retain the above copyright
+ *        notice, this list of conditions and the following disclaimer.
+ *      * Redistributions in binary form must reproduce the above copyright
+ *        notice, this list of conditions and the following disclaimer in the
+ *        documentation and/or other materials provided with the distribution.
+ *      * Neither the name of NVIDIA Corporation nor the
+ *        names of its contributors may be used to endorse or promote products
+ *        derived from this software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ *  ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ *  WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ *  DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+ *  DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ *  (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ *  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ *  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ *  (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ *  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+//-----------------------------------------------------------------------------------------
+// Micro-benchmarks for the reconstruction kernels.
+// Usage: reconstruction_bench coverage [numTriangles]
+//        reconstruction_bench phases [numRuns] [output.json] [input ...]
+//        reconstruction_bench quality input.bin [minPSNR] [minSSIM] [output.json]
+//        reconstruction_bench generate WxHxSPP[:preset] output.bin
+//        reconstruction_bench tune input [minPSNR] [numRuns] [tuning.txt]
+//        reconstruction_bench outofcore input [oversubscription] [numRuns]
+//        reconstruction_bench bands input [rows,rows,...]
+//        reconstruction_bench scaling input [maxThreads] [numRuns] [numa]
+//        (input is a sample buffer file or synthetic:WxHxSPP[:preset], see SyntheticScene)
+//-----------------------------------------------------------------------------------------
+
+#include "base/Main.hpp"
+#include "base/MulticoreLauncher.hpp"
+#include "base/Random.hpp"
+#include "base/Sort.hpp"
+#include "base/Timer.hpp"
+#include "base/Topology.hpp"
+#include "common/ImageQuality.hpp"
+#include "common/ReconstructionTuning.hpp"
+#include "common/SyntheticScene.hpp"
+#include "gui/Image.hpp"
+#include "io/File.hpp"
+#include "io/Stream.hpp"
+#include "reconstruction/Reconstruction.hpp"
+#include "reconstruction/ReconstructionShard.hpp"
+#include "reconstruction/ReconstructionSimd.hpp"
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+namespace FW
+{
+
+//-----------------------------------------------------------------------------------------
+// Coverage: one point against batches of candidate triangles, vs. one triangle at a time
+// with F64 edge functions.
+//-----------------------------------------------------------------------------------------
+
+static Vec2f snapToGrid(const Vec2f& v)
+{
+	return Vec2f(floor(v.x*64.f), floor(v.y*64.f)) / 64.f;
+}
+
+// Triangles have their vertices within 2 pixels of a random point on a 1024x1024 screen, like
+// the candidates of the triangle search. Every 4th point and its triangles are snapped to a
+// 1/64 pixel grid so that the point sometimes lies exactly on an edge.
+
+static void generateCoverageInput(Array<TrianglePacket>& packets, Array<Vec2f>& points, int numPackets)
+{
+	Random rnd(1);
+	packets.reset(numPackets);
+	points.reset(numPackets);
+	for(int i=0;i<numPackets;i++)
+	{
+		const bool snap = (i%4)==0;
+		Vec2f p(rnd.getF32(0.f,1024.f), rnd.getF32(0.f,1024.f));
+		if(snap)
+			p = snapToGrid(p);
+		points[i] = p;
+
+		TrianglePacket& tp = packets[i];
+		tp.clear();
+		while(!tp.isFull())
+		{
+			Vec2f v[3];
+			for(int k=0;k<3;k++)
+			{
+				v[k] = p + Vec2f(rnd.getF32(-2.f,2.f), rnd.getF32(-2.f,2.f));
+				if(snap)
+					v[k] = snapToGrid(v[k]);
+			}
+			tp.add(v[0],v[1],v[2]);
+		}
+	}
+}
+
+static void benchmarkCoverage(int numTriangles)
+{
+	const int numPackets = max(1, numTriangles/(int)TrianglePacket::SIZE);
+	numTriangles = numPackets*TrianglePacket::SIZE;
+
+	Array<TrianglePacket> packets;
+	Array<Vec2f> points;
+	generateCoverageInput(packets, points, numPackets);
+
+	printf("coverage: %d triangles\n", numTriangles);
+
+	// Reference.
+
+	Timer timer(true);
+	U32 refChecksum = 0;
+	int numCovered = 0;
+	for(int i=0;i<numPackets;i++)
+	{
+		const TrianglePacket& tp = packets[i];
+		U32 mask = 0;
+		for(int j=0;j<tp.num;j++)
+			if(coversTriangle(Vec2f(tp.x0[j],tp.y0[j]), Vec2f(tp.x1[j],tp.y1[j]), Vec2f(tp.x2[j],tp.y2[j]), points[i]))
+			{
+				mask |= 1u<<j;
+				numCovered++;
+			}
+		refChecksum = refChecksum*31 + mask;
+	}
+	const F32 refTime = timer.end();
+	printf("  %-8s %6.2f ns/triangle (%.1f%% covering)\n", "exact", refTime*1e9f/numTriangles, 100.f*numCovered/numTriangles);
+
+	// Batched, every level the CPU supports.
+
+	for(int level=0;level<=detectSimdLevel();level++)
+	{
+		int numExact = 0;
+		U32 checksum = 0;
+		timer.start();
+		for(int i=0;i<numPackets;i++)
+			checksum = checksum*31 + coverTriangles((SimdLevel)level, packets[i], points[i], &numExact);
+		const F32 time = timer.end();
+
+		const bool ok = (checksum == refChecksum);
+		printf("  %-8s %6.2f ns/triangle, %.3f%% exact fallbacks, %.2fx%s\n", getSimdLevelName((SimdLevel)level), time*1e9f/numTriangles,
+			100.f*numExact/numTriangles, refTime/time, ok ? "" : "  RESULTS DIFFER");
+		if(!ok)
+			exitCode = 1;
+	}
+}
+
+//-----------------------------------------------------------------------------------------
+// Phases: TreeGather build phases and filtering, repeated at 1,2,4,..,#cores threads.
+// Every run sees the same input and seeds; the first run of each configuration is a warm-up.
+//-----------------------------------------------------------------------------------------
+
+// "WxHxSPP[:preset]", e.g. "1024x768x16:depth".
+
+static bool parseSyntheticSpec(const char* spec, int& w, int& h, int& spp, SyntheticScene::Preset& preset)
+{
+	char presetName[64] = "default";
+	if(sscanf(spec, "%dx%dx%d:%63s", &w, &h, &spp, presetName) < 3 || w<=0 || h<=0 || spp<=0)
+		return false;
+	preset = SyntheticScene::findPreset(presetName);
+	return preset != SyntheticScene::Preset_Max;
+}
+
+// "file.bin" or "synthetic:WxHxSPP[:preset]". NULL if the file does not exist.
+
+static UVTSampleBuffer* loadBenchmarkInput(const String& name)
+{
+	int w, h, spp;
+	SyntheticScene::Preset preset;
+	if(name.startsWith("synthetic:"))
+	{
+		if(!parseSyntheticSpec(name.getPtr()+10, w, h, spp, preset))
+			return NULL;
+		return SyntheticScene(preset, w, h).generate(w, h, spp);
+	}
+
+	FILE* fp = fopen(name.getPtr(), "rb");
+	if(!fp)
+		return NULL;
+	fclose(fp);
+	return new UVTSampleBuffer(name.getPtr());
+}
+
+struct PhaseTimings
+{
+	Array<const char*>		names;
+	Array<Array<F32> >		seconds;
+
+	Array<F32>& get(const char* name)
+	{
+		for(int i=0;i<names.getSize();i++)
+			if(!strcmp(names[i],name))
+				return seconds[i];
+		names.add(name);
+		return seconds.add();
+	}
+};
+
+static F32 percentile(const Array<F32>& sorted, F32 p)
+{
+	const F32 pos = p*(sorted.getSize()-1);
+	const int i = min((int)pos, sorted.getSize()-1);
+	const int j = min(i+1, sorted.getSize()-1);
+	return lerp(sorted[i], sorted[j], pos-i);
+}
+
+static F32 writeTimings(BufferedOutputStream& out, const char* name, const Array<F32>& seconds)
+{
+	Array<F32> sorted = seconds;
+	sort(0, sorted.getSize(), sorted.getPtr(), compareF32, swapF32);
+	const F32 median = percentile(sorted,0.5f);
+	out.writef("\"%s\": {\"median\": %.6f, \"p10\": %.6f, \"p90\": %.6f, \"min\": %.6f, \"max\": %.6f}",
+		name, median, percentile(sorted,0.1f), percentile(sorted,0.9f), sorted[0], sorted[sorted.getSize()-1]);
+	return median;
+}
+
+static void benchmarkPhases(const Array<String>& inputs, int numRuns, const String& outputName)
+{
+	Array<int> threadCounts;
+	const int numCores = MulticoreLauncher::getNumCores();
+	for(int n=1;n<numCores;n*=2)
+		threadCounts.add(n);
+	threadCounts.add(numCores);
+
+	File file(outputName, File::Create);
+	BufferedOutputStream out(file);
+	out.writef("{\n  \"runs\": %d,\n  \"warmupRuns\": 1,\n  \"cores\": %d,\n  \"simd\": \"%s\",\n  \"inputs\": [", numRuns, numCores, getSimdLevelName(detectSimdLevel()));
+
+	int numWritten = 0;
+	for(int in=0;in<inputs.getSize();in++)
+	{
+		// Load (or generate) the input numRuns times.
+
+		Array<F32> loadSeconds;
+		UVTSampleBuffer* sbuf = NULL;
+		for(int run=0;run<numRuns;run++)
+		{
+			delete sbuf;
+			Timer timer(true);
+			sbuf = loadBenchmarkInput(inputs[in]);
+			loadSeconds.add(timer.end());
+			if(!sbuf)
+				break;
+		}
+		if(!sbuf)
+		{
+			printf("phases: %s not found or invalid, skipped\n", inputs[in].getPtr());
+			continue;
+		}
+
+		out.writef("%s\n    {\"name\": \"%s\", \"width\": %d, \"height\": %d, \"spp\": %d,\n      ", (numWritten++) ? "," : "",
+			inputs[in].getPtr(), sbuf->getWidth(), sbuf->getHeight(), sbuf->getNumSamples());
+		writeTimings(out, "load", loadSeconds);
+		out.writef(",\n      \"threads\": [");
+
+		CameraParams params;
+		Image image(Vec2i(sbuf->getWidth(),sbuf->getHeight()), ImageFormat::RGBA_Vec4f);
+		Array<F32> totals;
+
+		for(int tc=0;tc<threadCounts.getSize();tc++)
+		{
+			MulticoreLauncher::setNumThreads(threadCounts[tc]);
+
+			PhaseTimings timings;
+			for(int run=-1;run<numRuns;run++)
+			{
+				TreeGather tg(*sbuf, params);
+				tg.reconstructDofMotion(image);
+				if(run<0)
+					continue;
+
+				F32 sum = 0.f;
+				for(int i=0;i<tg.getNumPhases();i++)
+				{
+					timings.get(tg.getPhaseName(i)).add(tg.getPhaseSeconds(i));
+					sum += tg.getPhaseSeconds(i);
+				}
+				timings.get("Total").add(sum);
+			}
+
+			out.writef("%s\n        {\"threads\": %d", (tc) ? "," : "", threadCounts[tc]);
+			for(int i=0;i<timings.names.getSize();i++)
+			{
+				out.writef(",\n          ");
+				const F32 median = writeTimings(out, timings.names[i], timings.seconds[i]);
+				if(!strcmp(timings.names[i],"Total"))
+					totals.add(median);
+			}
+			out.writef("}");
+		}
+
+		// Thread scaling of the median total.
+
+		out.writef("\n      ],\n      \"scaling\": [");
+		printf("phases: %s\n", inputs[in].getPtr());
+		for(int tc=0;tc<threadCounts.getSize();tc++)
+		{
+			const F32 speedup = totals[0]/totals[tc];
+			out.writef("%s\n        {\"threads\": %d, \"seconds\": %.6f, \"speedup\": %.3f, \"efficiency\": %.3f}", (tc) ? "," : "",
+				threadCounts[tc], totals[tc], speedup, speedup/threadCounts[tc]);
+			printf("  %2d threads %8.3fs %6.2fx\n", threadCounts[tc], totals[tc], speedup);
+		}
+		out.writef("\n      ]\n    }");
+		delete sbuf;
+	}
+	out.writef("\n  ]\n}\n");
+	out.flush();
+
+	if(hasError())
+	{
+		printf("phases: %s\n", clearError().getPtr());
+		exitCode = 1;
+	}
+	else
+		printf("phases: wrote %s\n", outputName.getPtr());
+}
+
+//-----------------------------------------------------------------------------------------
+// Quality: reconstruct next to the ground truth images (<input>.groundtruth.G.g.png and
+// .pinhole.png, as in App::importSampleBuffer), and fail below the PSNR/SSIM thresholds.
+//-----------------------------------------------------------------------------------------
+
+static bool fileExists(const String& name)
+{
+	FILE* fp = fopen(name.getPtr(), "rb");
+	if(fp)
+		fclose(fp);
+	return fp != NULL;
+}
+
+static bool findGroundTruth(const String& input, int& gammaI, int& gammaF)
+{
+	for(gammaI=1;gammaI<10;gammaI++)
+	for(gammaF=0;gammaF<10;gammaF++)
+		if(fileExists(FW::sprintf("%s.groundtruth.%d.%d.png", input.getPtr(), gammaI, gammaF)))
+			return true;
+	return false;
+}
+
+// Display space, as App::adjustGamma. Negative filter overshoot would be NaN after pow().
+
+static void applyGamma(Image& image, F32 gamma)
+{
+	for(int y=0;y<image.getSize().y;y++)
+	for(int x=0;x<image.getSize().x;x++)
+	{
+		const Vec4f v = image.getVec4f(Vec2i(x,y));
+		image.setVec4f(Vec2i(x,y), Vec4f(pow(max(v.x,0.f),1/gamma), pow(max(v.y,0.f),1/gamma), pow(max(v.z,0.f),1/gamma), v.w));
+	}
+}
+
+static void benchmarkQuality(const String& input, F64 minPsnr, F64 minSsim, const String& outputName)
+{
+	int gammaI, gammaF;
+	UVTSampleBuffer* sbuf = loadBenchmarkInput(input);
+	if(!sbuf || !findGroundTruth(input, gammaI, gammaF))
+	{
+		printf("quality: %s or its ground truth not found\n", input.getPtr());
+		delete sbuf;
+		exitCode = 1;
+		return;
+	}
+	const F32 gamma = gammaI + gammaF/10.f;
+	const String prefix = outputName.endsWith(".json") ? outputName.substring(0, outputName.getLength()-5) : outputName;
+
+	struct Case
+	{
+		const char*	name;
+		const char*	suffix;
+		Vec3f		overrideUVT;
+	};
+	const Case cases[] =
+	{
+		{ "dofMotion",	"",			Vec3f(FW_F32_MAX) },
+		{ "pinhole",	".pinhole",	Vec3f(0,0,1) },			// as App::reconstructPinhole
+	};
+
+	File file(outputName, File::Create);
+	BufferedOutputStream out(file);
+	out.writef("{\n  \"input\": \"%s\",\n  \"gamma\": %.1f,\n  \"minPsnr\": %.2f,\n  \"minSsim\": %.4f,\n  \"cases\": [", input.getPtr(), gamma, minPsnr, minSsim);
+
+	int numWritten = 0;
+	bool allPassed = true;
+	for(int c=0;c<(int)(sizeof(cases)/sizeof(cases[0]));c++)
+	{
+		const String refName = FW::sprintf("%s.groundtruth.%d.%d%s.png", input.getPtr(), gammaI, gammaF, cases[c].suffix);
+		if(!fileExists(refName))
+			continue;
+		Image* reference = importImage(refName);
+		if(!reference)
+		{
+			printf("quality: cannot read %s\n", refName.getPtr());
+			allPassed = false;
+			continue;
+		}
+
+		CameraParams params;
+		params.overrideUVT = cases[c].overrideUVT;
+		Image image(Vec2i(sbuf->getWidth(),sbuf->getHeight()), ImageFormat::RGBA_Vec4f);
+
+		Timer timer(true);
+		{
+			TreeGather tg(*sbuf, params);
+			tg.reconstructDofMotion(image);
+		}
+		const F32 seconds = timer.end();
+		applyGamma(image, gamma);
+
+		Image errorMap(image.getSize(), ImageFormat::RGBA_Vec4f);
+		const ImageQuality q = compareImages(image, *reference, &errorMap);
+		const bool passed = (q.psnr >= minPsnr && q.ssim >= minSsim);
+		allPassed &= passed;
+
+		// |difference| x4 in RGB (the alpha holds the local SSIM, not exported).
+
+		for(int y=0;y<errorMap.getSize().y;y++)
+		for(int x=0;x<errorMap.getSize().x;x++)
+		{
+			const Vec4f e = errorMap.getVec4f(Vec2i(x,y));
+			errorMap.setVec4f(Vec2i(x,y), Vec4f(min(e.getXYZ()*4.f, Vec3f(1.f)), 1.f));
+		}
+		const String errorName = FW::sprintf("%s.%s.error.png", prefix.getPtr(), cases[c].name);
+		exportImage(errorName, &errorMap);
+
+		printf("quality: %-10s %7.3fs PSNR %6.2f dB SSIM %.4f max %.3f %s\n", cases[c].name, seconds, q.psnr, q.ssim, q.maxError, passed ? "ok" : "FAILED");
+		out.writef("%s\n    {\"name\": \"%s\", \"seconds\": %.6f, \"psnr\": %.4f, \"ssim\": %.6f, \"mse\": %.8f, \"maxError\": %.6f, \"errorMap\": \"%s\", \"passed\": %s}",
+			(numWritten++) ? "," : "", cases[c].name, seconds, min(q.psnr,999.0), q.ssim, q.mse, q.maxError, errorName.getPtr(), passed ? "true" : "false");
+		delete reference;
+	}
+	out.writef("\n  ],\n  \"passed\": %s\n}\n", (allPassed && numWritten) ? "true" : "false");
+	out.flush();
+	delete sbuf;
+
+	if(!numWritten || !allPassed || hasError())
+		exitCode = 1;
+	if(hasError())
+		printf("quality: %s\n", clearError().getPtr());
+}
+
+//-----------------------------------------------------------------------------------------
+// Tune: coordinate descent over the ReconstructionTuning constants, minimizing the median
+// end-to-end time of reconstructDofMotion() (a candidate must win by 2%) while the PSNR stays at or above minPSNR. The
+// reference is the ground truth if there is one, otherwise the result with the defaults.
+// The winner is stored in the tuning file under this machine and the buffer's scene class.
+//-----------------------------------------------------------------------------------------
+
+struct TuningKnob
+{
+	const char*	name;
+	int			numValues;
+	F32			values[8];
+};
+
+static const TuningKnob s_tuningKnobs[] =
+{
+	{ "maxLeafSize",		7, { 16, 24, 32, 48, 64, 96, 128 } },
+	{ "frontierLimit",		5, { 1, 2, 4, 8, 16 } },
+	{ "numTasksLog2",		6, { 3, 4, 5, 6, 7, 8 } },
+	{ "initialLeafArea",	5, { 16, 32, 64, 128, 256 } },
+	{ "sameSurfaceUVRange",	4, { 0.0625f, 0.0883883476f, 0.125f, 0.176776695f } },
+	{ "earlyOutThreshold",	4, { 1, 2, 3, 4 } },
+};
+
+static void setTuningKnob(ReconstructionTuning& t, int knob, F32 v)
+{
+	switch(knob)
+	{
+	case 0:	t.maxLeafSize			= (S32)v;	break;
+	case 1:	t.frontierLimit			= (S32)v;	break;
+	case 2:	t.numTasksLog2			= (S32)v;	break;
+	case 3:	t.initialLeafArea		= (S32)v;	break;
+	case 4:	t.sameSurfaceUVRange	= v;		break;
+	case 5:	t.earlyOutThreshold		= v;		break;
+	default: FW_ASSERT(0);
+	}
+}
+
+static F32 reconstructTimed(const UVTSampleBuffer& sbuf, const ReconstructionTuning& tuning, int numRuns, Image& image)
+{
+	CameraParams params;
+	params.tuning = tuning;
+	Array<F32> seconds;
+	for(int r=0;r<numRuns;r++)
+	{
+		Timer timer(true);
+		{
+			TreeGather tg(sbuf, params);
+			tg.reconstructDofMotion(image);
+		}
+		seconds.add(timer.end());
+	}
+	sort(0, seconds.getSize(), seconds.getPtr(), compareF32, swapF32);
+	return percentile(seconds, 0.5f);
+}
+
+static void tuneReconstruction(const String& input, F64 minPsnr, int numRuns, const String& tuningFile)
+{
+	UVTSampleBuffer* sbuf = loadBenchmarkInput(input);
+	if(!sbuf)
+	{
+		printf("tune: %s not found\n", input.getPtr());
+		exitCode = 1;
+		return;
+	}
+	const String machine = ReconstructionTuning::getMachineName();
+	const String sceneClass = ReconstructionTuning::getSceneClass(*sbuf);
+	printf("tune: %s, machine %s, scene class %s\n", input.getPtr(), machine.getPtr(), sceneClass.getPtr());
+
+	const Vec2i size(sbuf->getWidth(), sbuf->getHeight());
+	Image image(size, ImageFormat::RGBA_Vec4f);
+	ReconstructionTuning best;
+	F32 bestSeconds = reconstructTimed(*sbuf, best, 1, image);		// also warms up the caches
+
+	int gammaI, gammaF;
+	F32 gamma = 0.f;
+	Image* reference = NULL;
+	if(findGroundTruth(input, gammaI, gammaF))
+	{
+		const String refName = FW::sprintf("%s.groundtruth.%d.%d.png", input.getPtr(), gammaI, gammaF);
+		reference = importImage(refName);
+		if(reference)
+			gamma = gammaI + gammaF/10.f;
+		else
+			printf("tune: %s, comparing against the defaults instead\n", clearError().getPtr());
+	}
+	if(!reference)
+	{
+		reference = new Image(size, ImageFormat::RGBA_Vec4f);
+		reference->set(image);
+	}
+
+	// Against the ground truth the defaults may already miss minPSNR; then a candidate may
+	// not be worse than the defaults.
+
+	bestSeconds = reconstructTimed(*sbuf, best, numRuns, image);
+	if(gamma != 0.f)
+		applyGamma(image, gamma);
+	F64 psnrLimit = minPsnr;
+	const F64 defaultPsnr = compareImages(image, *reference).psnr;
+	if(defaultPsnr < minPsnr)
+		psnrLimit = defaultPsnr - 0.1;
+	printf("tune: defaults %s: %.3fs PSNR %.2f dB (limit %.2f dB)\n", best.toString().getPtr(), bestSeconds, min(defaultPsnr,999.0), psnrLimit);
+
+	const int numKnobs = (int)(sizeof(s_tuningKnobs)/sizeof(s_tuningKnobs[0]));
+	bool improved = true;
+	for(int pass=0;pass<3 && improved && !hasError();pass++)
+	{
+		improved = false;
+		for(int k=0;k<numKnobs;k++)
+		for(int i=0;i<s_tuningKnobs[k].numValues;i++)
+		{
+			ReconstructionTuning t = best;
+			setTuningKnob(t, k, s_tuningKnobs[k].values[i]);
+			if(t == best)
+				continue;
+
+			const F32 seconds = reconstructTimed(*sbuf, t, numRuns, image);
+			if(gamma != 0.f)
+				applyGamma(image, gamma);
+			const F64 psnr = compareImages(image, *reference).psnr;
+			const bool accepted = (seconds < 0.98f*bestSeconds && psnr >= psnrLimit && !hasError());
+			printf("tune: %-18s %-9g %.3fs PSNR %6.2f dB%s\n", s_tuningKnobs[k].name, s_tuningKnobs[k].values[i], seconds, min(psnr,999.0), accepted ? " *" : "");
+			if(accepted)
+			{
+				best = t;
+				bestSeconds = seconds;
+				improved = true;
+			}
+		}
+	}
+	delete reference;
+	delete sbuf;
+
+	if(hasError())
+	{
+		printf("tune: %s\n", clearError().getPtr());
+		exitCode = 1;
+		return;
+	}
+	printf("tune: best %s: %.3fs\n", best.toString().getPtr(), bestSeconds);
+	if(!best.save(tuningFile, machine, sceneClass, bestSeconds))
+	{
+		printf("tune: cannot write %s\n", tuningFile.getPtr());
+		exitCode = 1;
+	}
+}
+
+//-----------------------------------------------------------------------------------------
+// Out-of-core: filtering with the hierarchy in memory vs. in a mapped file of which only
+// 1/oversubscription may be paged in at a time. Evicted subtrees also leave the page cache,
+// so page-ins go to the storage device as they would with a hierarchy larger than RAM.
+//-----------------------------------------------------------------------------------------
+
+static void benchmarkOutOfCore(const String& input, F32 oversubscription, int numRuns)
+{
+	UVTSampleBuffer* sbuf = loadBenchmarkInput(input);
+	if(!sbuf)
+	{
+		printf("outofcore: %s not found\n", input.getPtr());
+		exitCode = 1;
+		return;
+	}
+
+	Image image(Vec2i(sbuf->getWidth(), sbuf->getHeight()), ImageFormat::RGBA_Vec4f);
+	S64 hierarchyBytes = 0;
+	F32 seconds[2] = { 0.f, 0.f };
+	for(int outOfCore=0;outOfCore<2;outOfCore++)
+	{
+		CameraParams params;
+		params.outOfCoreResident = (outOfCore) ? max((size_t)(hierarchyBytes/oversubscription), (size_t)1) : 0;
+		const size_t baseline = getMemoryUsed();
+		Timer buildTimer(true);
+		TreeGather tg(*sbuf, params);
+		const F32 buildSeconds = buildTimer.end();
+		hierarchyBytes = tg.getHierarchyBytes();
+		printf("outofcore: %s build %.3fs, %.1fMB held after it\n", (outOfCore) ? "out-of-core" : "in-core", buildSeconds, (getMemoryUsed()-baseline)/1024.f/1024.f);
+
+		Array<F32> runs;
+		for(int r=0;r<numRuns;r++)
+		{
+			Timer timer(true);
+			tg.reconstructDofMotion(image);
+			runs.add(timer.end());
+		}
+		sort(0, runs.getSize(), runs.getPtr(), compareF32, swapF32);
+		seconds[outOfCore] = percentile(runs, 0.5f);
+
+		const SubtreeFile* file = tg.getSubtreeFile();
+		if(outOfCore && !file)
+		{
+			printf("outofcore: the hierarchy could not be written to a temporary file\n");
+			exitCode = 1;
+			break;
+		}
+		if(file)
+			printf("outofcore: %.1fMB file, %.1fMB resident, %lld page-ins (%.1fMB, %.2fx the hierarchy per run), %lld evictions\n",
+				file->getFileBytes()/1024.f/1024.f, file->getResidentBudget()/1024.f/1024.f, (long long)file->getNumPageIns(),
+				file->getBytesPagedIn()/1024.f/1024.f, (F64)file->getBytesPagedIn()/max(hierarchyBytes,(S64)1)/numRuns, (long long)file->getNumEvictions());
+	}
+
+	if(!exitCode)
+		printf("outofcore: %s, hierarchy %.1fMB, %.1fx oversubscribed: filter %.3fs in-core, %.3fs out-of-core (%.2fx)\n", input.getPtr(),
+			hierarchyBytes/1024.f/1024.f, oversubscription, seconds[0], seconds[1], seconds[1]/max(seconds[0],1e-6f));
+	delete sbuf;
+}
+
+//-----------------------------------------------------------------------------------------
+// Bands: peak memory above the loaded input, time and halo of reconstructBanded() per band
+// height, against the whole image in one band. The bands differ from it only where the
+// hierarchies differ in shape, which the PSNR shows.
+//-----------------------------------------------------------------------------------------
+
+static void benchmarkBands(const String& input, const String& rowList)
+{
+	UVTSampleBuffer* sbuf = loadBenchmarkInput(input);
+	if(!sbuf)
+	{
+		printf("bands: %s not found\n", input.getPtr());
+		exitCode = 1;
+		return;
+	}
+
+	Array<String> items;
+	rowList.split(',', items);
+	Array<S32> rows;
+	rows.add(0);
+	for(int i=0;i<items.getSize();i++)
+		if(atoi(items[i].getPtr()) > 0)
+			rows.add(atoi(items[i].getPtr()));
+
+	const Vec2i size(sbuf->getWidth(), sbuf->getHeight());
+	Image reference(size, ImageFormat::RGBA_Vec4f);
+	Image image(size, ImageFormat::RGBA_Vec4f);
+	for(int i=0;i<rows.getSize();i++)
+	{
+		CameraParams params;
+		Image& target = (i) ? image : reference;
+
+		resetMemoryPeak();
+		const size_t baseline = getMemoryUsed();
+		Timer timer(true);
+		const F32 halo = reconstructBanded(target, *sbuf, params, rows[i]);
+		const F32 seconds = timer.end();
+		const F32 peakMB = (getMemoryPeak()-baseline)/1024.f/1024.f;
+
+		if(!i)
+			printf("bands: %s, whole image: %.3fs, peak %.1fMB\n", input.getPtr(), seconds, peakMB);
+		else
+			printf("bands: %4d rows: %.3fs, peak %.1fMB, %.2f rows built per row, PSNR %.2f dB\n", rows[i], seconds, peakMB, halo,
+				min(compareImages(image, reference).psnr, 999.0));
+	}
+	delete sbuf;
+}
+
+//-----------------------------------------------------------------------------------------
+// Scaling: median build and filter times for 1, 2, 4, ... maxThreads worker threads, and
+// the speedup over one thread. Counts above the core count are oversubscribed and show the
+// cost of the shared paths (FW::malloc, the scheduler) rather than parallel speedup. The
+// scheduler counters are per run: jobs, the share of them stolen and stolen across nodes,
+// steals lost to a race, sleeps, pushes through the injection lock, and yields on a
+// launcher's finished list. With numa, each thread count runs with unpinned workers and
+// first-touch placement, then pinned workers with first-touch, interleaved and per-node
+// replicas of the hierarchy; otherwise only with the defaults (pinned, interleaved).
+//-----------------------------------------------------------------------------------------
+
+struct ScalingConfig
+{
+	const char*	name;
+	bool		pinThreads;
+	bool		interleave;
+	bool		numaReplicas;
+};
+
+static const ScalingConfig s_scalingConfigs[] =
+{
+	{ "pinned, interleaved",	true,	true,	false },	// the defaults, first
+	{ "unpinned, first-touch",	false,	false,	false },
+	{ "pinned, first-touch",	true,	false,	false },
+	{ "pinned, replicas",		true,	true,	true },
+};
+
+static void benchmarkScaling(const String& input, int maxThreads, int numRuns, bool numa)
+{
+	UVTSampleBuffer* sbuf = loadBenchmarkInput(input);
+	if(!sbuf)
+	{
+		printf("scaling: %s not found\n", input.getPtr());
+		exitCode = 1;
+		return;
+	}
+
+	Array<int> threadCounts;
+	for(int n=1;n<maxThreads;n*=2)
+		threadCounts.add(n);
+	threadCounts.add(maxThreads);
+
+	const int numCores = MulticoreLauncher::getNumCores();
+	printf("scaling: %s, %d core(s) on %d %sNUMA node(s), median of %d run(s)\n", input.getPtr(), numCores,
+		Topology::getNumNodes(), (Topology::isFake()) ? "fake " : "", numRuns);
+
+	Image image(Vec2i(sbuf->getWidth(),sbuf->getHeight()), ImageFormat::RGBA_Vec4f);
+	const int numConfigs = (numa) ? (int)(sizeof(s_scalingConfigs)/sizeof(s_scalingConfigs[0])) : 1;
+	for(int c=0;c<numConfigs;c++)
+	{
+		const ScalingConfig& config = s_scalingConfigs[c];
+		MulticoreLauncher::setThreadPinning(config.pinThreads);
+		Topology::setInterleave(config.interleave);
+		CameraParams params;
+		params.numaReplicas = config.numaReplicas;
+		if(numa)
+			printf("scaling: %s\n", config.name);
+
+		F32 base[2] = { 0.f, 0.f };
+		for(int tc=0;tc<threadCounts.getSize();tc++)
+		{
+			MulticoreLauncher::setNumThreads(threadCounts[tc]);
+
+			Array<F32> seconds[2];
+			for(int run=-1;run<numRuns;run++)
+			{
+				Timer timer(true);
+				TreeGather tg(*sbuf, params);
+				const F32 buildSeconds = timer.end();
+				tg.reconstructDofMotion(image);
+				const F32 filterSeconds = timer.end();
+				if(run<0)
+				{
+					MulticoreLauncher::resetSchedulerStats();
+					continue;
+				}
+				seconds[0].add(buildSeconds);
+				seconds[1].add(filterSeconds);
+			}
+
+			F32 median[2];
+			for(int i=0;i<2;i++)
+			{
+				sort(0, seconds[i].getSize(), seconds[i].getPtr(), compareF32, swapF32);
+				median[i] = percentile(seconds[i], 0.5f);
+				if(!tc)
+					base[i] = median[i];
+			}
+			printf("scaling: %2d threads build %8.3fs %6.2fx  filter %8.3fs %6.2fx%s\n", threadCounts[tc],
+				median[0], base[0]/max(median[0],1e-6f), median[1], base[1]/max(median[1],1e-6f), (threadCounts[tc] > numCores) ? "  (oversubscribed)" : "");
+
+			const MulticoreLauncher::SchedulerStats s = MulticoreLauncher::getSchedulerStats();
+			const F64 jobs = max((F64)s.numJobs, 1.0);
+			printf("scaling:    %.0f jobs, %.1f%% stolen (%.1f%% remote), %.0f lost steals, %.0f sleeps, %.0f injected, %.0f finish spins\n",
+				(F64)s.numJobs/numRuns, 100.0*s.numSteals/jobs, 100.0*s.numRemoteSteals/jobs, (F64)s.numFailedSteals/numRuns,
+				(F64)s.numSleeps/numRuns, (F64)s.numInjected/numRuns, (F64)s.numFinishedSpins/numRuns);
+		}
+	}
+
+	MulticoreLauncher::setThreadPinning(true);
+	Topology::setInterleave(true);
+	delete sbuf;
+}
+
+//-----------------------------------------------------------------------------------------
+// Generate: synthetic buffer straight to the binary format, band by band.
+//-----------------------------------------------------------------------------------------
+
+static void generateSampleBuffer(const char* spec, const char* fileName)
+{
+	int w, h, spp;
+	SyntheticScene::Preset preset;
+	if(!parseSyntheticSpec(spec, w, h, spp, preset))
+	{
+		printf("generate: invalid spec '%s', expected WxHxSPP[:default|defocus|motion|depth]\n", spec);
+		exitCode = 1;
+		return;
+	}
+	SyntheticScene(preset, w, h).exportBinary(fileName, w, h, spp);
+	printf("generate: wrote %s (%s, %.1fMB)\n", fileName, SyntheticScene::getPresetName(preset), (F64)w*h*spp*16*sizeof(F32)/1024/1024);
+}
+
+//-----------------------------------------------------------------------------------------
+// Entry point.
+//-----------------------------------------------------------------------------------------
+
+void init(void)
+{
+	const char* name = (argc>1) ? argv[1] : "coverage";
+	if(!strcmp(name,"coverage"))
+		benchmarkCoverage((argc>2) ? atoi(argv[2]) : (1<<22));
+	else if(!strcmp(name,"phases"))
+	{
+		Array<String> inputs;
+		for(int i=4;i<argc;i++)
+			inputs.add(argv[i]);
+		if(!inputs.getSize())
+		{
+			inputs.add("data/butterflies-1spp.bin");
+			inputs.add("synthetic:512x512x4");
+			inputs.add("synthetic:1024x1024x16");
+			inputs.add("synthetic:512x512x8:depth");
+		}
+		benchmarkPhases(inputs, (argc>2) ? max(1,atoi(argv[2])) : 5, (argc>3) ? argv[3] : "bench.json");
+	}
+	else if(!strcmp(name,"quality") && argc>=3)
+		benchmarkQuality(argv[2], (argc>3) ? atof(argv[3]) : 30.0, (argc>4) ? atof(argv[4]) : 0.9, (argc>5) ? argv[5] : "quality.json");
+	else if(!strcmp(name,"generate") && argc==4)
+		generateSampleBuffer(argv[2], argv[3]);
+	else if(!strcmp(name,"tune") && argc>=3)
+		tuneReconstruction(argv[2], (argc>3) ? atof(argv[3]) : 40.0, (argc>4) ? max(1,atoi(argv[4])) : 3, (argc>5) ? argv[5] : "tuning.txt");
+	else if(!strcmp(name,"outofcore") && argc>=3)
+		benchmarkOutOfCore(argv[2], (argc>3) ? max(1.f,(F32)atof(argv[3])) : 2.f, (argc>4) ? max(1,atoi(argv[4])) : 3);
+	else if(!strcmp(name,"bands") && argc>=3)
+		benchmarkBands(argv[2], (argc>3) ? argv[3] : "512,256,128,64");
+	else if(!strcmp(name,"scaling") && argc>=3)
+		benchmarkScaling(argv[2], (argc>3) ? max(1,atoi(argv[3])) : 64, (argc>4) ? max(1,atoi(argv[4])) : 3, argc>5 && !strcmp(argv[5],"numa"));
+	else
+	{
+		printf("Usage: %s coverage [numTriangles]\n", argv[0]);
+		printf("       %s phases [numRuns] [output.json] [input ...]\n", argv[0]);
+		printf("       %s quality input.bin [minPSNR] [minSSIM] [output.json]\n", argv[0]);
+		printf("       %s generate WxHxSPP[:preset] output.bin\n", argv[0]);
+		printf("       %s tune input [minPSNR] [numRuns] [tuning.txt]\n", argv[0]);
+		printf("       %s outofcore input [oversubscription] [numRuns]\n", argv[0]);
+		printf("       %s bands input [rows,rows,...]\n", argv[0]);
+		printf("       %s scaling input [maxThreads] [numRuns] [numa]\n", argv[0]);
+		exitCode = 1;
+	}
+}
+
+} //
@@ -0,0 +1,820 @@
+/*
+ *  Copyright (c) 2010-2011, NVIDIA Corporation
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *      * Redistributions of source code must retain the above copyright
+ *        notice, this list of conditions and the following disclaimer.
+ *      * Redistributions in binary form must reproduce the above copyright
+ *        notice, this list of conditions and the following disclaimer in the
+ *        documentation and/or other materials provided with the distribution.
+ *      * Neither the name of NVIDIA Corporation nor the
+ *        names of its contributors may be used to endorse or promote products
+ *        derived from this software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ *  ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ *  WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ *  DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+ *  DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ *  (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ *  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ *  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ *  (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ *  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+//-----------------------------------------------------------------------------------------
+// Batch reconstruction for render-farm nodes. Links the core libraries (framework_core,
+// reconstruction_core): QtCore only, no Qt GUI/OpenGL, libGL or libcuda.
+// Usage: reconstruction_cli [options] input.bin output.png [input.bin output.png ...]
+//        -aperture=A       aperture scale (1 = as rendered, 0 = pinhole)
+//        -focus=F          focal distance scale (1 = as rendered)
+//        -uvt=U,V,T        reconstruct a single lens/time position (overrideUVT)
+//        -filter=box|bicubic, -lens=box|gaussian, -time=box|gaussian
+//        -gamma=G          applied before writing (1 = linear)
+//        -threads=N        worker threads (default: all cores)
+//        -memory=MB        memory budget of the reconstruction (0 = unlimited)
+//        -outofcore=MB     write the hierarchy to a temporary mapped file as it is built,
+//                          with at most MB of it paged in
+//        -bands=ROWS       build and filter bands of ROWS rows one at a time, so that memory
+//                          follows the band size; smaller bands rebuild more halo rows.
+//                          Local only, not with -service or -shards
+//        -tuning=file      ReconstructionTuning entries (default tuning.txt)
+//        -lazy             lazy front-to-back gather
+//        -crop=X0,Y0,X1,Y1 reconstruct and write pixels [X0,X1)x[Y0,Y1) only
+//        -service=socket   send the requests to a running reconstruction_service, which
+//                          keeps buffers and hierarchies cached (-threads, -memory,
+//                          -tuning and -lazy are then the service's)
+//        -shards=N         split each image into tiles reconstructed by N local worker
+//                          processes, which share the cores; the input is streamed from
+//                          its file rather than loaded
+//        -shards=A,B,...   ... by the workers listening at these addresses
+//        -tile=N           shard tile size in pixels (default 256)
+//        -worker=address   serve shard tiles at a socket path or host:port, no images
+//        -remote           let a -worker host:port listen on other than the loopback interface
+// TCP workers and services need the same secret in $RECONSTRUCTION_TOKEN on both ends.
+// Images are written in the orientation of the library's screenshot_DofMotion.png.
+//-----------------------------------------------------------------------------------------
+
+#include "base/Main.hpp"
+#include "base/MulticoreLauncher.hpp"
+#include "base/Timer.hpp"
+#include "base/Topology.hpp"
+#include "common/ReconstructionService.hpp"
+#include "common/ReconstructionTuning.hpp"
+#include "gui/Image.hpp"
+#include "reconstruction/Reconstruction.hpp"
+#include "reconstruction/ReconstructionShard.hpp"
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#if defined(__linux__)
+#   include <fcntl.h>
+#   include <sched.h>
+#   include <poll.h>
+#   include <sys/socket.h>
+#   include <sys/wait.h>
+#   include <unistd.h>
+#endif
+
+namespace FW
+{
+
+struct CliOptions
+{
+	CliOptions(void) :
+		aperture	(1.f),
+		focus		(1.f),
+		gamma		(1.f),
+		numThreads	(0),
+		memoryMB	(0),
+		outOfCoreMB	(0),
+		bandRows	(0),
+		tuningFile	("tuning.txt"),
+		cropLo		(0),
+		cropHi		(0),
+		tileSize	(256),
+		remote		(false),
+		workerFd	(-1)
+	{
+	}
+
+	F32				aperture;
+	F32				focus;
+	F32				gamma;
+	S32				numThreads;
+	S32				memoryMB;
+	S32				outOfCoreMB;
+	S32				bandRows;		// -bands, 0 == a single TreeGather over the whole image
+	String			tuningFile;
+	String			service;
+	Vec2i			cropLo;
+	Vec2i			cropHi;			// (0,0) == whole image
+	String			shards;
+	S32				tileSize;
+	String			worker;
+	bool			remote;			// -worker may listen on any interface
+	S32				workerFd;		// -worker-fd, a socketpair() end inherited from the coordinator
+	CameraParams	params;
+	Array<String>	inputs;
+	Array<String>	outputs;
+};
+
+//-----------------------------------------------------------------------------------------
+
+static void printUsage(void)
+{
+	printf("Usage: %s [options] input.bin output.png [input.bin output.png ...]\n", argv[0]);
+	printf("  -aperture=A  -focus=F  -uvt=U,V,T  -gamma=G\n");
+	printf("  -filter=box|bicubic  -lens=box|gaussian  -time=box|gaussian\n");
+	printf("  -threads=N  -memory=MB  -outofcore=MB  -bands=ROWS  -tuning=file  -lazy  -crop=X0,Y0,X1,Y1  -service=socket\n");
+	printf("  -shards=N|address,...  -tile=N\n");
+	printf("       %s [-threads=N] [-memory=MB] [-outofcore=MB] [-lazy] [-remote] -worker=address\n", argv[0]);
+}
+
+static bool parseOptions(CliOptions& o)
+{
+	Array<String> files;
+	for(int i=1;i<argc;i++)
+	{
+		const char* ptr = argv[i];
+		if(*ptr != '-')
+		{
+			files.add(ptr);
+			continue;
+		}
+
+		Vec3f uvt;
+		bool ok = true;
+		if(parseLiteral(ptr, "-aperture="))		ok = parseFloat(ptr, o.aperture);
+		else if(parseLiteral(ptr, "-focus="))	ok = parseFloat(ptr, o.focus);
+		else if(parseLiteral(ptr, "-gamma="))	ok = parseFloat(ptr, o.gamma) && o.gamma > 0.f;
+		else if(parseLiteral(ptr, "-threads="))	ok = parseInt(ptr, o.numThreads) && o.numThreads >= 1;
+		else if(parseLiteral(ptr, "-memory="))	ok = parseInt(ptr, o.memoryMB) && o.memoryMB >= 0;
+		else if(parseLiteral(ptr, "-outofcore="))	ok = parseInt(ptr, o.outOfCoreMB) && o.outOfCoreMB > 0;
+		else if(parseLiteral(ptr, "-bands="))	ok = parseInt(ptr, o.bandRows) && o.bandRows >= 1;
+		else if(parseLiteral(ptr, "-tuning="))	{ o.tuningFile = ptr; ptr += strlen(ptr); }
+		else if(parseLiteral(ptr, "-service="))	{ o.service = ptr; ptr += strlen(ptr); }
+		else if(parseLiteral(ptr, "-shards="))	{ o.shards = ptr; ptr += strlen(ptr); ok = (o.shards.getLength() > 0); }
+		else if(parseLiteral(ptr, "-tile="))	ok = parseInt(ptr, o.tileSize) && o.tileSize >= 16;
+		else if(parseLiteral(ptr, "-worker-fd="))	ok = parseInt(ptr, o.workerFd) && o.workerFd >= 0;
+		else if(parseLiteral(ptr, "-worker="))	{ o.worker = ptr; ptr += strlen(ptr); ok = (o.worker.getLength() > 0); }
+		else if(parseLiteral(ptr, "-remote"))	o.remote = true;
+		else if(parseLiteral(ptr, "-lazy"))		o.params.lazyGather = true;
+		else if(parseLiteral(ptr, "-crop="))
+		{
+			ok = parseInt(ptr, o.cropLo.x) && parseChar(ptr, ',') && parseInt(ptr, o.cropLo.y) && parseChar(ptr, ',') &&
+				 parseInt(ptr, o.cropHi.x) && parseChar(ptr, ',') && parseInt(ptr, o.cropHi.y) && o.cropHi.x > o.cropLo.x && o.cropHi.y > o.cropLo.y;
+		}
+		else if(parseLiteral(ptr, "-uvt="))
+		{
+			ok = parseFloat(ptr, uvt.x) && parseChar(ptr, ',') && parseFloat(ptr, uvt.y) && parseChar(ptr, ',') && parseFloat(ptr, uvt.z);
+			o.params.overrideUVT = uvt;
+		}
+		else if(parseLiteral(ptr, "-filter="))
+		{
+			if(parseLiteral(ptr, "box"))				o.params.filter = FILTER_BOX;
+			else if(parseLiteral(ptr, "bicubic"))		o.params.filter = FILTER_BICUBIC;
+			else										ok = false;
+		}
+		else if(parseLiteral(ptr, "-lens="))
+		{
+			if(parseLiteral(ptr, "box"))				o.params.lensFilter = LENS_BOX;
+			else if(parseLiteral(ptr, "gaussian"))		o.params.lensFilter = LENS_GAUSSIAN;
+			else										ok = false;
+		}
+		else if(parseLiteral(ptr, "-time="))
+		{
+			if(parseLiteral(ptr, "box"))				o.params.timeFilter = TIME_BOX;
+			else if(parseLiteral(ptr, "gaussian"))		o.params.timeFilter = TIME_GAUSSIAN;
+			else										ok = false;
+		}
+		else
+			ok = false;
+
+		if(!ok || *ptr)
+		{
+			printf("Invalid option '%s'\n", argv[i]);
+			return false;
+		}
+	}
+
+	o.params.memoryBudget = (size_t)o.memoryMB << 20;
+	o.params.outOfCoreResident = (size_t)o.outOfCoreMB << 20;
+	if(o.bandRows && (o.service.getLength() || o.shards.getLength()))
+	{
+		printf("-bands applies to local reconstruction only\n");
+		return false;
+	}
+	if(o.worker.getLength() || o.workerFd >= 0)
+		return !files.getSize();
+	if(!files.getSize() || files.getSize()%2)
+		return false;
+	for(int i=0;i<files.getSize();i+=2)
+	{
+		o.inputs.add(files[i]);
+		o.outputs.add(files[i+1]);
+	}
+	return true;
+}
+
+//-----------------------------------------------------------------------------------------
+
+static void writeImage(Image& image, F32 gamma, const String& output)
+{
+	if(gamma != 1.f)
+		for(int y=0;y<image.getSize().y;y++)
+		for(int x=0;x<image.getSize().x;x++)
+		{
+			const Vec4f c = image.getVec4f(Vec2i(x,y));
+			image.setVec4f(Vec2i(x,y), Vec4f(pow(c.x,1/gamma), pow(c.y,1/gamma), pow(c.z,1/gamma), c.w));
+		}
+	image.flipY();
+	exportImage(output, &image);
+}
+
+static bool reconstructFile(CliOptions& o, const String& input, const String& output, F64& totalSeconds, S64& totalSamples)
+{
+	FILE* fp = fopen(input.getPtr(), "rb");
+	if(!fp)
+	{
+		printf("%s: not found\n", input.getPtr());
+		return false;
+	}
+	fclose(fp);
+
+	Timer timer(true);
+	resetMemoryPeak();
+	UVTSampleBuffer sbuf(input.getPtr());
+	const F32 loadSeconds = timer.end();
+	if(hasError())
+		return false;
+
+	S64 numSamples = 0;
+	for(int y=0;y<sbuf.getHeight();y++)
+	for(int x=0;x<sbuf.getWidth();x++)
+		numSamples += sbuf.getNumSamples(x,y);
+
+	// Per-buffer tuning, as App::importSampleBuffer.
+
+	const String sceneClass = ReconstructionTuning::getSceneClass(sbuf);
+	o.params.tuning = ReconstructionTuning();
+	const bool tuned = o.params.tuning.load(o.tuningFile, ReconstructionTuning::getMachineName(), sceneClass);
+
+	const Vec2i size(sbuf.getWidth(), sbuf.getHeight());
+	const Vec2i lo = min(o.cropLo, size);
+	const Vec2i hi = (o.cropHi == Vec2i(0)) ? size : min(max(o.cropHi, lo), size);
+	Image image(size, ImageFormat::RGBA_Vec4f);
+	timer.start();
+	Array<String> phaseNames;
+	Array<F32> phaseSeconds;
+	F32 haloFactor = 0.f;
+	if(o.bandRows)
+		haloFactor = reconstructBanded(image, sbuf, o.params, o.bandRows, o.aperture, o.focus, lo, hi);
+	else
+	{
+		TreeGather tg(sbuf, o.params, o.aperture, o.focus);
+		tg.setRegion(lo, hi);
+		tg.reconstructDofMotion(image);
+		for(int i=0;i<tg.getNumPhases();i++)
+		{
+			phaseNames.add(tg.getPhaseName(i));
+			phaseSeconds.add(tg.getPhaseSeconds(i));
+		}
+	}
+	const F32 reconstructSeconds = timer.end();
+	if(hasError())
+		return false;
+
+	Image crop(hi-lo, ImageFormat::RGBA_Vec4f);
+	crop.set(Vec2i(0), image, lo, hi-lo);
+	writeImage(crop, o.gamma, output);
+	const F32 exportSeconds = timer.end();
+	if(hasError())
+		return false;
+
+	printf("%s -> %s\n", input.getPtr(), output.getPtr());
+	printf("  %dx%d, %.1f samples/pixel, scene class %s%s\n", sbuf.getWidth(), sbuf.getHeight(),
+		(F64)numSamples/(sbuf.getWidth()*sbuf.getHeight()), sceneClass.getPtr(), tuned ? " (tuned)" : "");
+	printf("  load %.3fs, reconstruct %.3fs (%.2f Msamples/s), export %.3fs\n", loadSeconds, reconstructSeconds,
+		numSamples/max(reconstructSeconds,1e-6f)*1e-6, exportSeconds);
+	for(int i=0;i<phaseNames.getSize();i++)
+		printf("    %-20s %.3fs\n", phaseNames[i].getPtr(), phaseSeconds[i]);
+	if(o.bandRows)
+		printf("    %d-row bands, %.2f input rows built per output row\n", o.bandRows, haloFactor);
+	printf("  memory peak %.1fMB\n", getMemoryPeak()/1024.f/1024.f);
+
+	totalSeconds += loadSeconds + reconstructSeconds + exportSeconds;
+	totalSamples += numSamples;
+	return true;
+}
+
+//-----------------------------------------------------------------------------------------
+// Client of reconstruction_service. The rows arrive band by band while the service filters.
+//-----------------------------------------------------------------------------------------
+
+static bool reconstructRemote(const CliOptions& o, const String& input, const String& output, F64& totalSeconds)
+{
+	ServiceRequest req;
+	req.input		= input;
+	req.aperture	= o.aperture;
+	req.focus		= o.focus;
+	req.overrideUVT	= o.params.overrideUVT;
+	req.filter		= o.params.filter;
+	req.lensFilter	= o.params.lensFilter;
+	req.timeFilter	= o.params.timeFilter;
+	req.regionLo	= o.cropLo;
+	req.regionHi	= o.cropHi;
+#if defined(__linux__)
+	char path[4096];
+	if(realpath(input.getPtr(), path))		// the service has its own working directory
+		req.input = path;
+#endif
+	req.token = getServiceToken();
+
+	Timer timer(true);
+	ServiceSocket socket;
+	const String request = req.toString();
+	if(!socket.connect(o.service) || !socket.write(request.getPtr(), request.getLength()))
+	{
+		printf("%s: cannot connect to %s\n", input.getPtr(), o.service.getPtr());
+		return false;
+	}
+
+	String reply;
+	Vec2i size, lo, hi;
+	int cached = 0;
+	F32 buildSeconds = 0.f, filterSeconds = 0.f;
+	if(!socket.readLine(reply) || sscanf(reply.getPtr(), "OK %d %d %d %d %d %d %d %f", &size.x, &size.y, &lo.x, &lo.y, &hi.x, &hi.y, &cached, &buildSeconds) != 8)
+	{
+		printf("%s: %s\n", input.getPtr(), reply.getLength() ? reply.getPtr() : "no reply");
+		return false;
+	}
+
+	Image image(hi-lo, ImageFormat::RGBA_Vec4f);
+	bool ok = true;
+	for(int y=0;y<image.getSize().y && ok;y++)
+		ok = socket.read(image.getMutablePtr(Vec2i(0,y)), (S64)image.getSize().x*sizeof(Vec4f));
+	if(!ok || !socket.readLine(reply) || sscanf(reply.getPtr(), "DONE %f", &filterSeconds) != 1)
+	{
+		printf("%s: connection lost\n", input.getPtr());
+		return false;
+	}
+	const F32 remoteSeconds = timer.end();
+
+	writeImage(image, o.gamma, output);
+	const F32 exportSeconds = timer.end();
+	if(hasError())
+		return false;
+
+	printf("%s -> %s (service)\n", input.getPtr(), output.getPtr());
+	printf("  %dx%d, region (%d,%d)-(%d,%d), hierarchy %s\n", size.x, size.y, lo.x, lo.y, hi.x, hi.y, cached ? "cached" : "built");
+	printf("  request %.3fs (build %.3fs, filter %.3fs), export %.3fs\n", remoteSeconds, buildSeconds, filterSeconds, exportSeconds);
+
+	totalSeconds += remoteSeconds + exportSeconds;
+	return true;
+}
+
+//-----------------------------------------------------------------------------------------
+// Sharding. The coordinator plans the tiles and their windows (see ReconstructionShard.hpp),
+// hands one tile at a time to each idle worker and merges the rows as they come back; it
+// builds no hierarchy itself. A tile whose worker fails goes back to the queue.
+//-----------------------------------------------------------------------------------------
+
+struct ShardWorker
+{
+	ShardWorker(void) : tile(-1), pid(-1) {}
+
+	String			name;
+	ServiceSocket	socket;
+	S32				tile;			// in flight, -1 when idle
+	S32				pid;			// spawned by us, -1 if remote
+};
+
+// A local worker runs on worker slots [firstSlot, firstSlot+numThreads) of the coordinator's
+// CPUs. Its Topology sees only that affinity mask, so the workers pin their threads to
+// disjoint CPUs instead of all taking the first ones.
+
+static bool spawnWorker(ShardWorker& worker, const CliOptions& o, int firstSlot, int numThreads)
+{
+#if defined(__linux__)
+	cpu_set_t cpus;
+	CPU_ZERO(&cpus);
+	for(int i=0;i<numThreads;i++)
+	{
+		int node;
+		CPU_SET(Topology::getSlotCpu((firstSlot+i) % Topology::getNumCpus(), node), &cpus);
+	}
+
+	int fds[2];
+	if(socketpair(AF_UNIX, SOCK_STREAM, 0, fds) != 0)
+		return false;
+	fcntl(fds[0], F_SETFD, FD_CLOEXEC);		// later workers must not keep this one's connection open
+
+	const String fdArg		= sprintf("-worker-fd=%d", fds[1]);
+	const String threadsArg	= sprintf("-threads=%d", numThreads);
+	const String memoryArg	= sprintf("-memory=%d", o.memoryMB);
+	const String outOfCoreArg	= sprintf("-outofcore=%d", o.outOfCoreMB);
+	Array<const char*> args;
+	args.add(argv[0]);
+	args.add(fdArg.getPtr());
+	args.add(threadsArg.getPtr());
+	args.add(memoryArg.getPtr());
+	if(o.outOfCoreMB)
+		args.add(outOfCoreArg.getPtr());
+	if(o.params.lazyGather)
+		args.add("-lazy");
+	args.add(NULL);
+
+	const pid_t pid = fork();
+	if(pid == 0)
+	{
+		sched_setaffinity(0, sizeof(cpus), &cpus);
+		execv("/proc/self/exe", (char* const*)args.getPtr());
+		_exit(127);
+	}
+	::close(fds[1]);
+	if(pid < 0)
+	{
+		::close(fds[0]);
+		return false;
+	}
+	worker.socket.attach(fds[0]);
+	worker.pid = pid;
+	worker.name = sprintf("local worker %d", pid);
+	return true;
+#else
+	FW_UNREF(worker); FW_UNREF(o); FW_UNREF(firstSlot); FW_UNREF(numThreads);
+	return false;	// not ported
+#endif
+}
+
+static bool dispatchTile(ShardWorker& worker, const CliOptions& o, UVTSampleRowReader& reader, const ShardTile& tile)
+{
+	ServiceRequest req;
+	req.command		= ServiceRequest::Command_Shard;
+	req.aperture	= o.aperture;
+	req.focus		= o.focus;
+	req.overrideUVT	= o.params.overrideUVT;
+	req.filter		= o.params.filter;
+	req.lensFilter	= o.params.lensFilter;
+	req.timeFilter	= o.params.timeFilter;
+	req.origin		= tile.windowLo;
+	req.regionLo	= tile.lo - tile.windowLo;
+	req.regionHi	= tile.hi - tile.windowLo;
+	req.token		= getServiceToken();
+
+	const String request = req.toString();
+	return worker.socket.write(request.getPtr(), request.getLength()) && sendShard(worker.socket, reader, tile);
+}
+
+static bool receiveTile(ShardWorker& worker, const ShardTile& tile, Image& image, F32& buildSeconds, F32& filterSeconds)
+{
+	String reply;
+	Vec2i size, lo, hi;
+	int cached = 0;
+	F32 build = 0.f, filter = 0.f;
+	if(!worker.socket.readLine(reply) || sscanf(reply.getPtr(), "OK %d %d %d %d %d %d %d %f", &size.x, &size.y, &lo.x, &lo.y, &hi.x, &hi.y, &cached, &build) != 8 ||
+	   hi-lo != tile.hi-tile.lo)
+	{
+		printf("  %s: %s\n", worker.name.getPtr(), reply.getLength() ? reply.getPtr() : "no reply");
+		return false;
+	}
+
+	for(int y=tile.lo.y;y<tile.hi.y;y++)
+		if(!worker.socket.read(image.getMutablePtr(Vec2i(tile.lo.x,y)), (S64)(tile.hi.x-tile.lo.x)*sizeof(Vec4f)))
+			return false;
+	if(!worker.socket.readLine(reply) || sscanf(reply.getPtr(), "DONE %f", &filter) != 1)
+		return false;
+
+	buildSeconds += build;
+	filterSeconds += filter;
+	return true;
+}
+
+// Index of a worker whose tile is ready, -1 if none is in flight.
+
+static int waitForTile(const Array<ShardWorker*>& workers)
+{
+#if defined(__linux__)
+	Array<pollfd> fds;
+	Array<int> index;
+	for(int i=0;i<workers.getSize();i++)
+		if(workers[i]->tile != -1)
+		{
+			pollfd& p = fds.add();
+			p.fd		= workers[i]->socket.getFd();
+			p.events	= POLLIN;
+			p.revents	= 0;
+			index.add(i);
+		}
+	if(!fds.getSize() || poll(fds.getPtr(), fds.getSize(), -1) < 0)
+		return (fds.getSize()) ? index[0] : -1;
+	for(int i=0;i<fds.getSize();i++)
+		if(fds[i].revents)
+			return index[i];
+	return index[0];
+#else
+	for(int i=0;i<workers.getSize();i++)
+		if(workers[i]->tile != -1)
+			return i;
+	return -1;
+#endif
+}
+
+static bool reconstructSharded(CliOptions& o, Array<ShardWorker*>& workers, const String& input, const String& output, F64& totalSeconds, S64& totalSamples)
+{
+	FILE* fp = fopen(input.getPtr(), "rb");
+	if(!fp)
+	{
+		printf("%s: not found\n", input.getPtr());
+		return false;
+	}
+	fclose(fp);
+
+	// The samples stay in the file: planning and every tile stream the rows they need.
+
+	Timer timer(true);
+	UVTSampleRowReader reader(input.getPtr());
+	const F32 loadSeconds = timer.end();
+	if(hasError())
+		return false;
+
+	const S64 numSamples = (S64)reader.getWidth()*reader.getHeight()*reader.getNumSamples();
+
+	// Tiles clipped to the crop; their windows stay valid.
+
+	const Vec2i size(reader.getWidth(), reader.getHeight());
+	const Vec2i lo = min(o.cropLo, size);
+	const Vec2i hi = (o.cropHi == Vec2i(0)) ? size : min(max(o.cropHi, lo), size);
+
+	Array<ShardTile> planned;
+	if(!planShardTiles(planned, reader, o.aperture, o.focus, o.tileSize))
+		return false;
+	Array<ShardTile> tiles;
+	S64 shippedSamples = 0;
+	for(int i=0;i<planned.getSize();i++)
+	{
+		ShardTile tile = planned[i];
+		tile.lo = max(tile.lo, lo);
+		tile.hi = min(tile.hi, hi);
+		if(tile.lo.x < tile.hi.x && tile.lo.y < tile.hi.y)
+		{
+			tiles.add(tile);
+			shippedSamples += tile.getNumWindowPixels()*reader.getNumSamples();
+		}
+	}
+	const F32 planSeconds = timer.end();
+
+	// Keep every live worker busy until all tiles are in.
+
+	Image image(size, ImageFormat::RGBA_Vec4f);
+	Array<S32> queue;
+	for(int i=tiles.getSize()-1;i>=0;i--)
+		queue.add(i);
+	int numDone = 0;
+	F32 buildSeconds = 0.f, filterSeconds = 0.f;
+	bool readFailed = false;
+	while(numDone < tiles.getSize())
+	{
+		for(int i=0;i<workers.getSize() && queue.getSize();i++)
+		{
+			ShardWorker& worker = *workers[i];
+			if(worker.tile != -1 || !worker.socket.isOpen())
+				continue;
+			worker.tile = queue.removeLast();
+			if(!dispatchTile(worker, o, reader, tiles[worker.tile]))
+			{
+				// A half-sent shard cannot be resumed. If the input failed, collect the
+				// tiles in flight, so that the next input starts with idle workers.
+
+				readFailed = hasError();
+				if(readFailed)
+					queue.clear();
+				else
+				{
+					printf("  %s: lost, tile requeued\n", worker.name.getPtr());
+					queue.add(worker.tile);
+				}
+				worker.tile = -1;
+				worker.socket.close();
+			}
+		}
+
+		const int ready = waitForTile(workers);
+		if(ready == -1)
+		{
+			if(!readFailed)
+				printf("%s: no workers left\n", input.getPtr());
+			return false;
+		}
+		ShardWorker& worker = *workers[ready];
+		if(receiveTile(worker, tiles[worker.tile], image, buildSeconds, filterSeconds))
+			numDone++;
+		else
+		{
+			printf("  %s: lost, tile requeued\n", worker.name.getPtr());
+			queue.add(worker.tile);
+			worker.socket.close();
+		}
+		worker.tile = -1;
+	}
+	const F32 reconstructSeconds = timer.end();
+
+	Image crop(hi-lo, ImageFormat::RGBA_Vec4f);
+	crop.set(Vec2i(0), image, lo, hi-lo);
+	writeImage(crop, o.gamma, output);
+	const F32 exportSeconds = timer.end();
+	if(hasError())
+		return false;
+
+	printf("%s -> %s (sharded)\n", input.getPtr(), output.getPtr());
+	printf("  %dx%d, %d tile(s) of %dx%d, %d worker(s), halo %.2fx (samples shipped / in the buffer)\n", size.x, size.y, tiles.getSize(),
+		o.tileSize, o.tileSize, workers.getSize(), (F64)shippedSamples/max(numSamples,(S64)1));
+	printf("  load %.3fs, plan %.3fs, reconstruct %.3fs (%.2f Msamples/s), export %.3fs\n", loadSeconds, planSeconds, reconstructSeconds,
+		numSamples/max(reconstructSeconds,1e-6f)*1e-6, exportSeconds);
+	printf("  worker build %.3fs, filter %.3fs (summed over tiles)\n", buildSeconds, filterSeconds);
+
+	totalSeconds += loadSeconds + planSeconds + reconstructSeconds + exportSeconds;
+	totalSamples += numSamples;
+	return true;
+}
+
+// Worker: serves shard requests on one connection until the coordinator closes it.
+
+static void serveShards(CliOptions& o, ServiceSocket& socket)
+{
+	for(;;)
+	{
+		String text, line;
+		while(socket.readLine(line) && line.getLength())
+			text += line + '\n';
+		if(!text.getLength())
+			return;
+
+		ServiceRequest req;
+		if(!req.parse(text.trimEnd()) || req.command != ServiceRequest::Command_Shard)
+		{
+			socket.writeLine("ERROR invalid request");
+			return;
+		}
+		if(!checkServiceToken(req.token))
+		{
+			socket.writeLine("ERROR unauthorized");
+			return;
+		}
+		if(!runShardJob(socket, req, o.params))
+			return;
+		if(hasError())
+			printf("shard: %s\n", clearError().getPtr());
+	}
+}
+
+static void runWorker(CliOptions& o)
+{
+	if(o.workerFd >= 0)
+	{
+		ServiceSocket socket;
+		socket.attach(o.workerFd);
+		serveShards(o, socket);
+		return;
+	}
+
+	if(ServiceSocket::isTcpAddress(o.worker) && !getServiceToken().getLength())
+	{
+		printf("Serving shards on %s needs a shared token in $RECONSTRUCTION_TOKEN\n", o.worker.getPtr());
+		exitCode = 1;
+		return;
+	}
+
+	ServiceSocket listener;
+	if(!listener.listen(o.worker, o.remote))
+	{
+		printf("Cannot listen on %s%s\n", o.worker.getPtr(), (o.remote) ? "" : " (loopback only without -remote)");
+		exitCode = 1;
+		return;
+	}
+	printf("Serving shards on %s, %d thread(s)\n", o.worker.getPtr(), (o.numThreads) ? o.numThreads : MulticoreLauncher::getNumCores());
+	for(;;)
+	{
+		ServiceSocket* socket = listener.accept();
+		if(!socket)
+			break;
+		serveShards(o, *socket);
+		delete socket;
+	}
+}
+
+//-----------------------------------------------------------------------------------------
+// Entry point. The buffers are processed one at a time with all worker threads; -threads
+// caps them, e.g. to run several instances side by side.
+//-----------------------------------------------------------------------------------------
+
+void init(void)
+{
+	CliOptions o;
+	if(!parseOptions(o))
+	{
+		printUsage();
+		exitCode = 1;
+		return;
+	}
+
+	// Pinned threads of every process would take the same first CPUs. A process capped by
+	// -threads may share the machine, so only spawned workers, which get a disjoint affinity
+	// mask from spawnWorker(), pin theirs.
+
+	if(o.numThreads && o.workerFd < 0)
+		MulticoreLauncher::setThreadPinning(false);
+	if(o.numThreads)
+		MulticoreLauncher::setNumThreads(o.numThreads);
+	if(o.worker.getLength() || o.workerFd >= 0)
+	{
+		runWorker(o);
+		return;
+	}
+
+	// -shards=N spawns N workers that split the cores, otherwise it lists worker addresses.
+
+	Array<ShardWorker*> workers;
+	if(o.shards.getLength())
+	{
+		const char* ptr = o.shards.getPtr();
+		S32 numLocal = 0;
+		if(parseInt(ptr, numLocal) && !*ptr)
+		{
+			const int numCores = (o.numThreads) ? o.numThreads : Topology::getNumCpus();
+			const int numWorkerThreads = max(numCores/max(numLocal,1),1);
+			for(int i=0;i<numLocal;i++)
+			{
+				ShardWorker* worker = new ShardWorker;
+				if(spawnWorker(*worker, o, i*numWorkerThreads, numWorkerThreads))
+					workers.add(worker);
+				else
+					delete worker;
+			}
+		}
+		else
+		{
+			Array<String> addresses;
+			o.shards.split(',', addresses);
+			for(int i=0;i<addresses.getSize();i++)
+			{
+				ShardWorker* worker = new ShardWorker;
+				worker->name = addresses[i];
+				if(worker->socket.connect(addresses[i]))
+					workers.add(worker);
+				else
+				{
+					printf("Cannot connect to worker %s\n", addresses[i].getPtr());
+					delete worker;
+				}
+			}
+		}
+		if(!workers.getSize())
+		{
+			printf("No shard workers\n");
+			exitCode = 1;
+			return;
+		}
+	}
+
+	F64 totalSeconds = 0.0;
+	S64 totalSamples = 0;
+	int numFailed = 0;
+	for(int i=0;i<o.inputs.getSize();i++)
+	{
+		const bool ok = (o.service.getLength()) ?	reconstructRemote(o, o.inputs[i], o.outputs[i], totalSeconds) :
+						(workers.getSize()) ?		reconstructSharded(o, workers, o.inputs[i], o.outputs[i], totalSeconds, totalSamples) :
+													reconstructFile(o, o.inputs[i], o.outputs[i], totalSeconds, totalSamples);
+		if(!ok)
+		{
+			if(hasError())
+				printf("%s: %s\n", o.inputs[i].getPtr(), clearError().getPtr());
+			numFailed++;
+		}
+	}
+
+	printf("%d/%d images in %.3fs (%.3f images/s, %.2f Msamples/s), %d thread(s)\n", o.inputs.getSize()-numFailed, o.inputs.getSize(),
+		totalSeconds, (o.inputs.getSize()-numFailed)/max(totalSeconds,1e-6), totalSamples/max(totalSeconds,1e-6)*1e-6,
+		(o.numThreads) ? o.numThreads : MulticoreLauncher::getNumCores());
+	if(numFailed)
+		exitCode = 1;
+
+	// Closing the connections ends the workers.
+
+	for(int i=0;i<workers.getSize();i++)
+	{
+		workers[i]->socket.close();
+#if defined(__linux__)
+		if(workers[i]->pid != -1)
+			waitpid(workers[i]->pid, NULL, 0);
+#endif
+		delete workers[i];
+	}
+}
+
+} //
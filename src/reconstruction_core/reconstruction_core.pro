@@ -0,0 +1,5 @@
+# reconstruction_lib without the CUDA reconstruction, built against framework_core.
+include(../src_core.pri)
+VPATH += ../reconstruction_lib
+include(../reconstruction_lib/common.pri)
+include(../reconstruction_lib/reconstruction.pri)
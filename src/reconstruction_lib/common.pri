@@ -2,9 +2,17 @@ HEADERS += common/CameraParams.hpp \
     common/EdgeFunction.hpp \
     common/Util.hpp \
     common/SampleBuffer.hpp \
-    common/TimeBounds.hpp
+    common/TimeBounds.hpp \
+    common/SyntheticScene.hpp \
+    common/ImageQuality.hpp \
+    common/ReconstructionTuning.hpp \
+    common/ReconstructionService.hpp
 
 SOURCES += common/SampleBuffer.cpp \
     common/Util.cpp \
     common/EdgeFunction.cpp \
-    common/TimeBounds.cpp
+    common/TimeBounds.cpp \
+    common/SyntheticScene.cpp \
+    common/ImageQuality.cpp \
+    common/ReconstructionTuning.cpp \
+    common/ReconstructionService.cpp
@@ -27,8 +27,8 @@
 
 #pragma once
 #include "base/Math.hpp"
-#include "3d/CameraControls.hpp"
 #include "SampleBuffer.hpp"
+#include "ReconstructionTuning.hpp"
 
 namespace FW
 {
@@ -74,18 +74,23 @@ inline float getCocRadius (const Vec2f& coeffs, float cameraSpaceZ)	{ return coe
 class CameraParams
 {
 public:
-	CameraParams(CommonControls* commonControls = NULL, U32 features = CameraControls::Feature_Default) : 
+	CameraParams(void) : 
 		reconstruction			(RECONSTRUCTION_TRIANGLE2),
 		filter					(FILTER_BOX),
 		lensFilter				(LENS_BOX),
 		timeFilter				(TIME_BOX),
-		camera					(commonControls, features),
+		cameraToWorld			(Mat4f::translate(Vec3f(0.f,0.f,1.5f))),
+		cameraFar				(3.f),
 		windowSize				(0),
 		apertureRadius			(0),
 		focusDistance			(1),
 		overrideUVT				(FW_F32_MAX),
 		overrideRefocusDistance	(FW_F32_MAX),
-		enableCuda				(false)
+		enableCuda				(false),
+		lazyGather				(false),
+		numaReplicas			(false),
+		memoryBudget			(0),
+		outOfCoreResident		(0)
 	{
 	}
 
@@ -93,7 +98,8 @@ public:
 	ReconstructionFilter	filter;					// for scanout/resolve
 	LensFilter				lensFilter;				
 	TimeFilter				timeFilter;
-	CameraControls			camera;					// OpenGL camera, essentially
+	Mat4f					cameraToWorld;			// pose of the viewing camera. The app copies it from its CameraControls, the default matches theirs
+	float					cameraFar;				// far plane of the viewing camera
 	Mat4f					projection;				// includes aspect ratio to match Tero's OpenGL rendering
 
 	Vec2i					windowSize;				
@@ -105,6 +111,11 @@ public:
 	float					overrideRefocusDistance;
 
 	bool					enableCuda;
+	bool					lazyGather;				// gather surfaces front-to-back, stop at the first covering one
+	bool					numaReplicas;			// per-node copies of the hierarchy for the filter tasks
+	size_t				memoryBudget;			// bytes for the CPU reconstruction, 0 == unlimited. Picks lower-memory build strategies when exceeded
+	size_t				outOfCoreResident;		// 0 == in-core. Otherwise the hierarchy goes to a mapped file during the build, and the filter keeps this many bytes of it paged in
+	ReconstructionTuning	tuning;					// build/gather constants of the CPU reconstruction
 
 	Mat4f	getWindowScale		(void) const	{ return Mat4f::scale(Vec3f(0.5f*windowSize.x, 0.5f*windowSize.y, 0.5f)) * Mat4f::translate(Vec3f(1.0f)); }	// [-1,1] -> [window size]
 	Mat4f	getInvWindowScale	(void) const	{ return Mat4f::translate(Vec3f(-1.0f)) * Mat4f::scale(Vec3f(2.f/windowSize.x, 2.f/windowSize.y, 2.f)); }	// [window size] -> [-1,1]
@@ -0,0 +1,137 @@
+/*
+ *  Copyright (c) 2010-2011, NVIDIA Corporation
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *      * Redistributions of source code must retain the above copyright
+ *        notice, this list of conditions and the following disclaimer.
+ *      * Redistributions in binary form must reproduce the above copyright
+ *        notice, this list of conditions and the following disclaimer in the
+ *        documentation and/or other materials provided with the distribution.
+ *      * Neither the name of NVIDIA Corporation nor the
+ *        names of its contributors may be used to endorse or promote products
+ *        derived from this software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ *  ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ *  WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ *  DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+ *  DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ *  (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ *  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ *  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ *  (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ *  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "ImageQuality.hpp"
+
+namespace FW
+{
+
+// Separable Gaussian blur with clamp-to-edge, for the SSIM window statistics.
+
+static void gaussianBlur(Array<F32>& data, const Vec2i& size)
+{
+	const int	RADIUS = 5;
+	const F32	SIGMA  = 1.5f;
+
+	F32 kernel[2*RADIUS+1];
+	F32 sum = 0.f;
+	for(int i=-RADIUS;i<=RADIUS;i++)
+		sum += (kernel[i+RADIUS] = exp(-0.5f*i*i/(SIGMA*SIGMA)));
+	for(int i=0;i<2*RADIUS+1;i++)
+		kernel[i] /= sum;
+
+	Array<F32> tmp;
+	tmp.reset(data.getSize());
+
+	for(int y=0;y<size.y;y++)
+	for(int x=0;x<size.x;x++)
+	{
+		F32 v = 0.f;
+		for(int i=-RADIUS;i<=RADIUS;i++)
+			v += kernel[i+RADIUS] * data[y*size.x + clamp(x+i,0,size.x-1)];
+		tmp[y*size.x+x] = v;
+	}
+
+	for(int y=0;y<size.y;y++)
+	for(int x=0;x<size.x;x++)
+	{
+		F32 v = 0.f;
+		for(int i=-RADIUS;i<=RADIUS;i++)
+			v += kernel[i+RADIUS] * tmp[clamp(y+i,0,size.y-1)*size.x + x];
+		data[y*size.x+x] = v;
+	}
+}
+
+ImageQuality compareImages(const Image& image, const Image& reference, Image* errorMap)
+{
+	const Vec2i size = reference.getSize();
+	if(image.getSize() != size || (errorMap && errorMap->getSize() != size))
+		fail("compareImages: image sizes differ");
+
+	const int n = size.x*size.y;
+	const Vec3f lumaWeights(0.299f, 0.587f, 0.114f);
+
+	// Per-pixel error, and the luma products for SSIM.
+
+	Array<F32> mx, my, sxx, syy, sxy;
+	mx.reset(n); my.reset(n); sxx.reset(n); syy.reset(n); sxy.reset(n);
+
+	ImageQuality q;
+	q.maxError = 0.0;
+	F64 sumSquared = 0.0;
+
+	for(int y=0;y<size.y;y++)
+	for(int x=0;x<size.x;x++)
+	{
+		const int i = y*size.x+x;
+		const Vec3f a = clamp(image    .getVec4f(Vec2i(x,y)).getXYZ(), Vec3f(0.f), Vec3f(1.f));
+		const Vec3f b = clamp(reference.getVec4f(Vec2i(x,y)).getXYZ(), Vec3f(0.f), Vec3f(1.f));
+		const Vec3f d = (a-b).abs();
+
+		sumSquared += dot(d,d);
+		q.maxError = max(q.maxError, (F64)d.max());
+		if(errorMap)
+			errorMap->setVec4f(Vec2i(x,y), Vec4f(d, 1.f));
+
+		const F32 la = dot(a,lumaWeights);
+		const F32 lb = dot(b,lumaWeights);
+		mx[i] = la;		sxx[i] = la*la;
+		my[i] = lb;		syy[i] = lb*lb;
+		sxy[i] = la*lb;
+	}
+
+	q.mse  = sumSquared / (3.0*n);
+	q.psnr = (q.mse > 0.0) ? 10.0*log10(1.0/q.mse) : FW_F64_MAX;
+
+	// SSIM (Wang et al. 2004), dynamic range 1.
+
+	gaussianBlur(mx,size);	gaussianBlur(my,size);
+	gaussianBlur(sxx,size);	gaussianBlur(syy,size);	gaussianBlur(sxy,size);
+
+	const F32 C1 = 0.01f*0.01f;
+	const F32 C2 = 0.03f*0.03f;
+	F64 sumSsim = 0.0;
+	for(int i=0;i<n;i++)
+	{
+		const F32 varX	= sxx[i] - mx[i]*mx[i];
+		const F32 varY	= syy[i] - my[i]*my[i];
+		const F32 cov	= sxy[i] - mx[i]*my[i];
+		const F32 ssim	= ((2.f*mx[i]*my[i] + C1) * (2.f*cov + C2)) / ((mx[i]*mx[i] + my[i]*my[i] + C1) * (varX + varY + C2));
+		sumSsim += ssim;
+		if(errorMap)
+		{
+			const Vec2i pos(i%size.x, i/size.x);
+			Vec4f e = errorMap->getVec4f(pos);
+			e.w = ssim;
+			errorMap->setVec4f(pos, e);
+		}
+	}
+	q.ssim = sumSsim / n;
+	return q;
+}
+
+} //
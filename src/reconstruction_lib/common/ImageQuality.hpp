@@ -0,0 +1,50 @@
+/*
+ *  Copyright (c) 2010-2011, NVIDIA Corporation
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *      * Redistributions of source code must retain the above copyright
+ *        notice, this list of conditions and the following disclaimer.
+ *      * Redistributions in binary form must reproduce the above copyright
+ *        notice, this list of conditions and the following disclaimer in the
+ *        documentation and/or other materials provided with the distribution.
+ *      * Neither the name of NVIDIA Corporation nor the
+ *        names of its contributors may be used to endorse or promote products
+ *        derived from this software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ *  ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ *  WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ *  DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+ *  DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ *  (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ *  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ *  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ *  (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ *  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#pragma once
+#include "gui/Image.hpp"
+
+namespace FW
+{
+
+//-------------------------------------------------------------------
+// Full-reference image quality, for guarding approximations against
+// the ground truth. Both images in display space, RGB in [0,1].
+//-------------------------------------------------------------------
+
+struct ImageQuality
+{
+	F64		mse;			// mean over pixels and RGB channels
+	F64		psnr;			// dB, peak 1.0. FW_F64_MAX for identical images
+	F64		ssim;			// mean SSIM of luma, 11x11 Gaussian window (sigma 1.5)
+	F64		maxError;		// largest absolute channel difference
+};
+
+// errorMap (optional, same size): per pixel (|dR|, |dG|, |dB|, local SSIM).
+ImageQuality	compareImages	(const Image& image, const Image& reference, Image* errorMap = NULL);
+
+} //
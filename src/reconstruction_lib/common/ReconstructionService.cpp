@@ -0,0 +1,357 @@
+/*
+ *  Copyright (c) 2010-2011, NVIDIA Corporation
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *      * Redistributions of source code must retain the above copyright
+ *        notice, this list of conditions and the following disclaimer.
+ *      * Redistributions in binary form must reproduce the above copyright
+ *        notice, this list of conditions and the following disclaimer in the
+ *        documentation and/or other materials provided with the distribution.
+ *      * Neither the name of NVIDIA Corporation nor the
+ *        names of its contributors may be used to endorse or promote products
+ *        derived from this software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ *  ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ *  WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ *  DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+ *  DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ *  (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ *  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ *  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ *  (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ *  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "ReconstructionService.hpp"
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#if defined(__linux__)
+#   include <errno.h>
+#   include <netdb.h>
+#   include <netinet/in.h>
+#   include <netinet/tcp.h>
+#   include <sys/socket.h>
+#   include <sys/stat.h>
+#   include <sys/un.h>
+#   include <unistd.h>
+#endif
+
+namespace FW
+{
+
+static const char* s_commandNames[] = { "reconstruct", "stats", "shutdown", "shard" };
+
+//-------------------------------------------------------------------
+
+String ServiceRequest::toString(void) const
+{
+	String s;
+	if(token.getLength())
+		s.appendf("token %s\n", token.getPtr());
+	s.appendf("command %s\n", s_commandNames[command]);
+	if(input.getLength())
+		s.appendf("input %s\n", input.getPtr());
+	s.appendf("aperture %.9g\nfocus %.9g\n", aperture, focus);
+	if(overrideUVT != Vec3f(FW_F32_MAX))
+		s.appendf("uvt %.9g %.9g %.9g\n", overrideUVT.x, overrideUVT.y, overrideUVT.z);
+	s.appendf("filter %d\nlens %d\ntime %d\n", (int)filter, (int)lensFilter, (int)timeFilter);
+	if(origin != Vec2i(0))
+		s.appendf("origin %d %d\n", origin.x, origin.y);
+	if(regionHi != Vec2i(0))
+		s.appendf("region %d %d %d %d\n", regionLo.x, regionLo.y, regionHi.x, regionHi.y);
+	s.append("\n");
+	return s;
+}
+
+bool ServiceRequest::parse(const String& text)
+{
+	*this = ServiceRequest();
+
+	Array<String> lines;
+	text.split('\n', lines);
+	for(int i=0;i<lines.getSize();i++)
+	{
+		const char* ptr = lines[i].getPtr();
+		S32 a, b, c, d;
+		bool ok = true;
+		if(parseLiteral(ptr, "command "))
+		{
+			ok = false;
+			for(int j=0;j<(int)(sizeof(s_commandNames)/sizeof(s_commandNames[0]));j++)
+				if(!strcmp(ptr, s_commandNames[j]))
+				{
+					command = (Command)j;
+					ptr += strlen(ptr);
+					ok = true;
+				}
+		}
+		else if(parseLiteral(ptr, "token "))		{ token = ptr; ptr += strlen(ptr); }
+		else if(parseLiteral(ptr, "input "))		{ input = ptr; ptr += strlen(ptr); }
+		else if(parseLiteral(ptr, "aperture "))		ok = parseFloat(ptr, aperture);
+		else if(parseLiteral(ptr, "focus "))		ok = parseFloat(ptr, focus);
+		else if(parseLiteral(ptr, "uvt "))			ok = parseFloat(ptr, overrideUVT.x) && parseSpace(ptr) && parseFloat(ptr, overrideUVT.y) && parseSpace(ptr) && parseFloat(ptr, overrideUVT.z);
+		else if(parseLiteral(ptr, "filter "))		{ ok = parseInt(ptr, a) && a>=FILTER_BOX && a<=FILTER_BICUBIC;	filter = (ReconstructionFilter)a; }
+		else if(parseLiteral(ptr, "lens "))			{ ok = parseInt(ptr, a) && a>=LENS_BOX && a<=LENS_GAUSSIAN;		lensFilter = (LensFilter)a; }
+		else if(parseLiteral(ptr, "time "))			{ ok = parseInt(ptr, a) && a>=TIME_BOX && a<=TIME_GAUSSIAN;		timeFilter = (TimeFilter)a; }
+		else if(parseLiteral(ptr, "origin "))
+		{
+			ok = parseInt(ptr, a) && parseSpace(ptr) && parseInt(ptr, b);
+			origin = Vec2i(a,b);
+		}
+		else if(parseLiteral(ptr, "region "))
+		{
+			ok = parseInt(ptr, a) && parseSpace(ptr) && parseInt(ptr, b) && parseSpace(ptr) && parseInt(ptr, c) && parseSpace(ptr) && parseInt(ptr, d);
+			regionLo = Vec2i(a,b);
+			regionHi = Vec2i(c,d);
+		}
+
+		parseSpace(ptr);
+		if(!ok || *ptr)
+			return false;
+	}
+	return true;
+}
+
+//-------------------------------------------------------------------
+
+String getServiceToken(void)
+{
+	const char* token = getenv("RECONSTRUCTION_TOKEN");
+	return String((token) ? token : "").trim();
+}
+
+bool checkServiceToken(const String& token)
+{
+	const String expected = getServiceToken();
+	if(!expected.getLength())
+		return true;
+
+	int diff = token.getLength() ^ expected.getLength();
+	for(int i=0;i<expected.getLength();i++)
+		diff |= expected[i] ^ ((i < token.getLength()) ? token[i] : 0);
+	return diff == 0;
+}
+
+// "host:port" or ":port" is TCP, anything else a Unix socket path.
+
+bool ServiceSocket::isTcpAddress(const String& path)
+{
+	return path.lastIndexOf(':') != -1 && !path.startsWith("/") && !path.startsWith(".");
+}
+
+//-------------------------------------------------------------------
+
+#if defined(__linux__)
+
+// ":port" is 127.0.0.1, or 0.0.0.0 for a server on any interface. The caller frees the result.
+
+static addrinfo* resolveAddress(const String& path, bool anyInterface)
+{
+	const int colon = path.lastIndexOf(':');
+	addrinfo hints;
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_socktype = SOCK_STREAM;
+
+	if(!ServiceSocket::isTcpAddress(path))
+	{
+		sockaddr_un* addr = new sockaddr_un;
+		memset(addr, 0, sizeof(*addr));
+		addr->sun_family = AF_UNIX;
+		if(path.getLength() >= (int)sizeof(addr->sun_path))
+		{
+			delete addr;
+			return NULL;
+		}
+		strcpy(addr->sun_path, path.getPtr());
+
+		addrinfo* ai = new addrinfo(hints);
+		ai->ai_family	= AF_UNIX;
+		ai->ai_addr		= (sockaddr*)addr;
+		ai->ai_addrlen	= sizeof(*addr);
+		return ai;
+	}
+
+	const String host = path.substring(0, colon);
+	const String port = path.substring(colon+1);
+	hints.ai_family = (host.getLength()) ? AF_UNSPEC : AF_INET;
+	hints.ai_flags = (anyInterface) ? AI_PASSIVE : 0;
+	addrinfo* result = NULL;
+	if(getaddrinfo(host.getLength() ? host.getPtr() : NULL, port.getPtr(), &hints, &result) != 0)
+		return NULL;
+	return result;
+}
+
+static void freeAddress(addrinfo* ai)
+{
+	if(ai && ai->ai_family == AF_UNIX)
+	{
+		delete (sockaddr_un*)ai->ai_addr;
+		delete ai;
+	}
+	else if(ai)
+		freeaddrinfo(ai);
+}
+
+static bool isLoopback(const addrinfo* ai)
+{
+	if(ai->ai_family == AF_INET)
+		return (ntohl(((const sockaddr_in*)ai->ai_addr)->sin_addr.s_addr) >> 24) == 127;
+	if(ai->ai_family == AF_INET6)
+		return IN6_IS_ADDR_LOOPBACK(&((const sockaddr_in6*)ai->ai_addr)->sin6_addr) != 0;
+	return ai->ai_family == AF_UNIX;
+}
+
+bool ServiceSocket::listen(const String& path, bool allowRemote)
+{
+	close();
+	addrinfo* ai = resolveAddress(path, allowRemote);
+	if(!ai)
+		return false;
+	if(!allowRemote && !isLoopback(ai))
+	{
+		freeAddress(ai);
+		return false;
+	}
+
+	m_fd = socket(ai->ai_family, SOCK_STREAM, 0);
+	if(m_fd != -1)
+	{
+		const int one = 1;
+		if(ai->ai_family == AF_UNIX)
+			unlink(path.getPtr());
+		else
+			setsockopt(m_fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+		const mode_t mask = umask(0077);		// the socket file is created owner-only, no window before a chmod
+		const bool bound = (bind(m_fd, ai->ai_addr, ai->ai_addrlen) == 0);
+		umask(mask);
+		if(!bound || ::listen(m_fd, 16) != 0)
+			close();
+		else if(ai->ai_family == AF_UNIX)
+			m_path = path;
+	}
+	freeAddress(ai);
+	return isOpen();
+}
+
+bool ServiceSocket::connect(const String& path)
+{
+	close();
+	addrinfo* ai = resolveAddress(path, false);
+	if(!ai)
+		return false;
+
+	m_fd = socket(ai->ai_family, SOCK_STREAM, 0);
+	if(m_fd != -1 && ::connect(m_fd, ai->ai_addr, ai->ai_addrlen) != 0)
+		close();
+	if(m_fd != -1 && ai->ai_family != AF_UNIX)
+	{
+		const int one = 1;
+		setsockopt(m_fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));	// request lines are small
+	}
+	freeAddress(ai);
+	return isOpen();
+}
+
+ServiceSocket* ServiceSocket::accept(void)
+{
+	int fd = ::accept(m_fd, NULL, NULL);
+	if(fd == -1)
+		return NULL;
+	ServiceSocket* s = new ServiceSocket;
+	s->m_fd = fd;
+	return s;
+}
+
+void ServiceSocket::close(void)
+{
+	if(m_fd != -1)
+		::close(m_fd);
+	if(m_path.getLength())
+		unlink(m_path.getPtr());
+	m_fd = -1;
+	m_path = "";
+}
+
+bool ServiceSocket::write(const void* data, S64 size)
+{
+	const char* ptr = (const char*)data;
+	while(size > 0)
+	{
+		const ssize_t n = send(m_fd, ptr, (size_t)min(size, (S64)1<<30), MSG_NOSIGNAL);	// a closed peer is an error, not SIGPIPE
+		if(n < 0 && errno == EINTR)
+			continue;
+		if(n <= 0)
+			return false;
+		ptr += n;
+		size -= n;
+	}
+	return true;
+}
+
+bool ServiceSocket::read(void* data, S64 size)
+{
+	char* ptr = (char*)data;
+	while(size > 0)
+	{
+		const ssize_t n = recv(m_fd, ptr, (size_t)min(size, (S64)1<<30), 0);
+		if(n < 0 && errno == EINTR)
+			continue;
+		if(n <= 0)
+			return false;
+		ptr += n;
+		size -= n;
+	}
+	return true;
+}
+
+int ServiceSocket::receive(Array<char>& buffer)
+{
+	char tmp[4096];
+	ssize_t n;
+	do
+		n = recv(m_fd, tmp, sizeof(tmp), 0);
+	while(n < 0 && errno == EINTR);
+	if(n > 0)
+		buffer.add(tmp, (int)n);
+	return (n < 0) ? -1 : (int)n;
+}
+
+#else
+
+bool			ServiceSocket::listen	(const String&, bool)	{ return false; }	// not ported
+bool			ServiceSocket::connect	(const String&)			{ return false; }
+ServiceSocket*	ServiceSocket::accept	(void)					{ return NULL; }
+void			ServiceSocket::close	(void)					{ m_fd = -1; }
+bool			ServiceSocket::write	(const void*, S64)		{ return false; }
+bool			ServiceSocket::read		(void*, S64)			{ return false; }
+int				ServiceSocket::receive	(Array<char>&)			{ return -1; }
+
+#endif
+
+//-------------------------------------------------------------------
+
+bool ServiceSocket::writeLine(const String& line)
+{
+	const String s = line + '\n';
+	return write(s.getPtr(), s.getLength());
+}
+
+bool ServiceSocket::readLine(String& line)
+{
+	line = "";
+	char c;
+	while(read(&c, 1))
+	{
+		if(c == '\n')
+			return true;
+		line.append(c);
+	}
+	return false;
+}
+
+} //
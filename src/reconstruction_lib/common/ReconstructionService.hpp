@@ -0,0 +1,149 @@
+/*
+ *  Copyright (c) 2010-2011, NVIDIA Corporation
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *      * Redistributions of source code must retain the above copyright
+ *        notice, this list of conditions and the following disclaimer.
+ *      * Redistributions in binary form must reproduce the above copyright
+ *        notice, this list of conditions and the following disclaimer in the
+ *        documentation and/or other materials provided with the distribution.
+ *      * Neither the name of NVIDIA Corporation nor the
+ *        names of its contributors may be used to endorse or promote products
+ *        derived from this software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ *  ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ *  WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ *  DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+ *  DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ *  (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ *  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ *  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ *  (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ *  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#pragma once
+#include "CameraParams.hpp"
+#include "base/String.hpp"
+
+namespace FW
+{
+
+//-------------------------------------------------------------------
+// Protocol of reconstruction_service, a long-running process that
+// keeps sample buffers and hierarchies cached between requests, and of
+// its client (reconstruction_cli -service=<socket>).
+//
+// A request is "key value" lines ended by an empty line:
+//   token <secret>						(getServiceToken(), if the server has one)
+//   command reconstruct|stats|shutdown|shard	(default reconstruct)
+//   input <file>
+//   origin <x> <y>						(shard: TreeGather::setPixelOffset)
+//   aperture <scale>, focus <scale>	(TreeGather adjust factors)
+//   uvt <u> <v> <t>					(CameraParams::overrideUVT)
+//   filter <n>, lens <n>, time <n>		(scanout, lens and time filters)
+//   region <x0> <y0> <x1> <y1>			(TreeGather::setRegion)
+// A reconstruct reply is "OK <w> <h> <x0> <y0> <x1> <y1> <cached> <buildSeconds>",
+// then the rows y0..y1-1 of the region as RGBA F32, streamed in bands
+// as they are filtered, then "DONE <filterSeconds>". Other replies are
+// a single line: "OK ..." or "ERROR <message>". The service answers
+// "ERROR request too long" and closes the connection if 64KB arrive
+// without the empty line.
+// A shard request carries its samples after the empty line instead of
+// an input file (see ReconstructionShard.hpp) and is answered like
+// reconstruct.
+//-------------------------------------------------------------------
+
+struct ServiceRequest
+{
+	enum Command
+	{
+		Command_Reconstruct = 0,
+		Command_Stats,
+		Command_Shutdown,
+		Command_Shard,
+	};
+
+	ServiceRequest(void) :
+		command		(Command_Reconstruct),
+		aperture	(1.f),
+		focus		(1.f),
+		overrideUVT	(FW_F32_MAX),
+		filter		(FILTER_BOX),
+		lensFilter	(LENS_BOX),
+		timeFilter	(TIME_BOX),
+		origin		(0),
+		regionLo	(0),
+		regionHi	(0)
+	{
+	}
+
+	Command					command;
+	String					token;
+	String					input;
+	F32						aperture;
+	F32						focus;
+	Vec3f					overrideUVT;
+	ReconstructionFilter	filter;
+	LensFilter				lensFilter;
+	TimeFilter				timeFilter;
+	Vec2i					origin;
+	Vec2i					regionLo;
+	Vec2i					regionHi;			// (0,0) == whole image
+
+	String	toString	(void) const;			// including the terminating empty line
+	bool	parse		(const String& text);	// false on unknown keys or malformed values
+};
+
+//-------------------------------------------------------------------
+// Shared secret of the service or shard workers and their clients,
+// from $RECONSTRUCTION_TOKEN (not an argument, which other users could
+// see). A server with a token rejects requests that lack it, and a TCP
+// server without one does not start.
+//-------------------------------------------------------------------
+
+String	getServiceToken		(void);							// "" if unset
+bool	checkServiceToken	(const String& token);			// against getServiceToken(), in constant time
+
+//-------------------------------------------------------------------
+// Blocking stream socket; the server polls getFd(). Addresses are Unix
+// socket paths, which only the owner may connect to, or "host:port" for
+// TCP between nodes. Listening on TCP is limited to the loopback
+// interface (":port") unless allowRemote is set; then ":port" is all
+// interfaces.
+//-------------------------------------------------------------------
+
+class ServiceSocket
+{
+public:
+					ServiceSocket		(void) : m_fd(-1)		{}
+					~ServiceSocket		(void)					{ close(); }
+
+	static bool		isTcpAddress		(const String& path);
+	bool			listen				(const String& path, bool allowRemote = false);	// replaces a stale socket file
+	bool			connect				(const String& path);
+	ServiceSocket*	accept				(void);					// NULL on failure
+	void			attach				(int fd)				{ close(); m_fd = fd; }	// takes ownership, e.g. of a socketpair() end
+	void			close				(void);
+
+	bool			isOpen				(void) const			{ return m_fd != -1; }
+	int				getFd				(void) const			{ return m_fd; }
+
+	bool			write				(const void* data, S64 size);
+	bool			writeLine			(const String& line);	// appends '\n'
+	bool			read				(void* data, S64 size);	// all or nothing
+	bool			readLine			(String& line);			// without '\n'
+	int				receive				(Array<char>& buffer);	// appends what is available, 0 when closed, -1 on error
+
+private:
+					ServiceSocket		(const ServiceSocket&);	// forbidden
+	ServiceSocket&	operator=			(const ServiceSocket&);	// forbidden
+
+	int				m_fd;
+	String			m_path;					// unlinked by close() if listening
+};
+
+} //
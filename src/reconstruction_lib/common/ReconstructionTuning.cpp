@@ -0,0 +1,159 @@
+/*
+ *  Copyright (c) 2010-2011, NVIDIA Corporation
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *      * Redistributions of source code must retain the above copyright
+ *        notice, this list of conditions and the following disclaimer.
+ *      * Redistributions in binary form must reproduce the above copyright
+ *        notice, this list of conditions and the following disclaimer in the
+ *        documentation and/or other materials provided with the distribution.
+ *      * Neither the name of NVIDIA Corporation nor the
+ *        names of its contributors may be used to endorse or promote products
+ *        derived from this software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ *  ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ *  WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ *  DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+ *  DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ *  (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ *  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ *  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ *  (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ *  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "ReconstructionTuning.hpp"
+#include "SampleBuffer.hpp"
+#include "CameraParams.hpp"
+#include "base/MulticoreLauncher.hpp"
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#if !defined(_MSC_VER)
+#   include <unistd.h>
+#endif
+
+namespace FW
+{
+
+String ReconstructionTuning::toString(void) const
+{
+	return sprintf("%d %d %d %d %.9g %.9g", maxLeafSize, frontierLimit, numTasksLog2, initialLeafArea, sameSurfaceUVRange, earlyOutThreshold);
+}
+
+//-------------------------------------------------------------------
+
+bool ReconstructionTuning::load(const String& fileName, const String& machine, const String& sceneClass)
+{
+	FILE* fp = fopen(fileName.getPtr(), "rt");
+	if(!fp)
+		return false;
+
+	bool found = false;
+	char line[1024];
+	while(!found && fgets(line, sizeof(line), fp))
+	{
+		char m[256], s[256];
+		ReconstructionTuning t;
+		if(line[0]=='#' || sscanf(line, "%255s %255s %d %d %d %d %f %f", m, s,
+			&t.maxLeafSize, &t.frontierLimit, &t.numTasksLog2, &t.initialLeafArea, &t.sameSurfaceUVRange, &t.earlyOutThreshold) != 8)
+			continue;
+		if(machine == m && sceneClass == s)
+		{
+			*this = t;
+			found = true;
+		}
+	}
+	fclose(fp);
+	return found;
+}
+
+bool ReconstructionTuning::save(const String& fileName, const String& machine, const String& sceneClass, F32 seconds) const
+{
+	// Keep the other entries.
+
+	Array<String> lines;
+	FILE* fp = fopen(fileName.getPtr(), "rt");
+	if(fp)
+	{
+		char line[1024];
+		while(fgets(line, sizeof(line), fp))
+		{
+			char m[256], s[256];
+			if(line[0]!='#' && sscanf(line, "%255s %255s", m, s) == 2 && machine == m && sceneClass == s)
+				continue;
+			lines.add(line);
+		}
+		fclose(fp);
+	}
+	if(!lines.getSize())
+		lines.add("# machine sceneClass maxLeafSize frontierLimit numTasksLog2 initialLeafArea sameSurfaceUVRange earlyOutThreshold seconds\n");
+	lines.add(sprintf("%s %s %s %.4f\n", machine.getPtr(), sceneClass.getPtr(), toString().getPtr(), seconds));
+
+	fp = fopen(fileName.getPtr(), "wt");
+	if(!fp)
+		return false;
+	for(int i=0;i<lines.getSize();i++)
+		fputs(lines[i].getPtr(), fp);
+	fclose(fp);
+	return true;
+}
+
+//-------------------------------------------------------------------
+
+String ReconstructionTuning::getMachineName(void)
+{
+	char host[256] = "unknown";
+#if defined(_MSC_VER)
+	const char* name = getenv("COMPUTERNAME");
+	if(name)
+		_snprintf(host, sizeof(host)-1, "%s", name);
+#else
+	if(gethostname(host, sizeof(host)-1) != 0)
+		strcpy(host, "unknown");
+	host[sizeof(host)-1] = 0;
+#endif
+	return sprintf("%s-%dc", host, MulticoreLauncher::getNumCores());
+}
+
+// Mean |CoC| and screen-space motion over a subset of the samples, in pixels: below 1 is "sharp"/"static",
+// below 8 "dof"/"motion", above that "largedof"/"fastmotion".
+
+String ReconstructionTuning::getSceneClass(const UVTSampleBuffer& sbuf)
+{
+	const int w = sbuf.getWidth();
+	const int h = sbuf.getHeight();
+	const Vec2f cocCoeffs = sbuf.getCocCoeffs();
+
+	F64 sumCoc = 0.0, sumMotion = 0.0;
+	int num = 0, spp = 0;
+	for(int y=0;y<h;y+=7)
+	for(int x=0;x<w;x+=7)
+	for(int i=0;i<sbuf.getNumSamples(x,y);i++)
+	{
+		const float sw = sbuf.getSampleW(x,y,i);
+		if(sw <= 0.f)
+			continue;
+		const Vec3f mv = sbuf.getSampleMV(x,y,i);
+		const Vec2f p  = sbuf.getSampleXY(x,y,i);
+		const Vec3f P  = Vec3f(p*sw, sw) + mv;
+		sumCoc    += fabs(getCocRadius(cocCoeffs, sw));
+		sumMotion += (P.z > 0.f) ? (P.getXY()/P.z - p).length() : 0.0;
+		num++;
+	}
+	for(int y=0;y<h;y+=7)
+	for(int x=0;x<w;x+=7)
+		spp = max(spp, sbuf.getNumSamples(x,y));
+
+	const F64 coc    = (num) ? sumCoc/num : 0.0;
+	const F64 motion = (num) ? sumMotion/num : 0.0;
+	return sprintf("spp%d-%s-%s", spp,
+		(coc < 1.0) ? "sharp" : (coc < 8.0) ? "dof" : "largedof",
+		(motion < 1.0) ? "static" : (motion < 8.0) ? "motion" : "fastmotion");
+}
+
+} //
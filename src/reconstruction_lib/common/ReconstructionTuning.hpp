@@ -0,0 +1,73 @@
+/*
+ *  Copyright (c) 2010-2011, NVIDIA Corporation
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *      * Redistributions of source code must retain the above copyright
+ *        notice, this list of conditions and the following disclaimer.
+ *      * Redistributions in binary form must reproduce the above copyright
+ *        notice, this list of conditions and the following disclaimer in the
+ *        documentation and/or other materials provided with the distribution.
+ *      * Neither the name of NVIDIA Corporation nor the
+ *        names of its contributors may be used to endorse or promote products
+ *        derived from this software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ *  ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ *  WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ *  DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+ *  DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ *  (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ *  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ *  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ *  (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ *  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#pragma once
+#include "base/String.hpp"
+
+namespace FW
+{
+
+class UVTSampleBuffer;
+
+//-------------------------------------------------------------------
+// Build and gather constants of TreeGather. The defaults are the
+// values of the paper; reconstruction_bench tune searches them per
+// machine and scene class and stores the best in a tuning file.
+//-------------------------------------------------------------------
+
+struct ReconstructionTuning
+{
+	ReconstructionTuning(void) :
+		maxLeafSize			(48),
+		frontierLimit		(4),
+		numTasksLog2		(5),
+		initialLeafArea		(64),
+		sameSurfaceUVRange	(0.0883883476f),	// 1/sqrt(128)
+		earlyOutThreshold	(2.f)
+	{
+	}
+
+	S32		maxLeafSize;			// target #samples per leaf, sets the reprojection grid scale
+	S32		frontierLimit;			// nodes emitNodes() leaves in each build task's frontier
+	S32		numTasksLog2;			// #parallel build tasks = 2^n, [1,8]
+	S32		initialLeafArea;		// buildInitialRecursive() considers a leaf at or below this many buckets
+	F32		sameSurfaceUVRange;		// half-size of the uv box of the SameSurface test (Sec. 3.2)
+	F32		earlyOutThreshold;		// CoC/motion tolerance of the surface early-out in buildRecursive()
+
+	bool	operator==			(const ReconstructionTuning& o) const	{ return maxLeafSize==o.maxLeafSize && frontierLimit==o.frontierLimit && numTasksLog2==o.numTasksLog2 && initialLeafArea==o.initialLeafArea && sameSurfaceUVRange==o.sameSurfaceUVRange && earlyOutThreshold==o.earlyOutThreshold; }
+	String	toString			(void) const;
+
+	// Tuning file: one line per (machine, scene class). load() leaves *this unchanged if there is no entry.
+
+	bool	load				(const String& fileName, const String& machine, const String& sceneClass);
+	bool	save				(const String& fileName, const String& machine, const String& sceneClass, F32 seconds) const;
+
+	static String	getMachineName	(void);									// host name and core count
+	static String	getSceneClass	(const UVTSampleBuffer& sbuf);			// spp, defocus and motion magnitude
+};
+
+} //
@@ -35,7 +35,6 @@
 #include "Util.hpp"
 #include "base/Sort.hpp"
 #include "gui/Image.hpp"
-#include "3d/ConvexPolyhedron.hpp"
 #include <cstdio>
 
 namespace
@@ -214,7 +213,40 @@ void SampleBuffer::scanOut(Image& image, const CameraParams& params) const
 
 //-------------------------------------------------------------------
 
-UVTSampleBuffer::UVTSampleBuffer(int w,int h, int numSamplesPerPixel)
+static void parseTextEntry(const char* line, Entry& e)
+{
+	const int NUM_ARGS = sizeof(Entry)/sizeof(float);
+	float* vals = &e.x;
+	const char* linePtr = line;
+	int numRead = 0;
+	for(int v=0;v<NUM_ARGS;v++)
+	{
+		if(v>0)
+		{
+			while(*linePtr!=',' && *linePtr!='\n')
+				linePtr++;
+			linePtr++;	// skip ','
+		}
+
+		parseFloat(linePtr,vals[v]);
+		numRead++;
+	}
+	FW_ASSERT(numRead == NUM_ARGS);
+}
+
+static void setEntry(UVTSampleBuffer& sbuf, int x,int y,int i, const Entry& e)
+{
+	sbuf.setSampleXY			(x,y,i, Vec2f(e.x,e.y));
+	sbuf.setSampleDepth			(x,y,i, e.z);
+	sbuf.setSampleW				(x,y,i, e.w);
+	sbuf.setSampleUV			(x,y,i, Vec2f(e.u,e.v));
+	sbuf.setSampleT 			(x,y,i, e.t);
+	sbuf.setSampleColor			(x,y,i, Vec4f(e.r,e.g,e.b,1));			// TODO: alpha
+	sbuf.setSampleMV			(x,y,i, Vec3f(e.mv_x,e.mv_y,e.mv_w));
+	sbuf.setSampleWG			(x,y,i, Vec2f(e.dwdx,e.dwdy));
+}
+
+UVTSampleBuffer::UVTSampleBuffer(int w,int h, int numSamplesPerPixel, int firstRow)
 : SampleBuffer(w,h,numSamplesPerPixel)
 {
 	Random random(1);
@@ -235,7 +267,7 @@ UVTSampleBuffer::UVTSampleBuffer(int w,int h, int numSamplesPerPixel)
 	}
 
 //  generateSobol(random);
-    generateSobolCoop(random);
+    generateSobolCoop(random, firstRow);
 }
 
 
@@ -302,54 +334,14 @@ UVTSampleBuffer::UVTSampleBuffer(const char* filename)
 				for(int i=0;i<getNumSamples(x,y);i++)
 				{
 					fgets(line,4096,fp);
-					const char* linePtr = line;
-					const int NUM_ARGS = sizeof(Entry)/sizeof(float);
-					float vals[NUM_ARGS];
-					int numRead = 0;
-					for(int v=0;v<NUM_ARGS;v++)
-					{
-						if(v>0)
-						{
-							while(*linePtr!=',' && *linePtr!='\n')
-								linePtr++;
-							linePtr++;	// skip ','
-						}
-
-						parseFloat(linePtr,vals[v]);
-						numRead++;
-					}
-
 					Entry e;
-					e.x    = vals[0];
-					e.y    = vals[1];
-					e.z    = vals[2];
-					e.w    = vals[3];
-					e.u    = vals[4];
-					e.v    = vals[5];
-					e.t    = vals[6];
-					e.r    = vals[7];
-					e.g    = vals[8];
-					e.b    = vals[9];
-					e.a    = vals[10];
-					e.mv_x = vals[11];
-					e.mv_y = vals[12];
-					e.mv_w = vals[13];
-					e.dwdx = vals[14];
-					e.dwdy = vals[15];
-
-					FW_ASSERT(numRead == NUM_ARGS);
+					parseTextEntry(line, e);
+
 					FW_ASSERT(e.x>=0 && e.y>=0 && e.x<m_width && e.y<m_height);
 					FW_ASSERT(e.u>=-1 && e.v>=-1 && e.u<=1 && e.v<=1);
 					FW_ASSERT(e.t>=0 && e.t<=1);
 
-					setSampleXY				(x,y,i, Vec2f(e.x,e.y));
-					setSampleDepth			(x,y,i, e.z);
-					setSampleW				(x,y,i, e.w);
-					setSampleUV				(x,y,i, Vec2f(e.u,e.v));
-					setSampleT 				(x,y,i, e.t);
-					setSampleColor			(x,y,i, Vec4f(e.r,e.g,e.b,1));			// TODO: alpha
-					setSampleMV				(x,y,i, Vec3f(e.mv_x,e.mv_y,e.mv_w));
-					setSampleWG				(x,y,i, Vec2f(e.dwdx,e.dwdy));
+					setEntry(*this, x,y,i, e);
 				}
 
 				printf("%d%%\r", 100*y/m_height);
@@ -368,18 +360,7 @@ UVTSampleBuffer::UVTSampleBuffer(const char* filename)
 			{
 				for(int x=0;x<m_width;x++)
 				for(int i=0;i<getNumSamples(x,y);i++)
-				{
-					const Entry& e = entries[sidx++];
-
-					setSampleXY				(x,y,i, Vec2f(e.x,e.y));
-					setSampleDepth			(x,y,i, e.z);
-					setSampleW				(x,y,i, e.w);
-					setSampleUV				(x,y,i, Vec2f(e.u,e.v));
-					setSampleT 				(x,y,i, e.t);
-					setSampleColor			(x,y,i, Vec4f(e.r,e.g,e.b,1));			// TODO: alpha
-					setSampleMV				(x,y,i, Vec3f(e.mv_x,e.mv_y,e.mv_w));
-					setSampleWG				(x,y,i, Vec2f(e.dwdx,e.dwdy));
-				}
+					setEntry(*this, x,y,i, entries[sidx++]);
 				printf("%d%%\r", 100*y/m_height);
 			}
 		}
@@ -393,6 +374,104 @@ UVTSampleBuffer::UVTSampleBuffer(const char* filename)
 	printf("done\n");
 }
 
+// Same header parsing as the constructor, without reading the samples.
+
+static S64 tellFile(FILE* fp)
+{
+#if defined(_MSC_VER)
+	return _ftelli64(fp);
+#else
+	return (S64)ftello(fp);
+#endif
+}
+
+static void seekFile(FILE* fp, S64 offset)
+{
+#if defined(_MSC_VER)
+	_fseeki64(fp, offset, SEEK_SET);
+#else
+	fseeko(fp, (off_t)offset, SEEK_SET);
+#endif
+}
+
+static bool readHeader13(FILE* fph, int& w, int& h, int& spp, Vec2f& cocCoeffs, bool& binary, String& error)
+{
+	float version = 0.f;
+	w = h = spp = 0;
+	binary = false;
+	bool ok = (fscanf(fph, "Version %f\n", &version) == 1 && fscanf(fph, "Width %d\n", &w) == 1 &&
+			   fscanf(fph, "Height %d\n", &h) == 1 && fscanf(fph, "Samples per pixel %d\n", &spp) == 1);
+	if(!ok || version != 1.3f)
+		error = sprintf("unsupported sample stream version (%.1f)", version);
+	else if(w <= 0 || h <= 0 || spp <= 0 || (S64)w*h*spp > FW_S32_MAX)
+		error = sprintf("invalid size %dx%dx%d", w, h, spp);
+	else
+	{
+		char motionModel[1024];
+		fscanf(fph, "Motion model: %1023s\n", motionModel);
+		ok = (fscanf(fph, "CoC coefficients (coc radius = C0/w+C1): %f,%f\n", &cocCoeffs[0],&cocCoeffs[1]) == 2);
+		char encoding[1024];
+		if(fscanf(fph, "Encoding = %1023s\n", encoding)==1)
+			binary = String(encoding) == String("binary");
+		fscanf(fph, "\n");
+		char descriptor[1024];
+		fscanf(fph, "%1023s\n", descriptor);
+		if(!ok)
+			error = "missing CoC coefficients";
+	}
+	return !error.getLength();
+}
+
+bool UVTSampleBuffer::probe(const char* filename, String& error)
+{
+	error.reset();
+	FILE* fp  = fopen(filename, "rb");
+	if(!fp)
+	{
+		error = "file not found";
+		return false;
+	}
+	FILE* fph = fopen((String(filename)+String(".header")).getPtr(),"rt");
+	bool separateHeader = (fph!=NULL);
+	if(!separateHeader)
+		fph = fp;
+
+	int w, h, spp;
+	Vec2f cocCoeffs;
+	bool binary;
+	readHeader13(fph, w, h, spp, cocCoeffs, binary, error);
+
+	// The samples must all be there: the constructor does not check its reads.
+
+	if(!error.getLength())
+	{
+		const S64 num = (S64)w*h*spp;
+		if(binary)
+		{
+			const S64 start = (separateHeader) ? 0 : tellFile(fp);
+			fseek(fp, 0, SEEK_END);
+			if(tellFile(fp) - start < num*(S64)sizeof(Entry))
+				error = sprintf("truncated, %lld of %lld bytes of samples", (long long)(tellFile(fp)-start), (long long)(num*sizeof(Entry)));
+		}
+		else
+		{
+			S64 numLines = 0;
+			char buf[65536];
+			size_t n;
+			while(numLines < num && (n = fread(buf, 1, sizeof(buf), fp)) > 0)
+				for(size_t i=0;i<n;i++)
+					numLines += (buf[i] == '\n');
+			if(numLines < num)
+				error = sprintf("truncated, %lld of %lld samples", (long long)numLines, (long long)num);
+		}
+	}
+
+	fclose(fp);
+	if(separateHeader)
+		fclose(fph);
+	return !error.getLength();
+}
+
 Vec4f UVTSampleBuffer::getXYWFrom(int x,int y,int i, const Vec2f uv, bool homogeneous) const
 {
 	// NOTE: No longer reprojects t. 
@@ -408,6 +487,79 @@ Vec4f UVTSampleBuffer::getXYWFrom(int x,int y,int i, const Vec2f uv, bool homoge
 	return xyw;
 }
 
+//-------------------------------------------------------------------
+// Version 1.3 writer, shared by serialize() and serializeBinaryBand().
+//-------------------------------------------------------------------
+
+static void writeHeader13(FILE* fph, const UVTSampleBuffer& sbuf, int height, bool binary)
+{
+	const Vec2f& cocCoeff = sbuf.getCocCoeffs();
+	if(cocCoeff == Vec2f(FW_F32_MAX,FW_F32_MAX))
+		fail("coc coefficients not set");
+
+	// header
+	fprintf(fph, "Version 1.3\n");
+	fprintf(fph, "Width %d\n", sbuf.getWidth());
+	fprintf(fph, "Height %d\n", height);
+	fprintf(fph, "Samples per pixel %d\n", sbuf.getNumSamples());
+	//fprintf(fph, "Motion model: %s\n", m_affineMotion ? "affine" : "perspective");	// deprecated
+	fprintf(fph, "CoC coefficients (coc radius = C0/w+C1): %f,%f\n", cocCoeff[0], cocCoeff[1]);
+	fprintf(fph, "Encoding = %s\n", binary ? "binary" : "text");
+	fprintf(fph, "x,y,z/w,w,u,v,t,r,g,b,a,mv_x,mv_y,mv_w,dwdx,dwdy\n");
+
+	// Using Wikipedia's terminology
+	//
+	//    c = AD * (objectDist-focusDist)/objectDist * f/(focusDist-f)
+	// => c = AD * f/(focusDist-f) * (1-focusDist/objectDist)
+	// => c = C1 * (1-focusDist/objectDist)
+	// => c = C1 - C1*focusDist/objectDist
+	// => c = C1 + C0/objectDist
+	//
+	// C1 = ApertureDiameter * f/(focusDist-f)
+	// C0 = -C1*focusDist
+}
+
+static void writeBinaryEntries(FILE* fp, const UVTSampleBuffer& sbuf)
+{
+	int num = 0;
+	for(int y=0;y<sbuf.getHeight();y++)
+	for(int x=0;x<sbuf.getWidth(); x++)
+		num += sbuf.getNumSamples(x,y);
+
+	Array<Entry> entries;
+	entries.reset(num);
+
+	int sidx=0;
+	for(int y=0;y<sbuf.getHeight();y++)
+	for(int x=0;x<sbuf.getWidth();x++)
+	for(int i=0;i<sbuf.getNumSamples(x,y);i++)
+	{
+		Entry& e = entries[sidx++];
+		e.x = sbuf.getSampleXY(x,y,i)[0];			// x	(in window coordinates, NOT multiplied with w)
+		e.y = sbuf.getSampleXY(x,y,i)[1];			// y	(in window coordinates, NOT multiplied with w)
+		e.z = sbuf.getSampleDepth(x,y,i);			// z	(z/w as in OpenGL, not used by reconstruction)
+		e.w = sbuf.getSampleW(x,y,i);				// w	(camera-space z. Positive are visible, larger is farther).
+
+		e.u = sbuf.getSampleUV(x,y,i)[0];			// u	[-1,1]
+		e.v = sbuf.getSampleUV(x,y,i)[1];			// v	[-1,1]
+		e.t = sbuf.getSampleT (x,y,i);				// t	[0,1]
+
+		e.r = sbuf.getSampleColor(x,y,i)[0];			// r	[0,1]
+		e.g = sbuf.getSampleColor(x,y,i)[1];			// g	[0,1]
+		e.b = sbuf.getSampleColor(x,y,i)[2];			// b	[0,1]
+		e.a = sbuf.getSampleColor(x,y,i)[2];			// a	[0,1]				TODO
+
+		e.mv_x = sbuf.getSampleMV(x,y,i)[0];			// homogeneous motion vector.x
+		e.mv_y = sbuf.getSampleMV(x,y,i)[1];			// homogeneous motion vector.y
+		e.mv_w = sbuf.getSampleMV(x,y,i)[2];			// homogeneous motion vector.w
+
+		e.dwdx = sbuf.getSampleWG(x,y,i)[0];			// dw/dx
+		e.dwdy = sbuf.getSampleWG(x,y,i)[1];			// dw/dy
+	}
+
+	fwrite(entries.getPtr(), sizeof(Entry), num, fp);
+}
+
 void UVTSampleBuffer::serialize(const char* filename, bool separateHeader, bool binary) const
 {
 	if(binary && !separateHeader)
@@ -459,29 +611,7 @@ void UVTSampleBuffer::serialize(const char* filename, bool separateHeader, bool
 
 	else if(version==1.3f)
 	{
-		if(m_cocCoeff == Vec2f(FW_F32_MAX,FW_F32_MAX))
-			fail("coc coefficients not set");
-
-		// header
-		fprintf(fph, "Version 1.3\n");
-		fprintf(fph, "Width %d\n", m_width);
-		fprintf(fph, "Height %d\n", m_height);
-		fprintf(fph, "Samples per pixel %d\n", m_numSamplesPerPixel);
-		//fprintf(fph, "Motion model: %s\n", m_affineMotion ? "affine" : "perspective");	// deprecated
-		fprintf(fph, "CoC coefficients (coc radius = C0/w+C1): %f,%f\n", m_cocCoeff[0], m_cocCoeff[1]);
-		fprintf(fph, "Encoding = %s\n", binary ? "binary" : "text");
-		fprintf(fph, "x,y,z/w,w,u,v,t,r,g,b,a,mv_x,mv_y,mv_w,dwdx,dwdy\n");
-
-		// Using Wikipedia's terminology
-		//
-		//    c = AD * (objectDist-focusDist)/objectDist * f/(focusDist-f)
-		// => c = AD * f/(focusDist-f) * (1-focusDist/objectDist)
-		// => c = C1 * (1-focusDist/objectDist)
-		// => c = C1 - C1*focusDist/objectDist
-		// => c = C1 + C0/objectDist
-		//
-		// C1 = ApertureDiameter * f/(focusDist-f)
-		// C0 = -C1*focusDist
+		writeHeader13(fph, *this, m_height, binary);
 
 		if(!binary)
 		{
@@ -514,45 +644,7 @@ void UVTSampleBuffer::serialize(const char* filename, bool separateHeader, bool
 			}
 		}
 		else
-		{
-			int num = 0;
-			for(int y=0;y<m_height;y++)
-			for(int x=0;x<m_width; x++)
-				num += getNumSamples(x,y);
-
-			Array<Entry> entries;
-			entries.reset(num);
-
-			int sidx=0;
-			for(int y=0;y<m_height;y++)
-			for(int x=0;x<m_width;x++)
-			for(int i=0;i<getNumSamples(x,y);i++)
-			{
-				Entry& e = entries[sidx++];
-				e.x = getSampleXY(x,y,i)[0];			// x	(in window coordinates, NOT multiplied with w)
-				e.y = getSampleXY(x,y,i)[1];			// y	(in window coordinates, NOT multiplied with w)
-				e.z = getSampleDepth(x,y,i);			// z	(z/w as in OpenGL, not used by reconstruction)
-				e.w = getSampleW(x,y,i);				// w	(camera-space z. Positive are visible, larger is farther).
-
-				e.u = getSampleUV(x,y,i)[0];			// u	[-1,1]
-				e.v = getSampleUV(x,y,i)[1];			// v	[-1,1]
-				e.t = getSampleT (x,y,i);				// t	[0,1]
-
-				e.r = getSampleColor(x,y,i)[0];			// r	[0,1]
-				e.g = getSampleColor(x,y,i)[1];			// g	[0,1]
-				e.b = getSampleColor(x,y,i)[2];			// b	[0,1]
-				e.a = getSampleColor(x,y,i)[2];			// a	[0,1]				TODO
-
-				e.mv_x = getSampleMV(x,y,i)[0];			// homogeneous motion vector.x
-				e.mv_y = getSampleMV(x,y,i)[1];			// homogeneous motion vector.y
-				e.mv_w = getSampleMV(x,y,i)[2];			// homogeneous motion vector.w
-
-				e.dwdx = getSampleWG(x,y,i)[0];			// dw/dx
-				e.dwdy = getSampleWG(x,y,i)[1];			// dw/dy
-			}
-
-			fwrite(entries.getPtr(), sizeof(Entry), num, fp);
-		}
+			writeBinaryEntries(fp, *this);
 	} // 1.3
 
 	fflush(fp);
@@ -567,6 +659,127 @@ void UVTSampleBuffer::serialize(const char* filename, bool separateHeader, bool
 
 //-------------------------------------------------------------------
 
+UVTSampleRowReader::UVTSampleRowReader(const char* filename)
+:	m_fp					(NULL),
+	m_width					(0),
+	m_height				(0),
+	m_numSamplesPerPixel	(0),
+	m_cocCoeff				(FW_F32_MAX,FW_F32_MAX),
+	m_binary				(false),
+	m_dataStart				(0)
+{
+	m_fp = fopen(filename, "rb");
+	if(!m_fp)
+	{
+		setError("%s: not found", filename);
+		return;
+	}
+	FILE* fph = fopen((String(filename)+String(".header")).getPtr(),"rt");
+	String error;
+	readHeader13((fph) ? fph : m_fp, m_width, m_height, m_numSamplesPerPixel, m_cocCoeff, m_binary, error);
+	if(fph)
+		fclose(fph);
+	else
+		m_dataStart = tellFile(m_fp);
+	if(error.getLength())
+	{
+		setError("%s: %s", filename, error.getPtr());
+		m_width = m_height = m_numSamplesPerPixel = 0;
+	}
+	m_rowOffsets.add(m_dataStart);
+}
+
+UVTSampleRowReader::~UVTSampleRowReader(void)
+{
+	if(m_fp)
+		fclose(m_fp);
+}
+
+// Binary rows are at fixed offsets. Text rows are indexed as they are first read,
+// so going back to a row costs a seek.
+
+bool UVTSampleRowReader::seekRow(int y, int x)
+{
+	if(m_binary)
+	{
+		seekFile(m_fp, m_dataStart + ((S64)y*m_width + x)*m_numSamplesPerPixel*(S64)sizeof(Entry));
+		return true;
+	}
+
+	char line[4096];
+	while(m_rowOffsets.getSize() <= y)
+	{
+		seekFile(m_fp, m_rowOffsets.getLast());
+		for(int j=0;j<m_width*m_numSamplesPerPixel;j++)
+			if(!fgets(line,4096,m_fp))
+				return false;
+		m_rowOffsets.add(tellFile(m_fp));
+	}
+	seekFile(m_fp, m_rowOffsets[y]);
+	for(int j=0;j<x*m_numSamplesPerPixel;j++)
+		if(!fgets(line,4096,m_fp))
+			return false;
+	return true;
+}
+
+bool UVTSampleRowReader::readRows(UVTSampleBuffer& rows, int firstRow, int firstColumn)
+{
+	FW_ASSERT(rows.getNumSamples() == m_numSamplesPerPixel);
+	FW_ASSERT(firstRow >= 0 && firstRow + rows.getHeight() <= m_height);
+	FW_ASSERT(firstColumn >= 0 && firstColumn + rows.getWidth() <= m_width);
+	rows.setCocCoeffs(m_cocCoeff);
+
+	Array<Entry> entries;
+	entries.reset(rows.getWidth()*m_numSamplesPerPixel);
+	char line[4096];
+	for(int y=0;y<rows.getHeight();y++)
+	{
+		bool ok = seekRow(firstRow+y, firstColumn);
+		if(m_binary)
+			ok = ok && fread(entries.getPtr(), sizeof(Entry), entries.getSize(), m_fp) == (size_t)entries.getSize();
+		else
+			for(int j=0;j<entries.getSize() && ok;j++)
+			{
+				ok = (fgets(line,4096,m_fp) != NULL);
+				if(ok)
+					parseTextEntry(line, entries[j]);
+			}
+		if(!ok)
+		{
+			setError("Sample file truncated at row %d", firstRow+y);
+			return false;
+		}
+
+		int sidx = 0;
+		for(int x=0;x<rows.getWidth();x++)
+		for(int i=0;i<m_numSamplesPerPixel;i++)
+			setEntry(rows, x,y,i, entries[sidx++]);
+	}
+	return true;
+}
+
+//-------------------------------------------------------------------
+
+void UVTSampleBuffer::serializeBinaryBand(const char* filename, int firstRow, int totalHeight) const
+{
+	if(firstRow==0)
+	{
+		FILE* fph = fopen((String(filename)+String(".header")).getPtr(),"wt");
+		if(!fph)
+			fail("Cannot create %s.header", filename);
+		writeHeader13(fph, *this, totalHeight, true);
+		fclose(fph);
+	}
+
+	FILE* fp = fopen(filename, (firstRow==0) ? "wb" : "ab");
+	if(!fp)
+		fail("Cannot open %s", filename);
+	writeBinaryEntries(fp, *this);
+	fclose(fp);
+}
+
+//-------------------------------------------------------------------
+
 void UVTSampleBuffer::generateSobol(Random& random)
 {
     for(int y=0;y<m_height;y++)
@@ -589,7 +802,7 @@ void UVTSampleBuffer::generateSobol(Random& random)
 
 //-------------------------------------------------------------------
 
-void UVTSampleBuffer::generateSobolCoop(Random& random)
+void UVTSampleBuffer::generateSobolCoop(Random& random, int firstRow)
 {
     Array<Vec4i> shuffle;
     shuffle.reset(24151); // prime
@@ -601,7 +814,7 @@ void UVTSampleBuffer::generateSobolCoop(Random& random)
     }
 
     int sampleIdx = 0;
-    for (int py = 0; py < m_height; py++)
+    for (int py = firstRow; py < firstRow + m_height; py++)
     for (int px = 0; px < m_width; px++)
     {
         int morton = 0;
@@ -30,6 +30,7 @@
 #include "base/Array.hpp"
 #include "gui/Image.hpp"
 #include "base/Random.hpp"
+#include <cstdio>
 
 namespace FW
 {
@@ -137,7 +138,7 @@ protected:
 class UVTSampleBuffer : public SampleBuffer
 {
 public:
-					UVTSampleBuffer		(int w,int h, int numSamplesPerPixel);
+					UVTSampleBuffer		(int w,int h, int numSamplesPerPixel, int firstRow=0);	// firstRow: rows [firstRow,firstRow+h) of a taller buffer, same sample pattern
     virtual         ~UVTSampleBuffer    (void)                                  {}
 
 	void			clear				(const Vec4f& color,float depth,float w);
@@ -163,13 +164,15 @@ public:
 	// serialization.
 
 					UVTSampleBuffer			(const char* filename);
+	static bool		probe					(const char* filename, String& error);	// false if the constructor would fail() on the file, or the samples are truncated
 	void			serialize				(const char* filename, bool separateHeader=false, bool binary=false) const;
+	void			serializeBinaryBand		(const char* filename, int firstRow, int totalHeight) const;	// appends this band; writes the header when firstRow==0
 
 protected:
 	UVTSampleBuffer()	{ }
 
     void            generateSobol       (Random& random);
-    void            generateSobolCoop   (Random& random);
+    void            generateSobolCoop   (Random& random, int firstRow = 0);
 
 	Vec2f			m_cocCoeff;
 
@@ -181,4 +184,39 @@ protected:
 	friend class TreeGather;		// for creating an output sample buffer (DEBUG feature).
 };
 
+//-------------------------------------------------------------------
+// Reads rows of a version 1.3 sample file on demand, for passes over
+// buffers that need not fit in memory. Sample xy stay in the file's
+// image coordinates. Errors go to setError().
+//-------------------------------------------------------------------
+
+class UVTSampleRowReader
+{
+public:
+					UVTSampleRowReader	(const char* filename);
+					~UVTSampleRowReader	(void);
+
+	int				getWidth			(void) const		{ return m_width; }
+	int				getHeight			(void) const		{ return m_height; }
+	int				getNumSamples		(void) const		{ return m_numSamplesPerPixel; }
+	const Vec2f&	getCocCoeffs		(void) const		{ return m_cocCoeff; }
+
+	bool			readRows			(UVTSampleBuffer& rows, int firstRow, int firstColumn = 0);	// the pixels of rows' size from (firstColumn,firstRow) on
+
+private:
+					UVTSampleRowReader	(const UVTSampleRowReader&);	// forbidden
+	UVTSampleRowReader&	operator=		(const UVTSampleRowReader&);	// forbidden
+
+	bool			seekRow				(int y, int x);
+
+	FILE*			m_fp;
+	int				m_width;
+	int				m_height;
+	int				m_numSamplesPerPixel;
+	Vec2f			m_cocCoeff;
+	bool			m_binary;
+	S64				m_dataStart;
+	Array<S64>		m_rowOffsets;		// text: where the rows read so far start
+};
+
 } //
@@ -0,0 +1,193 @@
+/*
+ *  Copyright (c) 2010-2011, NVIDIA Corporation
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *      * Redistributions of source code must retain the above copyright
+ *        notice, this list of conditions and the following disclaimer.
+ *      * Redistributions in binary form must reproduce the above copyright
+ *        notice, this list of conditions and the following disclaimer in the
+ *        documentation and/or other materials provided with the distribution.
+ *      * Neither the name of NVIDIA Corporation nor the
+ *        names of its contributors may be used to endorse or promote products
+ *        derived from this software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ *  ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ *  WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ *  DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+ *  DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ *  (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ *  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ *  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ *  (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ *  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "SyntheticScene.hpp"
+#include "CameraParams.hpp"
+#include "base/Random.hpp"
+#include <cstdio>
+#include <cstring>
+
+namespace FW
+{
+
+SyntheticScene::SyntheticScene(Preset preset, int width, int height, U32 seed)
+:	m_cocCoeffs(0.f)
+{
+	const float focusW	= 10.f;
+	const Vec2f size((float)width, (float)height);
+
+	Layer background;
+	background.w		= focusW;
+	background.color0	= Vec4f(0.2f,0.2f,0.2f,1.f);
+	background.color1	= Vec4f(0.8f,0.8f,0.8f,1.f);
+
+	Layer disc;
+	disc.w				= 0.5f*focusW;
+	disc.center			= 0.5f*size;
+	disc.radius			= 0.25f*size.min();
+	disc.color0			= Vec4f(0.5f,0.25f,0.f,1.f);
+	disc.color1			= Vec4f(1.f,0.5f,0.f,1.f);
+
+	switch(preset)
+	{
+	case Preset_Default:
+		setLens(focusW, width/64.f);
+		disc.motion			= Vec2f(width/32.f, 0.f);
+		addLayer(background);
+		addLayer(disc);
+		break;
+
+	case Preset_Defocus:
+		setLens(focusW, width/16.f);					// CoC radius -3*width/16 at the disc, 3*width/64 at the background
+		background.w		= 4.f*focusW;
+		disc.w				= 0.25f*focusW;
+		addLayer(background);
+		addLayer(disc);
+		break;
+
+	case Preset_Motion:
+		setLens(focusW, width/256.f);
+		background.motion	= Vec2f(width/64.f, height/64.f);
+		disc.motion			= Vec2f(width/4.f, 0.f);
+		addLayer(background);
+		addLayer(disc);
+		break;
+
+	case Preset_Depth:
+		{
+			setLens(focusW, width/64.f);
+			background.w	= 3.f*focusW;
+			addLayer(background);
+
+			Random random(seed);
+			for(int i=0;i<16;i++)
+			{
+				Layer l;
+				l.w				= random.getF32(focusW/3.f, 2.5f*focusW);
+				l.center		= Vec2f(random.getF32(0.f,size.x), random.getF32(0.f,size.y));
+				l.radius		= random.getF32(0.1f,0.3f)*size.min();
+				l.motion		= Vec2f(random.getF32(-1.f,1.f), random.getF32(-1.f,1.f))*(width/32.f);
+				l.color0		= Vec4f(random.getVec3f(0.f,0.5f), 1.f);
+				l.color1		= Vec4f(random.getVec3f(0.5f,1.f), 1.f);
+				l.checkerSize	= random.getF32(4.f,32.f);
+				addLayer(l);
+			}
+		}
+		break;
+
+	default:
+		fail("SyntheticScene: unknown preset %d", preset);
+	}
+}
+
+//-------------------------------------------------------------------
+
+UVTSampleBuffer* SyntheticScene::generate(int width, int height, int spp) const
+{
+	UVTSampleBuffer* sbuf = new UVTSampleBuffer(width, height, spp);		// Sobol (x,y,u,v,t), fixed seed
+	shade(*sbuf);
+	return sbuf;
+}
+
+void SyntheticScene::exportBinary(const char* filename, int width, int height, int spp, int bandHeight) const
+{
+	printf("Generating %dx%dx%d sample buffer... ", width, height, spp);
+	for(int y0=0;y0<height;y0+=bandHeight)
+	{
+		UVTSampleBuffer band(width, min(bandHeight,height-y0), spp, y0);	// same samples as the full buffer would have
+		shade(band);
+		band.serializeBinaryBand(filename, y0, height);
+		printf("%d%%\r", 100*y0/height);
+	}
+	printf("done\n");
+}
+
+void SyntheticScene::shade(UVTSampleBuffer& sbuf) const
+{
+	bool haveBackground = false;
+	for(int i=0;i<m_layers.getSize();i++)
+		haveBackground |= (m_layers[i].radius <= 0.f);
+	if(!haveBackground)
+		fail("SyntheticScene: no infinite plane (radius 0) behind the other layers");
+
+	sbuf.setCocCoeffs(m_cocCoeffs);
+
+	for(int y=0;y<sbuf.getHeight();y++)
+	for(int x=0;x<sbuf.getWidth();x++)
+	for(int i=0;i<sbuf.getNumSamples(x,y);i++)
+	{
+		const Vec2f xy	= sbuf.getSampleXY(x,y,i);
+		const Vec2f uv	= sbuf.getSampleUV(x,y,i);
+		const float t	= sbuf.getSampleT(x,y,i);
+
+		// Front-most layer covering the sample. p is the point on the layer at (u,v,t)=center.
+
+		const Layer* hit = NULL;
+		Vec2f hitP;
+		for(int j=0;j<m_layers.getSize();j++)
+		{
+			const Layer& l = m_layers[j];
+			if(hit && hit->w <= l.w)
+				continue;
+
+			const Vec2f p = xy - getCocRadius(m_cocCoeffs,l.w)*uv - (t-0.5f)*l.motion;
+			if(l.radius > 0.f && (p-l.center).length() > l.radius)
+				continue;
+
+			hit  = &m_layers[j];
+			hitP = p;
+		}
+
+		const Vec2f c = (hitP-hit->center) / hit->checkerSize;
+		const bool odd = (((int)floor(c.x) + (int)floor(c.y)) & 1) != 0;
+
+		sbuf.setSampleColor	(x,y,i, odd ? hit->color1 : hit->color0);
+		sbuf.setSampleDepth	(x,y,i, hit->w);								// not used by the reconstruction
+		sbuf.setSampleW		(x,y,i, hit->w);
+		sbuf.setSampleMV	(x,y,i, Vec3f(hit->motion*hit->w, 0.f));		// homogeneous
+		sbuf.setSampleWG	(x,y,i, Vec2f(0.f));							// fronto-parallel
+	}
+}
+
+//-------------------------------------------------------------------
+
+static const char* const s_presetNames[SyntheticScene::Preset_Max] = { "default", "defocus", "motion", "depth" };
+
+const char* SyntheticScene::getPresetName(Preset preset)
+{
+	return (preset>=0 && preset<Preset_Max) ? s_presetNames[preset] : "unknown";
+}
+
+SyntheticScene::Preset SyntheticScene::findPreset(const String& name)
+{
+	for(int i=0;i<Preset_Max;i++)
+		if(name == s_presetNames[i])
+			return (Preset)i;
+	return Preset_Max;
+}
+
+} //
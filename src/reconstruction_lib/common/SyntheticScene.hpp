@@ -0,0 +1,89 @@
+/*
+ *  Copyright (c) 2010-2011, NVIDIA Corporation
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *      * Redistributions of source code must retain the above copyright
+ *        notice, this list of conditions and the following disclaimer.
+ *      * Redistributions in binary form must reproduce the above copyright
+ *        notice, this list of conditions and the following disclaimer in the
+ *        documentation and/or other materials provided with the distribution.
+ *      * Neither the name of NVIDIA Corporation nor the
+ *        names of its contributors may be used to endorse or promote products
+ *        derived from this software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ *  ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ *  WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ *  DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+ *  DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ *  (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ *  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ *  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ *  (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ *  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#pragma once
+#include "SampleBuffer.hpp"
+
+namespace FW
+{
+
+//-------------------------------------------------------------------
+// Procedural sample buffers for benchmarks: checkerboard layers at
+// constant depth, each with its own motion, front-most layer wins.
+// The CoC coefficients control the defocus.
+//-------------------------------------------------------------------
+
+class SyntheticScene
+{
+public:
+	enum Preset
+	{
+		Preset_Default = 0,		// in-focus background, defocused disc moving in front of it
+		Preset_Defocus,			// very large CoCs in front of and behind the focus plane
+		Preset_Motion,			// fast motion on top of moving background
+		Preset_Depth,			// 16 overlapping discs at random depths
+
+		Preset_Max
+	};
+
+	struct Layer
+	{
+		Layer(void) : w(1.f), center(0.f), radius(0.f), motion(0.f), color0(0.f,0.f,0.f,1.f), color1(1.f), checkerSize(16.f) {}
+
+		float	w;				// camera-space depth, constant over the layer
+		Vec2f	center;			// pixels, at t=0.5
+		float	radius;			// pixels, 0 == infinite plane
+		Vec2f	motion;			// pixels over the shutter interval
+		Vec4f	color0;			// checkerboard
+		Vec4f	color1;
+		float	checkerSize;	// pixels
+	};
+
+						SyntheticScene		(void) : m_cocCoeffs(0.f) {}
+						SyntheticScene		(Preset preset, int width, int height, U32 seed = 1);
+
+	void				setLens				(float focusW, float cocAtInfinity)	{ m_cocCoeffs = Vec2f(-cocAtInfinity*focusW, cocAtInfinity); }	// see UVTSampleBuffer::serialize()
+	void				setCocCoeffs		(const Vec2f& cocCoeffs)			{ m_cocCoeffs = cocCoeffs; }
+	const Vec2f&		getCocCoeffs		(void) const						{ return m_cocCoeffs; }
+
+	void				addLayer			(const Layer& layer)				{ m_layers.add(layer); }
+	int					getNumLayers		(void) const						{ return m_layers.getSize(); }
+
+	UVTSampleBuffer*	generate			(int width, int height, int spp) const;
+	void				exportBinary		(const char* filename, int width, int height, int spp, int bandHeight = 64) const;	// band by band, the buffer never exists in memory
+
+	static const char*	getPresetName		(Preset preset);
+	static Preset		findPreset			(const String& name);			// Preset_Max if unknown
+
+private:
+	void				shade				(UVTSampleBuffer& sbuf) const;
+
+	Vec2f				m_cocCoeffs;
+	Array<Layer>		m_layers;
+};
+
+} //
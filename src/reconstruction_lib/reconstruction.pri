@@ -1,8 +1,11 @@
-HEADERS += reconstruction/ReconstructionCudaKernels.hpp \
-    reconstruction/Reconstruction.hpp
+HEADERS += reconstruction/Reconstruction.hpp \
+    reconstruction/ReconstructionSimd.hpp \
+    reconstruction/ReconstructionShard.hpp \
+    reconstruction/ReconstructionOutOfCore.hpp
 SOURCES += reconstruction/ReconstructionOur.cpp \
-    reconstruction/ReconstructionCuda.cpp \
     reconstruction/ReconstructionTreeBuilder.cpp \
-    reconstruction/Reconstruction.cpp
-
-OTHER_FILES += reconstruction/ReconstructionCudaKernels.cu
+    reconstruction/ReconstructionTelemetry.cpp \
+    reconstruction/Reconstruction.cpp \
+    reconstruction/ReconstructionSimd.cpp \
+    reconstruction/ReconstructionShard.cpp \
+    reconstruction/ReconstructionOutOfCore.cpp
@@ -36,8 +36,6 @@ namespace FW
 const float LIGHTING_SCALE		= 1.5f;
 const float AMBIENT_SCALE		= 0.5f;
 
-static bool g_profile    = false;
-
 //-----------------------------------------------------------------------------
 // Ctors.
 //-----------------------------------------------------------------------------
@@ -47,6 +45,29 @@ TreeGather::TreeGather(const UVTSampleBuffer& sbuf, const CameraParams& params,
 	init(sbuf,params,apertureAdjust,focalDistanceAdjust);
 }
 
+TreeGather::~TreeGather()
+{
+	for(int i=0;i<m_numaReplicas.getSize();i++)
+		delete m_numaReplicas[i];
+	delete m_spilled;
+}
+
+//-----------------------------------------------------------------------------
+// Support for refocus: scales the aperture and the focal distance of the CoC coefficients.
+//-----------------------------------------------------------------------------
+
+Vec2f TreeGather::adjustCocCoeffs(const Vec2f& cocCoeffs, float apertureAdjust, float focalDistanceAdjust)
+{
+	Vec2f cc = cocCoeffs;
+	float a = -cc.x;
+	float f = -cc.x*rcp(cc.y);
+	a *= apertureAdjust;
+	f *= focalDistanceAdjust;
+	cc.x = -a;
+	cc.y = a*rcp(f);
+	return cc;
+}
+
 //-----------------------------------------------------------------------------
 // Set variables, construct trees etc.
 //-----------------------------------------------------------------------------
@@ -61,6 +82,11 @@ void TreeGather::init(const UVTSampleBuffer& sbuf, const CameraParams& params, f
 	m_qbuf = NULL;
 	m_params = &params;
 	m_reconstructionMode = params.reconstruction;
+	m_lowMemory = false;
+	m_spilled = NULL;
+	m_regionLo = Vec2i(0);
+	m_regionHi = Vec2i(w,h);
+	m_pixelOffset = Vec2i(0);
 
 	// SPP. irregular --> compute average.
 
@@ -76,17 +102,7 @@ void TreeGather::init(const UVTSampleBuffer& sbuf, const CameraParams& params, f
 
 	// Support for refocus.
 
-    m_cocCoeffs = sbuf.getCocCoeffs();					// used everywhere else
-	{
-		Vec2f cc = m_cocCoeffs;
-		float a = -cc.x;
-		float f = -cc.x*rcp(cc.y);
-		a *= apertureAdjust;
-		f *= focalDistanceAdjust;
-		cc.x = -a;
-		cc.y = a*rcp(f);
-		m_cocCoeffs = cc;
-	}
+    m_cocCoeffs = adjustCocCoeffs(sbuf.getCocCoeffs(), apertureAdjust, focalDistanceAdjust);	// used everywhere else
 	if(params.overrideRefocusDistance != FW_F32_MAX)
 	{
 		printf("Experimental refocus enabled\n");
@@ -98,20 +114,27 @@ void TreeGather::init(const UVTSampleBuffer& sbuf, const CameraParams& params, f
 
 	// Reproject and bucket input samples.
 
+	beginPhase("Reprojection");
 	reprojectToUVTCenter();
+	endPhase();
 
 	// Build initial hierarchy.
 
+	beginPhase("Helper hierarchy");
 	profilePush("Helper hierarchy");
 	const int root = 0;
 	m_rootIndex = root;
 	m_initialHierarchy.setCapacity(2*m_reprojWidth*m_reprojHeight);	// pre-allocate memory. (n + n/2 + n/4 + n/8 + ... = 2*n)
-	buildInitialRecursive(0,m_reprojWidth, 0,m_reprojHeight);
+	{
+		FW_PERF_SCOPE("Helper hierarchy");
+		buildInitialRecursive(0,m_reprojWidth, 0,m_reprojHeight);
+	}
 
 	// Find entry points for parallel builder
-	const int numTasksLog2 = 5;
+	const int numTasksLog2 = clamp(m_params->tuning.numTasksLog2, 1, 8);
 	const int numTasks = 1<<numTasksLog2;
-	int entryPoints[numTasks];
+	Array<int> entryPoints;
+	entryPoints.reset(numTasks);
 	for(int i=0;i<numTasks;i++)
 	{
 		int node = root;
@@ -127,34 +150,43 @@ void TreeGather::init(const UVTSampleBuffer& sbuf, const CameraParams& params, f
 		entryPoints[i] = node;
 	}
 	profilePop();
+	endPhase();
 
 	// Create parallel tasks (this pins some memory arrays, which would unnecessary in a real system, and hence outside timers)
 
+	beginPhase("Pin memory");
 	profilePush("Pin memory");
-	m_samples.reset( m_initialHierarchy[root].numSamples );
+	const int numSamples = m_initialHierarchy[root].numSamples;
+	SpilledHierarchy* spill = (params.outOfCoreResident && !params.enableCuda) ? createSpill(numSamples) : NULL;	// the GPU path uploads the arrays
+	if(!spill)
+		m_samples.reset(numSamples);
+	const bool interleaved = Topology::interleave(m_samples.getPtr(), m_samples.getNumBytes());	// build tasks would first-touch it in arbitrary order
 	int sampleIndex = 0;
 
-	const int frontierLim = 4;
-	BuildTask btask[numTasks];
+	const int frontierLim = max(m_params->tuning.frontierLimit, 1);
+	BuildTask* btask = new BuildTask[numTasks];
 	for(int i=0;i<numTasks;i++)
 	{
 		const int ep = entryPoints[i];
-		btask[i].init(this, ep, frontierLim, sampleIndex);
+		btask[i].init(this, ep, frontierLim, sampleIndex, spill);
 		if(ep!=-1)
 			sampleIndex += m_initialHierarchy[ btask[i].nodeIndex ].numSamples;
 	}
 	profilePop();
+	endPhase();
 
 	// Build actual hierarchy.
 
 	profilePush("Build hierarchy");
+	beginPhase("Build");
 
 	// Launch parallel tasks
 
 	MulticoreLauncher launcher;	// uses #available_cores threads by default
-	for(int i=0;i<numTasks;i++)
-		launcher.push(buildRecursiveDispatcher, &btask[i]);
+	launcher.push(buildRecursiveDispatcher, btask, 0, numTasks);	// one batch, split and stolen by the workers
 	launcher.popAll();
+	endPhase();
+	beginPhase("Merge sub-hierarchies");
 
 	// Merge sub-hierarchies (we don't know the #nodes per sub-hierarchy in advance)
 
@@ -163,9 +195,13 @@ void TreeGather::init(const UVTSampleBuffer& sbuf, const CameraParams& params, f
 		numNodes   += btask[i].hierarchy.getSize();
 
 	m_hierarchy.reset(numNodes);
+	Topology::interleave(m_hierarchy.getPtr(), m_hierarchy.getNumBytes());						// otherwise the merge below touches all of it
 
 	profilePush("Merge sub-hierarchies");
 	int nodeBase = 0;
+	Array<int> segmentEnds;		// BuildTask subtrees, for out-of-core
+	Array<int> sampleEnds;
+	Array<Vec2i> packetRanges;
 	for(int i=0;i<numTasks;i++)
 	{
 		BuildTask& task = btask[i];
@@ -186,25 +222,48 @@ void TreeGather::init(const UVTSampleBuffer& sbuf, const CameraParams& params, f
 		}
 
 		nodeBase   += task.hierarchy.getSize();
+		task.hierarchy.reset(0);												// merged, only the frontier is needed from here on
+		segmentEnds.add(nodeBase);
+		sampleEnds.add((task.nodeIndex != -1) ? task.currentSampleIndex : (i) ? sampleEnds[i-1] : 0);	// advanced past the subtree's samples
+		packetRanges.add(task.packets);
 	}
 	profilePop();
+	endPhase();
 
 	// Build top of tree
 
+	beginPhase("Top of tree");
 	profilePush("Serial top of tree");
-	for(int j=0;j<numTasksLog2;j++)
 	{
-		int offset = 1<<j;
-		for(int i=0;i<numTasks;i+=2*offset)
+		FW_PERF_SCOPE("Top of tree");
+		for(int j=0;j<numTasksLog2;j++)
 		{
-			btask[i].frontier.add( btask[i+offset].frontier );
-			bool isRootNode = (j==numTasksLog2-1);
-			emitNodes(isRootNode, frontierLim, btask[i].frontier, m_hierarchy);
+			int offset = 1<<j;
+			for(int i=0;i<numTasks;i+=2*offset)
+			{
+				btask[i].frontier.add( btask[i+offset].frontier );
+				bool isRootNode = (j==numTasksLog2-1);
+				emitNodes(isRootNode, frontierLim, btask[i].frontier, 0, m_hierarchy);
+			}
 		}
 	}
 	profilePop();
+	endPhase();
 
 	profilePop();	// actual hierarchy
+	delete[] btask;
+
+	// SoA copies of the leaf samples for the gather kernels. Out-of-core, the subtrees have theirs
+	// in the file already, and the rest of the hierarchy follows.
+
+	m_simdLevel = detectSimdLevel();
+	computeLeafDepths();
+	beginPhase((spill) ? "Out-of-core" : "Sample packets");
+	profilePush("Sample packets");
+	if(spill)	spillHierarchy(spill, segmentEnds, sampleEnds, packetRanges);
+	else		buildSamplePackets();
+	profilePop();
+	endPhase();
 
 	// Free memory arrays
 
@@ -212,18 +271,98 @@ void TreeGather::init(const UVTSampleBuffer& sbuf, const CameraParams& params, f
 	m_initialHierarchy.reset(0);
 
 	printf("sizeof(Sample) = %d bytes\n", sizeof(Sample));
-	printf("Samples %.1fMB\n", 1.f*m_samples.getSize() * sizeof(Sample) / 1024 / 1024);
-	printf("Tree    %.1fMB\n", 1.f*m_hierarchy.getSize() * sizeof(Node) / 1024 / 1024);
+	printf("Samples %.1fMB\n", 1.f*numSamples * sizeof(Sample) / 1024 / 1024);
+	printf("Tree    %.1fMB\n", 1.f*((m_spilled) ? m_spilled->numNodes : m_hierarchy.getSize()) * sizeof(Node) / 1024 / 1024);
+	printf("Packets %.1fMB (%s kernels)\n", 1.f*((m_spilled) ? m_spilled->numPackets : m_packets.getSize()) * sizeof(SamplePacket) / 1024 / 1024, getSimdLevelName(m_simdLevel));
+
+	// Per-node replicas are filled lazily by the filter tasks.
+
+	const int numaNodes = Topology::getNumNodes();
+	bool numaReplicas = params.numaReplicas && !m_spilled;
+	if(numaReplicas && params.memoryBudget)
+	{
+		const size_t replicaBytes = m_samples.getNumBytes() + m_hierarchy.getNumBytes() + m_packets.getNumBytes();
+		if(getMemoryUsed() + numaNodes*replicaBytes > params.memoryBudget)
+		{
+			printf("NUMA replicas (%d x %.1fMB) would exceed the memory budget, using shared arrays\n", numaNodes, replicaBytes/1024.f/1024.f);
+			numaReplicas = false;
+		}
+	}
+	if(numaReplicas && numaNodes > 1)
+	{
+		m_numaReplicas.reset(numaNodes);
+		for(int i=0;i<numaNodes;i++)
+		{
+			m_numaReplicas[i] = new NumaReplica;
+			m_numaReplicas[i]->ready = false;
+		}
+	}
+	printf("NUMA    %d node(s)%s, %s\n", numaNodes, Topology::isFake() ? " (fake)" : "",
+		m_numaReplicas.getSize() ? "per-node replicas" : interleaved ? "interleaved" : "shared");
+	printPhases();
+}
+
+//-----------------------------------------------------------------------------
+// NUMA replicas
+//-----------------------------------------------------------------------------
+
+const TreeGather::NumaReplica* TreeGather::getNumaReplica(int node) const
+{
+	if(node < 0 || node >= m_numaReplicas.getSize())
+		return NULL;
+
+	// Called once per scanline, so the lock is cheap.
+
+	NumaReplica* replica = m_numaReplicas[node];
+	replica->lock.enter();
+	if(!replica->ready)
+	{
+		replica->hierarchy	= m_hierarchy;
+		replica->samples	= m_samples;
+		replica->packets	= m_packets;
+		replica->ready		= true;
+	}
+	replica->lock.leave();
+	return replica;
+}
+
+void TreeGather::Filterer::setNumaNode(int node)
+{
+	if(m_tg->m_spilled)
+	{
+		m_nodes			= m_tg->m_spilled->nodes;
+		m_sampleData	= m_tg->m_spilled->samples;
+		m_packetData	= m_tg->m_spilled->packets;
+		return;
+	}
+
+	const NumaReplica* replica = m_tg->getNumaReplica(node);
+	m_nodes			= (replica) ? replica->hierarchy.getPtr()	: m_tg->m_hierarchy.getPtr();
+	m_sampleData	= (replica) ? replica->samples.getPtr()		: m_tg->m_samples.getPtr();
+	m_packetData	= (replica) ? replica->packets.getPtr()		: m_tg->m_packets.getPtr();
+}
+
+//-----------------------------------------------------------------------------
+// Crops, tiles and bands reuse the hierarchy and filter only part of the image.
+//-----------------------------------------------------------------------------
+
+void TreeGather::setRegion(const Vec2i& lo, const Vec2i& hi)
+{
+	const Vec2i size(m_sbuf->getWidth(), m_sbuf->getHeight());
+	m_regionLo = min(max(lo, Vec2i(0)), size);
+	m_regionHi = min(max(hi, m_regionLo), size);
 }
 
 //-----------------------------------------------------------------------------
 // Entry point for defocus and motion
 //-----------------------------------------------------------------------------
 
-void TreeGather::reconstructDofMotion(Image& image, Image* debugImage)
+void TreeGather::reconstructDofMotion(Image& image, Image* debugImage, Image* costImage)
 {
 	if(image.getSize().x < m_sbuf->getWidth() || image.getSize().y < m_sbuf->getHeight())
 		fail("TreeGather::reconstructDofMotion image smaller than < sample buffer");
+	if(costImage)
+		costImage->clear();							// not measured on the GPU
 
 	// Generate output sampling pattern (x,y,u,v,t).
 
@@ -234,58 +373,63 @@ void TreeGather::reconstructDofMotion(Image& image, Image* debugImage)
 	// CUDA mode
 	if (m_params->enableCuda)
 	{
+#if (!FW_USE_CUDA)
+		fail("TreeGather::reconstructDofMotion(): Built without FW_USE_CUDA!");
+#else
 		printf("Filtering on GPU...\n");
 		cudaReconstruction(image,*m_params);
 		return;
+#endif
 	}
 
+	beginPhase("Filtering");
 	profilePush("Filtering");
 
-	const int w = m_sbuf->getWidth();
-	const int h = m_sbuf->getHeight();
+	const Vec2i lo = m_regionLo;
+	const Vec2i hi = m_regionHi;
 
 	MulticoreLauncher launcher;
 	Array<FilterTask> ftasks;
-	ftasks.reset(h);
-
-	m_multicore = !g_profile;
-
-	for(int y=0;y<h;y++)
-	{
-		FilterTask& ftask = ftasks[y];
-		ftask.init(this);
+	ftasks.reset(hi.y);		// indexed by scanline; the rows above lo.y stay uninitialized
 
-		{
-			if(m_multicore)	launcher.push(FilterTask::dispatcher, &ftask, y,1);
-			else			ftask.process(y), printf("%d%%\r", 100*y/h);
-		}
-	}
+	for(int y=lo.y;y<hi.y;y++)
+		ftasks[y].init(this, costImage!=NULL);
+	launcher.push(FilterTask::dispatcher, ftasks.getPtr(), lo.y, hi.y-lo.y);
 
-	if(m_multicore)
-		launcher.popAll("Filtering...");
+	launcher.popAll("Filtering...");
 	profilePop();
+	endPhase();
 
 	// Combine results.
 
 	Stats stats;
-	for(int y=0;y<h;y++)
+	for(int y=lo.y;y<hi.y;y++)
 	{
-		stats += ftasks[y].m_stats;
-		for(int x=0;x<w;x++)
+		const FilterTask& ftask = ftasks[y];
+		stats += ftask.m_stats;
+		for(int x=lo.x;x<hi.x;x++)
 		{
-			image.setVec4f(Vec2i(x,y), ftasks[y].m_outputColors[x]);
+			image.setVec4f(Vec2i(x,y), ftask.m_outputColors[x]);
 			if(debugImage)
-				debugImage->setVec4f(Vec2i(x,y), ftasks[y].m_debugColors[x]);
+				debugImage->setVec4f(Vec2i(x,y), ftask.m_debugColors[x]);
+			if(costImage)
+				costImage->setVec4f(Vec2i(x,y), ftask.m_costs[x]);
 		}
 	}
 
+	m_stats = stats;
 	printStats(stats);
+	if(m_spilled)
+		printf("Out-of-core: %lld page-ins (%.1fMB), %lld evictions\n", (long long)m_spilled->file.getNumPageIns(), m_spilled->file.getBytesPagedIn()/1024.f/1024.f, (long long)m_spilled->file.getNumEvictions());
 
-	// Output a screenshot.
+	// Output a screenshot (of full reconstructions only, not of every band of setRegion()).
 
-	image.flipY();
-	exportImage("screenshot_DofMotion.png", &image);
-	image.flipY();
+	if(lo == Vec2i(0) && hi == Vec2i(m_sbuf->getWidth(), m_sbuf->getHeight()))
+	{
+		image.flipY();
+		exportImage("screenshot_DofMotion.png", &image);
+		image.flipY();
+	}
 
 	// Free memory.
 
@@ -309,6 +453,7 @@ void TreeGather::reconstructShadows	(UVTSampleBuffer* qbuf, Image* debugImage)
 
 	// Launch filter tasks. One per scanline.
 
+	beginPhase("Filtering");
 	profilePush("Filtering");
 
 	const int w = m_sbuf->getWidth();
@@ -318,22 +463,13 @@ void TreeGather::reconstructShadows	(UVTSampleBuffer* qbuf, Image* debugImage)
 	Array<FilterTask> ftasks;
 	ftasks.reset(h);
 
-	m_multicore = !g_profile;
-
 	for(int y=0;y<h;y++)
-	{
-		FilterTask& ftask = ftasks[y];
-		ftask.init(this);
+		ftasks[y].init(this);
+	launcher.push(FilterTask::dispatcher, ftasks.getPtr(), 0, h);
 
-		{
-			if(m_multicore)	launcher.push(FilterTask::dispatcher, &ftask, y,1);
-			else			ftask.process(y), printf("%d%%\r", 100*y/h);
-		}
-	}
-
-	if(m_multicore)
-		launcher.popAll("Filtering...");
+	launcher.popAll("Filtering...");
 	profilePop();
+	endPhase();
 
 	// Combine results.
 
@@ -346,6 +482,7 @@ void TreeGather::reconstructShadows	(UVTSampleBuffer* qbuf, Image* debugImage)
 				debugImage->setVec4f(Vec2i(x,y), ftasks[y].m_debugColors[x]);
 	}
 
+	m_stats = stats;
 	printStats(stats);
 }
 
@@ -373,11 +510,11 @@ void TreeGather::reconstructDofMotionShadows	(Image& image, const TreeGather& sh
 	const Mat4f shadowProjection = shadowParams.projection;
 	const Mat4f cameraProjection = cameraParams.projection;
 	const Mat4f invCameraProjection = cameraProjection.inverted();
-	const Mat4f cameraToShadow  = shadowProjection * shadowParams.camera.getWorldToCamera() * cameraParams.camera.getCameraToWorld() * invCameraProjection;
-	const Mat4f cameraToShadow2 = shadowParams.camera.getWorldToCamera() * cameraParams.camera.getCameraToWorld();
+	const Mat4f cameraToShadow  = shadowProjection * shadowParams.cameraToWorld.inverted() * cameraParams.cameraToWorld * invCameraProjection;
+	const Mat4f cameraToShadow2 = shadowParams.cameraToWorld.inverted() * cameraParams.cameraToWorld;
     // const Mat4f cameraToShadowInvT  = cameraToShadow.inverted().transposed();
 	const Mat4f cameraToShadow2InvT = cameraToShadow2.inverted().transposed();
-	const Mat4f cameraToWorldInvT = cameraParams.camera.getCameraToWorld().inverted().transposed();
+	const Mat4f cameraToWorldInvT = cameraParams.cameraToWorld.inverted().transposed();
 	const Mat4f ws    = Mat4f::scale(Vec3f(0.5f*w, 0.5f*h, 0.5f)) * Mat4f::translate(Vec3f(1.0f));	// [-1,1] -> [window size]
 	const Mat4f invws = Mat4f::translate(Vec3f(-1.0f)) * Mat4f::scale(Vec3f(2.f/w, 2.f/h, 2.f));	// [window size] -> [-1,1]
 
@@ -391,29 +528,24 @@ void TreeGather::reconstructDofMotionShadows	(Image& image, const TreeGather& sh
 
 	// Launch filter tasks. One per scanline.
 
+	beginPhase("Filtering");
 	profilePush("Filtering");
 
 	MulticoreLauncher launcher;
 	Array<FilterTask> ftasks;
 	ftasks.reset(h);
 
-	m_multicore = !g_profile;
-
 	for(int y=0;y<h;y++)
 	{
 		FilterTask& ftask = ftasks[y];
 		ftask.init(this);
 		ftask.initShadow(&shadowTG,c2l,cameraProjectedZfromW,invws,cameraToShadow2,cameraToShadow2InvT,invCameraProjection,cameraToWorldInvT);
-
-		{
-			if(m_multicore)	launcher.push(FilterTask::dispatcher, &ftask, y,1);
-			else			ftask.process(y), printf("%d%%\r", 100*y/h);
-		}
 	}
+	launcher.push(FilterTask::dispatcher, ftasks.getPtr(), 0, h);
 
-	if(m_multicore)
-		launcher.popAll("Filtering...");
+	launcher.popAll("Filtering...");
 	profilePop();
+	endPhase();
 
 	// Combine results.
 
@@ -425,6 +557,7 @@ void TreeGather::reconstructDofMotionShadows	(Image& image, const TreeGather& sh
 			image.setVec4f(Vec2i(x,y), ftasks[y].m_outputColors[x]);
 	}
 
+	m_stats = stats;
 	printStats(stats);
 
 	// Output a screenshot.
@@ -440,15 +573,24 @@ void TreeGather::reconstructDofMotionShadows	(Image& image, const TreeGather& sh
 
 void TreeGather::printStats	(const Stats& stats) const
 {
+	printf("%-6.1f nodes visited/output sample\n", 1.f*stats.numNodesVisited[0]/stats.numNodesVisited[1]);
 	printf("%-6.1f leaf nodes/output sample\n", 1.f*stats.numLeafNodes[0]/stats.numLeafNodes[1]);
 	printf("%-6.1f samples in leaf nodes/output sample (avg %.1f/node)\n", 1.f*stats.numSamplesInLeafNodes[0]/stats.numSamplesInLeafNodes[1], 1.f*stats.numSamplesInLeafNodes[0]/stats.numLeafNodes[0]);
 	printf("%-6.1f samples within 1R/output sample\n", 1.f*stats.numSamplesWithin1R[0]/stats.numSamplesWithin1R[1]);
 	printf("%-5.2f%% output samples did 2R fetch\n", 100.f*stats.num2R[0]/stats.num2R[1]);
 	printf("%-6.1f samples fetched/output sample\n", 1.f*stats.numSamplesFetched[0]/stats.numSamplesFetched[1]);
+	if(stats.numSamplesSkipped[0])
+		printf("%-6.1f samples skipped by lazy gather/output sample\n", 1.f*stats.numSamplesSkipped[0]/stats.numSamplesSkipped[1]);
 	printf("%-6.2f surfaces/output sample\n", 1.f*stats.numSurfaces[0]/stats.numSurfaces[1]);
 	printf("%-5.2f%% output samples did surface merging\n", 100.f*stats.numSurfacesMerged[0]/stats.numSurfacesMerged[1]);
+	printf("%-6.1f same surface plane tests/output sample\n", 1.f*stats.numSameSurfaceTests[0]/stats.numSameSurfaceTests[1]);
 	if(stats.numAtLeastOne[0])
 		printf("%-5.2f%% output samples invoked 'at least one'\n", 100.f*stats.numAtLeastOne[0]/stats.numAtLeastOne[1]);
+	printf("%-6.3f heap allocations/output sample\n", 1.f*stats.numHeapAllocs[0]/stats.numHeapAllocs[1]);
+	if(stats.numTriangleSearches[0])
+		printf("%-6.1f candidate triangles/triangle search\n", 1.f*stats.numTriangleTests[0]/stats.numTriangleSearches[0]);
+	if(PerfCounters::isActive())
+		PerfCounters::printSummary();
 }
 
 void TreeGather::generateOutputSamples(const CameraParams& params)
@@ -516,6 +658,7 @@ void TreeGather::generateOutputSamples(const CameraParams& params)
 void TreeGather::reprojectToUVTCenter(void)
 {
 	profilePush("Init to (u,v,t)=c");
+	FW_PERF_SCOPE("Reprojection");
 	printf("Init to (u,v,t) center\n");
 
 	const Vec2f cocCoeffs0 = m_sbuf->getCocCoeffs();
@@ -530,6 +673,17 @@ void TreeGather::reprojectToUVTCenter(void)
 	for(int x=0;x<w;x++)
 		numInputSamples += m_sbuf->getNumSamples(x,y);
 
+	// Memory budget: the input copy below and the buckets coexist, and the buckets then coexist with m_samples during
+	// the build. Without slack in the buckets and with buildRecursive() releasing them, the peak stays near 2x the samples.
+	// Out-of-core there is no m_samples, and the buckets are most of what the build holds.
+
+	const size_t budget = m_params->memoryBudget;
+	const size_t estimatedPeak = getMemoryUsed() + 3*(size_t)numInputSamples*sizeof(Sample);
+	m_lowMemory = (budget && estimatedPeak > budget);
+	if(m_lowMemory)
+		printf("  Estimated peak %.1fMB exceeds the %.1fMB budget, low-memory build\n", estimatedPeak/1024.f/1024.f, budget/1024.f/1024.f);
+	m_lowMemory |= (m_params->outOfCoreResident && !m_params->enableCuda);
+
 	Array<Sample> samples;
 	samples.reset(numInputSamples);
 
@@ -589,7 +743,7 @@ void TreeGather::reprojectToUVTCenter(void)
 	if(maxSamplesPerPixel==0)
 		fail("All samples were discarded in reprojection to (u,v,t)=0. Invalid params?\n");
 
-	float scale = sqrt(1.f*maxSamplesPerPixel/MAX_LEAF_SIZE);			// How much x and y should be scaled so that maximum leaf size is approx. MAX_LEAF_SIZE
+	float scale = sqrt(1.f*maxSamplesPerPixel/max(m_params->tuning.maxLeafSize,1));	// How much x and y should be scaled so that maximum leaf size is approx. maxLeafSize
 	const int MAX_XY_SIZE = 4096;
 	if(scale*(bbmax-bbmin).max() > MAX_XY_SIZE)
 		scale = MAX_XY_SIZE / (bbmax-bbmin).max();						// Avoid excessively large surfaces
@@ -606,6 +760,28 @@ void TreeGather::reprojectToUVTCenter(void)
 
 	// Step 3: bucket the input samples
 
+	if(m_lowMemory)
+	{
+		// Size each bucket exactly instead of letting add() over-allocate.
+		Array<int> bucketSizes;
+		bucketSizes.reset(m_reprojWidth*m_reprojHeight);
+		memset(bucketSizes.getPtr(),0,bucketSizes.getNumBytes());
+
+		sidx = 0;
+		for(int y=0;y<h;y++)
+		for(int x=0;x<w;x++)
+		for(int i=0;i<m_sbuf->getNumSamples(x,y);i++)
+		{
+			const Sample& s = samples[sidx++];
+			int sx = (int)floor(scale*s.xy.x) - bbminInt.x;
+			int sy = (int)floor(scale*s.xy.y) - bbminInt.y;
+			if(sx>=0 && sy>=0 && sx<m_reprojWidth && sy<m_reprojHeight)
+				bucketSizes[sy*m_reprojWidth+sx]++;
+		}
+		for(int i=0;i<bucketSizes.getSize();i++)
+			m_reprojected[i].setCapacity(bucketSizes[i]);
+	}
+
 	int numSamplesDiscarded = 0;
 	int numSamplesAccepted  = 0;
 
@@ -643,8 +819,40 @@ void TreeGather::reprojectToUVTCenter(void)
 
 void TreeGather::FilterTask::process(int y)
 {
-	for(int x=0;x<getWidth();x++)
+	FW_TRACE_SCOPE("Filter scanline");
+	FW_PERF_SCOPE("Filtering");
+	pushMemOwner("Filtering");
+	Arena& scratch = Arena::getThreadArena();
+	m_filterer.setScratch(&scratch);
+	m_shadowFilterer.setScratch(&scratch);
+
+	const int node = MulticoreLauncher::getCurrentNode();
+	m_filterer.setNumaNode(node);
+	if(haveShadowFilterer())
+		m_shadowFilterer.setNumaNode(node);
+
+	// Cost of each pixel for the heatmap, if asked for. The counters are the Stats deltas.
+
+	const S64 numAllocs = getNumAllocs();
+	for(int x=m_tg->m_regionLo.x;x<m_tg->m_regionHi.x;x++)
+	{
+		if(!m_costs.getSize())
+		{
+			m_outputColors[x] = (haveShadowFilterer()) ? process2(Vec2i(x,y)) : process( Vec2i(x,y) );
+			continue;
+		}
+
+		const Vec3d counters0(m_stats.numNodesVisited[0], m_stats.numSamplesInLeafNodes[0], m_stats.numTriangleTests[0]);
+		const U64 ticks0 = Trace::readTSC();
+
 		m_outputColors[x] = (haveShadowFilterer()) ? process2(Vec2i(x,y)) : process( Vec2i(x,y) );
+
+		const U64 ticks = Trace::readTSC() - ticks0;
+		const Vec3d counters = Vec3d(m_stats.numNodesVisited[0], m_stats.numSamplesInLeafNodes[0], m_stats.numTriangleTests[0]) - counters0;
+		m_costs[x] = Vec4f((F32)ticks, (F32)counters.x, (F32)counters.y, (F32)counters.z);
+	}
+	m_stats.numHeapAllocs[0] += (F64)(getNumAllocs()-numAllocs);
+	popMemOwner();
 }
 
 // does motion+dof, shadow-only
@@ -652,7 +860,7 @@ Vec4f TreeGather::FilterTask::process(const Vec2i& pixelIndex)
 {
 	const int x = pixelIndex.x;
 	const int y = pixelIndex.y;
-	const int outputPatternIndex = hashBits(x,y) % NUM_PATTERNS;
+	const int outputPatternIndex = hashBits(x+m_tg->m_pixelOffset.x, y+m_tg->m_pixelOffset.y) % NUM_PATTERNS;
 
 	UVTSampleBuffer* qbuf = getQuerySampleBuffer();
 	UVTSampleBuffer* obuf = getOutputSampleBuffer();
@@ -731,7 +939,7 @@ Vec4f TreeGather::FilterTask::process2(const Vec2i& pixelIndex)
 
 	Random random(hashBits(x,y));
 	const Vec2f uvoffset(random.getF32(),random.getF32());
-	const float camFarW = m_filterer.getParams().camera.getFar() - 1e-2f;
+	const float camFarW = m_filterer.getParams().cameraFar - 1e-2f;
 	const Vec2f cCoCCoeffs = m_filterer.getParams().getCocCoeffs();
 	const Vec2f lCoCCoeffs = m_shadowFilterer.getParams().getCocCoeffs();
 	const int cw = m_filterer.getWidth ();
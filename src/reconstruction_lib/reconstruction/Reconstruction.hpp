@@ -30,8 +30,16 @@
 #include "common/CameraParams.hpp"
 #include "common/TimeBounds.hpp"
 #include "common/Util.hpp"
+#include "ReconstructionSimd.hpp"
+#include "ReconstructionOutOfCore.hpp"
 #include "base/MulticoreLauncher.hpp"
+#include "base/Arena.hpp"
+#include "base/PerfCounters.hpp"
+#include "base/InlineArray.hpp"
 #include "base/Sort.hpp"
+#include "base/Timer.hpp"
+#include "base/Topology.hpp"
+#include "base/Trace.hpp"
 #include <cfloat>
 #include <cstdio>
 
@@ -39,19 +47,41 @@
 namespace FW
 {
 
+// SameSurface heuristic (Sec. 3.2): tolerance of the fuzzy ordering compares. The half-size of the uv box
+// around the reconstruction location is ReconstructionTuning::sameSurfaceUVRange.
+static const float SAME_SURFACE_THRESHOLD	= 0.1f;
+
 class TreeGather
 {
 public:
 	TreeGather(const UVTSampleBuffer& sbuf, const CameraParams& params, float apertureAdjust = 1.f, float focalDistanceAdjust = 1.f);
-	void	reconstructDofMotion		(Image& image, Image* debugImage=NULL);
+	~TreeGather();
+	void	reconstructDofMotion		(Image& image, Image* debugImage=NULL, Image* costImage=NULL);	// costImage: per pixel (TSC ticks, nodes visited, samples tested, triangle candidates)
 	void	reconstructShadows			(UVTSampleBuffer* qbuf, Image* debugImage=NULL);
 	void	reconstructDofMotionShadows	(Image& image, const TreeGather& shadowTG);
+	bool	exportTelemetry				(const String& fileName) const;		// JSON report of the build and the last reconstruct*() call
+	void	setRegion					(const Vec2i& lo, const Vec2i& hi);	// CPU reconstruct*() computes pixels [lo,hi) only and leaves the rest of the image as is
+	void	setPixelOffset				(const Vec2i& offset)	{ m_pixelOffset = offset; }	// the buffer is a window at offset of a larger image (a shard); picks that image's output patterns
+
+	int			getNumPhases			(void) const		{ return m_phases.getSize(); }		// build phases in order, then Filtering
+	const char*	getPhaseName			(int i) const		{ return m_phases[i].name; }
+	F32			getPhaseSeconds			(int i) const		{ return m_phases[i].seconds; }
+
+	static Vec2f	adjustCocCoeffs		(const Vec2f& cocCoeffs, float apertureAdjust, float focalDistanceAdjust);
+	static float	getDispersion		(int spp);		// radius of the largest empty circle of the input sampling pattern, in pixels
+
+	S64					getHierarchyBytes	(void) const;		// samples, nodes and packets, in memory or in the file
+	const SubtreeFile*	getSubtreeFile		(void) const		{ return (m_spilled) ? &m_spilled->file : NULL; }	// NULL unless out-of-core
 
 private:
 
 	struct Stats;
 	void	init		(const UVTSampleBuffer& sbuf, const CameraParams& params, float apertureAdjust, float focalDistanceAdjust);
 	void	printStats	(const Stats& stats) const;
+	void	beginPhase	(const char* name);					// telemetry: time and memory per phase, also the FW::pushMemOwner() tag
+	void	endPhase	(void);
+	void	printPhases	(void) const;
+	void	computeLeafDepths(void);
 
 	//----------------------------------------------------------------------
 	// Structures and enums
@@ -67,7 +97,6 @@ private:
 		NUM_OUTPUT_SAMPLES			= 128,	// default
 		NUM_OUTPUT_SAMPLES_OVERRIDE	= 1,	// use this if UVT override (animations)
 		NUM_PATTERNS				= 64,
-		MAX_LEAF_SIZE				= 48,
 	};
 
 	struct Sample
@@ -131,11 +160,28 @@ private:
 		int		getQuadrant() const		{ return rpos & (XPOS|YPOS); }
 	};
 
+	struct Histogram						// power-of-two buckets: 0, 1, 2-3, 4-7, ...
+	{
+		enum { NUM_BUCKETS = 24 };
+		static S64	getBucketMin(int b)				{ return (b==0) ? 0 : (S64)1<<(b-1); }
+		void	add(S64 value)						{ int b=0; while(value>0 && b<NUM_BUCKETS-1) { value>>=1; b++; } counts[b]++; }
+		void	operator+=(const Histogram& src)	{ for(int i=0;i<NUM_BUCKETS;i++) counts[i] += src.counts[i]; }
+		S64		counts[NUM_BUCKETS];
+	};
+
+	struct Histograms						// per output sample
+	{
+		Histogram	leafNodes;
+		Histogram	samplesFetched;
+		Histogram	surfaces;
+	};
+
 	struct Stats
 	{
 		Stats() { memset(this,0,sizeof(Stats)); }
-		void	operator+=(const Stats& src)	{ Vec2d* d=(Vec2d*)this; const Vec2d* s=(const Vec2d*)(&src); for(std::size_t i=0;i<sizeof(Stats)/sizeof(Vec2d);i++) d[i] += s[i]; }
-		void	newOutputSample() const			{ Vec2d* d=(Vec2d*)this; for(std::size_t i=0;i<sizeof(Stats)/sizeof(Vec2d);i++) d[i] += Vec2d(0,1); }
+		void	operator+=(const Stats& src)	{ Vec2d* d=(Vec2d*)this; const Vec2d* s=(const Vec2d*)(&src); for(std::size_t i=0;i<getNumCounters();i++) d[i] += s[i]; histograms.leafNodes += src.histograms.leafNodes; histograms.samplesFetched += src.histograms.samplesFetched; histograms.surfaces += src.histograms.surfaces; }
+		void	newOutputSample() const			{ Vec2d* d=(Vec2d*)this; for(std::size_t i=0;i<getNumCounters();i++) d[i] += Vec2d(0,1); }
+		static std::size_t getNumCounters()		{ return (sizeof(Stats)-sizeof(Histograms))/sizeof(Vec2d); }	// the Vec2d members, histograms last
 		Vec2d	numLeafNodes;			// #leafnodes / output
 		Vec2d	numSamplesInLeafNodes;	// #samples in leafnodes / output
 		Vec2d	numSamplesWithin1R;		// #samples within 1R / output
@@ -144,6 +190,13 @@ private:
 		Vec2d	num2R;					// % outputs needing 2R fetch
 		Vec2d	numSurfacesMerged;		// % samples that had surfaces merged
 		Vec2d	numAtLeastOne;			// % outputs needing "at least 1" adjustment
+		Vec2d	numSamplesSkipped;		// #samples in leafnodes never visited by lazy gather / output
+		Vec2d	numSameSurfaceTests;	// #full sameSurface() tests / output
+		Vec2d	numHeapAllocs;			// #FW::malloc() calls by the filter / output
+		Vec2d	numTriangleSearches;	// #findCoveringTriangle() calls / output
+		Vec2d	numTriangleTests;		// #candidate triangles examined / output
+		Vec2d	numNodesVisited;		// #hierarchy nodes visited by the gather / output
+		Histograms	histograms;
 	};
 
 	struct TimeLensBounds
@@ -178,7 +231,7 @@ private:
 
 	struct Node
 	{
-		Node()							{ child0=-1; child1 = -1; }
+		Node()							{ child0=-1; child1 = -1; p0 = -1; surfaceKey = 0; }
 		bool	isLeaf() const			{ return child0==-1; }
 
 		float	getExpectedCost() const
@@ -220,7 +273,9 @@ private:
 			: tlb(TimeLensBounds(n0.tlb, n1.tlb)),
 			  child0(-1),
 			  child1(-1),
-			  ns(n0.ns + n1.ns)
+			  ns(n0.ns + n1.ns),
+			  p0(-1),
+			  surfaceKey(0)
 		{}
 
 		TimeLensBounds tlb;
@@ -228,8 +283,48 @@ private:
 		int		child0,child1;
 		int		s0,s1;		// sample indices (inc,exc)
 		int		ns;			// total number of sample under this node
+		int		p0;			// leaves only: first SamplePacket, samples s0.. in order
+		U64		surfaceKey;	// leaves only: quantized hyperplane slopes, 0 = unknown. Equal keys always pass sameSurface().
+	};
+
+	// Read-only copy of the hierarchy for the filter tasks of one NUMA node. Made by the first
+	// task that runs there, so that the pages are local to the node.
+
+	struct NumaReplica
+	{
+		Array<Node>			hierarchy;
+		Array<Sample>		samples;
+		Array<SamplePacket>	packets;
+		Spinlock			lock;
+		bool				ready;
 	};
 
+	const NumaReplica*	getNumaReplica		(int node) const;	// NULL => use the shared arrays
+
+	// Out-of-core hierarchy (CameraParams::outOfCoreResident). Each BuildTask writes the samples and
+	// packets of its subtree to a SubtreeFile when it finishes and releases them; the nodes follow after
+	// the build. The subtree of each BuildTask is one segment; the gather touches it when it reaches one
+	// of its leaves. The top of the tree is in no segment.
+
+	struct SpilledHierarchy
+	{
+		SubtreeFile			file;
+		S64					samplesOffset;		// reserved for all samples, in build order
+		S64					packetsOffset;		// packets are appended without gaps from here
+		const Node*			nodes;
+		const Sample*		samples;
+		const SamplePacket*	packets;
+		int					numNodes;
+		int					numSamples;
+		int					numPackets;
+		Array<int>			segmentEnds;		// first node after each BuildTask's subtree
+
+		void				touch				(int nodeIndex);
+	};
+
+	SpilledHierarchy*	createSpill			(int numSamples);	// NULL if the file cannot be created
+	void				spillHierarchy		(SpilledHierarchy* spilled, const Array<int>& segmentEnds, const Array<int>& sampleEnds, const Array<Vec2i>& packetRanges);
+
 	//----------------------------------------------------------------------
 	// CUDA reconstruction
 	//----------------------------------------------------------------------
@@ -245,41 +340,51 @@ private:
 	int 			buildInitialRecursive	(int x0,int x1, int y0,int y1);	// initial tree, used for building the actual tree
 	struct BuildTask;
 	void			buildRecursive			(int nodeIndex, int maxFrontierSize, Array<Node>& frontier, Array<Node>& hierarchy, BuildTask& bt) const;
-	void			emitNodes				(bool isRootNode, int maxFrontierSize, Array<Node>& frontier, Array<Node>& hierarchy) const;
+	void			emitNodes				(bool isRootNode, int maxFrontierSize, Array<Node>& frontier, int frontierStart, Array<Node>& hierarchy) const;	// merges frontier[frontierStart..]
+	void			buildSamplePackets		(void);
+	static void		packLeaf				(SamplePacket* packets, const Sample* samples, int numSamples);
 
 	struct BuildTask
 	{
-		void init(TreeGather* ptr, int index, int frontierLim, int sampleIndex)
+		void init(TreeGather* ptr, int index, int frontierLim, int sampleIndex, SpilledHierarchy* spilled)
 		{
-			tg=ptr; nodeIndex=index; maxFrontierSize=frontierLim; 
+			tg=ptr; nodeIndex=index; maxFrontierSize=frontierLim; spill=spilled;
+			sampleBase = sampleIndex; numSamples = 0; packets = Vec2i(0,0);
 			if(nodeIndex!=-1)
 			{
 				const InitialNode& in = tg->m_initialHierarchy[nodeIndex];
 				currentSampleIndex = sampleIndex;
+				numSamples = in.numSamples;
 				hierarchy.setCapacity( (in.x1-in.x0)*(in.y1-in.y0) );	// not actually a bound, but a good guess
 			}
-			hierarchy.add();	// space for root (index 0)
+			Node& root = hierarchy.add();	// space for root (index 0)
+			root.s0 = root.s1 = root.ns = 0;
 		}
 
-		Array<Sample>& getSharedSampleArray(void) const { return tg->m_samples; }
+		Array<Sample>& getSampleArray(void)		{ return (spill) ? samples : tg->m_samples; }	// indexed with currentSampleIndex-getSampleBase()
+		int getSampleBase(void) const			{ return (spill) ? sampleBase : 0; }
 
 		TreeGather* tg;
 		int nodeIndex;				
 		int maxFrontierSize;		
 
 		Array<Sample>			candidates;	// temp arrays (avoids repeated calls to malloc)
-		Array<int>				surface;
-		Array<Vec2f>			boxa, boxb;
-		Array<Vec2f>			boxaT1, boxbT1;
-		Array<TimeLensBounds>	bounds;
+		Arena					scratch;	// per-leaf temporaries, rewound after each leaf
 
-		Array<Node>		frontier;	// return parameter
+		Array<Node>		frontier;	// return parameter, children append to it
 
 		int currentSampleIndex;		// sample output array is shared (indexed with currentSampleIndex) to avoid a large memcopy
 		Array<Node>	hierarchy;		// private output for avoiding conflicts in parallel emission
+
+		SpilledHierarchy*	spill;		// out-of-core: the samples go to a private array, then to the file
+		int					sampleBase;
+		int					numSamples;
+		Array<Sample>		samples;
+		Vec2i				packets;	// written by spillSubtree(), global indices
 	};
 
-	static void buildRecursiveDispatcher	(MulticoreLauncher::Task& task) { BuildTask& bt = *(BuildTask*)task.data; bt.tg->buildRecursive(bt.nodeIndex, bt.maxFrontierSize, bt.frontier, bt.hierarchy, bt); }
+	void			spillSubtree			(BuildTask& bt) const;
+	static void		buildRecursiveDispatcher(MulticoreLauncher::Task& task);	// one BuildTask per task.idx
 
 	// for sorting samples according to first t, then w
 	static int sampleCompareFuncInc( void* data, int idxA, int idxB );
@@ -289,7 +394,15 @@ private:
 	int						m_rootIndex;
 
 	Array<Sample>			m_samples;
-	Array<Array<Sample> >	m_reprojected;
+	Array<SamplePacket>		m_packets;			// SoA copies of the leaf samples, for the gather
+	Array<NumaReplica*>		m_numaReplicas;		// per NUMA node, empty unless CameraParams::numaReplicas
+	SpilledHierarchy*		m_spilled;			// NULL unless out-of-core
+	SimdLevel				m_simdLevel;
+	mutable Array<Array<Sample> >	m_reprojected;	// buildRecursive() releases the buckets as it goes when m_lowMemory
+	bool					m_lowMemory;		// estimated build peak exceeds CameraParams::memoryBudget
+	Vec2i					m_regionLo;			// setRegion(), the whole image by default
+	Vec2i					m_regionHi;
+	Vec2i					m_pixelOffset;		// setPixelOffset()
 	int						m_reprojWidth;
 	int						m_reprojHeight;
 
@@ -305,7 +418,20 @@ private:
 	int						m_outputSpp;
 
 	const CameraParams*		m_params;
-	bool					m_multicore;
+
+	struct Phase
+	{
+		const char*	name;
+		F32			seconds;
+		size_t		memoryUsed;							// FW::getMemoryUsed() at the end of the phase
+		size_t		memoryPeak;							// highest FW::getMemoryUsed() during the phase, all threads
+	};
+
+	const char*				m_phaseName;
+	Timer					m_phaseTimer;
+	Array<Phase>			m_phases;
+	Stats					m_stats;					// of the last reconstruct*() call
+	Array<S64>				m_leafDepths;				// #leaf nodes per depth in m_hierarchy
 
 	//----------------------------------------------------------------------
 	// Filterer (performs reconstruction)
@@ -314,10 +440,8 @@ private:
 	class Filterer
 	{
 	public:
-		Filterer() : m_tg(NULL)
+		Filterer() : m_scratch(NULL), m_gatherLeaf(0), m_gatherNumSamples(0), m_numTriangleTests(0), m_tg(NULL), m_nodes(NULL), m_sampleData(NULL), m_packetData(NULL)
 		{
-			m_leafNodes.     setCapacity(128);
-			m_traversalStack.setCapacity(128);
 			m_surfaces.      setCapacity(32);
 		}
 
@@ -333,18 +457,23 @@ private:
 			Vec2f	wg;
 		};
 
-		void	setTreeGather			(const TreeGather* tg)	{ m_tg = tg; }
+		void	setTreeGather			(const TreeGather* tg)	{ m_tg = tg; if(tg) setNumaNode(-1); }
+		void	setNumaNode				(int node);												// read the node's replica, if any
+		void	setScratch				(Arena* scratch)		{ m_scratch = scratch; }	// per-thread, must be set before reconstruct()
 		bool	enabled					(void) const			{ return m_tg!=NULL; }
 
 		Result	reconstruct				(const Sample& o,float density,bool reconstructShadow, Stats& stats,Vec4f& debugColor);
 
 	private:
+		// Per-query containers keep typical queries in inline storage; only larger ones go to the heap.
+
+		typedef InlineArray<ReconSample,64>	ReconSampleArray;
+
 		struct Surface
 		{
-			Surface()			{ cmpIndices.setCapacity(64); samples.setCapacity(64); clear(); }
-			void clear (void)	{ minDist=FW_F32_MAX; minIndex=-1; quadrantMask=0; cmpIndices.clear(); samples.clear(); }
-			Array<int>			cmpIndices;
-			Array<ReconSample>	samples;
+			Surface()			{ clear(); }
+			void clear (void)	{ minDist=FW_F32_MAX; minIndex=-1; quadrantMask=0; samples.clear(); }
+			ReconSampleArray	samples;
 			float				minDist;
 			int					minIndex;
 			int					quadrantMask;
@@ -356,20 +485,59 @@ private:
 			float key;
 		};
 
+		struct SweepVertex
+		{
+			int	index;		// in Surface::samples
+			F64	key;		// angle around the output sample
+		};
+
 		int		collectInputSamples2	(Array<Surface>& surfaces, const Sample& s,float R,Stats& stats,bool separateSurfaces=true);		// uses "spectrum heuristic"
 
-		Array<Leaf>				m_leafNodes;			// unique for this task (reduces a memory allocations)
-		Array<int>				m_traversalStack;		// unique for this task (reduces a memory allocations)
+		// Incremental version of collectInputSamples2: surfaces are emitted front-to-back on demand.
+		// A surface is complete once the next one has been started or all leaf nodes have been visited.
+
+		void	beginGather				(Array<Surface>& surfaces, const Sample& s,float R,Stats& stats);
+		int		gatherSurfaces			(Array<Surface>& surfaces, int numComplete,Stats& stats);	// returns #complete surfaces
+		int		endGather				(Stats& stats);												// returns #samples gathered
+		bool	isGatherDone			(void) const			{ return m_gatherLeaf == m_leafNodes.getSize(); }
+
+		bool	mergeTinySurface		(Array<Surface>& surfaces, int sidx) const;								// combines a tiny surface with the next one
+
+		bool	isCoveringTriangle				(const ReconSample& r0,const ReconSample& r1,const ReconSample& r2, const Sample& o,float dispersion) const;
+		bool	isCandidateTriangle				(const ReconSample& r0,const ReconSample& r1,const ReconSample& r2, const Sample& o,float dispersion) const;	// all tests except coverage
+		bool	flushCandidateTriangles			(const Sample& o);
+		bool	findCoveringTriangle			(const ReconSampleArray& samples, const Sample& o,float dispersion);		// angular sweep over neighbour masks. Allocates from m_scratch, the caller rewinds.
+
+		InlineArray<Leaf,128>	m_leafNodes;
+		InlineArray<int,128>	m_traversalStack;
 		Array<Surface>			m_surfaces;				// unique for this task (reduces a memory allocations)
+		TrianglePacket			m_candidates;			// triangles waiting for the coverage test
+		Arena*					m_scratch;				// per-query temporaries (sweep, SoA filter inputs)
+
+		Sample					m_gatherOutput;			// state of the incremental gather
+		float					m_gatherR;
+		Vec3f					m_gatherUVTMin;
+		Vec3f					m_gatherUVTMax;
+		int						m_gatherLeaf;			// next leaf node to visit
+		int						m_gatherSurfaceStart;	// first leaf node of the current surface
+		U64						m_gatherSurfaceKey;		// surfaceKey shared by all leaf nodes since m_gatherSurfaceStart, 0 if none
+		int						m_gatherNumSamples;
+		S64						m_numTriangleTests;		// candidate triangles examined by the triangle search, for Stats
 
 		const TreeGather*		m_tg;
-		const Sample&			getSample				(int i) const			{ return m_tg->m_samples[i]; }
-		const Node&				getNode					(int i) const			{ return m_tg->m_hierarchy[i]; }
+		const Node*				m_nodes;				// m_tg's arrays, or their replicas on this node
+		const Sample*			m_sampleData;
+		const SamplePacket*		m_packetData;
+		const Sample&			getSample				(int i) const			{ return m_sampleData[i]; }
+		const Node&				getNode					(int i) const			{ return m_nodes[i]; }
 		float					getCocRadius			(float w) const			{ return FW::getCocRadius(m_tg->m_cocCoeffs,w); }
 		int						getRootIndex			(void) const			{ return m_tg->m_rootIndex; }
 		int						getSPP					(void) const			{ return m_tg->m_spp; }
 		ReconstructionMode		getReconstructionMode	(void) const			{ return m_tg->m_reconstructionMode; }
-		bool					isMulticore				(void) const			{ return m_tg->m_multicore; }
+		bool					isLazyGather			(void) const			{ return m_tg->m_params->lazyGather; }
+		SimdLevel				getSimdLevel			(void) const			{ return m_tg->m_simdLevel; }
+		const SamplePacket&		getPacket				(int i) const			{ return m_packetData[i]; }
+		const Vec2f&			getCocCoeffs			(void) const			{ return m_tg->m_cocCoeffs; }
 
 	public:
 		const CameraParams&		getParams				(void) const			{ return *(m_tg->m_params); }
@@ -385,9 +553,9 @@ private:
 	class FilterTask
 	{
 	public:
-		static void dispatcher	(MulticoreLauncher::Task& task) { FilterTask* fttask = (FilterTask*)task.data; fttask->process(task.idx); }
+		static void dispatcher	(MulticoreLauncher::Task& task) { FilterTask* ftasks = (FilterTask*)task.data; ftasks[task.idx].process(task.idx); }	// data = one task per scanline, pushed as one batch
 
-		void	init			(const TreeGather* tg)							{ m_tg=tg; m_filterer.setTreeGather(tg); int w=getWidth(); m_outputColors.reset(w); m_debugColors.reset(w); }
+		void	init			(const TreeGather* tg, bool measureCosts = false)	{ m_tg=tg; m_filterer.setTreeGather(tg); int w=getWidth(); m_outputColors.reset(w); m_debugColors.reset(w); m_costs.reset((measureCosts) ? w : 0); }
 		void	initShadow		(const TreeGather* shadowTG,const Mat4f& c2l,const Mat4f& cameraProjectedZfromW,const Mat4f& invws,const Mat4f& cameraToShadow2,const Mat4f& cameraToShadow2InvT,const Mat4f& invCameraProjection,const Mat4f& cameraToWorldInvT)	{ m_shadowFilterer.setTreeGather(shadowTG); m_c2l=c2l; m_cameraProjectedZfromW=cameraProjectedZfromW; m_invws=invws; m_cameraToShadow2=cameraToShadow2; m_cameraToShadow2InvT=cameraToShadow2InvT; m_invCameraProjection=invCameraProjection; m_cameraToWorldInvT=cameraToWorldInvT; }
 		void	process			(int scanline);
 
@@ -418,6 +586,7 @@ private:
 	public:
 		Array<Vec4f>			m_outputColors;			// unique for this task
 		Array<Vec4f>			m_debugColors;			// unique for this task
+		Array<Vec4f>			m_costs;				// unique for this task, see reconstructDofMotion(). Empty unless a cost image was asked for.
 		Stats					m_stats;				// unique for this task
 	};
 
@@ -456,7 +625,7 @@ private:
 	// using the center of the uv cube.
 	bool sameSurface(const TreeGather::Node& n0,const TreeGather::Node& n1, const Vec3f& uvtmin, const Vec3f& uvtmax ) const
 	{
-		const float COC_THRESHOLD = 1*0.1f;
+		const float COC_THRESHOLD = SAME_SURFACE_THRESHOLD;
 
 		// evaluate U bounds at t between a and b
 		float tmid = 0.5f * (uvtmin.z+uvtmax.z);
@@ -523,6 +692,8 @@ private:
 
 		return bTime;
 	}
+
+	static U64 computeSurfaceKey(const TimeLensBounds& tlb, float uvRange);
 };
 
 
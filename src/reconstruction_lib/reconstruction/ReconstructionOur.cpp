@@ -41,7 +41,6 @@
 #endif
 
 #include "Reconstruction.hpp"
-#include "common/EdgeFunction.hpp"
 
 namespace FW
 {
@@ -50,6 +49,25 @@ static const float SHADOW_BIAS = 0.01f;
 
 const bool DEBUG_VERBOSE = false;
 
+// Measured from the sampling pattern -- dispersion is halved when #samples quadruples.
+
+float TreeGather::getDispersion(int spp)
+{
+	switch(spp)
+	{
+	default:	fail("TreeGather::Filterer::reconstruct -- unknown SPP"); return 0.f;
+	case 256:	return 0.14f;
+	case 128:	return 0.18f;
+	case 64:	return 0.27f;
+	case 32:	return 0.37f;
+	case 16:	return 0.50f;
+	case 8:		return 0.80f;
+	case 4:		return 1.10f;
+	case 2:		return 1.34f;
+	case 1:		return 2.00f;
+	}
+}
+
 TreeGather::Filterer::Result TreeGather::Filterer::reconstruct(const Sample& o,float density,bool reconstructShadow, Stats& stats,Vec4f& debugColor)
 {
 	int numSamples1R = 0;
@@ -57,26 +75,15 @@ TreeGather::Filterer::Result TreeGather::Filterer::reconstruct(const Sample& o,f
 	int numSamplesNR = 0;
 	int totalNumSamples = 0;
 	Array<Surface>& surfaces = m_surfaces;
+	const F64 numLeafNodes0 = stats.numLeafNodes[0];
+	const F64 numSamplesFetched0 = stats.numSamplesFetched[0];
 
 	//-----------------------------------------------------------------------------------------
 	// Dispersion is the radius of largest empty circle.
 	// These number have been measured from sampling pattern.
 	//-----------------------------------------------------------------------------------------
 
-	float dispersion;
-	switch(getSPP())
-	{
-	default:	fail("TreeGather::Filterer::reconstruct -- unknown SPP");
-	case 256:	dispersion = 0.14f; break;	// measured from sampling pattern -- dispersion is halved when #samples quadruples.
-	case 128:	dispersion = 0.18f; break;
-	case 64:	dispersion = 0.27f; break;
-	case 32:	dispersion = 0.37f; break;
-	case 16:	dispersion = 0.50f; break;
-	case 8:		dispersion = 0.80f; break;
-	case 4:		dispersion = 1.10f; break;
-	case 2:		dispersion = 1.34f; break;
-	case 1:		dispersion = 2.00f; break;
-	}
+	float dispersion = getDispersion(getSPP());
 
 	// account for non-uniform view sample density in light space when using irregular buffers
 	if ( reconstructShadow )
@@ -93,8 +100,15 @@ TreeGather::Filterer::Result TreeGather::Filterer::reconstruct(const Sample& o,f
 	// 0  surfaces --> need more information
 	// 1  surfaces --> trivial case, use circle
 	// 2+ surfaces --> complex case, use triangle (must refetch with 2R), UNLESS the first surface occupies all 4 quadrants (thus guaranteed to cover output if triangulated).
+	//
+	// With lazy gathering the surfaces are emitted front-to-back on demand and gathering stops at the
+	// first surface that covers the output. The first complete surface and the start of the second
+	// one are enough to make the 2R decision.
+
+	const bool lazy = isLazyGather();
 
-	numSamples1R = collectInputSamples2(surfaces, o, dispersion, stats);
+	beginGather(surfaces, o, dispersion, stats);
+	gatherSurfaces(surfaces, lazy ? 1 : FW_S32_MAX, stats);
 
 	numSamples2R = 0;
 	numSamplesNR = 0;
@@ -102,16 +116,20 @@ TreeGather::Filterer::Result TreeGather::Filterer::reconstruct(const Sample& o,f
 	const bool fetch2R = surfaces.getSize()==0 || (surfaces[0].quadrantMask!=0xF && surfaces.getSize()>1);
 	if(fetch2R)
 	{
+		numSamples1R = endGather(stats);
+
 		// Step 2: Perform 2R fetch for triangulation.
 
-		numSamples2R = collectInputSamples2(surfaces, o, dispersion*2, stats);
+		beginGather(surfaces, o, dispersion*2, stats);
+		gatherSurfaces(surfaces, lazy ? 1 : FW_S32_MAX, stats);
 
 		// Step 3: Emergency mode, must find at least 1 sample...
 		// - Don't care about surfaces anymore
 		// - Widen the filter
 
-		if(numSamples2R==0)
+		if(surfaces.getSize()==0)
 		{
+			numSamples2R = endGather(stats);
 			stats.numAtLeastOne[0]++;
 			numSamplesNR = numSamples2R;
 			for(int k=0;k<3 && !numSamplesNR;k++)	// This needs to be limited in order to avoid near-infinite slowdowns in corner cases
@@ -124,42 +142,20 @@ TreeGather::Filterer::Result TreeGather::Filterer::reconstruct(const Sample& o,f
 	}
 
 	stats.num2R[0]			  += (fetch2R) ? 1 : 0;
-	stats.numSamplesWithin1R[0] += numSamples1R;
-
-	totalNumSamples = max(numSamples1R,numSamples2R,numSamplesNR);
-	if(DEBUG_VERBOSE)
-		printf("Collected %d input samples\n", totalNumSamples);
 
 	//-----------------------------------------------------------------------------------------
 	// Combine tiny surfaces
 	// - wouldn't be able to triangulate them...
 	// - this essentially makes the closer surface semi-transparent, hence somewhat justified.
 	// - IMPORTANT: Must not merge small occluded surfaces to the visible ones!
+	// Lazy gathering merges each surface just before processing it, once its successor is complete.
 	//-----------------------------------------------------------------------------------------
 
-	const int MIN_SAMPLES_PER_SURFACE = 4;	// Arbitrary (4 means four quadrants)
-	int numSurfaces = surfaces.getSize();
+	int numMerged = 0;
 
-	if(fetch2R)
+	if(fetch2R && !lazy)
 	for(int sidx=0;sidx<surfaces.getSize()-1;sidx++)
-	{
-		Surface& src = surfaces[sidx];
-		if(src.samples.getSize() < MIN_SAMPLES_PER_SURFACE)
-		{
-			Surface& dst = surfaces[sidx+1];
-			dst.samples.add( src.samples );
-			src.samples.reset(0);
-			if(src.minDist < dst.minDist)
-			{
-				dst.minDist  = src.minDist;
-				dst.minIndex = src.minIndex;
-			}
-			numSurfaces--;
-		}
-	}
-
-	stats.numSurfaces[0]       += numSurfaces;
-	stats.numSurfacesMerged[0] += (numSurfaces != surfaces.getSize()) ? 1 : 0;
+		numMerged += mergeTinySurface(surfaces, sidx) ? 1 : 0;
 
 	//-----------------------------------------------------------------------------------------
 	// Process input samples, one surface at a time.
@@ -170,10 +166,20 @@ TreeGather::Filterer::Result TreeGather::Filterer::reconstruct(const Sample& o,f
 	float nearestDist  = FW_F32_MAX;
 	Vec2i nearestIndex(-1,1);			// surface, sample
 
-	for(int sidx=0;sidx<surfaces.getSize() && !found;sidx++)
+	for(int sidx=0;!found;sidx++)
 	{
+		if(lazy)
+		{
+			gatherSurfaces(surfaces, sidx+2, stats);		// this one and the next one complete
+			if(fetch2R && sidx<surfaces.getSize()-1)
+				numMerged += mergeTinySurface(surfaces, sidx) ? 1 : 0;
+		}
+
+		if(sidx>=surfaces.getSize())
+			break;
+
 		const Surface& surface = surfaces[sidx];
-		const Array<ReconSample>& inputSamples = surface.samples;
+		const ReconSampleArray& inputSamples = surface.samples;
 
 		if(inputSamples.getSize()==0)
 			continue;
@@ -209,60 +215,19 @@ TreeGather::Filterer::Result TreeGather::Filterer::reconstruct(const Sample& o,f
 
 		// Find a triangle that covers output sample.
 
-		if(!isMulticore())
-			profilePush("Triangulation");
+		FW_TRACE_FINE_BEGIN("Triangulation");
 
-		// EMERGENCY CHECK: avoid very long times spent in triangulation.
-		// This should never happen, but keeping to avoid near-infinite loops if something goes wrong.
-
-		if(surface.samples.getSize()>=200)
+		if(!found)
 		{
-			printf("%d samples in triangulation\n", surface.samples.getSize());
-			found = true;
+			const Arena::Mark scratchMark = m_scratch->getMark();
+			m_numTriangleTests = 0;
+			found = findCoveringTriangle(inputSamples, o, dispersion);
+			m_scratch->rewind(scratchMark);
+			stats.numTriangleSearches[0]++;
+			stats.numTriangleTests[0] += (F64)m_numTriangleTests;
 		}
 
-		for(int m=0  ;m<surface.samples.getSize()-2 && !found; m++)
-		for(int k=m+1;k<surface.samples.getSize()-1 && !found; k++)
-		for(int l=k+1;l<surface.samples.getSize()   && !found; l++)
-		{
-			const ReconSample& r0 = inputSamples[m];
-			const ReconSample& r1 = inputSamples[k];
-			const ReconSample& r2 = inputSamples[l];
-
-			// Early out: Make sure the relative positions of input samples are on different side of output.
-
-			const int rpos = inputSamples[m].rpos | inputSamples[k].rpos | inputSamples[l].rpos;
-			if(rpos!=(XPOS|XNEG|YPOS|YNEG))
-				continue;
-
-			// Is the triangle valid? I.e. would it fit inside a circle of R=dispersion? 
-			// We approximate this by testing that each edge would fit within such a circle (edge length <= 2R).
-			// In the worst case this accepts triangles whose center is 1.15R away from vertices (equal triangle).
-
-			if((r0.xy-r1.xy).length() > 2*dispersion || (r0.xy-r2.xy).length() > 2*dispersion || (r1.xy-r2.xy).length() > 2*dispersion)
-				continue;
-
-			// Is at least one vertex within R of the reconstruction location?
-
-			if((r0.xy-o.xy).length() > dispersion && (r1.xy-o.xy).length() > dispersion && (r2.xy-o.xy).length() > dispersion)
-				continue;
-
-			// Test coverage.
-
-			EdgeFunction ef0(r1.xy.x,r1.xy.y, r2.xy.x,r2.xy.y);		// 1->2
-			EdgeFunction ef1(r2.xy.x,r2.xy.y, r0.xy.x,r0.xy.y);		// 2->0
-			EdgeFunction ef2(r0.xy.x,r0.xy.y, r1.xy.x,r1.xy.y);		// 0->1
-			const float dist0 = ef0.evaluate(o.xy.x,o.xy.y);
-			const float dist1 = ef1.evaluate(o.xy.x,o.xy.y);
-			const float dist2 = ef2.evaluate(o.xy.x,o.xy.y);
-			const bool pos0 = ef0.test(dist0);
-			const bool pos1 = ef1.test(dist1);
-			const bool pos2 = ef2.test(dist2);
-			found = (pos0&&pos1&&pos2) || (!pos0&&!pos1&&!pos2);
-		} // triangle
-
-		if(!isMulticore())
-			profilePop();
+		FW_TRACE_FINE_END();
 
 		//-------------------------------------------------------------------------------------
 		// Filter color from samples of this surface.
@@ -270,10 +235,28 @@ TreeGather::Filterer::Result TreeGather::Filterer::reconstruct(const Sample& o,f
 
 		if(found)
 		{
-			if(!isMulticore())
-				profilePush("Filter");
+			FW_TRACE_FINE_BEGIN("Filter");
 
 			result.clear();
+			if (!reconstructShadow)
+			{
+				// Gather positions and colors to SoA, filter with the SIMD kernel.
+				const int n = inputSamples.getSize();
+				const Arena::Mark scratchMark = m_scratch->getMark();
+				float* tentX     = m_scratch->alloc<float>(n);
+				float* tentY     = m_scratch->alloc<float>(n);
+				Vec4f* tentColor = m_scratch->alloc<Vec4f>(n);
+				for(int k=0;k<n;k++)
+				{
+					const ReconSample& r = inputSamples[k];
+					tentX[k]     = r.xy.x;
+					tentY[k]     = r.xy.y;
+					tentColor[k] = getSample( r.index ).color;
+				}
+				result.color = accumulateTent(getSimdLevel(), n, tentX,tentY,tentColor, o.xy,dispersion);
+				m_scratch->rewind(scratchMark);
+			}
+			else
 			for(int k=0;k<surface.samples.getSize();k++)
 			{
 				const ReconSample& r = inputSamples[k];
@@ -284,14 +267,8 @@ TreeGather::Filterer::Result TreeGather::Filterer::reconstruct(const Sample& o,f
 					continue;
 
 				// if reconstructing shadows: perform per-input-sample thresholding
-				Vec4f color;
-				if (!reconstructShadow)
-					color = s.color;
-				else
-				{
-					bool bLight = (o.w-SHADOW_BIAS <= r.key + dot(dxy,s.wg));
-					color = bLight ? s.color : Vec4f( 0, 0, 0, s.color.w );
-				}
+				bool bLight = (o.w-SHADOW_BIAS <= r.key + dot(dxy,s.wg));
+				Vec4f color = bLight ? s.color : Vec4f( 0, 0, 0, s.color.w );
 
 				result.color   += weight*color;
 			}
@@ -300,12 +277,30 @@ TreeGather::Filterer::Result TreeGather::Filterer::reconstruct(const Sample& o,f
 			result.color   *= oow;							// normalize
 			nearestIndex = Vec2i(sidx,surface.minIndex);	// from this surface (rarely needed, but anyway)
 
-			if(!isMulticore())
-				profilePop();
+			FW_TRACE_FINE_END();
 		}
 
 	} // input samples
 
+	// Close the gather, accounting for the leaf nodes lazy gathering never visited.
+
+	if(!fetch2R)
+		numSamples1R = endGather(stats);
+	else if(!numSamplesNR)
+		numSamples2R = endGather(stats);
+
+	const int numSurfaces = surfaces.getSize() - numMerged;
+	stats.numSurfaces[0]       += numSurfaces;
+	stats.numSurfacesMerged[0] += (numMerged) ? 1 : 0;
+	stats.numSamplesWithin1R[0] += numSamples1R;
+	stats.histograms.leafNodes.add		((S64)(stats.numLeafNodes[0] - numLeafNodes0));
+	stats.histograms.samplesFetched.add	((S64)(stats.numSamplesFetched[0] - numSamplesFetched0));
+	stats.histograms.surfaces.add		(numSurfaces);
+
+	totalNumSamples = max(numSamples1R,numSamples2R,numSamplesNR);
+	if(DEBUG_VERBOSE)
+		printf("Collected %d input samples\n", totalNumSamples);
+
 	//-----------------------------------------------------------------------------------------
 	// Set output color.
 	//-----------------------------------------------------------------------------------------
@@ -361,21 +356,288 @@ TreeGather::Filterer::Result TreeGather::Filterer::reconstruct(const Sample& o,f
 	return result;
 }
 
+//-----------------------------------------------------------------------------------------
+// Merges surface sidx to sidx+1 if it has too few samples to be triangulated.
+//-----------------------------------------------------------------------------------------
+
+bool TreeGather::Filterer::mergeTinySurface(Array<Surface>& surfaces, int sidx) const
+{
+	const int MIN_SAMPLES_PER_SURFACE = 4;	// Arbitrary (4 means four quadrants)
+
+	Surface& src = surfaces[sidx];
+	if(src.samples.getSize() >= MIN_SAMPLES_PER_SURFACE)
+		return false;
+
+	Surface& dst = surfaces[sidx+1];
+	dst.samples.add( src.samples );
+	src.samples.reset(0);
+	if(src.minDist < dst.minDist)
+	{
+		dst.minDist  = src.minDist;
+		dst.minIndex = src.minIndex;
+	}
+	return true;
+}
+
+//-----------------------------------------------------------------------------------------
+// Triangle search.
+// A triangle is accepted if its vertices lie on different sides of the output, it fits inside
+// a circle of R=dispersion, at least one vertex is within R, and it covers the output.
+//-----------------------------------------------------------------------------------------
+
+bool TreeGather::Filterer::isCoveringTriangle(const ReconSample& r0,const ReconSample& r1,const ReconSample& r2, const Sample& o,float dispersion) const
+{
+	return isCandidateTriangle(r0,r1,r2, o,dispersion) && coversTriangle(r0.xy,r1.xy,r2.xy, o.xy);
+}
+
+bool TreeGather::Filterer::isCandidateTriangle(const ReconSample& r0,const ReconSample& r1,const ReconSample& r2, const Sample& o,float dispersion) const
+{
+	// Early out: Make sure the relative positions of input samples are on different side of output.
+
+	const int rpos = r0.rpos | r1.rpos | r2.rpos;
+	if(rpos!=(XPOS|XNEG|YPOS|YNEG))
+		return false;
+
+	// Is the triangle valid? I.e. would it fit inside a circle of R=dispersion? 
+	// We approximate this by testing that each edge would fit within such a circle (edge length <= 2R).
+	// In the worst case this accepts triangles whose center is 1.15R away from vertices (equal triangle).
+
+	if((r0.xy-r1.xy).length() > 2*dispersion || (r0.xy-r2.xy).length() > 2*dispersion || (r1.xy-r2.xy).length() > 2*dispersion)
+		return false;
+
+	// Is at least one vertex within R of the reconstruction location?
+
+	if((r0.xy-o.xy).length() > dispersion && (r1.xy-o.xy).length() > dispersion && (r2.xy-o.xy).length() > dispersion)
+		return false;
+
+	return true;
+}
+
+// Coverage of the candidates collected so far, tested as a batch.
+
+bool TreeGather::Filterer::flushCandidateTriangles(const Sample& o)
+{
+	const U32 covered = coverTriangles(getSimdLevel(), m_candidates, o.xy);
+	m_candidates.clear();
+	return covered != 0;
+}
+
+// Bit masks over the sweep positions of the samples.
+
+static void setMaskRange(U64* mask, int lo, int hi)		// [lo,hi)
+{
+	for(int p=lo;p<hi;)
+	{
+		const int bit = p & 63;
+		const int num = min(hi-p, 64-bit);
+		mask[p>>6] |= ((num==64) ? ~(U64)0 : (((U64)1<<num)-1)) << bit;
+		p += num;
+	}
+}
+
+static inline int popLowestBit(U64& word)
+{
+	const int bit = popc64((word & (0-word)) - 1);
+	word &= word - 1;
+	return bit;
+}
+
+// Counter-clockwise angle from sweep position i to position i+k, for k in [0,n). Non-decreasing in k.
+
+template <class SweepVertex> static inline F64 sweepOffset(const SweepVertex* sweep, int n, int i, int k)
+{
+	const F64 TWO_PI = 6.28318530717958647692;
+	return sweep[(i+k)%n].key - sweep[i].key + ((i+k >= n) ? TWO_PI : 0.0);
+}
+
+// Adds the positions whose offset from i is in [lo,hi] (mod 2pi) to the mask, except i itself.
+
+template <class SweepVertex> static void addSweepWindow(U64* mask, const SweepVertex* sweep, int n, int i, F64 lo, F64 hi)
+{
+	const F64 TWO_PI = 6.28318530717958647692;
+	for(int shift=-1;shift<=1;shift++)
+	{
+		const F64 a = lo + shift*TWO_PI;
+		const F64 b = hi + shift*TWO_PI;
+		if(b < 0 || a > TWO_PI)
+			continue;
+
+		int k0 = 1, k1 = 1;		// first k with offset >= a, first k with offset > b
+		for(int hi=n;k0<hi;)
+		{
+			const int mid = (k0+hi)/2;
+			if(sweepOffset(sweep,n,i,mid) < a)	k0 = mid+1;
+			else								hi = mid;
+		}
+		for(int hi=n;k1<hi;)
+		{
+			const int mid = (k1+hi)/2;
+			if(sweepOffset(sweep,n,i,mid) <= b)	k1 = mid+1;
+			else								hi = mid;
+		}
+		if(k0 >= k1)
+			continue;
+
+		const int p0 = (i+k0)%n;
+		const int p1 = p0 + (k1-k0);
+		setMaskRange(mask, p0, min(p1,n));
+		if(p1 > n)
+			setMaskRange(mask, 0, p1-n);
+	}
+}
+
+// Finds a triangle accepted by isCoveringTriangle(), without testing all triples.
+//
+// Every vertex of an accepted triangle is within 3R of the output (one within R, edges at most
+// 2R), so only those samples take part. A bit mask per sample records which others are within 2R,
+// with the test of isCandidateTriangle(). The samples are sorted by angle around the output once.
+// A triangle covers the output only if no two of its vertices are more than pi apart going around
+// it, so with a vertex a within R, b in the half-turn counter-clockwise from a, and c between the
+// directions opposite to a and to b:
+// - If the largest angular gap exceeds pi, all samples are in a half-plane and nothing covers the output.
+// - For every a, the b window is found by binary search and masked with a's neighbours. For every
+//   such b, the c window is found by binary search, and the AND of it with the masks of a and b
+//   leaves exactly the c that pass the edge length tests.
+// The work per (a,b) pair is O(log n) plus n/64 words, on top of the O(n log n) sort and O(n^2)
+// masks. Only the c in the final mask are tested, and coverage is tested in batches. The windows
+// are padded by ANGLE_EPSILON so that they never exclude a triangle the exact edge function test
+// accepts. Samples (almost) on top of the output have no meaningful angle; then the windows are
+// dropped and all pairs of neighbours are tried.
+
+bool TreeGather::Filterer::findCoveringTriangle(const ReconSampleArray& samples, const Sample& o,float dispersion)
+{
+	const F64 PI				= 3.14159265358979323846;
+	const F64 ANGLE_EPSILON		= 1e-6;
+	const F64 DEGENERATE_DIST	= 1e-4;		// pixels
+	const float MAX_VERTEX_DIST	= 3*dispersion*(1+1e-4f);	// padded for the rounding of the length tests
+
+	// Samples that can be vertices, sorted by angle around the output.
+
+	SweepVertex* sweep = m_scratch->alloc<SweepVertex>(samples.getSize());
+	int n = 0;
+	bool degenerate = false;
+	for(int i=0;i<samples.getSize();i++)
+	{
+		if((samples[i].xy-o.xy).length() > MAX_VERTEX_DIST)
+			continue;
+
+		const F64 dx = (F64)samples[i].xy.x - (F64)o.xy.x;
+		const F64 dy = (F64)samples[i].xy.y - (F64)o.xy.y;
+		degenerate |= (fabs(dx) < DEGENERATE_DIST && fabs(dy) < DEGENERATE_DIST);
+		sweep[n].index = i;
+		sweep[n].key   = atan2(dy,dx);		// [-pi,pi]
+		n++;
+	}
+	if(n < 3)
+		return false;
+
+	FW::sort(0, n, sweep, Sort<SweepVertex>::compareFuncInc, Sort<SweepVertex>::swapFunc);
+
+	// All samples in a half-plane through the output?
+
+	if(!degenerate)
+	{
+		F64 maxGap = sweep[0].key + 2*PI - sweep[n-1].key;
+		for(int i=1;i<n;i++)
+			maxGap = max(maxGap, sweep[i].key - sweep[i-1].key);
+		if(maxGap > PI + ANGLE_EPSILON)
+			return false;
+	}
+
+	// Neighbours within 2R, by sweep position.
+
+	const int numWords = (n+63)/64;
+	U64* neighbours = m_scratch->alloc<U64>(n*numWords);
+	U64* windowB    = m_scratch->alloc<U64>(numWords);
+	U64* windowC    = m_scratch->alloc<U64>(numWords);
+	memset(neighbours, 0, n*numWords*sizeof(U64));
+	for(int i=0;i<n;i++)
+	for(int j=i+1;j<n;j++)
+		if(!((samples[sweep[i].index].xy-samples[sweep[j].index].xy).length() > 2*dispersion))
+		{
+			neighbours[i*numWords + (j>>6)] |= (U64)1 << (j&63);
+			neighbours[j*numWords + (i>>6)] |= (U64)1 << (i&63);
+		}
+
+	// Sweep.
+
+	m_candidates.clear();
+	for(int i=0;i<n;i++)
+	{
+		const ReconSample& ra = samples[ sweep[i].index ];
+		if((ra.xy-o.xy).length() > dispersion)
+			continue;
+
+		const U64* neighboursA = neighbours + i*numWords;
+		memset(windowB, 0, numWords*sizeof(U64));
+		if(degenerate)
+			setMaskRange(windowB, 0, n);
+		else
+			addSweepWindow(windowB, sweep, n, i, -ANGLE_EPSILON, PI + ANGLE_EPSILON);
+
+		for(int wb=0;wb<numWords;wb++)
+		for(U64 bitsB = windowB[wb] & neighboursA[wb]; bitsB;)
+		{
+			const int j = wb*64 + popLowestBit(bitsB);
+			const ReconSample& rb = samples[ sweep[j].index ];
+			const U64* neighboursB = neighbours + j*numWords;
+
+			memset(windowC, 0, numWords*sizeof(U64));
+			if(degenerate)
+				setMaskRange(windowC, 0, n);
+			else
+			{
+				F64 offsetB = sweep[j].key - sweep[i].key;
+				if(offsetB < 0)						offsetB += 2*PI;
+				if(offsetB > PI + ANGLE_EPSILON)	offsetB -= 2*PI;	// in the padding before a
+				addSweepWindow(windowC, sweep, n, i, PI - ANGLE_EPSILON, offsetB + PI + ANGLE_EPSILON);
+			}
+
+			for(int wc=0;wc<numWords;wc++)
+			for(U64 bitsC = windowC[wc] & neighboursA[wc] & neighboursB[wc]; bitsC;)
+			{
+				const int k = wc*64 + popLowestBit(bitsC);
+				if(k == j)
+					continue;
+
+				const ReconSample& rc = samples[ sweep[k].index ];
+				m_numTriangleTests++;
+				if(!isCandidateTriangle(ra,rb,rc, o,dispersion))
+					continue;
+
+				m_candidates.add(ra.xy,rb.xy,rc.xy);
+				if(m_candidates.isFull() && flushCandidateTriangles(o))
+					return true;
+			}
+		}
+	}
+
+	return flushCandidateTriangles(o);
+}
+
 int TreeGather::Filterer::collectInputSamples2(Array<Surface>& surfaces, const Sample& o,float R,Stats& stats,bool /*separateSurfaces*/)
+{
+	beginGather(surfaces, o, R, stats);
+	gatherSurfaces(surfaces, FW_S32_MAX, stats);
+	return endGather(stats);
+}
+
+void TreeGather::Filterer::beginGather(Array<Surface>& surfaces, const Sample& o,float R,Stats& stats)
 {
 	// Collect leaf nodes that are at least partially within R.
 
-	if(!isMulticore())
-		profilePush("Tree gather");
+	FW_TRACE_FINE_BEGIN("Tree gather");
 
 	m_leafNodes.clear();
 	m_traversalStack.clear();
 	m_traversalStack.add( getRootIndex() );
+	int numVisited = 0;
 
 	while(m_traversalStack.getSize()>0)
 	{
 		const int nodeIndex = m_traversalStack.removeLast();
 		const Node& node = getNode(nodeIndex);
+		numVisited++;
 
 		if(node.intersect(o,R))
 		{
@@ -383,6 +645,8 @@ int TreeGather::Filterer::collectInputSamples2(Array<Surface>& surfaces, const S
 			{
 				Leaf leaf;
 				leaf.nodeIndex = nodeIndex;
+				if(m_tg->m_spilled)
+					m_tg->m_spilled->touch(nodeIndex);		// pages in the subtree
 
 				const Sample& s = getSample(node.s0);		// from first sample. (u,v,t) = 0.
 				leaf.key = s.w + (o.t-s.t)*s.mv[2];			// w @ output t
@@ -397,71 +661,69 @@ int TreeGather::Filterer::collectInputSamples2(Array<Surface>& surfaces, const S
 		}
 	}
 
-	if(!isMulticore())
-		profilePop();
+	FW_TRACE_FINE_END();
 
 	stats.numLeafNodes[0] += m_leafNodes.getSize();
+	stats.numNodesVisited[0] += numVisited;
 
 	// Sort the leaf nodes front-to-back. Each leaf has samples from only one surface.
 
-	if(!isMulticore())
-		profilePush("Leaf node sort");
+	FW_TRACE_FINE_BEGIN("Leaf node sort");
 
-	Sort<Leaf>::increasing(m_leafNodes);
+	FW::sort(0, m_leafNodes.getSize(), m_leafNodes.getPtr(), Sort<Leaf>::compareFuncInc, Sort<Leaf>::swapFunc);
 
-	if(!isMulticore())
-		profilePop();
-
-	// Copy samples with R directly to the correct order. Also, creates surfaces here.
-
-	if(!isMulticore())
-		profilePush("Per-sample R test");
+	FW_TRACE_FINE_END();
 
 	surfaces.clear();
-	int totalNumSamples = 0;
-	int surfaceStart = 0;
 
 	// UVT box in which to check for crossings in sameSurface() (cf. Sec. 3.2)
-	const float RANGE = 1.0f/sqrt(128.0f);
-	Vec3f uvtmin = Vec3f( o.uv.x-RANGE, o.uv.y-RANGE, o.t-0.5f*RANGE );
-	Vec3f uvtmax = Vec3f( o.uv.x+RANGE, o.uv.y+RANGE, o.t+0.5f*RANGE );
+	const float RANGE = getParams().tuning.sameSurfaceUVRange;
+	m_gatherUVTMin = Vec3f( o.uv.x-RANGE, o.uv.y-RANGE, o.t-0.5f*RANGE );
+	m_gatherUVTMax = Vec3f( o.uv.x+RANGE, o.uv.y+RANGE, o.t+0.5f*RANGE );
+
+	m_gatherOutput			= o;
+	m_gatherR				= R;
+	m_gatherLeaf			= 0;
+	m_gatherSurfaceStart	= 0;
+	m_gatherSurfaceKey		= 0;
+	m_gatherNumSamples		= 0;
+}
+
+int TreeGather::Filterer::gatherSurfaces(Array<Surface>& surfaces, int numComplete,Stats& stats)
+{
+	// Copy samples with R directly to the correct order. Also, creates surfaces here.
 
-	// loop over found leaf nodes
-	for(int lidx=0;lidx<m_leafNodes.getSize();lidx++)
+	FW_TRACE_FINE_BEGIN("Per-sample R test");
+
+	const Sample& o = m_gatherOutput;
+	const float R = m_gatherR;
+
+	// loop over found leaf nodes, until enough surfaces are complete
+	while(m_gatherLeaf<m_leafNodes.getSize() && surfaces.getSize()-1 < numComplete)
 	{
+		const int lidx = m_gatherLeaf++;
 		bool firstInThisLeaf = true;
 		const Node& node = getNode( m_leafNodes[lidx].nodeIndex );
 		stats.numSamplesInLeafNodes[0] += node.ns;
 
-		for(int i=node.s0;i<node.s1;i++)
+		const int numPackets = (node.ns+SamplePacket::SIZE-1)/SamplePacket::SIZE;
+		for(int p=0;p<numPackets;p++)
 		{
-			// Reproject to output sample's (u,v,t)
-			const Sample& s = getSample(i);								// (u,v,t) = center.
+			// Reproject a packet of samples to output sample's (u,v,t), test against R.
+			ReprojectedPacket rp;
+			U32 inside = reprojectPacket(getSimdLevel(), getPacket(node.p0+p), o.xy,o.uv,o.t, getCocCoeffs(),R, rp);
 
-			Vec2f xy;
-			float w;
-			if(s.mv!=Vec3f(0))
+			for(int lane=0;inside;lane++,inside>>=1)
 			{
-				const Vec3f P0 = s.xy.toHomogeneous()*s.w;					// homogeneous position (u,v,t) = center
-				const Vec3f P(P0 + (o.t-s.t)*s.mv);							// homogeneous position (u,v)=0, t
-				w  = P[2];
-				xy = P.toCartesian() + getCocRadius(w)*o.uv;				// affine position @ (u,v,t)
-			}
-			else	// dof-only
-			{
-				w  = s.w;
-				xy = s.xy + getCocRadius(s.w)*o.uv;
-			}
+				if(!(inside&1))
+					continue;
 
-			const Vec2f dxy   = xy-o.xy;
-			const float dist2 = dxy.lenSqr();
-			if(dist2 <= R*R)									// within radius R?
-			{
 				ReconSample r;
-				r.xy    = xy;								// reproject to output sample's (u,v,t)
-				r.rpos  = (dxy.x>=0 ? XPOS : XNEG) | (dxy.y>=0 ? YPOS : YNEG);
-				r.key   = w;
-				r.index = i;								// in m_samples
+				r.xy    = Vec2f(rp.x[lane],rp.y[lane]);		// reproject to output sample's (u,v,t)
+				r.rpos  = ((rp.xpos>>lane)&1 ? XPOS : XNEG) | ((rp.ypos>>lane)&1 ? YPOS : YNEG);
+				r.key   = rp.w[lane];
+				r.index = node.s0 + p*SamplePacket::SIZE + lane;	// in m_samples
+				const float dist2 = rp.dist2[lane];
 
 				// SameSurface Heuristic: separate samples to surfaces.
 				
@@ -471,23 +733,27 @@ int TreeGather::Filterer::collectInputSamples2(Array<Surface>& surfaces, const S
 					bool sameSurf = true;
 
 					// test all previous leaves
-					if(!isMulticore())
-						profilePush("Same surface");
+					FW_TRACE_FINE_BEGIN("Same surface");
 
-					for ( int j = surfaceStart; j < lidx && sameSurf; ++j )
+					// Leaves with equal surface keys are known to pass; skip the plane tests for them.
+					if ( node.surfaceKey == 0 || node.surfaceKey != m_gatherSurfaceKey )
+					for ( int j = m_gatherSurfaceStart; j < lidx && sameSurf; ++j )
 					{
 						const Node& testNode = getNode( m_leafNodes[j].nodeIndex );
-						sameSurf = m_tg->sameSurface( node, testNode, uvtmin, uvtmax );
+						if ( node.surfaceKey != 0 && node.surfaceKey == testNode.surfaceKey )
+							continue;
+
+						sameSurf = m_tg->sameSurface( node, testNode, m_gatherUVTMin, m_gatherUVTMax );
+						stats.numSameSurfaceTests[0]++;
 					}
 					if ( !sameSurf || surfaces.getSize()==0 )
 					{
-						surfaceStart = lidx;
+						m_gatherSurfaceStart = lidx;
 						Surface& surface = surfaces.add();
 						surface.clear();
 					}
 
-					if(!isMulticore())
-						profilePop();
+					FW_TRACE_FINE_END();
 				}
 
 				Surface& surface = surfaces.getLast();
@@ -501,16 +767,36 @@ int TreeGather::Filterer::collectInputSamples2(Array<Surface>& surfaces, const S
 					surface.minIndex = surface.samples.getSize()-1;
 				}
 
-				totalNumSamples++;
+				m_gatherNumSamples++;
 			}
 		}
+
+		if ( m_gatherSurfaceStart == lidx )
+			m_gatherSurfaceKey = node.surfaceKey;
+		else if ( m_gatherSurfaceKey != node.surfaceKey )
+			m_gatherSurfaceKey = 0;
 	}
 
-	if(!isMulticore())
-		profilePop();
+	FW_TRACE_FINE_END();
+
+	return isGatherDone() ? surfaces.getSize() : surfaces.getSize()-1;
+}
+
+int TreeGather::Filterer::endGather(Stats& stats)
+{
+	// Leaf nodes that were never visited.
+
+	for(int lidx=m_gatherLeaf;lidx<m_leafNodes.getSize();lidx++)
+		stats.numSamplesSkipped[0] += getNode( m_leafNodes[lidx].nodeIndex ).ns;
+	m_gatherLeaf = m_leafNodes.getSize();
+
+	// Calling again is harmless, the samples are only accounted for once.
+
+	const int numSamples = m_gatherNumSamples;
+	m_gatherNumSamples = 0;
 
-	stats.numSamplesFetched[0]  += totalNumSamples;
-	return totalNumSamples;
+	stats.numSamplesFetched[0]  += numSamples;
+	return numSamples;
 }
 
-} // 
+} //
@@ -0,0 +1,405 @@
+/*
+ *  Copyright (c) 2010-2011, NVIDIA Corporation
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *      * Redistributions of source code must retain the above copyright
+ *        notice, this list of conditions and the following disclaimer.
+ *      * Redistributions in binary form must reproduce the above copyright
+ *        notice, this list of conditions and the following disclaimer in the
+ *        documentation and/or other materials provided with the distribution.
+ *      * Neither the name of NVIDIA Corporation nor the
+ *        names of its contributors may be used to endorse or promote products
+ *        derived from this software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ *  ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ *  WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ *  DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+ *  DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ *  (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ *  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ *  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ *  (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ *  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+//-----------------------------------------------------------------------------------------
+// Out-of-core hierarchy: the subtrees of the parallel build go to a mapped file and the
+// filter pages them in on demand.
+//-----------------------------------------------------------------------------------------
+
+#include "Reconstruction.hpp"
+#include "ReconstructionOutOfCore.hpp"
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#if defined(__linux__)
+#   include <errno.h>
+#   include <fcntl.h>
+#   include <sys/mman.h>
+#   include <unistd.h>
+#endif
+
+namespace FW
+{
+
+SubtreeFile::SubtreeFile(void)
+:	m_fd			(-1),
+	m_base			(NULL),
+	m_numBytes		(0),
+	m_residentBudget(0),
+	m_residentBytes	(0),
+	m_clock			(0),
+	m_numPageIns	(0),
+	m_numEvictions	(0),
+	m_bytesPagedIn	(0)
+{
+}
+
+SubtreeFile::~SubtreeFile(void)
+{
+	for(int i=0;i<m_segments.getSize();i++)
+		delete m_segments[i];
+#if defined(__linux__)
+	if(m_base)
+		munmap((void*)m_base, (size_t)m_numBytes);
+	if(m_fd != -1)
+		::close(m_fd);
+#endif
+}
+
+int SubtreeFile::addSegment(void)
+{
+	Segment* segment = new Segment;
+	segment->numBytes	= 0;
+	segment->lastUse	= 0;
+	segment->resident	= 0;
+	m_segments.add(segment);
+	return m_segments.getSize()-1;
+}
+
+void SubtreeFile::addRange(int segment, S64 offset, S64 numBytes)
+{
+	Range& r = m_segments[segment]->ranges.add();
+	r.offset	= offset;
+	r.numBytes	= numBytes;
+	m_segments[segment]->numBytes += numBytes;
+}
+
+#if defined(__linux__)
+
+static S64 getPageSize(void)
+{
+	return (S64)sysconf(_SC_PAGESIZE);
+}
+
+bool SubtreeFile::create(void)
+{
+	const char* dir = getenv("TMPDIR");
+	String name = String((dir && *dir) ? dir : "/tmp") + "/reconstruction_subtrees_XXXXXX";
+	Array<char> path(name.getPtr(), name.getLength()+1);
+	m_fd = mkstemp(path.getPtr());
+	if(m_fd == -1)
+		return false;
+	unlink(path.getPtr());				// freed when closed, also on a crash
+	return true;
+}
+
+S64 SubtreeFile::reserve(S64 numBytes, bool pageAligned)
+{
+	const S64 page = (pageAligned) ? getPageSize() : 1;
+	m_lock.enter();
+	const S64 offset = (m_numBytes+page-1)/page*page;
+	m_numBytes = offset + numBytes;
+	m_lock.leave();
+	return offset;
+}
+
+bool SubtreeFile::write(S64 offset, const void* data, S64 numBytes)
+{
+	// Written back and dropped right away, so what the build has finished does not stay in memory as page cache.
+
+	const char* ptr = (const char*)data;
+	S64 pos = offset;
+	S64 left = numBytes;
+	while(left > 0)
+	{
+		const ssize_t n = pwrite(m_fd, ptr, (size_t)min(left, (S64)1<<30), (off_t)pos);
+		if(n < 0 && errno == EINTR)
+			continue;
+		if(n <= 0)
+			return false;
+		ptr += n;
+		pos += n;
+		left -= n;
+	}
+	if(numBytes && sync_file_range(m_fd, (off64_t)offset, (off64_t)numBytes, SYNC_FILE_RANGE_WAIT_BEFORE | SYNC_FILE_RANGE_WRITE | SYNC_FILE_RANGE_WAIT_AFTER) == 0)
+		posix_fadvise(m_fd, (off_t)offset, (off_t)numBytes, POSIX_FADV_DONTNEED);
+	return true;
+}
+
+bool SubtreeFile::read(S64 offset, void* data, S64 numBytes) const
+{
+	char* ptr = (char*)data;
+	while(numBytes > 0)
+	{
+		const ssize_t n = pread(m_fd, ptr, (size_t)min(numBytes, (S64)1<<30), (off_t)offset);
+		if(n < 0 && errno == EINTR)
+			continue;
+		if(n <= 0)
+			return false;
+		ptr += n;
+		offset += n;
+		numBytes -= n;
+	}
+	return true;
+}
+
+S64 SubtreeFile::append(const void* data, S64 numBytes, bool pageAligned)
+{
+	const S64 offset = reserve(numBytes, pageAligned);
+	return (write(offset, data, numBytes)) ? offset : -1;
+}
+
+bool SubtreeFile::map(void)
+{
+	// Reserved sections that were never written read as zeros. Everything is out of the page cache,
+	// so the filter starts with nothing resident.
+
+	if(ftruncate(m_fd, (off_t)m_numBytes) != 0 || fdatasync(m_fd) != 0)
+		return false;
+	posix_fadvise(m_fd, 0, (off_t)m_numBytes, POSIX_FADV_DONTNEED);
+	void* base = mmap(NULL, (size_t)m_numBytes, PROT_READ, MAP_SHARED, m_fd, 0);
+	if(base == MAP_FAILED)
+		return false;
+	madvise(base, (size_t)m_numBytes, MADV_RANDOM);		// no readahead beyond what pageIn() asks for
+	m_base = (const U8*)base;
+	return true;
+}
+
+void SubtreeFile::pageIn(Segment& segment)
+{
+	m_lock.enter();
+	if(!segment.resident)
+	{
+		segment.lastUse = ++m_clock;
+		while(m_residentBudget && m_residentBytes + segment.numBytes > m_residentBudget)
+		{
+			Segment* lru = NULL;
+			for(int i=0;i<m_segments.getSize();i++)
+			{
+				Segment* s = m_segments[i];
+				if(s != &segment && s->resident && (!lru || s->lastUse < lru->lastUse))
+					lru = s;
+			}
+			if(!lru)
+				break;					// larger than the budget on its own
+			pageOut(*lru);
+		}
+
+		const S64 page = getPageSize();
+		for(int i=0;i<segment.ranges.getSize();i++)
+		{
+			const Range& r = segment.ranges[i];
+			const S64 lo = r.offset/page*page;
+			madvise((void*)(m_base+lo), (size_t)(r.offset+r.numBytes-lo), MADV_WILLNEED);
+		}
+		segment.resident = 1;
+		m_residentBytes += segment.numBytes;
+		m_bytesPagedIn += segment.numBytes;
+		m_numPageIns++;
+	}
+	m_lock.leave();
+}
+
+void SubtreeFile::pageOut(Segment& segment)
+{
+	// Whole pages only. A page shared with a neighbouring segment faults back in if that one is still in use.
+
+	const S64 page = getPageSize();
+	for(int i=0;i<segment.ranges.getSize();i++)
+	{
+		const Range& r = segment.ranges[i];
+		const S64 lo = r.offset/page*page;
+		const S64 hi = (r.offset+r.numBytes+page-1)/page*page;
+		madvise((void*)(m_base+lo), (size_t)(hi-lo), MADV_DONTNEED);		// our mappings
+		posix_fadvise(m_fd, (off_t)lo, (off_t)(hi-lo), POSIX_FADV_DONTNEED);	// and the page cache
+	}
+	segment.resident = 0;
+	m_residentBytes -= segment.numBytes;
+	m_numEvictions++;
+}
+
+#else
+
+bool	SubtreeFile::create		(void)					{ return false; }	// not ported
+S64		SubtreeFile::reserve	(S64, bool)				{ return -1; }
+bool	SubtreeFile::write		(S64, const void*, S64)	{ return false; }
+bool	SubtreeFile::read		(S64, void*, S64) const	{ return false; }
+S64		SubtreeFile::append		(const void*, S64, bool)	{ return -1; }
+bool	SubtreeFile::map		(void)					{ return false; }
+void	SubtreeFile::pageIn		(Segment& segment)		{ segment.resident = 1; }
+void	SubtreeFile::pageOut	(Segment& segment)		{ segment.resident = 0; }
+
+#endif
+
+//-----------------------------------------------------------------------------
+// TreeGather side.
+//-----------------------------------------------------------------------------
+
+void TreeGather::SpilledHierarchy::touch(int nodeIndex)
+{
+	int lo = 0;
+	int hi = segmentEnds.getSize();
+	while(lo < hi)								// first segment that ends after the node
+	{
+		const int mid = (lo+hi) >> 1;
+		if(segmentEnds[mid] <= nodeIndex)	lo = mid+1;
+		else								hi = mid;
+	}
+	if(lo < segmentEnds.getSize())
+		file.touch(lo);
+}
+
+// Before the build: the file, with room for all samples at their final indices.
+
+TreeGather::SpilledHierarchy* TreeGather::createSpill(int numSamples)
+{
+	SpilledHierarchy* spilled = new SpilledHierarchy;
+	if(!spilled->file.create())
+	{
+		printf("Out-of-core: cannot create a temporary file, the hierarchy stays in memory\n");
+		delete spilled;
+		return NULL;
+	}
+	spilled->samplesOffset	= spilled->file.reserve((S64)numSamples*sizeof(Sample));
+	spilled->packetsOffset	= spilled->file.reserve(0);
+	spilled->numSamples		= numSamples;
+	return spilled;
+}
+
+// Called by each BuildTask when its subtree is done. The samples go to their place in the file, the
+// packets of the subtree's leaves are appended, and both are released. Leaves still in the frontier
+// are packed by spillHierarchy().
+
+void TreeGather::spillSubtree(BuildTask& bt) const
+{
+	SubtreeFile& file = bt.spill->file;
+	const int SIZE = SamplePacket::SIZE;
+
+	int numPackets = 0;
+	for(int i=0;i<bt.hierarchy.getSize();i++)
+	{
+		Node& node = bt.hierarchy[i];
+		if(node.isLeaf())
+		{
+			node.p0 = numPackets;
+			numPackets += (node.ns+SIZE-1)/SIZE;
+		}
+	}
+
+	Array<SamplePacket> packets;
+	packets.reset(numPackets);
+	for(int i=0;i<bt.hierarchy.getSize();i++)
+	{
+		const Node& node = bt.hierarchy[i];
+		if(node.isLeaf())
+			packLeaf(packets.getPtr(node.p0), bt.samples.getPtr(node.s0-bt.sampleBase), node.ns);
+	}
+
+	// The packet section is contiguous, so offsets are whole packets from its start.
+
+	const S64 packetsOffset	= file.reserve(packets.getNumBytes(), false);
+	const int p0			= (int)((packetsOffset - bt.spill->packetsOffset) / (S64)sizeof(SamplePacket));
+	for(int i=0;i<bt.hierarchy.getSize();i++)
+		if(bt.hierarchy[i].isLeaf())
+			bt.hierarchy[i].p0 += p0;
+	bt.packets = Vec2i(p0, p0+numPackets);
+
+	const int numWritten = (bt.nodeIndex != -1) ? bt.currentSampleIndex-bt.sampleBase : 0;
+	if(!file.write(bt.spill->samplesOffset + (S64)bt.sampleBase*sizeof(Sample), bt.samples.getPtr(), (S64)numWritten*sizeof(Sample)) ||
+	   !file.write(packetsOffset, packets.getPtr(), packets.getNumBytes()))
+		fail("Out-of-core: cannot write the temporary file");
+	bt.samples.reset(0);
+}
+
+// After the top of the tree is built. Its leaves came from the frontiers and get their packets here,
+// from samples read back from the file. Then the nodes are written and the file is mapped. One segment
+// per BuildTask: its nodes, its samples and the packets of its leaves, which are contiguous in each array.
+
+void TreeGather::spillHierarchy(SpilledHierarchy* spilled, const Array<int>& segmentEnds, const Array<int>& sampleEnds, const Array<Vec2i>& packetRanges)
+{
+	SubtreeFile& file = spilled->file;
+	const int SIZE = SamplePacket::SIZE;
+	const int firstPacket = (int)((file.reserve(0, false) - spilled->packetsOffset) / (S64)sizeof(SamplePacket));
+
+	Array<int> leaves;
+	int numPackets = 0;
+	for(int i=0;i<m_hierarchy.getSize();i++)
+	{
+		Node& node = m_hierarchy[i];
+		if(node.isLeaf() && node.p0 == -1)
+		{
+			node.p0 = firstPacket + numPackets;
+			numPackets += (node.ns+SIZE-1)/SIZE;
+			leaves.add(i);
+		}
+	}
+
+	Array<SamplePacket> packets;
+	Array<Sample> samples;
+	packets.reset(numPackets);
+	bool ok = true;
+	for(int i=0;i<leaves.getSize() && ok;i++)
+	{
+		const Node& node = m_hierarchy[leaves[i]];
+		samples.reset(node.ns);
+		ok = file.read(spilled->samplesOffset + (S64)node.s0*sizeof(Sample), samples.getPtr(), samples.getNumBytes());
+		packLeaf(packets.getPtr(node.p0-firstPacket), samples.getPtr(), node.ns);
+	}
+
+	const S64 packetsOffset	= (ok) ? file.append(packets.getPtr(), packets.getNumBytes(), false)	: -1;
+	const S64 nodesOffset	= (packetsOffset != -1) ? file.append(m_hierarchy.getPtr(), m_hierarchy.getNumBytes())	: -1;
+	if(nodesOffset == -1 || !file.map())
+		fail("Out-of-core: cannot write the temporary file");
+
+	int n0 = 0;
+	int s0 = 0;
+	for(int i=0;i<segmentEnds.getSize();i++)
+	{
+		const int n1 = segmentEnds[i];
+		const int s1 = sampleEnds[i];
+		const Vec2i& p = packetRanges[i];
+
+		const int segment = file.addSegment();
+		file.addRange(segment, nodesOffset + (S64)n0*sizeof(Node), (S64)(n1-n0)*sizeof(Node));
+		file.addRange(segment, spilled->samplesOffset + (S64)s0*sizeof(Sample), (S64)(s1-s0)*sizeof(Sample));
+		if(p.x < p.y)
+			file.addRange(segment, spilled->packetsOffset + (S64)p.x*sizeof(SamplePacket), (S64)(p.y-p.x)*sizeof(SamplePacket));
+		n0 = n1;
+		s0 = s1;
+	}
+	file.setResidentBudget((S64)m_params->outOfCoreResident);
+
+	spilled->nodes			= (const Node*)file.getPtr(nodesOffset);
+	spilled->samples		= (const Sample*)file.getPtr(spilled->samplesOffset);
+	spilled->packets		= (const SamplePacket*)file.getPtr(spilled->packetsOffset);
+	spilled->numNodes		= m_hierarchy.getSize();
+	spilled->numPackets		= firstPacket + numPackets;
+	spilled->segmentEnds	= segmentEnds;
+
+	printf("Out-of-core: %.1fMB in %d subtrees, %.1fMB resident\n", file.getFileBytes()/1024.f/1024.f, segmentEnds.getSize(), m_params->outOfCoreResident/1024.f/1024.f);
+	m_hierarchy.reset(0);
+	m_spilled = spilled;
+}
+
+S64 TreeGather::getHierarchyBytes(void) const
+{
+	if(m_spilled)
+		return (S64)m_spilled->numNodes*sizeof(Node) + (S64)m_spilled->numSamples*sizeof(Sample) + (S64)m_spilled->numPackets*sizeof(SamplePacket);
+	return (S64)m_hierarchy.getNumBytes() + m_samples.getNumBytes() + m_packets.getNumBytes();
+}
+
+} //
@@ -0,0 +1,106 @@
+/*
+ *  Copyright (c) 2010-2011, NVIDIA Corporation
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *      * Redistributions of source code must retain the above copyright
+ *        notice, this list of conditions and the following disclaimer.
+ *      * Redistributions in binary form must reproduce the above copyright
+ *        notice, this list of conditions and the following disclaimer in the
+ *        documentation and/or other materials provided with the distribution.
+ *      * Neither the name of NVIDIA Corporation nor the
+ *        names of its contributors may be used to endorse or promote products
+ *        derived from this software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ *  ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ *  WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ *  DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+ *  DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ *  (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ *  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ *  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ *  (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ *  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#pragma once
+#include "base/Array.hpp"
+#include "base/Thread.hpp"
+
+namespace FW
+{
+
+//-------------------------------------------------------------------
+// Out-of-core storage for TreeGather (CameraParams::outOfCoreResident).
+// Sections are written to an unlinked temporary file while the hierarchy
+// is built, and each write leaves the page cache as soon as it reaches
+// the disk. The file is then mapped read-only. A segment is a set of byte
+// ranges that is paged in as a unit when touch()ed, evicting the least
+// recently used segments to stay within the resident budget. Eviction
+// is only advice to the kernel: a thread that still reads an evicted
+// segment faults its pages back in from the file, so nothing is pinned.
+//-------------------------------------------------------------------
+
+class SubtreeFile
+{
+public:
+					SubtreeFile			(void);
+					~SubtreeFile		(void);
+
+	bool			create				(void);									// in $TMPDIR or /tmp
+	S64				reserve				(S64 numBytes, bool pageAligned = true);	// offset of a section written later
+	bool			write				(S64 offset, const void* data, S64 numBytes);	// into a reserved section, from any thread
+	bool			read				(S64 offset, void* data, S64 numBytes) const;
+	S64				append				(const void* data, S64 numBytes, bool pageAligned = true);	// reserve() + write(), -1 on failure
+	bool			map					(void);									// after the last write()
+	const void*		getPtr				(S64 offset) const						{ return m_base + offset; }
+
+	int				addSegment			(void);
+	void			addRange			(int segment, S64 offset, S64 numBytes);
+	void			setResidentBudget	(S64 numBytes)							{ m_residentBudget = numBytes; }	// 0 == unlimited
+	void			touch				(int segment)							{ Segment& s = *m_segments[segment]; s.lastUse = m_clock; if(!s.resident) pageIn(s); }	// unlocked when resident, an approximate LRU is enough
+
+	S64				getFileBytes		(void) const							{ return m_numBytes; }
+	S64				getResidentBudget	(void) const							{ return m_residentBudget; }
+	S64				getResidentBytes	(void) const							{ return m_residentBytes; }
+	S64				getNumPageIns		(void) const							{ return m_numPageIns; }
+	S64				getNumEvictions		(void) const							{ return m_numEvictions; }
+	S64				getBytesPagedIn		(void) const							{ return m_bytesPagedIn; }
+
+private:
+	struct Range
+	{
+		S64				offset;
+		S64				numBytes;
+	};
+
+	struct Segment
+	{
+		Array<Range>	ranges;
+		S64				numBytes;
+		volatile S64	lastUse;
+		volatile S32	resident;
+	};
+
+					SubtreeFile			(const SubtreeFile&);	// forbidden
+	SubtreeFile&	operator=			(const SubtreeFile&);	// forbidden
+
+	void			pageIn				(Segment& segment);
+	void			pageOut				(Segment& segment);
+
+	int				m_fd;
+	const U8*		m_base;
+	S64				m_numBytes;
+	Array<Segment*>	m_segments;
+	S64				m_residentBudget;
+	S64				m_residentBytes;
+	volatile S64	m_clock;				// advanced by each page-in
+	S64				m_numPageIns;
+	S64				m_numEvictions;
+	S64				m_bytesPagedIn;
+	Spinlock		m_lock;					// reserve(), page-ins and evictions
+};
+
+} //
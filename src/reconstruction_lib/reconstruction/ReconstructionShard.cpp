@@ -0,0 +1,425 @@
+/*
+ *  Copyright (c) 2010-2011, NVIDIA Corporation
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *      * Redistributions of source code must retain the above copyright
+ *        notice, this list of conditions and the following disclaimer.
+ *      * Redistributions in binary form must reproduce the above copyright
+ *        notice, this list of conditions and the following disclaimer in the
+ *        documentation and/or other materials provided with the distribution.
+ *      * Neither the name of NVIDIA Corporation nor the
+ *        names of its contributors may be used to endorse or promote products
+ *        derived from this software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ *  ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ *  WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ *  DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+ *  DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ *  (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ *  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ *  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ *  (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ *  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "ReconstructionShard.hpp"
+#include "Reconstruction.hpp"
+#include "common/ReconstructionService.hpp"
+#include "common/TimeBounds.hpp"
+#include "base/Timer.hpp"
+#include "gui/Image.hpp"
+
+namespace FW
+{
+
+static const int SHARD_SAMPLE_FLOATS	= 16;
+static const int SHARD_MAX_SIZE			= 1 << 16;		// pixels per side of a window
+
+//-----------------------------------------------------------------------------
+// Reach of a sample: the bounding box of its reprojections over the lens and the
+// shutter interval, grown by the largest gather radius. The center-lens position
+// is projective in t with a denominator w(t) that keeps its sign, so its extremes
+// are at t=0 and t=1, and the circle of confusion is monotonic in w. Returns false
+// if the sample crosses the image plane, i.e. it may reach anywhere.
+//-----------------------------------------------------------------------------
+
+static bool getSampleReach(const UVTSampleBuffer& sbuf, int x,int y,int i, const Vec2f& cocCoeffs, float margin, Vec2f& lo, Vec2f& hi)
+{
+	const float w  = sbuf.getSampleW(x,y,i);
+	const Vec2f p  = sbuf.getSampleXY(x,y,i) - getCocRadius(sbuf.getCocCoeffs(),w)*sbuf.getSampleUV(x,y,i);	// (u,v)=center
+	const Vec3f mv = sbuf.getSampleMV(x,y,i);
+	const Vec3f P0 = p.toHomogeneous()*w - sbuf.getSampleT(x,y,i)*mv;		// (u,v)=center, t=0
+	const Vec3f P1 = P0 + mv;												// t=1
+	if(P0.z <= 0.f || P1.z <= 0.f)
+		return false;
+
+	const Vec2f c0 = P0.toCartesian();
+	const Vec2f c1 = P1.toCartesian();
+	const float r  = max(abs(getCocRadius(cocCoeffs,P0.z)), abs(getCocRadius(cocCoeffs,P1.z))) + margin;	// |uv| <= 1
+	lo = min(c0,c1) - r;
+	hi = max(c0,c1) + r;
+	return true;
+}
+
+bool planShardTiles(Array<ShardTile>& tiles, UVTSampleRowReader& reader, float apertureAdjust, float focalDistanceAdjust, int tileSize)
+{
+	const int w = reader.getWidth();
+	const int h = reader.getHeight();
+	const Vec2i numTiles((w+tileSize-1)/tileSize, (h+tileSize-1)/tileSize);
+
+	tiles.reset(numTiles.x*numTiles.y);
+	for(int ty=0;ty<numTiles.y;ty++)
+	for(int tx=0;tx<numTiles.x;tx++)
+	{
+		ShardTile& tile = tiles[ty*numTiles.x+tx];
+		tile.lo			= Vec2i(tx,ty)*tileSize;
+		tile.hi			= min(tile.lo+tileSize, Vec2i(w,h));
+		tile.windowLo	= tile.lo;
+		tile.windowHi	= tile.hi;
+	}
+
+	// Grow the window of every tile a pixel's samples can reach by that pixel. The
+	// rows are streamed from the file, one at a time.
+
+	const Vec2f cocCoeffs = TreeGather::adjustCocCoeffs(reader.getCocCoeffs(), apertureAdjust, focalDistanceAdjust);
+	const float margin = 16.f*TreeGather::getDispersion(reader.getNumSamples()) + 2.f;	// emergency gather radius, bicubic footprint
+	UVTSampleBuffer row(w,1,reader.getNumSamples());
+
+	for(int y=0;y<h;y++)
+	{
+		if(!reader.readRows(row, y))
+			return false;
+		for(int x=0;x<w;x++)
+		{
+			Vec2f lo( FW_F32_MAX, FW_F32_MAX);
+			Vec2f hi(-FW_F32_MAX,-FW_F32_MAX);
+			for(int i=0;i<row.getNumSamples(x,0);i++)
+			{
+				Vec2f slo,shi;
+				if(!getSampleReach(row, x,0,i, cocCoeffs, margin, slo,shi))
+				{
+					lo = Vec2f(-FW_F32_MAX,-FW_F32_MAX);
+					hi = Vec2f( FW_F32_MAX, FW_F32_MAX);
+					break;
+				}
+				lo = min(lo,slo);
+				hi = max(hi,shi);
+			}
+			if(hi.x < 0.f || hi.y < 0.f || lo.x >= (float)w || lo.y >= (float)h)
+				continue;
+
+			const Vec2f imageMax((float)(w-1), (float)(h-1));
+			const Vec2f clo = min(max(lo, Vec2f(0.f)), imageMax);
+			const Vec2f chi = min(max(hi, Vec2f(0.f)), imageMax);
+			const Vec2i t0((int)clo.x/tileSize, (int)clo.y/tileSize);
+			const Vec2i t1((int)chi.x/tileSize, (int)chi.y/tileSize);
+			for(int ty=t0.y;ty<=t1.y;ty++)
+			for(int tx=t0.x;tx<=t1.x;tx++)
+			{
+				ShardTile& tile = tiles[ty*numTiles.x+tx];
+				tile.windowLo = min(tile.windowLo, Vec2i(x,y));
+				tile.windowHi = max(tile.windowHi, Vec2i(x+1,y+1));
+			}
+		}
+	}
+	return true;
+}
+
+//-----------------------------------------------------------------------------
+// Bands. Within the image, a sample's y is bounded by the planes y = A*t + B*v + C
+// of computeTUXPlanes() over its visible time span and |v| <= 1. TreeBuilder gives
+// the leaves the same bounds, so the gather of a band they miss culls the sample
+// anyway. A sample that is never inside the image gets no bounds there, and stays
+// with its own row.
+//-----------------------------------------------------------------------------
+
+void planBands(Array<ShardTile>& bands, const UVTSampleBuffer& sbuf, float apertureAdjust, float focalDistanceAdjust, int bandRows)
+{
+	const int w = sbuf.getWidth();
+	const int h = sbuf.getHeight();
+	if(bandRows <= 0 || bandRows > h)
+		bandRows = h;
+	const int numBands = (h+bandRows-1)/bandRows;
+
+	bands.reset(numBands);
+	for(int b=0;b<numBands;b++)
+	{
+		ShardTile& band = bands[b];
+		band.lo			= Vec2i(0, b*bandRows);
+		band.hi			= Vec2i(w, min((b+1)*bandRows, h));
+		band.windowLo	= band.lo;
+		band.windowHi	= band.hi;
+	}
+	if(numBands == 1)
+		return;
+
+	// Bands span the width, so the union of a row's reach decides which windows contain the row.
+
+	const Vec2f cocCoeffs0	= sbuf.getCocCoeffs();
+	const Vec2f cocCoeffs	= TreeGather::adjustCocCoeffs(cocCoeffs0, apertureAdjust, focalDistanceAdjust);
+	const float margin		= 16.f*TreeGather::getDispersion(sbuf.getNumSamples()) + 2.f;	// emergency gather radius, bicubic footprint
+	const Vec2f bbmin(0.f, 0.f);
+	const Vec2f bbmax((float)w, (float)h);
+
+	for(int y=0;y<h;y++)
+	{
+		float lo =  FW_F32_MAX;
+		float hi = -FW_F32_MAX;
+		for(int x=0;x<w;x++)
+		for(int i=0;i<sbuf.getNumSamples(x,y);i++)
+		{
+			const float sw = sbuf.getSampleW(x,y,i);
+			const Vec2f p  = sbuf.getSampleXY(x,y,i) - getCocRadius(cocCoeffs0,sw)*sbuf.getSampleUV(x,y,i);	// (u,v)=center
+			const Vec3f mv = sbuf.getSampleMV(x,y,i);
+			const Vec3f P0 = p.toHomogeneous()*sw - sbuf.getSampleT(x,y,i)*mv;		// (u,v)=center, t=0
+
+			Vec3f planes[4];
+			Vec2f tspan;
+			if(!computeTUXPlanes(P0, mv, bbmin, bbmax, cocCoeffs, planes, tspan) || !(tspan.x < tspan.y))
+				continue;
+
+			const Vec3f& ymin = planes[2];
+			const Vec3f& ymax = planes[3];
+			lo = min(lo, ymin.z + min(ymin.x*tspan.x, ymin.x*tspan.y) - abs(ymin.y));
+			hi = max(hi, ymax.z + max(ymax.x*tspan.x, ymax.x*tspan.y) + abs(ymax.y));
+		}
+		if(lo > hi)
+			continue;
+
+		const int b0 = (int)min(max(lo-margin, 0.f), (float)(h-1)) / bandRows;
+		const int b1 = (int)min(max(hi+margin, 0.f), (float)(h-1)) / bandRows;
+		for(int b=b0;b<=b1;b++)
+		{
+			bands[b].windowLo.y = min(bands[b].windowLo.y, y);
+			bands[b].windowHi.y = max(bands[b].windowHi.y, y+1);
+		}
+	}
+}
+
+//-----------------------------------------------------------------------------
+// Transfer. Translating the window to the origin keeps the motion exact: the
+// homogeneous position (xy*w,w) moves by -origin*w, so mv.xy moves by -origin*mv.w.
+// packWindowRow() takes row y of the window from sbuf, whose pixel (0,0) is image
+// pixel sbufLo.
+//-----------------------------------------------------------------------------
+
+static void packWindowRow(F32* ptr, const UVTSampleBuffer& sbuf, const Vec2i& sbufLo, const ShardTile& tile, int y)
+{
+	const Vec2f o((float)tile.windowLo.x, (float)tile.windowLo.y);
+	y -= sbufLo.y;
+	for(int x=tile.windowLo.x-sbufLo.x;x<tile.windowHi.x-sbufLo.x;x++)
+	for(int i=0;i<sbuf.getNumSamples();i++)
+	{
+		const Vec2f  xy	= sbuf.getSampleXY(x,y,i) - o;
+		const Vec2f& uv	= sbuf.getSampleUV(x,y,i);
+		const Vec3f& mv	= sbuf.getSampleMV(x,y,i);
+		const Vec4f& c	= sbuf.getSampleColor(x,y,i);
+		const Vec2f& wg	= sbuf.getSampleWG(x,y,i);
+		*ptr++ = xy.x;	*ptr++ = xy.y;
+		*ptr++ = uv.x;	*ptr++ = uv.y;
+		*ptr++ = sbuf.getSampleT(x,y,i);
+		*ptr++ = sbuf.getSampleW(x,y,i);
+		*ptr++ = mv.x-o.x*mv.z;	*ptr++ = mv.y-o.y*mv.z;	*ptr++ = mv.z;
+		*ptr++ = c.x;	*ptr++ = c.y;	*ptr++ = c.z;	*ptr++ = c.w;
+		*ptr++ = sbuf.getSampleDepth(x,y,i);
+		*ptr++ = wg.x;	*ptr++ = wg.y;
+	}
+}
+
+static void unpackRow(UVTSampleBuffer& sbuf, int y, const F32* p)
+{
+	for(int x=0;x<sbuf.getWidth();x++)
+	for(int i=0;i<sbuf.getNumSamples();i++)
+	{
+		sbuf.setSampleXY	(x,y,i, Vec2f(p[0],p[1]));
+		sbuf.setSampleUV	(x,y,i, Vec2f(p[2],p[3]));
+		sbuf.setSampleT		(x,y,i, p[4]);
+		sbuf.setSampleW		(x,y,i, p[5]);
+		sbuf.setSampleMV	(x,y,i, Vec3f(p[6],p[7],p[8]));
+		sbuf.setSampleColor	(x,y,i, Vec4f(p[9],p[10],p[11],p[12]));
+		sbuf.setSampleDepth	(x,y,i, p[13]);
+		sbuf.setSampleWG	(x,y,i, Vec2f(p[14],p[15]));
+		p += SHARD_SAMPLE_FLOATS;
+	}
+}
+
+bool sendShard(ServiceSocket& socket, UVTSampleRowReader& reader, const ShardTile& tile)
+{
+	const Vec2i size	= tile.windowHi - tile.windowLo;
+	const int   spp		= reader.getNumSamples();
+	const Vec2f cc		= reader.getCocCoeffs();
+	if(!socket.writeLine(sprintf("SHARD %d %d %d %.9g %.9g", size.x, size.y, spp, cc.x, cc.y)))
+		return false;
+
+	UVTSampleBuffer window(size.x,1,spp);
+	Array<F32> row;
+	row.reset(size.x*spp*SHARD_SAMPLE_FLOATS);
+	for(int y=tile.windowLo.y;y<tile.windowHi.y;y++)
+	{
+		if(!reader.readRows(window, y, tile.windowLo.x))
+			return false;
+		packWindowRow(row.getPtr(), window, Vec2i(tile.windowLo.x,y), tile, y);
+		if(!socket.write(row.getPtr(), row.getNumBytes()))
+			return false;
+	}
+	return true;
+}
+
+// The size comes off the wire, so it is checked in S64 before anything is allocated:
+// sides of at most SHARD_MAX_SIZE, sample indices that fit UVTSampleBuffer's int, and
+// the samples as sent within maxBytes.
+
+UVTSampleBuffer* receiveShard(ServiceSocket& socket, S64 maxBytes)
+{
+	String line;
+	if(!socket.readLine(line))
+		return NULL;
+
+	const char* ptr = line.getPtr();
+	S32 w, h, spp;
+	Vec2f cc;
+	if(!parseLiteral(ptr, "SHARD ") || !parseInt(ptr, w) || !parseSpace(ptr) || !parseInt(ptr, h) || !parseSpace(ptr) || !parseInt(ptr, spp) ||
+	   !parseSpace(ptr) || !parseFloat(ptr, cc.x) || !parseSpace(ptr) || !parseFloat(ptr, cc.y) || *ptr)
+		return NULL;
+	if(w <= 0 || h <= 0 || spp <= 0 || spp > 256 || (spp & (spp-1)))		// see TreeGather::getDispersion()
+		return NULL;
+	if(w > SHARD_MAX_SIZE || h > SHARD_MAX_SIZE)
+		return NULL;
+	const S64 numSamples	= (S64)w*h*spp;
+	const S64 rowFloats		= (S64)w*spp*SHARD_SAMPLE_FLOATS;
+	if(numSamples > FW_S32_MAX || rowFloats > FW_S32_MAX)
+		return NULL;
+	if(maxBytes && numSamples*SHARD_SAMPLE_FLOATS*(S64)sizeof(F32) > maxBytes)
+		return NULL;
+
+	UVTSampleBuffer* sbuf = new UVTSampleBuffer(w,h,spp);
+	sbuf->setCocCoeffs(cc);
+
+	Array<F32> row;
+	row.reset((int)rowFloats);
+	for(int y=0;y<h;y++)
+	{
+		if(!socket.read(row.getPtr(), row.getNumBytes()))
+		{
+			delete sbuf;
+			return NULL;
+		}
+		unpackRow(*sbuf, y, row.getPtr());
+	}
+	return sbuf;
+}
+
+UVTSampleBuffer* extractShard(const UVTSampleBuffer& sbuf, const ShardTile& tile)
+{
+	const Vec2i size = tile.windowHi - tile.windowLo;
+	const int   spp  = sbuf.getNumSamples();
+	UVTSampleBuffer* window = new UVTSampleBuffer(size.x,size.y,spp);
+	window->setCocCoeffs(sbuf.getCocCoeffs());
+
+	Array<F32> row;
+	row.reset(size.x*spp*SHARD_SAMPLE_FLOATS);
+	for(int y=tile.windowLo.y;y<tile.windowHi.y;y++)
+	{
+		packWindowRow(row.getPtr(), sbuf, Vec2i(0), tile, y);
+		unpackRow(*window, y-tile.windowLo.y, row.getPtr());
+	}
+	return window;
+}
+
+//-----------------------------------------------------------------------------
+// Worker side.
+//-----------------------------------------------------------------------------
+
+bool runShardJob(ServiceSocket& socket, const ServiceRequest& req, CameraParams& params)
+{
+	Timer timer(true);
+	UVTSampleBuffer* sbuf = receiveShard(socket, params.memoryBudget);
+	if(!sbuf)
+	{
+		socket.writeLine("ERROR malformed or oversized shard");		// cannot resynchronize with the stream
+		return false;
+	}
+	const F32 receiveSeconds = timer.end();
+
+	params.overrideUVT	= req.overrideUVT;
+	params.filter		= req.filter;
+	params.lensFilter	= req.lensFilter;
+	params.timeFilter	= req.timeFilter;
+	TreeGather* tg = new TreeGather(*sbuf, params, req.aperture, req.focus);
+	const F32 buildSeconds = timer.end();
+
+	const Vec2i size(sbuf->getWidth(), sbuf->getHeight());
+	const Vec2i lo = min(max(req.regionLo, Vec2i(0)), size);
+	const Vec2i hi = (req.regionHi == Vec2i(0)) ? size : min(max(req.regionHi, lo), size);
+	tg->setPixelOffset(req.origin);
+	tg->setRegion(lo, hi);
+
+	Image image(size, ImageFormat::RGBA_Vec4f);
+	tg->reconstructDofMotion(image);
+	const F32 filterSeconds = timer.end();
+
+	bool connected = socket.writeLine(sprintf("OK %d %d %d %d %d %d 0 %.6f", size.x, size.y, lo.x, lo.y, hi.x, hi.y, buildSeconds));
+	for(int y=lo.y;y<hi.y && connected;y++)
+		connected = socket.write(image.getPtr(Vec2i(lo.x,y)), (S64)(hi.x-lo.x)*sizeof(Vec4f));
+	if(connected)
+		connected = socket.writeLine(sprintf("DONE %.6f", filterSeconds));
+
+	printf("shard: origin (%d,%d) window %dx%d region (%d,%d)-(%d,%d): receive %.3fs, build %.3fs, filter %.3fs\n", req.origin.x, req.origin.y, size.x, size.y,
+		lo.x, lo.y, hi.x, hi.y, receiveSeconds, buildSeconds, filterSeconds);
+
+	delete tg;
+	delete sbuf;
+	return connected;
+}
+
+//-----------------------------------------------------------------------------
+// Banded reconstruction.
+//-----------------------------------------------------------------------------
+
+F32 reconstructBanded(Image& image, const UVTSampleBuffer& sbuf, const CameraParams& params, int bandRows, float apertureAdjust, float focalDistanceAdjust, const Vec2i& lo, const Vec2i& hi)
+{
+	const Vec2i size(sbuf.getWidth(), sbuf.getHeight());
+	const Vec2i rlo = min(max(lo, Vec2i(0)), size);
+	const Vec2i rhi = (hi == Vec2i(0)) ? size : min(max(hi, rlo), size);
+
+	Timer timer(true);
+	Array<ShardTile> bands;
+	planBands(bands, sbuf, apertureAdjust, focalDistanceAdjust, bandRows);
+	printf("Banded reconstruction: %d band(s), planned in %.3fs\n", bands.getSize(), timer.end());
+
+	S64 numPixels		= 0;
+	S64 numWindowPixels	= 0;
+	for(int b=0;b<bands.getSize();b++)
+	{
+		const ShardTile& band = bands[b];
+		const Vec2i blo = max(band.lo, rlo);
+		const Vec2i bhi = min(band.hi, rhi);
+		if(blo.x >= bhi.x || blo.y >= bhi.y)
+			continue;
+
+		// A single band reaching the whole image needs no copy.
+
+		const bool whole = (band.windowLo == Vec2i(0) && band.windowHi == size);
+		UVTSampleBuffer* window = (whole) ? NULL : extractShard(sbuf, band);
+		TreeGather* tg = new TreeGather((whole) ? sbuf : *window, params, apertureAdjust, focalDistanceAdjust);
+		tg->setPixelOffset(band.windowLo);
+		tg->setRegion(blo-band.windowLo, bhi-band.windowLo);
+
+		Image bandImage(band.windowHi-band.windowLo, ImageFormat::RGBA_Vec4f);
+		tg->reconstructDofMotion(bandImage);
+		delete tg;
+		delete window;
+		image.set(blo, bandImage, blo-band.windowLo, bhi-blo);
+
+		printf("  band %d/%d: rows [%d,%d) from window rows [%d,%d), %.3fs\n", b+1, bands.getSize(), band.lo.y, band.hi.y,
+			band.windowLo.y, band.windowHi.y, timer.end());
+		numPixels		+= band.getNumPixels();
+		numWindowPixels	+= band.getNumWindowPixels();
+	}
+	return (F32)((F64)numWindowPixels/max(numPixels,(S64)1));
+}
+
+} //
@@ -0,0 +1,104 @@
+/*
+ *  Copyright (c) 2010-2011, NVIDIA Corporation
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *      * Redistributions of source code must retain the above copyright
+ *        notice, this list of conditions and the following disclaimer.
+ *      * Redistributions in binary form must reproduce the above copyright
+ *        notice, this list of conditions and the following disclaimer in the
+ *        documentation and/or other materials provided with the distribution.
+ *      * Neither the name of NVIDIA Corporation nor the
+ *        names of its contributors may be used to endorse or promote products
+ *        derived from this software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ *  ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ *  WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ *  DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+ *  DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ *  (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ *  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ *  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ *  (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ *  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#pragma once
+#include "common/SampleBuffer.hpp"
+#include "common/CameraParams.hpp"
+#include "base/Array.hpp"
+
+namespace FW
+{
+
+class Image;
+class ServiceSocket;
+struct ServiceRequest;
+
+//-------------------------------------------------------------------
+// Tile sharding of one reconstruction across processes or nodes
+// (reconstruction_cli -shards, -worker). The output is cut into tiles,
+// and each tile is reconstructed by a worker from a window of input
+// pixels: every pixel that has a sample whose reprojection, anywhere
+// on the lens and shutter interval, lands within the largest gather
+// radius of the tile. The windows overlap (the halo), tiles do not.
+// The coordinator streams the input from its file, so neither planning
+// nor sending needs the whole buffer in memory.
+//
+// The worker builds its own hierarchy over the window and offsets the
+// output sample patterns by the window origin, so a tile matches the
+// same pixels of a single-process reconstruction up to differences in
+// the hierarchy's shape.
+//-------------------------------------------------------------------
+
+struct ShardTile
+{
+	Vec2i	lo, hi;					// output pixels [lo,hi)
+	Vec2i	windowLo, windowHi;		// input pixels [windowLo,windowHi), contains [lo,hi)
+
+	S64		getNumPixels		(void) const	{ return (S64)(hi.x-lo.x)*(hi.y-lo.y); }
+	S64		getNumWindowPixels	(void) const	{ return (S64)(windowHi.x-windowLo.x)*(windowHi.y-windowLo.y); }
+};
+
+bool				planShardTiles	(Array<ShardTile>& tiles, UVTSampleRowReader& reader, float apertureAdjust, float focalDistanceAdjust, int tileSize);	// false if the file cannot be read
+
+// Wire format: "SHARD <w> <h> <spp> <cocX> <cocY>", then the window's
+// samples in scanline order, 16 F32 each (xy uv t w mv color depth wg)
+// with xy and mv relative to the window origin.
+
+bool				sendShard		(ServiceSocket& socket, UVTSampleRowReader& reader, const ShardTile& tile);	// false if the connection is lost or the file cannot be read
+UVTSampleBuffer*	receiveShard	(ServiceSocket& socket, S64 maxBytes = 0);	// NULL on a malformed stream or a window over the limits, maxBytes 0: no budget
+
+// Worker side of a Command_Shard request whose header has been read:
+// receives the samples and answers like a reconstruct request, in
+// window-local coordinates. params carries the worker's tuning and
+// memory budget; the request's filters are written into it. False if
+// the connection is lost.
+
+bool				runShardJob		(ServiceSocket& socket, const ServiceRequest& req, CameraParams& params);
+
+//-------------------------------------------------------------------
+// Banded reconstruction in one process (reconstruction_cli -bands). The
+// tiles are full-width bands, and a pixel's samples reach a band if
+// their time/lens bounds (computeTUXPlanes(), the planes the hierarchy
+// culls with) come within the largest gather radius of it. Each band's
+// window is extracted, built, filtered and freed before the next, so
+// the peak memory of the reconstruction follows the band size. Smaller
+// bands repeat more halo rows in the builds and the gathers.
+//-------------------------------------------------------------------
+
+void				planBands			(Array<ShardTile>& bands, const UVTSampleBuffer& sbuf, float apertureAdjust, float focalDistanceAdjust, int bandRows);
+UVTSampleBuffer*	extractShard		(const UVTSampleBuffer& sbuf, const ShardTile& tile);	// the window, relative to its origin as sent by sendShard()
+
+// Reconstructs pixels [lo,hi) of image (hi == 0: all) in bands of
+// bandRows rows (0: a single band). Returns the number of input pixels
+// built per output pixel, i.e. 1 + the halo overhead. This is a driver
+// over TreeGather, not a mode of it: a TreeGather always builds one
+// hierarchy over its whole buffer.
+
+F32					reconstructBanded	(Image& image, const UVTSampleBuffer& sbuf, const CameraParams& params, int bandRows, float apertureAdjust = 1.f, float focalDistanceAdjust = 1.f,
+										 const Vec2i& lo = Vec2i(0), const Vec2i& hi = Vec2i(0));
+
+} //
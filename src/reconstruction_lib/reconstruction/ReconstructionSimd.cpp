@@ -0,0 +1,546 @@
+/*
+ *  Copyright (c) 2010-2011, NVIDIA Corporation
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *      * Redistributions of source code must retain the above copyright
+ *        notice, this list of conditions and the following disclaimer.
+ *      * Redistributions in binary form must reproduce the above copyright
+ *        notice, this list of conditions and the following disclaimer in the
+ *        documentation and/or other materials provided with the distribution.
+ *      * Neither the name of NVIDIA Corporation nor the
+ *        names of its contributors may be used to endorse or promote products
+ *        derived from this software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ *  ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ *  WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ *  DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+ *  DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ *  (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ *  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ *  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ *  (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ *  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#include "ReconstructionSimd.hpp"
+#include "common/CameraParams.hpp"
+#include "common/EdgeFunction.hpp"
+#include <cfloat>
+#include <cstring>
+
+#if defined(__GNUC__) && (defined(__i386__) || defined(__x86_64__))
+#	define FW_SIMD_X86 1
+#	define FW_SIMD_TARGET(X) __attribute__((target(X)))
+#	include <immintrin.h>
+#else
+#	define FW_SIMD_X86 0
+#endif
+
+namespace FW
+{
+
+// Coverage: a float edge value e decides the sign if |e| > COVERAGE_GUARD*M + FLT_MIN, where
+// M = (|px|+|xa|)*|A| + (|py|+|ya|)*|B| bounds the magnitude of the terms. The rounding error of the
+// float evaluation is below 4*2^-24*M and that of EdgeFunction's F64 evaluation far below it, so both
+// agree on the sign and EdgeFunction's result is non-zero (no tie-breaking needed).
+
+static const float COVERAGE_GUARD = 1.f/524288.f;		// 2^-19
+
+SimdLevel detectSimdLevel(void)
+{
+#if FW_SIMD_X86
+	__builtin_cpu_init();
+	if(__builtin_cpu_supports("avx2"))	return SIMD_AVX2;
+	if(__builtin_cpu_supports("sse2"))	return SIMD_SSE;
+#endif
+	return SIMD_SCALAR;
+}
+
+const char* getSimdLevelName(SimdLevel level)
+{
+	switch(level)
+	{
+	case SIMD_SCALAR:	return "scalar";
+	case SIMD_SSE:		return "SSE2";
+	case SIMD_AVX2:		return "AVX2";
+	default:			return "unknown";
+	}
+}
+
+//-----------------------------------------------------------------------------------------
+// Packets
+//-----------------------------------------------------------------------------------------
+
+void SamplePacket::set(int lane, const Vec2f& xy,float w,float t, const Vec3f& mv)
+{
+	const Vec3f P0 = xy.toHomogeneous()*w;		// homogeneous position (u,v,t) = center
+	this->x[lane]	= xy.x;
+	this->y[lane]	= xy.y;
+	this->hx[lane]	= P0.x;
+	this->hy[lane]	= P0.y;
+	this->w[lane]	= P0.z;
+	this->t[lane]	= t;
+	this->mvx[lane]	= mv.x;
+	this->mvy[lane]	= mv.y;
+	this->mvw[lane]	= mv.z;
+}
+
+void SamplePacket::setEmpty(int lane)
+{
+	set(lane, Vec2f(FW_F32_MAX), 1.f, 0.f, Vec3f(0.f));	// distance to any output overflows to inf
+}
+
+TrianglePacket::TrianglePacket(void)
+{
+	memset(this, 0, sizeof(TrianglePacket));			// unused lanes are evaluated too
+}
+
+void TrianglePacket::add(const Vec2f& v0,const Vec2f& v1,const Vec2f& v2)
+{
+	FW_ASSERT(num < SIZE);
+	x0[num] = v0.x;	y0[num] = v0.y;
+	x1[num] = v1.x;	y1[num] = v1.y;
+	x2[num] = v2.x;	y2[num] = v2.y;
+	num++;
+}
+
+bool coversTriangle(const Vec2f& v0,const Vec2f& v1,const Vec2f& v2, const Vec2f& p)
+{
+	EdgeFunction ef0(v1.x,v1.y, v2.x,v2.y);		// 1->2
+	EdgeFunction ef1(v2.x,v2.y, v0.x,v0.y);		// 2->0
+	EdgeFunction ef2(v0.x,v0.y, v1.x,v1.y);		// 0->1
+	const bool pos0 = ef0.test(ef0.evaluate(p.x,p.y));
+	const bool pos1 = ef1.test(ef1.evaluate(p.x,p.y));
+	const bool pos2 = ef2.test(ef2.evaluate(p.x,p.y));
+	return (pos0&&pos1&&pos2) || (!pos0&&!pos1&&!pos2);
+}
+
+//-----------------------------------------------------------------------------------------
+// Scalar kernels. These are the reference, and follow the operation order of the original
+// per-sample code exactly.
+//-----------------------------------------------------------------------------------------
+
+static U32 reprojectPacketScalar(const SamplePacket& p, const Vec2f& oxy,const Vec2f& ouv,float ot, const Vec2f& cocCoeffs,float R, ReprojectedPacket& out)
+{
+	const float R2 = R*R;
+	out.inside = out.xpos = out.ypos = 0;
+
+	for(int i=0;i<SamplePacket::SIZE;i++)
+	{
+		float x,y,w;
+		if(p.mvx[i]!=0 || p.mvy[i]!=0 || p.mvw[i]!=0)
+		{
+			const float dt = ot-p.t[i];
+			const float hx = p.hx[i] + dt*p.mvx[i];		// homogeneous position (u,v)=0, t
+			const float hy = p.hy[i] + dt*p.mvy[i];
+			w = p.w[i] + dt*p.mvw[i];
+			const float c = rcp(w);
+			x = hx*c;
+			y = hy*c;
+		}
+		else	// dof-only
+		{
+			x = p.x[i];
+			y = p.y[i];
+			w = p.w[i];
+		}
+
+		const float coc = getCocRadius(cocCoeffs,w);
+		x += coc*ouv.x;										// affine position @ (u,v,t)
+		y += coc*ouv.y;
+
+		const float dx = x-oxy.x;
+		const float dy = y-oxy.y;
+		out.x[i]		= x;
+		out.y[i]		= y;
+		out.w[i]		= w;
+		out.dist2[i]	= dx*dx + dy*dy;
+
+		if(out.dist2[i] <= R2)	out.inside |= 1u<<i;
+		if(dx >= 0)				out.xpos   |= 1u<<i;
+		if(dy >= 0)				out.ypos   |= 1u<<i;
+	}
+
+	return out.inside;
+}
+
+static Vec4f accumulateTentScalar(int n, const float* x,const float* y,const Vec4f* colors, const Vec2f& oxy,float R)
+{
+	Vec4f sum(0.f);
+	for(int k=0;k<n;k++)
+	{
+		const float dx = oxy.x-x[k];
+		const float dy = oxy.y-y[k];
+		const float weight = 1 - sqrt(dx*dx + dy*dy)/R;		// tent filter
+		if(weight<=0)
+			continue;
+		sum += weight*colors[k];
+	}
+	return sum;
+}
+
+// Returns the float-decided covering lanes, and the lanes that need the exact test.
+
+static U32 coverTrianglesScalar(const TrianglePacket& tris, const Vec2f& p, U32& ambiguous)
+{
+	U32 covered = 0;
+	ambiguous = 0;
+
+	for(int i=0;i<TrianglePacket::SIZE;i++)
+	{
+		const float xs[3] = { tris.x0[i], tris.x1[i], tris.x2[i] };
+		const float ys[3] = { tris.y0[i], tris.y1[i], tris.y2[i] };
+		bool pos[3];
+		bool sure = true;
+		for(int k=0;k<3;k++)
+		{
+			const int a = (k+1)%3;				// edges 1->2, 2->0, 0->1
+			const int b = (k+2)%3;
+			const float A  = ys[a]-ys[b];
+			const float B  = xs[b]-xs[a];
+			const float e  = A*(p.x-xs[a]) + B*(p.y-ys[a]);
+			const float M  = (fabs(p.x)+fabs(xs[a]))*fabs(A) + (fabs(p.y)+fabs(ys[a]))*fabs(B);
+			sure   = sure && (fabs(e) > COVERAGE_GUARD*M + FLT_MIN);
+			pos[k] = e > 0;
+		}
+
+		if(!sure)
+			ambiguous |= 1u<<i;
+		else if((pos[0]&&pos[1]&&pos[2]) || (!pos[0]&&!pos[1]&&!pos[2]))
+			covered |= 1u<<i;
+	}
+
+	return covered;
+}
+
+#if FW_SIMD_X86
+
+//-----------------------------------------------------------------------------------------
+// SSE2 kernels, 4 lanes.
+//-----------------------------------------------------------------------------------------
+
+FW_SIMD_TARGET("sse2")
+static inline __m128 select4(__m128 mask,__m128 a,__m128 b)	// mask ? a : b
+{
+	return _mm_or_ps( _mm_and_ps(mask,a), _mm_andnot_ps(mask,b) );
+}
+
+FW_SIMD_TARGET("sse2")
+static U32 reprojectPacketSSE(const SamplePacket& p, const Vec2f& oxy,const Vec2f& ouv,float ot, const Vec2f& cocCoeffs,float R, ReprojectedPacket& out)
+{
+	const __m128 zero	= _mm_setzero_ps();
+	const __m128 one	= _mm_set1_ps(1.f);
+	const __m128 R2		= _mm_set1_ps(R*R);
+	out.inside = out.xpos = out.ypos = 0;
+
+	for(int i=0;i<SamplePacket::SIZE;i+=4)
+	{
+		const __m128 mvx = _mm_loadu_ps(p.mvx+i);
+		const __m128 mvy = _mm_loadu_ps(p.mvy+i);
+		const __m128 mvw = _mm_loadu_ps(p.mvw+i);
+		const __m128 w0  = _mm_loadu_ps(p.w+i);
+		const __m128 moving = _mm_or_ps( _mm_or_ps(_mm_cmpneq_ps(mvx,zero), _mm_cmpneq_ps(mvy,zero)), _mm_cmpneq_ps(mvw,zero) );
+
+		const __m128 dt = _mm_sub_ps( _mm_set1_ps(ot), _mm_loadu_ps(p.t+i) );
+		const __m128 hx = _mm_add_ps( _mm_loadu_ps(p.hx+i), _mm_mul_ps(dt,mvx) );
+		const __m128 hy = _mm_add_ps( _mm_loadu_ps(p.hy+i), _mm_mul_ps(dt,mvy) );
+		const __m128 hw = _mm_add_ps( w0, _mm_mul_ps(dt,mvw) );
+		const __m128 c  = _mm_and_ps( _mm_div_ps(one,hw), _mm_cmpneq_ps(hw,zero) );	// rcp()
+
+		const __m128 w   = select4( moving, hw, w0 );
+		const __m128 coc = _mm_add_ps( _mm_div_ps(_mm_set1_ps(cocCoeffs[0]),w), _mm_set1_ps(cocCoeffs[1]) );
+		const __m128 x   = _mm_add_ps( select4(moving, _mm_mul_ps(hx,c), _mm_loadu_ps(p.x+i)), _mm_mul_ps(coc,_mm_set1_ps(ouv.x)) );
+		const __m128 y   = _mm_add_ps( select4(moving, _mm_mul_ps(hy,c), _mm_loadu_ps(p.y+i)), _mm_mul_ps(coc,_mm_set1_ps(ouv.y)) );
+
+		const __m128 dx    = _mm_sub_ps( x, _mm_set1_ps(oxy.x) );
+		const __m128 dy    = _mm_sub_ps( y, _mm_set1_ps(oxy.y) );
+		const __m128 dist2 = _mm_add_ps( _mm_mul_ps(dx,dx), _mm_mul_ps(dy,dy) );
+
+		_mm_storeu_ps( out.x+i, x );
+		_mm_storeu_ps( out.y+i, y );
+		_mm_storeu_ps( out.w+i, w );
+		_mm_storeu_ps( out.dist2+i, dist2 );
+		out.inside |= _mm_movemask_ps( _mm_cmple_ps(dist2,R2) ) << i;
+		out.xpos   |= _mm_movemask_ps( _mm_cmpge_ps(dx,zero) ) << i;
+		out.ypos   |= _mm_movemask_ps( _mm_cmpge_ps(dy,zero) ) << i;
+	}
+
+	return out.inside;
+}
+
+FW_SIMD_TARGET("sse2")
+static Vec4f accumulateTentSSE(int n, const float* x,const float* y,const Vec4f* colors, const Vec2f& oxy,float R)
+{
+	const __m128 one = _mm_set1_ps(1.f);
+	const __m128 ox  = _mm_set1_ps(oxy.x);
+	const __m128 oy  = _mm_set1_ps(oxy.y);
+	const __m128 r   = _mm_set1_ps(R);
+
+	__m128 sum = _mm_setzero_ps();
+	float weights[4];
+	for(int k=0;k<n;k+=4)
+	{
+		const int m = min(n-k,4);
+		if(m==4)
+		{
+			const __m128 dx = _mm_sub_ps( ox, _mm_loadu_ps(x+k) );
+			const __m128 dy = _mm_sub_ps( oy, _mm_loadu_ps(y+k) );
+			const __m128 len = _mm_sqrt_ps( _mm_add_ps(_mm_mul_ps(dx,dx), _mm_mul_ps(dy,dy)) );
+			_mm_storeu_ps( weights, _mm_sub_ps(one, _mm_div_ps(len,r)) );
+		}
+		else
+		{
+			for(int j=0;j<m;j++)
+			{
+				const float dx = oxy.x-x[k+j];
+				const float dy = oxy.y-y[k+j];
+				weights[j] = 1 - sqrt(dx*dx + dy*dy)/R;
+			}
+		}
+
+		// Accumulate in input order so that the result matches the scalar code.
+
+		for(int j=0;j<m;j++)
+			if(!(weights[j]<=0))
+				sum = _mm_add_ps( sum, _mm_mul_ps(_mm_loadu_ps(&colors[k+j].x), _mm_set1_ps(weights[j])) );
+	}
+
+	Vec4f result;
+	_mm_storeu_ps( &result.x, sum );
+	return result;
+}
+
+FW_SIMD_TARGET("sse2")
+static U32 coverTrianglesSSE(const TrianglePacket& tris, const Vec2f& p, U32& ambiguous)
+{
+	const __m128 zero	= _mm_setzero_ps();
+	const __m128 absMask = _mm_castsi128_ps( _mm_set1_epi32(0x7fffffff) );
+	const __m128 guard	= _mm_set1_ps(COVERAGE_GUARD);
+	const __m128 tiny	= _mm_set1_ps(FLT_MIN);
+	const __m128 px		= _mm_set1_ps(p.x);
+	const __m128 py		= _mm_set1_ps(p.y);
+	const __m128 apx	= _mm_and_ps(px,absMask);
+	const __m128 apy	= _mm_and_ps(py,absMask);
+
+	U32 covered = 0;
+	ambiguous = 0;
+
+	for(int i=0;i<TrianglePacket::SIZE;i+=4)
+	{
+		const __m128 xs[3] = { _mm_loadu_ps(tris.x0+i), _mm_loadu_ps(tris.x1+i), _mm_loadu_ps(tris.x2+i) };
+		const __m128 ys[3] = { _mm_loadu_ps(tris.y0+i), _mm_loadu_ps(tris.y1+i), _mm_loadu_ps(tris.y2+i) };
+		__m128 pos[3];
+		__m128 sure = _mm_cmpeq_ps(zero,zero);
+		for(int k=0;k<3;k++)
+		{
+			const int a = (k+1)%3;
+			const int b = (k+2)%3;
+			const __m128 A = _mm_sub_ps( ys[a], ys[b] );
+			const __m128 B = _mm_sub_ps( xs[b], xs[a] );
+			const __m128 e = _mm_add_ps( _mm_mul_ps(A, _mm_sub_ps(px,xs[a])), _mm_mul_ps(B, _mm_sub_ps(py,ys[a])) );
+			const __m128 M = _mm_add_ps( _mm_mul_ps(_mm_add_ps(apx, _mm_and_ps(xs[a],absMask)), _mm_and_ps(A,absMask)),
+										 _mm_mul_ps(_mm_add_ps(apy, _mm_and_ps(ys[a],absMask)), _mm_and_ps(B,absMask)) );
+			sure   = _mm_and_ps( sure, _mm_cmpgt_ps(_mm_and_ps(e,absMask), _mm_add_ps(_mm_mul_ps(guard,M),tiny)) );
+			pos[k] = _mm_cmpgt_ps( e, zero );
+		}
+
+		const __m128 allPos = _mm_and_ps( _mm_and_ps(pos[0],pos[1]), pos[2] );
+		const __m128 anyPos = _mm_or_ps ( _mm_or_ps (pos[0],pos[1]), pos[2] );
+		const int surebits = _mm_movemask_ps(sure);
+		covered   |= (surebits & (_mm_movemask_ps(allPos) | ~_mm_movemask_ps(anyPos)) & 0xF) << i;
+		ambiguous |= (~surebits & 0xF) << i;
+	}
+
+	return covered;
+}
+
+//-----------------------------------------------------------------------------------------
+// AVX2 kernels, 8 lanes.
+//-----------------------------------------------------------------------------------------
+
+FW_SIMD_TARGET("avx2")
+static U32 reprojectPacketAVX2(const SamplePacket& p, const Vec2f& oxy,const Vec2f& ouv,float ot, const Vec2f& cocCoeffs,float R, ReprojectedPacket& out)
+{
+	const __m256 zero	= _mm256_setzero_ps();
+	const __m256 one	= _mm256_set1_ps(1.f);
+
+	const __m256 mvx = _mm256_loadu_ps(p.mvx);
+	const __m256 mvy = _mm256_loadu_ps(p.mvy);
+	const __m256 mvw = _mm256_loadu_ps(p.mvw);
+	const __m256 w0  = _mm256_loadu_ps(p.w);
+	const __m256 moving = _mm256_or_ps( _mm256_or_ps(_mm256_cmp_ps(mvx,zero,_CMP_NEQ_UQ), _mm256_cmp_ps(mvy,zero,_CMP_NEQ_UQ)), _mm256_cmp_ps(mvw,zero,_CMP_NEQ_UQ) );
+
+	const __m256 dt = _mm256_sub_ps( _mm256_set1_ps(ot), _mm256_loadu_ps(p.t) );
+	const __m256 hx = _mm256_add_ps( _mm256_loadu_ps(p.hx), _mm256_mul_ps(dt,mvx) );
+	const __m256 hy = _mm256_add_ps( _mm256_loadu_ps(p.hy), _mm256_mul_ps(dt,mvy) );
+	const __m256 hw = _mm256_add_ps( w0, _mm256_mul_ps(dt,mvw) );
+	const __m256 c  = _mm256_and_ps( _mm256_div_ps(one,hw), _mm256_cmp_ps(hw,zero,_CMP_NEQ_UQ) );	// rcp()
+
+	const __m256 w   = _mm256_blendv_ps( w0, hw, moving );
+	const __m256 coc = _mm256_add_ps( _mm256_div_ps(_mm256_set1_ps(cocCoeffs[0]),w), _mm256_set1_ps(cocCoeffs[1]) );
+	const __m256 x   = _mm256_add_ps( _mm256_blendv_ps(_mm256_loadu_ps(p.x), _mm256_mul_ps(hx,c), moving), _mm256_mul_ps(coc,_mm256_set1_ps(ouv.x)) );
+	const __m256 y   = _mm256_add_ps( _mm256_blendv_ps(_mm256_loadu_ps(p.y), _mm256_mul_ps(hy,c), moving), _mm256_mul_ps(coc,_mm256_set1_ps(ouv.y)) );
+
+	const __m256 dx    = _mm256_sub_ps( x, _mm256_set1_ps(oxy.x) );
+	const __m256 dy    = _mm256_sub_ps( y, _mm256_set1_ps(oxy.y) );
+	const __m256 dist2 = _mm256_add_ps( _mm256_mul_ps(dx,dx), _mm256_mul_ps(dy,dy) );
+
+	_mm256_storeu_ps( out.x, x );
+	_mm256_storeu_ps( out.y, y );
+	_mm256_storeu_ps( out.w, w );
+	_mm256_storeu_ps( out.dist2, dist2 );
+	out.inside = _mm256_movemask_ps( _mm256_cmp_ps(dist2,_mm256_set1_ps(R*R),_CMP_LE_OQ) );
+	out.xpos   = _mm256_movemask_ps( _mm256_cmp_ps(dx,zero,_CMP_GE_OQ) );
+	out.ypos   = _mm256_movemask_ps( _mm256_cmp_ps(dy,zero,_CMP_GE_OQ) );
+
+	return out.inside;
+}
+
+FW_SIMD_TARGET("avx2")
+static Vec4f accumulateTentAVX2(int n, const float* x,const float* y,const Vec4f* colors, const Vec2f& oxy,float R)
+{
+	const __m256 one = _mm256_set1_ps(1.f);
+	const __m256 ox  = _mm256_set1_ps(oxy.x);
+	const __m256 oy  = _mm256_set1_ps(oxy.y);
+	const __m256 r   = _mm256_set1_ps(R);
+
+	__m128 sum = _mm_setzero_ps();
+	float weights[8];
+	for(int k=0;k<n;k+=8)
+	{
+		const int m = min(n-k,8);
+		if(m==8)
+		{
+			const __m256 dx = _mm256_sub_ps( ox, _mm256_loadu_ps(x+k) );
+			const __m256 dy = _mm256_sub_ps( oy, _mm256_loadu_ps(y+k) );
+			const __m256 len = _mm256_sqrt_ps( _mm256_add_ps(_mm256_mul_ps(dx,dx), _mm256_mul_ps(dy,dy)) );
+			_mm256_storeu_ps( weights, _mm256_sub_ps(one, _mm256_div_ps(len,r)) );
+		}
+		else
+		{
+			for(int j=0;j<m;j++)
+			{
+				const float dx = oxy.x-x[k+j];
+				const float dy = oxy.y-y[k+j];
+				weights[j] = 1 - sqrt(dx*dx + dy*dy)/R;
+			}
+		}
+
+		// Accumulate in input order so that the result matches the scalar code.
+
+		for(int j=0;j<m;j++)
+			if(!(weights[j]<=0))
+				sum = _mm_add_ps( sum, _mm_mul_ps(_mm_loadu_ps(&colors[k+j].x), _mm_set1_ps(weights[j])) );
+	}
+
+	Vec4f result;
+	_mm_storeu_ps( &result.x, sum );
+	return result;
+}
+
+FW_SIMD_TARGET("avx2")
+static U32 coverTrianglesAVX2(const TrianglePacket& tris, const Vec2f& p, U32& ambiguous)
+{
+	const __m256 zero	= _mm256_setzero_ps();
+	const __m256 absMask = _mm256_castsi256_ps( _mm256_set1_epi32(0x7fffffff) );
+	const __m256 guard	= _mm256_set1_ps(COVERAGE_GUARD);
+	const __m256 tiny	= _mm256_set1_ps(FLT_MIN);
+	const __m256 px		= _mm256_set1_ps(p.x);
+	const __m256 py		= _mm256_set1_ps(p.y);
+	const __m256 apx	= _mm256_and_ps(px,absMask);
+	const __m256 apy	= _mm256_and_ps(py,absMask);
+
+	const __m256 xs[3] = { _mm256_loadu_ps(tris.x0), _mm256_loadu_ps(tris.x1), _mm256_loadu_ps(tris.x2) };
+	const __m256 ys[3] = { _mm256_loadu_ps(tris.y0), _mm256_loadu_ps(tris.y1), _mm256_loadu_ps(tris.y2) };
+	__m256 pos[3];
+	__m256 sure = _mm256_cmp_ps(zero,zero,_CMP_EQ_OQ);
+	for(int k=0;k<3;k++)
+	{
+		const int a = (k+1)%3;
+		const int b = (k+2)%3;
+		const __m256 A = _mm256_sub_ps( ys[a], ys[b] );
+		const __m256 B = _mm256_sub_ps( xs[b], xs[a] );
+		const __m256 e = _mm256_add_ps( _mm256_mul_ps(A, _mm256_sub_ps(px,xs[a])), _mm256_mul_ps(B, _mm256_sub_ps(py,ys[a])) );
+		const __m256 M = _mm256_add_ps( _mm256_mul_ps(_mm256_add_ps(apx, _mm256_and_ps(xs[a],absMask)), _mm256_and_ps(A,absMask)),
+										_mm256_mul_ps(_mm256_add_ps(apy, _mm256_and_ps(ys[a],absMask)), _mm256_and_ps(B,absMask)) );
+		sure   = _mm256_and_ps( sure, _mm256_cmp_ps(_mm256_and_ps(e,absMask), _mm256_add_ps(_mm256_mul_ps(guard,M),tiny), _CMP_GT_OQ) );
+		pos[k] = _mm256_cmp_ps( e, zero, _CMP_GT_OQ );
+	}
+
+	const __m256 allPos = _mm256_and_ps( _mm256_and_ps(pos[0],pos[1]), pos[2] );
+	const __m256 anyPos = _mm256_or_ps ( _mm256_or_ps (pos[0],pos[1]), pos[2] );
+	const int surebits = _mm256_movemask_ps(sure);
+	ambiguous = ~surebits & 0xFF;
+	return surebits & (_mm256_movemask_ps(allPos) | ~_mm256_movemask_ps(anyPos)) & 0xFF;
+}
+
+#endif // FW_SIMD_X86
+
+//-----------------------------------------------------------------------------------------
+// Dispatch
+//-----------------------------------------------------------------------------------------
+
+U32 reprojectPacket(SimdLevel level, const SamplePacket& p, const Vec2f& oxy,const Vec2f& ouv,float ot, const Vec2f& cocCoeffs,float R, ReprojectedPacket& out)
+{
+	switch(level)
+	{
+#if FW_SIMD_X86
+	case SIMD_AVX2:	return reprojectPacketAVX2 (p, oxy,ouv,ot, cocCoeffs,R, out);
+	case SIMD_SSE:	return reprojectPacketSSE  (p, oxy,ouv,ot, cocCoeffs,R, out);
+#endif
+	default:		return reprojectPacketScalar(p, oxy,ouv,ot, cocCoeffs,R, out);
+	}
+}
+
+Vec4f accumulateTent(SimdLevel level, int n, const float* x,const float* y,const Vec4f* colors, const Vec2f& oxy,float R)
+{
+	switch(level)
+	{
+#if FW_SIMD_X86
+	case SIMD_AVX2:	return accumulateTentAVX2 (n, x,y,colors, oxy,R);
+	case SIMD_SSE:	return accumulateTentSSE  (n, x,y,colors, oxy,R);
+#endif
+	default:		return accumulateTentScalar(n, x,y,colors, oxy,R);
+	}
+}
+
+U32 coverTriangles(SimdLevel level, const TrianglePacket& tris, const Vec2f& p, int* numExact)
+{
+	if(tris.isEmpty())
+		return 0;
+
+	U32 ambiguous;
+	U32 covered;
+	switch(level)
+	{
+#if FW_SIMD_X86
+	case SIMD_AVX2:	covered = coverTrianglesAVX2 (tris, p, ambiguous); break;
+	case SIMD_SSE:	covered = coverTrianglesSSE  (tris, p, ambiguous); break;
+#endif
+	default:		covered = coverTrianglesScalar(tris, p, ambiguous); break;
+	}
+
+	const U32 valid = (1u<<tris.num)-1;
+	covered   &= valid;
+	ambiguous &= valid;
+
+	// Guarded fallback.
+
+	for(int i=0;ambiguous;i++,ambiguous>>=1)
+	{
+		if(!(ambiguous&1))
+			continue;
+		if(coversTriangle(Vec2f(tris.x0[i],tris.y0[i]), Vec2f(tris.x1[i],tris.y1[i]), Vec2f(tris.x2[i],tris.y2[i]), p))
+			covered |= 1u<<i;
+		if(numExact)
+			(*numExact)++;
+	}
+
+	return covered;
+}
+
+} //
@@ -0,0 +1,118 @@
+/*
+ *  Copyright (c) 2010-2011, NVIDIA Corporation
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *      * Redistributions of source code must retain the above copyright
+ *        notice, this list of conditions and the following disclaimer.
+ *      * Redistributions in binary form must reproduce the above copyright
+ *        notice, this list of conditions and the following disclaimer in the
+ *        documentation and/or other materials provided with the distribution.
+ *      * Neither the name of NVIDIA Corporation nor the
+ *        names of its contributors may be used to endorse or promote products
+ *        derived from this software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ *  ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ *  WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ *  DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+ *  DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ *  (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ *  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ *  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ *  (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ *  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#pragma once
+#include "base/Math.hpp"
+
+namespace FW
+{
+
+//-----------------------------------------------------------------------------------------
+// SIMD kernels for the per-sample work of the gather and the filter.
+// The instruction set is chosen at runtime. All levels give bit-identical results.
+//-----------------------------------------------------------------------------------------
+
+enum SimdLevel
+{
+	SIMD_SCALAR = 0,
+	SIMD_SSE,				// SSE2
+	SIMD_AVX2,
+
+	SIMD_NUM_LEVELS
+};
+
+SimdLevel		detectSimdLevel		(void);				// highest level supported by the CPU and the compiler
+const char*		getSimdLevelName	(SimdLevel level);
+
+// SoA copy of up to SIZE consecutive samples of a leaf node. Unused lanes are never within R.
+
+struct SamplePacket
+{
+	enum { SIZE = 8 };
+
+	void	set			(int lane, const Vec2f& xy,float w,float t, const Vec3f& mv);
+	void	setEmpty	(int lane);
+
+	float	x[SIZE],  y[SIZE];		// affine position @ (u,v,t) = center
+	float	hx[SIZE], hy[SIZE];		// homogeneous position @ (u,v,t) = center
+	float	w[SIZE];
+	float	t[SIZE];
+	float	mvx[SIZE], mvy[SIZE], mvw[SIZE];
+};
+
+// Samples of a packet reprojected to the output sample's (u,v,t).
+
+struct ReprojectedPacket
+{
+	float	x[SamplePacket::SIZE];
+	float	y[SamplePacket::SIZE];
+	float	w[SamplePacket::SIZE];
+	float	dist2[SamplePacket::SIZE];	// squared distance to the output sample
+	U32		inside;						// lane mask: within R
+	U32		xpos;						// lane mask: x >= output x
+	U32		ypos;						// lane mask: y >= output y
+};
+
+// Reprojects a packet to (ouv,ot), using motion if the sample has any, and tests it against a circle of radius R around oxy.
+// Returns the inside mask.
+
+U32		reprojectPacket		(SimdLevel level, const SamplePacket& p, const Vec2f& oxy,const Vec2f& ouv,float ot, const Vec2f& cocCoeffs,float R, ReprojectedPacket& out);
+
+// Tent filter: sum of max(0, 1-|oxy-(x,y)|/R) * color, accumulated in input order.
+
+Vec4f	accumulateTent		(SimdLevel level, int n, const float* x,const float* y,const Vec4f* colors, const Vec2f& oxy,float R);
+
+// Up to SIZE candidate triangles, SoA.
+
+struct TrianglePacket
+{
+	enum { SIZE = 8 };
+
+			TrianglePacket	(void);
+	void	clear			(void)						{ num = 0; }
+	bool	isEmpty			(void) const				{ return num==0; }
+	bool	isFull			(void) const				{ return num==SIZE; }
+	void	add				(const Vec2f& v0,const Vec2f& v1,const Vec2f& v2);
+
+	float	x0[SIZE], y0[SIZE];
+	float	x1[SIZE], y1[SIZE];
+	float	x2[SIZE], y2[SIZE];
+	int		num;
+};
+
+// Does triangle (v0,v1,v2) cover p? Exact reference, uses EdgeFunction and its tie-breaking rules.
+
+bool	coversTriangle		(const Vec2f& v0,const Vec2f& v1,const Vec2f& v2, const Vec2f& p);
+
+// Tests one point against all triangles of a packet. Returns the mask of covering triangles, always equal
+// to coversTriangle(). The edge functions are evaluated in single precision; triangles with an edge value
+// within the rounding error bound are redone with coversTriangle(), and counted in numExact.
+
+U32		coverTriangles		(SimdLevel level, const TrianglePacket& tris, const Vec2f& p, int* numExact = NULL);
+
+} //
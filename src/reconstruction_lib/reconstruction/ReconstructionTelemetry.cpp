@@ -0,0 +1,214 @@
+/*
+ *  Copyright (c) 2010-2011, NVIDIA Corporation
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *      * Redistributions of source code must retain the above copyright
+ *        notice, this list of conditions and the following disclaimer.
+ *      * Redistributions in binary form must reproduce the above copyright
+ *        notice, this list of conditions and the following disclaimer in the
+ *        documentation and/or other materials provided with the distribution.
+ *      * Neither the name of NVIDIA Corporation nor the
+ *        names of its contributors may be used to endorse or promote products
+ *        derived from this software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ *  ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ *  WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ *  DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+ *  DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ *  (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ *  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ *  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ *  (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ *  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+//-----------------------------------------------------------------------------------------
+// Telemetry: per-phase timings and memory, gather statistics and the shape of the hierarchy,
+// exported as one JSON object per reconstruction for offline tracking.
+//-----------------------------------------------------------------------------------------
+
+#include "Reconstruction.hpp"
+#include "io/File.hpp"
+#include "io/Stream.hpp"
+
+namespace FW
+{
+
+void TreeGather::beginPhase(const char* name)
+{
+	m_phaseName = name;
+	pushMemOwner(name);			// worker tasks tag their own allocations (see buildRecursiveDispatcher, FilterTask::process)
+	resetMemoryPeak();
+	m_phaseTimer.start();
+}
+
+void TreeGather::endPhase(void)
+{
+	const char* name = m_phaseName;
+	popMemOwner();
+
+	Phase phase;
+	phase.name			= name;
+	phase.seconds		= m_phaseTimer.end();
+	phase.memoryUsed	= getMemoryUsed();
+	phase.memoryPeak	= getMemoryPeak();
+
+	const size_t budget = m_params->memoryBudget;
+	if(budget && phase.memoryPeak > budget)
+		printf("Warning: %s exceeded the memory budget (peak %.1fMB > %.1fMB)\n", name, phase.memoryPeak/1024.f/1024.f, budget/1024.f/1024.f);
+
+	// Repeated reconstruct*() calls replace their previous entry.
+
+	for(int i=0;i<m_phases.getSize();i++)
+		if(strcmp(m_phases[i].name, name) == 0)
+		{
+			m_phases[i] = phase;
+			return;
+		}
+	m_phases.add(phase);
+}
+
+void TreeGather::printPhases(void) const
+{
+	printf("Phase                     Time    Used MB   Peak MB\n");
+	for(int i=0;i<m_phases.getSize();i++)
+	{
+		const Phase& p = m_phases[i];
+		printf("  %-22s %6.3fs %9.1f %9.1f\n", p.name, p.seconds, p.memoryUsed/1024.f/1024.f, p.memoryPeak/1024.f/1024.f);
+	}
+	if(m_params->memoryBudget)
+		printf("  Budget %.1fMB%s\n", m_params->memoryBudget/1024.f/1024.f, m_lowMemory ? ", low-memory build" : "");
+	printMemStats();			// live bytes per owner
+}
+
+void TreeGather::computeLeafDepths(void)
+{
+	m_leafDepths.reset(0);
+	if(!m_hierarchy.getSize())
+		return;
+
+	Array<Vec2i> stack;		// (node, depth)
+	stack.add(Vec2i(m_rootIndex,0));
+	while(stack.getSize())
+	{
+		const Vec2i entry = stack.removeLast();
+		const Node& node = m_hierarchy[entry.x];
+		if(node.isLeaf())
+		{
+			while(m_leafDepths.getSize() <= entry.y)
+				m_leafDepths.add(0);
+			m_leafDepths[entry.y]++;
+			continue;
+		}
+
+		stack.add(Vec2i(node.child0,entry.y+1));
+		if(node.child1!=-1)
+			stack.add(Vec2i(node.child1,entry.y+1));
+	}
+}
+
+//-----------------------------------------------------------------------------------------
+
+static F64 perOutputSample(const Vec2d& v)
+{
+	return (v[1] != 0.0) ? v[0]/v[1] : 0.0;
+}
+
+static void writeHistogram(BufferedOutputStream& out, const char* name, const S64* counts, int numBuckets)
+{
+	out.writef(",\n    \"%s\": [", name);
+	for(int i=0;i<numBuckets;i++)
+		out.writef("%s%lld", (i) ? "," : "", (long long)counts[i]);
+	out.writef("]");
+}
+
+bool TreeGather::exportTelemetry(const String& fileName) const
+{
+	const Stats& s = m_stats;
+	const Histograms& h = s.histograms;
+
+	File file(fileName, File::Create);
+	BufferedOutputStream out(file);
+
+	out.writef("{\n");
+	const int numSamples = (m_spilled) ? m_spilled->numSamples : m_samples.getSize();
+	out.writef("  \"input\": {\"width\": %d, \"height\": %d, \"spp\": %d, \"numSamples\": %d},\n", m_sbuf->getWidth(), m_sbuf->getHeight(), m_spp, numSamples);
+	out.writef("  \"outputSpp\": %d,\n", m_outputSpp);
+	out.writef("  \"lazyGather\": %s,\n", m_params->lazyGather ? "true" : "false");
+	out.writef("  \"simd\": \"%s\",\n", getSimdLevelName(m_simdLevel));
+
+	// Phases.
+
+	size_t memoryPeak = 0;
+	out.writef("  \"phases\": [");
+	for(int i=0;i<m_phases.getSize();i++)
+	{
+		const Phase& p = m_phases[i];
+		out.writef("%s\n    {\"name\": \"%s\", \"seconds\": %.6f, \"memoryUsedBytes\": %llu, \"memoryPeakBytes\": %llu}", (i) ? "," : "", p.name, p.seconds, (unsigned long long)p.memoryUsed, (unsigned long long)p.memoryPeak);
+		memoryPeak = max(memoryPeak, p.memoryPeak);
+	}
+	out.writef("\n  ],\n");
+	const S64 samplesBytes	= (m_spilled) ? (S64)m_spilled->numSamples*sizeof(Sample)			: m_samples.getNumBytes();
+	const S64 treeBytes		= (m_spilled) ? (S64)m_spilled->numNodes*sizeof(Node)				: m_hierarchy.getNumBytes();
+	const S64 packetsBytes	= (m_spilled) ? (S64)m_spilled->numPackets*sizeof(SamplePacket)	: m_packets.getNumBytes();
+	out.writef("  \"memory\": {\"samplesBytes\": %llu, \"treeBytes\": %llu, \"packetsBytes\": %llu, \"peakBytes\": %llu, \"budgetBytes\": %llu, \"lowMemory\": %s},\n",
+		(unsigned long long)samplesBytes, (unsigned long long)treeBytes, (unsigned long long)packetsBytes, (unsigned long long)memoryPeak, (unsigned long long)m_params->memoryBudget, m_lowMemory ? "true" : "false");
+	if(m_spilled)
+	{
+		const SubtreeFile& f = m_spilled->file;
+		out.writef("  \"outOfCore\": {\"fileBytes\": %llu, \"residentBudgetBytes\": %llu, \"subtrees\": %d, \"pageIns\": %llu, \"bytesPagedIn\": %llu, \"evictions\": %llu},\n",
+			(unsigned long long)f.getFileBytes(), (unsigned long long)f.getResidentBudget(), m_spilled->segmentEnds.getSize(),
+			(unsigned long long)f.getNumPageIns(), (unsigned long long)f.getBytesPagedIn(), (unsigned long long)f.getNumEvictions());
+	}
+
+	// Gather statistics.
+
+	out.writef("  \"numOutputSamples\": %.0f,\n", s.numLeafNodes[1]);
+	out.writef("  \"perOutputSample\": {\"nodesVisited\": %.4f, \"leafNodes\": %.4f, \"samplesInLeafNodes\": %.4f, \"samplesWithin1R\": %.4f, \"samplesFetched\": %.4f, \"samplesSkipped\": %.4f, \"surfaces\": %.4f, \"sameSurfaceTests\": %.4f, \"heapAllocs\": %.6f, \"triangleSearches\": %.4f, \"triangleTests\": %.4f},\n",
+		perOutputSample(s.numNodesVisited), perOutputSample(s.numLeafNodes), perOutputSample(s.numSamplesInLeafNodes), perOutputSample(s.numSamplesWithin1R), perOutputSample(s.numSamplesFetched), perOutputSample(s.numSamplesSkipped),
+		perOutputSample(s.numSurfaces), perOutputSample(s.numSameSurfaceTests), perOutputSample(s.numHeapAllocs), perOutputSample(s.numTriangleSearches), perOutputSample(s.numTriangleTests));
+	out.writef("  \"rates\": {\"fetch2R\": %.6f, \"atLeastOne\": %.6f, \"surfacesMerged\": %.6f},\n",
+		perOutputSample(s.num2R), perOutputSample(s.numAtLeastOne), perOutputSample(s.numSurfacesMerged));
+	out.writef("  \"triangleTestsPerSearch\": %.4f,\n", (s.numTriangleSearches[0] != 0.0) ? s.numTriangleTests[0]/s.numTriangleSearches[0] : 0.0);
+
+	// Histograms, trailing empty buckets dropped.
+
+	int numBuckets = 1;
+	for(int i=0;i<Histogram::NUM_BUCKETS;i++)
+		if(h.leafNodes.counts[i] || h.samplesFetched.counts[i] || h.surfaces.counts[i])
+			numBuckets = i+1;
+
+	out.writef("  \"histograms\": {\n    \"bucketMin\": [");
+	for(int i=0;i<numBuckets;i++)
+		out.writef("%s%lld", (i) ? "," : "", (long long)Histogram::getBucketMin(i));
+	out.writef("]");
+	writeHistogram(out, "leafNodes", h.leafNodes.counts, numBuckets);
+	writeHistogram(out, "samplesFetched", h.samplesFetched.counts, numBuckets);
+	writeHistogram(out, "surfaces", h.surfaces.counts, numBuckets);
+	out.writef("\n  },\n");
+
+	// Hierarchy. The leaf depths are taken before an out-of-core build moves the nodes to the file.
+
+	const int numNodes = (m_spilled) ? m_spilled->numNodes : m_hierarchy.getSize();
+	S64 numLeaves = 0;
+	F64 depthSum = 0.0;
+	for(int i=0;i<m_leafDepths.getSize();i++)
+	{
+		numLeaves += m_leafDepths[i];
+		depthSum  += (F64)i * (F64)m_leafDepths[i];
+	}
+	out.writef("  \"tree\": {\"numNodes\": %d, \"numLeaves\": %lld, \"maxDepth\": %d, \"meanLeafDepth\": %.3f, \"leafDepths\": [",
+		numNodes, (long long)numLeaves, m_leafDepths.getSize()-1, (numLeaves) ? depthSum/(F64)numLeaves : 0.0);
+	for(int i=0;i<m_leafDepths.getSize();i++)
+		out.writef("%s%lld", (i) ? "," : "", (long long)m_leafDepths[i]);
+	out.writef("]}\n");
+	out.writef("}\n");
+
+	out.flush();
+	return !hasError();
+}
+
+} //
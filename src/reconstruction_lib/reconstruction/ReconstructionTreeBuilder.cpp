@@ -54,13 +54,13 @@ int TreeGather::buildInitialRecursive(int x0,int x1, int y0,int y1)
 
 	// Create a leaf?
 	bool leaf = max(dx,dy)==1;
-	if(!leaf && dx*dy<=64)		// arbitrary threshold
+	if(!leaf && dx*dy<=m_params->tuning.initialLeafArea)		// arbitrary threshold
 	{
 		int numSamples = 0;
 		for(int y=y0;y<y1;y++)
 		for(int x=x0;x<x1;x++)
 			numSamples += m_reprojected[y*m_reprojWidth+x].getSize();
-		leaf = (numSamples <= MAX_LEAF_SIZE);
+		leaf = (numSamples <= m_params->tuning.maxLeafSize);
 	}
 
 	int child0,child1;
@@ -118,12 +118,30 @@ int TreeGather::sampleCompareFuncInc(void* data, int idxA, int idxB)
 	}
 }
 
+void TreeGather::buildRecursiveDispatcher(MulticoreLauncher::Task& task)
+{
+	FW_TRACE_SCOPE("Build subtree");
+	FW_PERF_SCOPE("Build");
+	pushMemOwner("Build");
+
+	// Out-of-core, the subtree's samples go to a private array until it is spilled.
+
+	BuildTask& bt = ((BuildTask*)task.data)[task.idx];
+	if(bt.spill)
+		bt.samples.reset(bt.numSamples);
+	bt.tg->buildRecursive(bt.nodeIndex, bt.maxFrontierSize, bt.frontier, bt.hierarchy, bt);
+	if(bt.spill)
+		bt.tg->spillSubtree(bt);
+	popMemOwner();
+}
+
 void TreeGather::buildRecursive(int nodeIndex, int maxFrontierSize, Array<Node>& frontier, Array<Node>& hierarchy, BuildTask& bt) const
 {
 	if(nodeIndex==-1)
 		return;
 
-	Array<Sample>& samples = bt.getSharedSampleArray();
+	Array<Sample>& samples = bt.getSampleArray();
+	const int sampleBase = bt.getSampleBase();
 	int& currentSampleIndex = bt.currentSampleIndex;
 
 	if(m_initialHierarchy[nodeIndex].isLeaf())
@@ -138,8 +156,12 @@ void TreeGather::buildRecursive(int nodeIndex, int maxFrontierSize, Array<Node>&
 		const InitialNode& in = m_initialHierarchy[nodeIndex];
 		for(int y=in.y0;y<in.y1;y++)
 		for(int x=in.x0;x<in.x1;x++)
-		for(int i=0;i<m_reprojected[y*m_reprojWidth+x].getSize();i++)
-			candidates.add( m_reprojected[y*m_reprojWidth+x][i] );
+		{
+			Array<Sample>& bucket = m_reprojected[y*m_reprojWidth+x];
+			candidates.add( bucket );
+			if(m_lowMemory)
+				bucket.reset(0);			// each bucket belongs to exactly one leaf
+		}
 
 		if ( candidates.getSize() == 0 )
 		{
@@ -157,18 +179,14 @@ void TreeGather::buildRecursive(int nodeIndex, int maxFrontierSize, Array<Node>&
 
 		//profilePush( "computeCoCs" );
 		// compute CoCs and screen bounding boxes for samples
-		Array<int>& surface				= bt.surface;
-		Array<Vec2f>& boxa				= bt.boxa;
-		Array<Vec2f>& boxb				= bt.boxb;
-		Array<Vec2f>& boxaT1			= bt.boxaT1;
-		Array<Vec2f>& boxbT1			= bt.boxbT1;
-		Array<TimeLensBounds>& bounds	= bt.bounds;
-		boxa.resize( candidates.getSize() );
-		boxb.resize( candidates.getSize() );
-		boxaT1.resize( candidates.getSize() );
-		boxbT1.resize( candidates.getSize() );
-		bounds.resize( candidates.getSize() );
-		surface.resize( candidates.getSize() );
+		Arena& scratch					= bt.scratch;
+		const Arena::Mark scratchMark	= scratch.getMark();
+		int* surface					= scratch.alloc<int>( candidates.getSize() );
+		Vec2f* boxa						= scratch.alloc<Vec2f>( candidates.getSize() );
+		Vec2f* boxb						= scratch.alloc<Vec2f>( candidates.getSize() );
+		Vec2f* boxaT1					= scratch.alloc<Vec2f>( candidates.getSize() );
+		Vec2f* boxbT1					= scratch.alloc<Vec2f>( candidates.getSize() );
+		TimeLensBounds* bounds			= scratch.alloc<TimeLensBounds>( candidates.getSize() );
 		for ( int i = 0; i < candidates.getSize(); ++i )
 		{
 			const Sample& s = candidates[ i ];
@@ -221,8 +239,6 @@ void TreeGather::buildRecursive(int nodeIndex, int maxFrontierSize, Array<Node>&
 		// Scan bounds for each leaf node.
 		// Add node to frontier.
 
-		frontier.clear();
-
 		int surfacebegin = 0;
 		int currsurface = 0;
 		int n = candidates.getSize();
@@ -252,7 +268,7 @@ void TreeGather::buildRecursive(int nodeIndex, int maxFrontierSize, Array<Node>&
 			bool bConflict = false;
 			bool bEarlyOut = false;
 
-			const float COC_THRESHOLD = 1*2.0f;
+			const float COC_THRESHOLD = m_params->tuning.earlyOutThreshold;
 
 			// See that the current sample has been bucketed at the same time instant than the current surface
 			// If not, start a new surface.
@@ -363,7 +379,7 @@ void TreeGather::buildRecursive(int nodeIndex, int maxFrontierSize, Array<Node>&
 			for ( int k = i; k < j; ++k )
 			{
 				const Sample& s = candidates[ k ];
-				samples[currentSampleIndex++] = s;
+				samples[currentSampleIndex++ - sampleBase] = s;
 
 				// merge sample's XYUVT hyperplanes to node's
 				node.tlb = TimeLensBounds(bounds[ k ], node.tlb);
@@ -372,6 +388,7 @@ void TreeGather::buildRecursive(int nodeIndex, int maxFrontierSize, Array<Node>&
 			// ..and finalize the node..
 			node.s1 = currentSampleIndex;
 			node.ns = node.s1-node.s0;
+			node.surfaceKey = computeSurfaceKey(node.tlb, m_params->tuning.sameSurfaceUVRange);
 			FW_ASSERT(node.ns>0);
 			frontier.add( node );
 
@@ -380,44 +397,110 @@ void TreeGather::buildRecursive(int nodeIndex, int maxFrontierSize, Array<Node>&
 		}
 		//profilePop();	// createNodes
 
+		scratch.rewind(scratchMark);
 
 		//profilePop();	// construct leafs
 	}
 	else
 	{
-		// Recursive call.
+		// Recursive call. Both children append to the frontier, which is then merged in place.
 
 		const InitialNode& in = m_initialHierarchy[nodeIndex];
-		Array<Node> frontier1;
-		Array<Node> frontier2;
-		buildRecursive(in.child0, maxFrontierSize, frontier1, hierarchy, bt);
-		buildRecursive(in.child1, maxFrontierSize, frontier2, hierarchy, bt);
-
-		// Merge two frontiers
-		frontier.clear();
-		frontier.add( frontier1 );
-		frontier.add( frontier2 );
+		const int frontierStart = frontier.getSize();
+		buildRecursive(in.child0, maxFrontierSize, frontier, hierarchy, bt);
+		buildRecursive(in.child1, maxFrontierSize, frontier, hierarchy, bt);
 
 		// Create new node(s)
 		const int root = 0;
-		emitNodes(nodeIndex==root, maxFrontierSize, frontier, hierarchy);
+		emitNodes(nodeIndex==root, maxFrontierSize, frontier, frontierStart, hierarchy);
+	}
+}
+
+
+// Copies the samples of each leaf node to SoA packets, padding the last packet of a leaf.
+
+void TreeGather::packLeaf(SamplePacket* packets, const Sample* samples, int numSamples)
+{
+	const int SIZE = SamplePacket::SIZE;
+	int j=0;
+	for(;j<numSamples;j++)
+	{
+		const Sample& s = samples[j];
+		packets[j/SIZE].set(j%SIZE, s.xy,s.w,s.t,s.mv);
 	}
+	for(;j%SIZE;j++)
+		packets[j/SIZE].setEmpty(j%SIZE);
 }
 
+void TreeGather::buildSamplePackets(void)
+{
+	const int SIZE = SamplePacket::SIZE;
+	int numPackets = 0;
+	for(int i=0;i<m_hierarchy.getSize();i++)
+	{
+		Node& node = m_hierarchy[i];
+		if(node.isLeaf())
+		{
+			node.p0 = numPackets;
+			numPackets += (node.ns+SIZE-1)/SIZE;
+		}
+	}
+
+	m_packets.reset(numPackets);
+	Topology::interleave(m_packets.getPtr(), m_packets.getNumBytes());
+	for(int i=0;i<m_hierarchy.getSize();i++)
+	{
+		const Node& node = m_hierarchy[i];
+		if(node.isLeaf())
+			packLeaf(m_packets.getPtr(node.p0), m_samples.getPtr(node.s0), node.ns);
+	}
+}
+
+// Quantizes the t and uv slopes of a leaf's hyperplanes. Leaves with equal keys have slopes within one
+// step of each other, so the difference of their bounds changes by less than 1.5*SAME_SURFACE_THRESHOLD
+// over the uvt box used by sameSurface(). The fuzzy compares can then never flip from -1 to +1, and the
+// test always passes. The remaining 0.5*threshold absorbs the rounding in evaluating the planes, which is
+// why large coordinates get no key (0).
+
+U64 TreeGather::computeSurfaceKey(const TimeLensBounds& tlb, float uvRange)
+{
+	if(!tlb.isValid())
+		return 0;
+
+	const float MAX_COORD	= 8192.f;
+	const float UV_STEP		= 0.75f*SAME_SURFACE_THRESHOLD/uvRange;	// uv span of the box is 2*RANGE
+	const float T_STEP		= 1.5f *SAME_SURFACE_THRESHOLD/uvRange;	// t span of the box is RANGE
+
+	U64 key = 0;
+	for(int i=0;i<4;i++)
+	{
+		const Vec3f& p = tlb.planes[i];
+		if(!(fabs(p.x)<MAX_COORD && fabs(p.y)<MAX_COORD && fabs(p.z)<MAX_COORD))
+			return 0;
+
+		const int qt  = (int)floor(p.x/T_STEP);
+		const int quv = (int)floor(p.y/UV_STEP);
+		if(qt<-127 || qt>127 || quv<-127 || quv>127)
+			return 0;
+
+		key = (key<<16) | ((U64)(qt+128)<<8) | (U64)(quv+128);		// bytes are never 0, hence key!=0
+	}
+	return key;
+}
 
 // If the frontier is too large, find and emit the best nodes until the frontier is within the threshold.
 // Uses an exhaustive O(n^2) algorithm, but n is bounded and small.
 
-void TreeGather::emitNodes(bool isRootNode, int maxFrontierSize, Array<Node>& frontier, Array<Node>& hierarchy) const
+void TreeGather::emitNodes(bool isRootNode, int maxFrontierSize, Array<Node>& frontier, int frontierStart, Array<Node>& hierarchy) const
 {
 	const int frontierLim = (isRootNode ? 1 : maxFrontierSize);
-	while(frontier.getSize() > frontierLim)
+	while(frontier.getSize()-frontierStart > frontierLim)
 	{
 		// Evaluate all pairs.
 
 		float minCost = FW_F32_MAX;
 		Vec2i minIndex(-1,-1);
-		for(int i=0  ;i<frontier.getSize();i++)
+		for(int i=frontierStart;i<frontier.getSize();i++)
 		for(int j=i+1;j<frontier.getSize();j++)
 		{
 			// cost = area*#samples
@@ -442,13 +525,13 @@ void TreeGather::emitNodes(bool isRootNode, int maxFrontierSize, Array<Node>& fr
 		n.child1 = hierarchy.getSize();	hierarchy.add(n1);
 
 		frontier[minIndex[0]] = n;			// replace n -> n0
-		frontier.removeSwap(minIndex[1]);	// remove n1
+		frontier.removeSwap(minIndex[1]);	// remove n1 (the last element is within the range, too)
 	}
 
 	if(isRootNode)
 	{
 		hierarchy[0] = frontier.removeLast();
-		FW_ASSERT(frontier.getSize()==0);
+		FW_ASSERT(frontier.getSize()==frontierStart);
 	}
 }
 
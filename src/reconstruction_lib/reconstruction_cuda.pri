@@ -0,0 +1,4 @@
+HEADERS += reconstruction/ReconstructionCudaKernels.hpp
+SOURCES += reconstruction/ReconstructionCuda.cpp
+
+OTHER_FILES += reconstruction/ReconstructionCudaKernels.cu
@@ -1,3 +1,4 @@
 include(../src.pri)
 include(common.pri)
 include(reconstruction.pri)
+include(reconstruction_cuda.pri)
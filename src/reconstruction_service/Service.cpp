@@ -0,0 +1,495 @@
+/*
+ *  Copyright (c) 2010-2011, NVIDIA Corporation
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *      * Redistributions of source code must retain the above copyright
+ *        notice, this list of conditions and the following disclaimer.
+ *      * Redistributions in binary form must reproduce the above copyright
+ *        notice, this list of conditions and the following disclaimer in the
+ *        documentation and/or other materials provided with the distribution.
+ *      * Neither the name of NVIDIA Corporation nor the
+ *        names of its contributors may be used to endorse or promote products
+ *        derived from this software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ *  ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ *  WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ *  DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+ *  DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ *  (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ *  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ *  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ *  (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ *  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+//-----------------------------------------------------------------------------------------
+// Local reconstruction service. Keeps sample buffers and their hierarchies in an LRU cache
+// bounded by memory, runs the requests of all clients in arrival order on the shared
+// MulticoreLauncher threads, and streams the rows back as they are filtered. See
+// common/ReconstructionService.hpp for the protocol; reconstruction_cli -service=<socket>
+// is the client. A "host:port" socket is TCP on the loopback interface only, unless -remote
+// is given; TCP needs a shared token in $RECONSTRUCTION_TOKEN that every request must carry.
+// Usage: reconstruction_service [-socket=path] [-remote] [-memory=MB] [-threads=N] [-band=rows]
+//-----------------------------------------------------------------------------------------
+
+#include "base/Main.hpp"
+#include "base/MulticoreLauncher.hpp"
+#include "base/Timer.hpp"
+#include "common/ReconstructionService.hpp"
+#include "common/ReconstructionTuning.hpp"
+#include "gui/Image.hpp"
+#include "reconstruction/Reconstruction.hpp"
+#include <cstdio>
+#include <cstring>
+#include <poll.h>
+#include <sys/stat.h>
+
+namespace FW
+{
+
+//-----------------------------------------------------------------------------------------
+// Cache. Sizes are the getMemoryUsed() deltas of loading and building; the hierarchies of
+// a buffer go with it.
+//-----------------------------------------------------------------------------------------
+
+struct CachedBuffer
+{
+	String					name;
+	UVTSampleBuffer*		sbuf;
+	ReconstructionTuning	tuning;
+	size_t					bytes;
+	U64						lastUse;
+};
+
+struct CachedHierarchy
+{
+	CachedBuffer*			buffer;
+	F32						aperture;
+	F32						focus;
+	CameraParams			params;			// TreeGather keeps a pointer, per-request fields are set before filtering
+	TreeGather*				tg;
+	size_t					bytes;
+	U64						lastUse;
+};
+
+class SampleBufferCache
+{
+public:
+						SampleBufferCache	(size_t budget) : m_budget(budget), m_bytes(0), m_clock(0), m_hits(0), m_misses(0) {}
+						~SampleBufferCache	(void)				{ while(m_buffers.getSize()) removeBuffer(0); }
+
+	CachedHierarchy*	acquire				(const ServiceRequest& req, bool& cached, F32& buildSeconds);	// NULL if the input cannot be read
+	void				resize				(CachedHierarchy* h, size_t bytes);								// e.g. NUMA replicas filled by the filter
+	String				getStats			(void) const;
+
+private:
+	CachedBuffer*		getBuffer			(const String& name);
+	void				makeRoom			(size_t bytes, const CachedBuffer* keep);
+	void				removeHierarchy		(int i);
+	void				removeBuffer		(int i);
+
+	size_t				m_budget;
+	size_t				m_bytes;
+	U64					m_clock;
+	S64					m_hits;
+	S64					m_misses;
+	Array<CachedBuffer*>	m_buffers;
+	Array<CachedHierarchy*>	m_hierarchies;
+};
+
+//-----------------------------------------------------------------------------------------
+
+CachedHierarchy* SampleBufferCache::acquire(const ServiceRequest& req, bool& cached, F32& buildSeconds)
+{
+	buildSeconds = 0.f;
+	CachedBuffer* b = getBuffer(req.input);
+	if(!b)
+		return NULL;
+
+	for(int i=0;i<m_hierarchies.getSize();i++)
+	{
+		CachedHierarchy* h = m_hierarchies[i];
+		if(h->buffer == b && h->aperture == req.aperture && h->focus == req.focus)
+		{
+			h->lastUse = b->lastUse = ++m_clock;
+			cached = true;
+			m_hits++;
+			return h;
+		}
+	}
+
+	// Samples, hierarchy and packets are about twice the buffer.
+
+	makeRoom(2*b->bytes, b);
+	cached = false;
+	m_misses++;
+
+	Timer timer(true);
+	const size_t mem0 = getMemoryUsed();
+	CachedHierarchy* h = new CachedHierarchy;
+	h->buffer			= b;
+	h->aperture			= req.aperture;
+	h->focus			= req.focus;
+	h->params.tuning	= b->tuning;
+	h->params.memoryBudget = m_budget;
+	h->tg				= new TreeGather(*b->sbuf, h->params, req.aperture, req.focus);
+	h->bytes			= getMemoryUsed() - min(getMemoryUsed(), mem0);
+	h->lastUse			= b->lastUse = ++m_clock;
+	buildSeconds		= timer.end();
+
+	m_hierarchies.add(h);
+	m_bytes += h->bytes;
+	makeRoom(0, b);
+	return h;
+}
+
+CachedBuffer* SampleBufferCache::getBuffer(const String& name)
+{
+	for(int i=0;i<m_buffers.getSize();i++)
+		if(m_buffers[i]->name == name)
+		{
+			m_buffers[i]->lastUse = ++m_clock;
+			return m_buffers[i];
+		}
+
+	// The loader fail()s on a bad file, which would take the whole cache down.
+
+	struct stat st;
+	String error;
+	if(stat(name.getPtr(), &st) != 0 || !UVTSampleBuffer::probe(name.getPtr(), error))
+	{
+		printf("cache: cannot load %s: %s\n", name.getPtr(), (error.getLength()) ? error.getPtr() : "not found");
+		return NULL;
+	}
+	makeRoom((size_t)st.st_size, NULL);
+
+	const size_t mem0 = getMemoryUsed();
+	CachedBuffer* b = new CachedBuffer;
+	b->name		= name;
+	b->sbuf		= new UVTSampleBuffer(name.getPtr());
+	b->bytes	= getMemoryUsed() - min(getMemoryUsed(), mem0);
+	b->lastUse	= ++m_clock;
+	b->tuning.load("tuning.txt", ReconstructionTuning::getMachineName(), ReconstructionTuning::getSceneClass(*b->sbuf));
+	m_buffers.add(b);
+	m_bytes += b->bytes;
+	printf("cache: loaded %s (%.1fMB)\n", name.getPtr(), b->bytes/1024.f/1024.f);
+	return b;
+}
+
+void SampleBufferCache::resize(CachedHierarchy* h, size_t bytes)
+{
+	m_bytes = m_bytes - h->bytes + bytes;
+	h->bytes = bytes;
+	makeRoom(0, h->buffer);
+}
+
+// Evicts least recently used entries until the cache and the given bytes fit the budget.
+// The buffer in use and its most recent hierarchy stay, even if they alone exceed it.
+
+void SampleBufferCache::makeRoom(size_t bytes, const CachedBuffer* keep)
+{
+	while(m_bytes + bytes > m_budget)
+	{
+		int hi = -1, bi = -1;
+		for(int i=0;i<m_hierarchies.getSize();i++)
+		{
+			const CachedHierarchy* h = m_hierarchies[i];
+			const bool inUse = (keep && h->buffer == keep && h->lastUse == keep->lastUse);
+			if(!inUse && (hi==-1 || h->lastUse < m_hierarchies[hi]->lastUse))
+				hi = i;
+		}
+		for(int i=0;i<m_buffers.getSize();i++)
+			if(m_buffers[i] != keep && (bi==-1 || m_buffers[i]->lastUse < m_buffers[bi]->lastUse))
+				bi = i;
+
+		if(hi != -1 && (bi == -1 || m_hierarchies[hi]->lastUse <= m_buffers[bi]->lastUse))
+			removeHierarchy(hi);
+		else if(bi != -1)
+			removeBuffer(bi);
+		else
+			break;
+	}
+}
+
+void SampleBufferCache::removeHierarchy(int i)
+{
+	CachedHierarchy* h = m_hierarchies[i];
+	printf("cache: evicted hierarchy of %s (aperture %g, focus %g, %.1fMB)\n", h->buffer->name.getPtr(), h->aperture, h->focus, h->bytes/1024.f/1024.f);
+	m_bytes -= h->bytes;
+	delete h->tg;
+	delete h;
+	m_hierarchies.removeSwap(i);
+}
+
+void SampleBufferCache::removeBuffer(int i)
+{
+	CachedBuffer* b = m_buffers[i];
+	for(int j=m_hierarchies.getSize()-1;j>=0;j--)
+		if(m_hierarchies[j]->buffer == b)
+			removeHierarchy(j);
+
+	printf("cache: evicted %s (%.1fMB)\n", b->name.getPtr(), b->bytes/1024.f/1024.f);
+	m_bytes -= b->bytes;
+	delete b->sbuf;
+	delete b;
+	m_buffers.removeSwap(i);
+}
+
+String SampleBufferCache::getStats(void) const
+{
+	return sprintf("OK buffers %d hierarchies %d bytes %lld budget %lld hits %lld misses %lld",
+		m_buffers.getSize(), m_hierarchies.getSize(), (long long)m_bytes, (long long)m_budget, (long long)m_hits, (long long)m_misses);
+}
+
+//-----------------------------------------------------------------------------------------
+// Connections and jobs.
+//-----------------------------------------------------------------------------------------
+
+static const int MAX_REQUEST_BYTES = 64 << 10;		// a request is a few short lines; more is not a client
+
+struct ServiceClient
+{
+	ServiceClient(void) : socket(NULL), scanned(0) {}
+
+	ServiceSocket*		socket;
+	Array<char>			pending;			// request text received so far
+	S32					scanned;			// pending[0,scanned) holds no terminating empty line
+};
+
+struct ServiceJob
+{
+	ServiceClient*		client;
+	ServiceRequest		request;
+};
+
+// Filters the region replyRows rows at a time over the cached hierarchy, and writes
+// each chunk as soon as it is done. This bounds the reply latency, not the memory:
+// the hierarchy stays whole so that later requests can reuse it.
+
+static void runReconstruct(SampleBufferCache& cache, ServiceSocket& socket, const ServiceRequest& req, int replyRows)
+{
+	bool cached;
+	F32 buildSeconds;
+	CachedHierarchy* h = cache.acquire(req, cached, buildSeconds);
+	if(!h)
+	{
+		socket.writeLine(sprintf("ERROR cannot read %s", req.input.getPtr()));
+		return;
+	}
+
+	const size_t mem0 = getMemoryUsed();
+	TreeGather& tg = *h->tg;
+	h->params.overrideUVT	= req.overrideUVT;
+	h->params.filter		= req.filter;
+	h->params.lensFilter	= req.lensFilter;
+	h->params.timeFilter	= req.timeFilter;
+
+	const Vec2i size(h->buffer->sbuf->getWidth(), h->buffer->sbuf->getHeight());
+	const Vec2i lo = min(max(req.regionLo, Vec2i(0)), size);
+	const Vec2i hi = (req.regionHi == Vec2i(0)) ? size : min(max(req.regionHi, lo), size);
+	if(!socket.writeLine(sprintf("OK %d %d %d %d %d %d %d %.6f", size.x, size.y, lo.x, lo.y, hi.x, hi.y, cached ? 1 : 0, buildSeconds)))
+		return;
+
+	Image image(size, ImageFormat::RGBA_Vec4f);
+	Timer timer(true);
+	bool connected = true;
+	for(int y=lo.y;y<hi.y && connected;y+=replyRows)
+	{
+		const int y1 = min(y+replyRows, hi.y);
+		tg.setRegion(Vec2i(lo.x,y), Vec2i(hi.x,y1));
+		tg.reconstructDofMotion(image);
+		for(int row=y;row<y1 && connected;row++)
+			connected = socket.write(image.getPtr(Vec2i(lo.x,row)), (S64)(hi.x-lo.x)*sizeof(Vec4f));
+	}
+	tg.setRegion(Vec2i(0), size);
+	const F32 filterSeconds = timer.end();
+	if(connected)
+		socket.writeLine(sprintf("DONE %.6f", filterSeconds));
+
+	printf("job: %s aperture %g focus %g region (%d,%d)-(%d,%d): %s, build %.3fs, filter %.3fs%s\n", req.input.getPtr(), req.aperture, req.focus,
+		lo.x, lo.y, hi.x, hi.y, cached ? "cached" : "built", buildSeconds, filterSeconds, connected ? "" : " (client gone)");
+
+	// Memory the hierarchy kept after filtering, e.g. per-node replicas.
+
+	const size_t mem1 = getMemoryUsed();
+	if(mem1 > mem0)
+		cache.resize(h, h->bytes + (mem1-mem0));
+}
+
+//-----------------------------------------------------------------------------------------
+// Entry point. One thread polls the connections and runs the jobs; each job uses all
+// worker threads.
+//-----------------------------------------------------------------------------------------
+
+void init(void)
+{
+	String socketPath = "/tmp/reconstruction_service.sock";
+	S32 memoryMB = 4096;
+	S32 numThreads = 0;
+	S32 replyRows = 64;
+	bool remote = false;
+	for(int i=1;i<argc;i++)
+	{
+		const char* ptr = argv[i];
+		bool ok = true;
+		if(parseLiteral(ptr, "-socket="))		{ socketPath = ptr; ptr += strlen(ptr); }
+		else if(parseLiteral(ptr, "-remote"))	remote = true;
+		else if(parseLiteral(ptr, "-memory="))	ok = parseInt(ptr, memoryMB) && memoryMB > 0;
+		else if(parseLiteral(ptr, "-threads="))	ok = parseInt(ptr, numThreads) && numThreads > 0;
+		else if(parseLiteral(ptr, "-band="))	ok = parseInt(ptr, replyRows) && replyRows > 0;
+		else									ok = false;
+		if(!ok || *ptr)
+		{
+			printf("Usage: %s [-socket=path] [-remote] [-memory=MB] [-threads=N] [-band=rows]\n", argv[0]);
+			exitCode = 1;
+			return;
+		}
+	}
+	if(numThreads)
+	{
+		MulticoreLauncher::setThreadPinning(false);		// capped to share the machine, see reconstruction_cli
+		MulticoreLauncher::setNumThreads(numThreads);
+	}
+
+	if(ServiceSocket::isTcpAddress(socketPath) && !getServiceToken().getLength())
+	{
+		printf("Listening on %s needs a shared token in $RECONSTRUCTION_TOKEN\n", socketPath.getPtr());
+		exitCode = 1;
+		return;
+	}
+
+	ServiceSocket listener;
+	if(!listener.listen(socketPath, remote))
+	{
+		printf("Cannot listen on %s%s\n", socketPath.getPtr(), (remote) ? "" : " (loopback only without -remote)");
+		exitCode = 1;
+		return;
+	}
+	printf("Listening on %s, cache %dMB, %d thread(s)\n", socketPath.getPtr(), memoryMB, (numThreads) ? numThreads : MulticoreLauncher::getNumCores());
+
+	SampleBufferCache cache((size_t)memoryMB << 20);
+	Array<ServiceClient*> clients;
+	Array<ServiceJob> jobs;
+	bool running = true;
+	while(running)
+	{
+		// Wait for connections and requests; don't block while there is work.
+
+		Array<pollfd> fds;
+		fds.add().fd = listener.getFd();
+		for(int i=0;i<clients.getSize();i++)
+			fds.add().fd = clients[i]->socket->getFd();
+		for(int i=0;i<fds.getSize();i++)
+		{
+			fds[i].events = POLLIN;
+			fds[i].revents = 0;
+		}
+		if(poll(fds.getPtr(), fds.getSize(), jobs.getSize() ? 0 : -1) < 0)
+			continue;
+
+		if(fds[0].revents & POLLIN)
+		{
+			ServiceSocket* s = listener.accept();
+			if(s)
+			{
+				ServiceClient* c = new ServiceClient;
+				c->socket = s;
+				clients.add(c);
+			}
+		}
+
+		for(int i=fds.getSize()-1;i>=1;i--)
+		{
+			ServiceClient* c = clients[i-1];
+			if(!fds[i].revents)
+				continue;
+
+			bool closed = (c->socket->receive(c->pending) <= 0);
+
+			// Complete requests end with an empty line. The scan resumes where the last one
+			// stopped, and a client that sends more than MAX_REQUEST_BYTES without one is cut off.
+
+			for(;;)
+			{
+				int end = -1;
+				for(int j=max(c->scanned,1);j<c->pending.getSize() && end==-1;j++)
+					if(c->pending[j-1]=='\n' && c->pending[j]=='\n')
+						end = j+1;
+				if(end == -1)
+				{
+					c->scanned = c->pending.getSize();
+					if(c->pending.getSize() > MAX_REQUEST_BYTES)
+					{
+						c->socket->writeLine("ERROR request too long");
+						closed = true;
+					}
+					break;
+				}
+				c->scanned = 0;
+
+				ServiceJob job;
+				job.client = c;
+				String text;
+				for(int j=0;j<end;j++)
+					text.append(c->pending[j]);
+				c->pending.remove(0, end);
+				if(!job.request.parse(text.trimEnd()))
+					closed |= !c->socket->writeLine("ERROR invalid request");
+				else if(!checkServiceToken(job.request.token))
+				{
+					c->socket->writeLine("ERROR unauthorized");
+					closed = true;
+					break;
+				}
+				else if(job.request.command == ServiceRequest::Command_Shard)
+				{
+					c->socket->writeLine("ERROR shard requests go to reconstruction_cli -worker");	// the samples that follow are not requests
+					closed = true;
+					break;
+				}
+				else
+					jobs.add(job);
+			}
+
+			if(closed)
+			{
+				for(int j=jobs.getSize()-1;j>=0;j--)
+					if(jobs[j].client == c)
+						jobs.remove(j);
+				delete c->socket;
+				delete c;
+				clients.remove(i-1);
+			}
+		}
+
+		// Run the oldest job.
+
+		if(jobs.getSize())
+		{
+			const ServiceJob job = jobs.remove(0);
+			ServiceSocket& socket = *job.client->socket;
+			switch(job.request.command)
+			{
+			case ServiceRequest::Command_Reconstruct:	runReconstruct(cache, socket, job.request, replyRows); break;
+			case ServiceRequest::Command_Stats:			socket.writeLine(cache.getStats()); break;
+			case ServiceRequest::Command_Shutdown:		socket.writeLine("OK"); running = false; break;
+			default:									FW_ASSERT(0);
+			}
+			if(hasError())
+				printf("job: %s\n", clearError().getPtr());
+		}
+	}
+
+	for(int i=0;i<clients.getSize();i++)
+	{
+		delete clients[i]->socket;
+		delete clients[i];
+	}
+	printf("Shut down\n");
+}
+
+} //
@@ -0,0 +1,10 @@
+include(../src_core.pri)
+
+TEMPLATE = app
+DEFINES += FW_HEADLESS
+
+SOURCES += Service.cpp
+
+LIBS += -L../framework_core -L../reconstruction_core -lreconstruction_core -lframework_core
+
+linux-*:PRE_TARGETDEPS += ../framework_core/libframework_core.a ../reconstruction_core/libreconstruction_core.a
@@ -1,5 +1,10 @@
 TEMPLATE = subdirs
 SUBDIRS = framework \
+    framework_core \
     reconstruction_lib \
-    reconstruction_app
+    reconstruction_core \
+    reconstruction_app \
+    reconstruction_bench \
+    reconstruction_cli \
+    reconstruction_service
 CONFIG += ordered
@@ -0,0 +1,9 @@
+TEMPLATE = lib
+DEFINES += FW_QT
+DEFINES += FW_USE_CUDA=0
+DEFINES += FW_USE_GL=0
+CONFIG(debug, debug|release): DEFINES += _DEBUG
+QT -= gui
+CONFIG += staticlib
+INCLUDEPATH += $$PWD/framework
+INCLUDEPATH += $$PWD/reconstruction_lib